@@ -0,0 +1,151 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Text;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Provides access to the basic block tables written by the Pin tool in basic block control flow mode.
+/// The Pin tool appends newly instrumented blocks while tracing, so the tables are extended on demand.
+/// </summary>
+internal static class BasicBlockTable
+{
+    /// <summary>
+    /// The name of the basic block table file in the trace directory.
+    /// </summary>
+    private const string _basicBlockTableFileName = "bbl_table.txt";
+
+    /// <summary>
+    /// Protects the table state.
+    /// </summary>
+    private static readonly object _lock = new();
+
+    /// <summary>
+    /// The loaded tables, indexed by table file name.
+    /// </summary>
+    private static readonly Dictionary<string, Table> _tables = new();
+
+    /// <summary>
+    /// Returns the basic blocks of the table in the given trace directory, which contain at least the block with the given ID.
+    /// The returned list must not be modified.
+    /// </summary>
+    /// <param name="traceDirectory">Directory where the Pin tool writes its traces.</param>
+    /// <param name="basicBlockId">ID of a basic block which must be contained in the returned list.</param>
+    public static List<BasicBlock> GetBlocks(string traceDirectory, uint basicBlockId)
+    {
+        string fileName = Path.Combine(traceDirectory, _basicBlockTableFileName);
+        lock(_lock)
+        {
+            if(!_tables.TryGetValue(fileName, out var table))
+            {
+                table = new Table();
+                _tables.Add(fileName, table);
+            }
+
+            if(basicBlockId >= table.Blocks.Count)
+                table.Load(fileName);
+            if(basicBlockId >= table.Blocks.Count)
+                throw new TraceFormatException($"Unknown basic block ID {basicBlockId} in basic block table '{fileName}'.");
+
+            // Reloading replaces the list, so the caller can safely keep using the returned one
+            return table.Blocks;
+        }
+    }
+
+    /// <summary>
+    /// A basic block table.
+    /// </summary>
+    private class Table
+    {
+        /// <summary>
+        /// The basic blocks, indexed by their IDs.
+        /// </summary>
+        public List<BasicBlock> Blocks { get; private set; } = new();
+
+        /// <summary>
+        /// The offset of the first table line which has not been read yet.
+        /// </summary>
+        private long _readOffset;
+
+        /// <summary>
+        /// Reads all complete lines which were appended to the table file since the last call.
+        /// </summary>
+        /// <param name="fileName">Table file.</param>
+        public void Load(string fileName)
+        {
+            byte[] data;
+            using(var tableFileStream = File.Open(fileName, FileMode.Open, FileAccess.Read, FileShare.ReadWrite))
+            {
+                tableFileStream.Seek(_readOffset, SeekOrigin.Begin);
+                data = new byte[tableFileStream.Length - _readOffset];
+                tableFileStream.ReadExactly(data);
+            }
+
+            // The Pin tool may be writing the last line right now
+            int end = Array.LastIndexOf(data, (byte)'\n') + 1;
+            _readOffset += end;
+
+            // Do not modify the current list, it may be in use by another reader
+            var blocks = new List<BasicBlock>(Blocks);
+            foreach(string line in Encoding.ASCII.GetString(data, 0, end).Split('\n', StringSplitOptions.RemoveEmptyEntries))
+            {
+                // "<id>\t<address>\t<size>\t<last instruction address>\t<branch type>\t<conditional>\t<branch target>"
+                string[] parts = line.Split('\t');
+                if(parts.Length != 7 || int.Parse(parts[0], NumberStyles.None, CultureInfo.InvariantCulture) != blocks.Count)
+                    throw new TraceFormatException($"Invalid line in basic block table '{fileName}': {line}");
+
+                blocks.Add(new BasicBlock
+                {
+                    Address = ulong.Parse(parts[1], NumberStyles.HexNumber, CultureInfo.InvariantCulture),
+                    Size = uint.Parse(parts[2], NumberStyles.HexNumber, CultureInfo.InvariantCulture),
+                    LastInstructionAddress = ulong.Parse(parts[3], NumberStyles.HexNumber, CultureInfo.InvariantCulture),
+                    BranchType = (PinTracePreprocessor.RawTraceBranchEntryFlags)byte.Parse(parts[4], NumberStyles.None, CultureInfo.InvariantCulture),
+                    Conditional = parts[5] == "1",
+                    BranchTarget = ulong.Parse(parts[6], NumberStyles.HexNumber, CultureInfo.InvariantCulture)
+                });
+            }
+
+            Blocks = blocks;
+        }
+    }
+
+    /// <summary>
+    /// A basic block from the table.
+    /// </summary>
+    public readonly struct BasicBlock
+    {
+        /// <summary>
+        /// The address of the first instruction.
+        /// </summary>
+        public ulong Address { get; init; }
+
+        /// <summary>
+        /// The size of the block in bytes.
+        /// </summary>
+        public uint Size { get; init; }
+
+        /// <summary>
+        /// The address of the last instruction, i.e., the branch instruction terminating the block.
+        /// </summary>
+        public ulong LastInstructionAddress { get; init; }
+
+        /// <summary>
+        /// The type of the terminating branch (<see cref="PinTracePreprocessor.RawTraceBranchEntryFlags.Jump"/>, <see cref="PinTracePreprocessor.RawTraceBranchEntryFlags.Call"/> or <see cref="PinTracePreprocessor.RawTraceBranchEntryFlags.Return"/>),
+        /// or 0 if the block does not end with a traced branch.
+        /// </summary>
+        public PinTracePreprocessor.RawTraceBranchEntryFlags BranchType { get; init; }
+
+        /// <summary>
+        /// Determines whether the terminating branch is a conditional jump.
+        /// </summary>
+        public bool Conditional { get; init; }
+
+        /// <summary>
+        /// The target of the terminating branch, or 0 if it is indirect.
+        /// </summary>
+        public ulong BranchTarget { get; init; }
+    }
+}
@@ -0,0 +1,215 @@
+﻿using System;
+using System.Buffers.Binary;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Decodes LZ4 frames, as produced by the Pin tool when trace compression is enabled.
+/// </summary>
+internal static class Lz4FrameDecoder
+{
+    /// <summary>
+    /// The file name extension of compressed trace files.
+    /// </summary>
+    public const string FileExtension = ".lz4";
+
+    /// <summary>
+    /// The magic number at the beginning of LZ4 frames.
+    /// </summary>
+    private const uint _frameMagic = 0x184D2204;
+
+    /// <summary>
+    /// The minimum size of the frame header: Magic number, FLG, BD and header checksum.
+    /// </summary>
+    private const int _minFrameHeaderSize = 4 + 1 + 1 + 1;
+
+    /// <summary>
+    /// The minimum match length; the token stores the match length minus this value.
+    /// </summary>
+    private const int _minMatchLength = 4;
+
+    /// <summary>
+    /// The flag in a block size field which indicates that the block is stored uncompressed.
+    /// </summary>
+    private const uint _uncompressedBlockFlag = 1u << 31;
+
+    /// <summary>
+    /// Checks whether the given data starts with an LZ4 frame.
+    /// </summary>
+    /// <param name="input">Input data.</param>
+    public static bool IsFrame(ReadOnlySpan<byte> input)
+    {
+        return input.Length >= _minFrameHeaderSize && BinaryPrimitives.ReadUInt32LittleEndian(input) == _frameMagic;
+    }
+
+    /// <summary>
+    /// Decodes the LZ4 frame at the beginning of the given data. The blocks are decoded one after another into a single buffer.
+    /// </summary>
+    /// <param name="input">Input data.</param>
+    /// <param name="fileName">Trace file name, for error messages.</param>
+    /// <returns>A buffer containing the decompressed data.</returns>
+    public static ReadOnlyMemory<byte> Decode(ReadOnlySpan<byte> input, string fileName)
+    {
+        if(!IsFrame(input))
+            throw new TraceFormatException($"Missing LZ4 frame header in trace file '{fileName}'.");
+
+        // Frame descriptor
+        byte flags = input[4];
+        if((flags >> 6) != 0b01)
+            throw new TraceFormatException($"Unsupported LZ4 frame version in trace file '{fileName}'.");
+        bool hasBlockChecksums = (flags & (1 << 4)) != 0;
+        bool hasContentSize = (flags & (1 << 3)) != 0;
+        bool hasContentChecksum = (flags & (1 << 2)) != 0;
+        bool hasDictionaryId = (flags & (1 << 0)) != 0;
+        if(hasDictionaryId)
+            throw new TraceFormatException($"LZ4 frames with dictionary are not supported, in trace file '{fileName}'.");
+
+        int pos = 6;
+        long contentSize = -1;
+        if(hasContentSize)
+        {
+            if(input.Length < pos + 8)
+                throw new TraceFormatException($"Truncated LZ4 frame header in trace file '{fileName}'.");
+            contentSize = BinaryPrimitives.ReadInt64LittleEndian(input[pos..]);
+            pos += 8;
+        }
+
+        // Skip header checksum
+        ++pos;
+
+        // Use the content size as initial buffer size, or guess based on the compressed size
+        if(contentSize > Array.MaxLength)
+            throw new TraceFormatException($"Trace file '{fileName}' is too large after decompression.");
+        long initialSize = contentSize >= 0 ? contentSize : Math.Min(4L * input.Length, Array.MaxLength);
+        byte[] output = new byte[Math.Max(initialSize, 16)];
+        int outputLength = 0;
+
+        // Decode blocks until the end mark is reached
+        while(true)
+        {
+            if(input.Length < pos + 4)
+                throw new TraceFormatException($"Truncated LZ4 frame in trace file '{fileName}'.");
+            uint blockSizeField = BinaryPrimitives.ReadUInt32LittleEndian(input[pos..]);
+            pos += 4;
+            if(blockSizeField == 0)
+                break;
+
+            int blockSize = (int)(blockSizeField & ~_uncompressedBlockFlag);
+            if(blockSize < 0 || input.Length - pos < blockSize)
+                throw new TraceFormatException($"Truncated LZ4 block at offset {pos - 4} in trace file '{fileName}'.");
+            var block = input.Slice(pos, blockSize);
+            pos += blockSize;
+            if(hasBlockChecksums)
+                pos += 4;
+
+            if((blockSizeField & _uncompressedBlockFlag) != 0)
+            {
+                EnsureCapacity(ref output, outputLength, blockSize, fileName);
+                block.CopyTo(output.AsSpan(outputLength));
+                outputLength += blockSize;
+            }
+            else
+            {
+                DecodeBlock(block, ref output, ref outputLength, fileName);
+            }
+        }
+
+        if(hasContentChecksum)
+            pos += 4;
+        if(pos > input.Length)
+            throw new TraceFormatException($"Truncated LZ4 frame in trace file '{fileName}'.");
+
+        return output.AsMemory(0, outputLength);
+    }
+
+    /// <summary>
+    /// Decodes a compressed LZ4 block and appends the result to the given output buffer.
+    /// Matches may refer to data of preceding blocks.
+    /// </summary>
+    /// <param name="block">Compressed block.</param>
+    /// <param name="output">Output buffer, which is resized when needed.</param>
+    /// <param name="outputLength">Number of used bytes in the output buffer.</param>
+    /// <param name="fileName">Trace file name, for error messages.</param>
+    private static void DecodeBlock(ReadOnlySpan<byte> block, ref byte[] output, ref int outputLength, string fileName)
+    {
+        int pos = 0;
+        while(pos < block.Length)
+        {
+            byte token = block[pos++];
+
+            // Literals
+            int literalLength = ReadLength(block, ref pos, token >> 4, fileName);
+            if(block.Length - pos < literalLength)
+                throw new TraceFormatException($"Invalid LZ4 literal length in trace file '{fileName}'.");
+            EnsureCapacity(ref output, outputLength, literalLength, fileName);
+            block.Slice(pos, literalLength).CopyTo(output.AsSpan(outputLength));
+            pos += literalLength;
+            outputLength += literalLength;
+
+            // The last sequence only consists of literals
+            if(pos == block.Length)
+                break;
+
+            // Match
+            if(block.Length - pos < 2)
+                throw new TraceFormatException($"Truncated LZ4 match in trace file '{fileName}'.");
+            int offset = BinaryPrimitives.ReadUInt16LittleEndian(block[pos..]);
+            pos += 2;
+            if(offset == 0 || offset > outputLength)
+                throw new TraceFormatException($"Invalid LZ4 match offset {offset} in trace file '{fileName}'.");
+            int matchLength = ReadLength(block, ref pos, token & 0xF, fileName) + _minMatchLength;
+            EnsureCapacity(ref output, outputLength, matchLength, fileName);
+
+            // Overlapping matches repeat the last bytes and must be copied byte by byte
+            int matchStart = outputLength - offset;
+            if(offset >= matchLength)
+                output.AsSpan(matchStart, matchLength).CopyTo(output.AsSpan(outputLength));
+            else
+            {
+                for(int i = 0; i < matchLength; ++i)
+                    output[outputLength + i] = output[matchStart + i];
+            }
+
+            outputLength += matchLength;
+        }
+    }
+
+    /// <summary>
+    /// Reads a literal or match length, which is extended by additional bytes if the token nibble has its maximum value.
+    /// </summary>
+    private static int ReadLength(ReadOnlySpan<byte> block, ref int pos, int tokenLength, string fileName)
+    {
+        int length = tokenLength;
+        if(tokenLength != 0xF)
+            return length;
+
+        byte value;
+        do
+        {
+            if(pos >= block.Length)
+                throw new TraceFormatException($"Truncated LZ4 length in trace file '{fileName}'.");
+            value = block[pos++];
+            length += value;
+            if(length < 0)
+                throw new TraceFormatException($"Invalid LZ4 length in trace file '{fileName}'.");
+        } while(value == 0xFF);
+
+        return length;
+    }
+
+    /// <summary>
+    /// Grows the given output buffer, such that it can hold the given number of additional bytes.
+    /// </summary>
+    private static void EnsureCapacity(ref byte[] output, int outputLength, int additionalLength, string fileName)
+    {
+        long requiredLength = (long)outputLength + additionalLength;
+        if(requiredLength <= output.Length)
+            return;
+        if(requiredLength > Array.MaxLength)
+            throw new TraceFormatException($"Trace file '{fileName}' is too large after decompression.");
+
+        long newLength = Math.Min(Math.Max(2L * output.Length, requiredLength), Array.MaxLength);
+        Array.Resize(ref output, (int)newLength);
+    }
+}
@@ -0,0 +1,445 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+using Microwalk.FrameworkBase;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Manages a single Pin tool process, and implements the wrapper's testcase protocol.
+/// </summary>
+internal sealed class PinToolInstance
+{
+    private readonly string _genericLogMessagePrefix;
+    private readonly string _pinLogMessagePrefix;
+    private readonly string _pinOutMessagePrefix;
+
+    /// <summary>
+    /// A logger instance for printing infos, errors and debug outputs.
+    /// </summary>
+    private readonly ILogger _logger;
+
+    /// <summary>
+    /// Start information of the Pin tool process.
+    /// </summary>
+    private readonly ProcessStartInfo _startInfo;
+
+    /// <summary>
+    /// The shared memory ring file of this instance, if the Pin tool writes its traces to shared memory.
+    /// </summary>
+    private readonly string? _sharedMemoryRingPath;
+
+    /// <summary>
+    /// The testcase buffer file of this instance, if testcases are passed to the wrapper in memory.
+    /// </summary>
+    private readonly string? _testcaseBufferPath;
+
+    /// <summary>
+    /// Receives the trace fingerprints, if the Pin tool runs in fingerprint mode.
+    /// </summary>
+    private readonly Func<TraceEntity, TraceFingerprint, Task>? _fingerprintHandler;
+
+    /// <summary>
+    /// Receives the tracer statistics of each testcase, if the Pin tool collects statistics.
+    /// </summary>
+    private readonly Func<TraceEntity, string, Task>? _statisticsHandler;
+
+    /// <summary>
+    /// The maximum number of parallel worker processes of the wrapper, or 0 if fork-server mode is disabled.
+    /// </summary>
+    private readonly int _forkServerWorkerCount;
+
+    /// <summary>
+    /// The Pin tool process handle.
+    /// </summary>
+    private Process? _process;
+
+    /// <summary>
+    /// The trace archive file of the last announced archive record, if the Pin tool writes its traces to an archive.
+    /// </summary>
+    private string? _lastTraceArchiveFileName;
+
+    /// <summary>
+    /// Creates a new Pin tool instance. The process is started by <see cref="Start"/>.
+    /// </summary>
+    /// <param name="index">Index of this instance, for log messages.</param>
+    /// <param name="logger">A logger instance for printing infos, errors and debug outputs.</param>
+    /// <param name="startInfo">Start information of the Pin tool process.</param>
+    /// <param name="sharedMemoryRingPath">The shared memory ring file, if the Pin tool writes its traces to shared memory.</param>
+    /// <param name="testcaseBufferPath">The testcase buffer file, if testcases are passed to the wrapper in memory.</param>
+    /// <param name="fingerprintHandler">Receives the trace fingerprints, if the Pin tool runs in fingerprint mode.</param>
+    /// <param name="statisticsHandler">Receives the tracer statistics of each testcase as tab-separated list, if the Pin tool collects statistics.</param>
+    /// <param name="forkServerWorkerCount">The maximum number of parallel worker processes of the wrapper, or 0 if fork-server mode is disabled.</param>
+    public PinToolInstance(int index, ILogger logger, ProcessStartInfo startInfo, string? sharedMemoryRingPath, string? testcaseBufferPath, Func<TraceEntity, TraceFingerprint, Task>? fingerprintHandler, Func<TraceEntity, string, Task>? statisticsHandler, int forkServerWorkerCount)
+    {
+        string instanceName = index == 0 ? "pin" : $"pin#{index}";
+        _genericLogMessagePrefix = $"[trace:{instanceName}]";
+        _pinLogMessagePrefix = $"[trace:{instanceName}:stderr]";
+        _pinOutMessagePrefix = $"[trace:{instanceName}:stdout]";
+
+        _logger = logger;
+        _startInfo = startInfo;
+        _sharedMemoryRingPath = sharedMemoryRingPath;
+        _testcaseBufferPath = testcaseBufferPath;
+        _fingerprintHandler = fingerprintHandler;
+        _statisticsHandler = statisticsHandler;
+        _forkServerWorkerCount = forkServerWorkerCount;
+    }
+
+    /// <summary>
+    /// Returns whether the Pin tool process has been started.
+    /// </summary>
+    public bool IsStarted => _process != null;
+
+    /// <summary>
+    /// Starts the Pin tool process.
+    /// </summary>
+    /// <param name="pipelineToken">Cancellation token of the pipeline. The process is stopped when the pipeline gets aborted.</param>
+    public async Task StartAsync(CancellationToken pipelineToken)
+    {
+        // Start Pin tool
+        await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Pin tool command: {_startInfo.FileName} {string.Join(" ", _startInfo.ArgumentList)}");
+        var process = Process.Start(_startInfo) ?? throw new Exception("Could not start the Pin process.");
+        _process = process;
+
+        // Ensure that the Pin process is eventually stopped when the Pipeline gets aborted early
+        pipelineToken.Register(() =>
+        {
+            if(process.HasExited)
+                return;
+
+            try
+            {
+                // Try to stop the Pin process the clean way
+                process.StandardInput.WriteLineAsync("e 0").Wait(1000);
+                if(process.WaitForExit(1000))
+                    return;
+
+                process.Kill(true);
+
+                if(!process.WaitForExit(1000))
+                    _logger.LogErrorAsync($"{_genericLogMessagePrefix} Sent a KILL signal to the Pin tool process, but it did not respond in time. Please check whether it still running.").Wait(2000);
+            }
+            catch(Exception ex)
+            {
+                _logger.LogErrorAsync($"{_genericLogMessagePrefix} Could not safely stop the Pin tool process. Please check whether it still running. Error message:\n{ex}").Wait(2000);
+            }
+        });
+
+        // Read and log error output of Pin tool (avoids pipe contention leading to I/O hangs)
+        process.ErrorDataReceived += async (_, e) =>
+        {
+            if(!string.IsNullOrWhiteSpace(e.Data))
+                await _logger.LogDebugAsync($"{_pinLogMessagePrefix} {e.Data}");
+        };
+        process.BeginErrorReadLine();
+
+        // Let the wrapper run the testcases in worker processes
+        if(_forkServerWorkerCount > 0)
+            await process.StandardInput.WriteLineAsync($"f {_forkServerWorkerCount}");
+    }
+
+    /// <summary>
+    /// Stops the Pin tool process and removes the temporary files of this instance.
+    /// </summary>
+    public async Task StopAsync()
+    {
+        // Exit Pin tool process
+        await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Stopping Pin tool process");
+        if(_process != null && !_process.HasExited)
+        {
+            await _process.StandardInput.WriteLineAsync("e 0");
+            await _process.WaitForExitAsync();
+        }
+
+        // The last trace archive file is complete as well, and is deleted when its remaining traces have been processed
+        if(_lastTraceArchiveFileName != null)
+            TraceArchive.CompleteArchive(_lastTraceArchiveFileName);
+
+        // Remove shared memory ring file; existing mappings stay valid until the process exits
+        if(_sharedMemoryRingPath != null && File.Exists(_sharedMemoryRingPath))
+            File.Delete(_sharedMemoryRingPath);
+        if(_testcaseBufferPath != null && File.Exists(_testcaseBufferPath))
+            File.Delete(_testcaseBufferPath);
+    }
+
+    /// <summary>
+    /// Sends the given testcase to the Pin tool and waits for its trace.
+    /// </summary>
+    public async Task RunTestcaseAsync(TraceEntity traceEntity)
+    {
+        var process = _process ?? throw new InvalidOperationException("The Pin tool process is not started.");
+
+        await process.StandardInput.WriteLineAsync($"t {traceEntity.Id}");
+        await process.StandardInput.WriteLineAsync(traceEntity.TestcaseFilePath);
+
+        if(_forkServerWorkerCount > 0)
+        {
+            var completion = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            await ReadWorkerTraceResultsAsync(new List<(TraceEntity TraceEntity, TaskCompletionSource Completion)> { (traceEntity, completion) });
+            await completion.Task;
+        }
+        else
+        {
+            await ReadTraceResultAsync(traceEntity);
+        }
+    }
+
+    /// <summary>
+    /// Sends the pending testcases to the Pin tool in batches, and completes each of them as soon as its trace is announced.
+    /// Returns when the given channel is completed.
+    /// </summary>
+    /// <param name="pendingTestcases">Testcases waiting for the next batch. The channel may be shared by several instances.</param>
+    /// <param name="batchSize">The maximum number of testcases in a single batch.</param>
+    public async Task DispatchBatchesAsync(ChannelReader<(TraceEntity TraceEntity, TaskCompletionSource Completion)> pendingTestcases, int batchSize)
+    {
+        var batch = new List<(TraceEntity TraceEntity, TaskCompletionSource Completion)>();
+        while(await pendingTestcases.WaitToReadAsync())
+        {
+            // Collect all testcases which are currently available
+            batch.Clear();
+            while(batch.Count < batchSize && pendingTestcases.TryRead(out var pendingTestcase))
+                batch.Add(pendingTestcase);
+            if(batch.Count == 0)
+                continue;
+
+            await _logger.LogDebugAsync($"{_genericLogMessagePrefix} Sending batch of {batch.Count} testcases, starting with #{batch[0].TraceEntity.Id}");
+
+            try
+            {
+                await SendBatchAsync(batch.Select(b => b.TraceEntity).ToList());
+            }
+            catch(Exception ex)
+            {
+                foreach(var pendingTestcase in batch)
+                    pendingTestcase.Completion.TrySetException(ex);
+                continue;
+            }
+
+            // The worker processes of the fork server complete their testcases in arbitrary order
+            if(_forkServerWorkerCount > 0)
+            {
+                try
+                {
+                    await ReadWorkerTraceResultsAsync(batch);
+                }
+                catch(Exception ex)
+                {
+                    foreach(var pendingTestcase in batch)
+                        pendingTestcase.Completion.TrySetException(ex);
+                }
+
+                continue;
+            }
+
+            // The Pin tool announces the traces in the order of the batch
+            foreach(var pendingTestcase in batch)
+            {
+                try
+                {
+                    await ReadTraceResultAsync(pendingTestcase.TraceEntity);
+                    pendingTestcase.Completion.TrySetResult();
+                }
+                catch(Exception ex)
+                {
+                    pendingTestcase.Completion.TrySetException(ex);
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Sends the given batch of testcases to the wrapper, either as a list of testcase files, or through the testcase buffer file.
+    /// </summary>
+    private async Task SendBatchAsync(List<TraceEntity> traceEntities)
+    {
+        var process = _process ?? throw new InvalidOperationException("The Pin tool process is not started.");
+
+        if(_testcaseBufferPath == null)
+        {
+            await process.StandardInput.WriteLineAsync($"b {traceEntities.Count}");
+            foreach(var traceEntity in traceEntities)
+                await process.StandardInput.WriteLineAsync($"{traceEntity.Id}\t{traceEntity.TestcaseFilePath}");
+            return;
+        }
+
+        // Concatenate testcases in the buffer file
+        // The wrapper unmaps the buffer after each batch, so it can be safely overwritten here
+        var testcaseDescriptions = new List<string>();
+        await using(var testcaseBufferStream = new FileStream(_testcaseBufferPath, FileMode.Create, FileAccess.Write))
+        {
+            foreach(var traceEntity in traceEntities)
+            {
+                long offset = testcaseBufferStream.Position;
+                await using(var testcaseStream = File.OpenRead(traceEntity.TestcaseFilePath))
+                    await testcaseStream.CopyToAsync(testcaseBufferStream);
+
+                testcaseDescriptions.Add($"{traceEntity.Id}\t{offset}\t{testcaseBufferStream.Position - offset}");
+            }
+        }
+
+        await process.StandardInput.WriteLineAsync($"m {traceEntities.Count}");
+        await process.StandardInput.WriteLineAsync(_testcaseBufferPath);
+        foreach(var testcaseDescription in testcaseDescriptions)
+            await process.StandardInput.WriteLineAsync(testcaseDescription);
+    }
+
+    /// <summary>
+    /// Reads the Pin tool output until the trace of the given testcase is announced.
+    /// </summary>
+    private async Task ReadTraceResultAsync(TraceEntity traceEntity)
+    {
+        string logMessagePrefix = $"[trace:pin:{traceEntity.Id}]";
+
+        while(true)
+        {
+            string[] outputParts = await ReadOutputLineAsync(logMessagePrefix);
+            if(await HandleTestcaseMessageAsync(traceEntity, outputParts, logMessagePrefix))
+                break;
+        }
+    }
+
+    /// <summary>
+    /// Reads the Pin tool output until the traces of all given testcases are announced, in fork-server mode.
+    /// Each message is prefixed with the ID of the testcase it belongs to, and completes the respective testcase when its trace is announced.
+    /// </summary>
+    private async Task ReadWorkerTraceResultsAsync(List<(TraceEntity TraceEntity, TaskCompletionSource Completion)> testcases)
+    {
+        var pendingTestcases = testcases.ToDictionary(t => t.TraceEntity.Id);
+        while(pendingTestcases.Count > 0)
+        {
+            string[] outputParts = await ReadOutputLineAsync(_genericLogMessagePrefix);
+            if(outputParts.Length < 2 || !int.TryParse(outputParts[0], out int testcaseId) || !pendingTestcases.TryGetValue(testcaseId, out var pendingTestcase))
+            {
+                await _logger.LogWarningAsync($"{_genericLogMessagePrefix} Unexpected message from Pin tool, which does not belong to a pending testcase.");
+                await _logger.LogWarningAsync($"{_genericLogMessagePrefix}   >>> {string.Join('\t', outputParts)}");
+                continue;
+            }
+
+            try
+            {
+                if(!await HandleTestcaseMessageAsync(pendingTestcase.TraceEntity, outputParts[1..], $"[trace:pin:{testcaseId}]"))
+                    continue;
+
+                pendingTestcase.Completion.TrySetResult();
+            }
+            catch(Exception ex)
+            {
+                pendingTestcase.Completion.TrySetException(ex);
+            }
+
+            pendingTestcases.Remove(testcaseId);
+        }
+    }
+
+    /// <summary>
+    /// Reads the next line of the Pin tool output, and returns its tab-separated parts.
+    /// </summary>
+    private async Task<string[]> ReadOutputLineAsync(string logMessagePrefix)
+    {
+        var process = _process ?? throw new InvalidOperationException("The Pin tool process is not started.");
+
+        // Read Pin tool output
+        await _logger.LogDebugAsync($"{logMessagePrefix} Read from Pin tool stdout...");
+        string pinToolOutput = await process.StandardOutput.ReadLineAsync()
+                               ?? throw new IOException("Could not read from Pin tool standard output (null). Probably the process has exited early.");
+
+        await _logger.LogDebugAsync($"{_pinOutMessagePrefix} {pinToolOutput}");
+        return pinToolOutput.Split('\t');
+    }
+
+    /// <summary>
+    /// Handles the given Pin tool message of the given testcase.
+    /// Returns true when the testcase is complete, i.e., its trace or fingerprint has been announced.
+    /// </summary>
+    private async Task<bool> HandleTestcaseMessageAsync(TraceEntity traceEntity, string[] outputParts, string logMessagePrefix)
+    {
+        // The messages about a trace start with its name, which must belong to the testcase the caller is waiting for
+        if(outputParts.Length >= 2 && (outputParts[0] == "t" || outputParts[0] == "a" || outputParts[0] == "s" || outputParts[0] == "f"))
+            CheckAnnouncedTraceName(traceEntity, outputParts[1]);
+
+        if(outputParts[0] == "t")
+        {
+            // Store trace file name
+            traceEntity.RawTraceFilePath = outputParts[1];
+
+            // Trace in shared memory ring?
+            if(outputParts.Length >= 4)
+            {
+                if(_sharedMemoryRingPath == null)
+                    throw new IOException("The Pin tool announced a shared memory trace, but shared memory output is not enabled.");
+
+                SharedTraceRing.Open(_sharedMemoryRingPath);
+                SharedTraceRing.RegisterSegment(_sharedMemoryRingPath, outputParts[1], ulong.Parse(outputParts[2]), ulong.Parse(outputParts[3]));
+            }
+
+            return true;
+        }
+
+        if(outputParts[0] == "a")
+        {
+            // Trace in archive: "a\t<name>\t<archive file>\t<offset>\t<length>"
+            if(outputParts.Length < 5)
+                throw new IOException($"Invalid trace archive announcement: {string.Join('\t', outputParts)}");
+            traceEntity.RawTraceFilePath = outputParts[1];
+            TraceArchive.RegisterRecord(outputParts[2], outputParts[1], ulong.Parse(outputParts[3]), ulong.Parse(outputParts[4]));
+
+            // The Pin tool does not write to the previous archive segment anymore
+            if(_lastTraceArchiveFileName != null && _lastTraceArchiveFileName != outputParts[2])
+                TraceArchive.CompleteArchive(_lastTraceArchiveFileName);
+            _lastTraceArchiveFileName = outputParts[2];
+
+            return true;
+        }
+
+        if(outputParts[0] == "s")
+        {
+            // Statistics precede the trace announcement of the same testcase
+            if(_statisticsHandler != null)
+                await _statisticsHandler(traceEntity, string.Join('\t', outputParts.Skip(2)));
+            return false;
+        }
+
+        if(outputParts[0] == "f")
+        {
+            // Only a fingerprint, there is no trace file
+            if(_fingerprintHandler == null)
+                throw new IOException("The Pin tool reported a trace fingerprint, but fingerprint mode is not enabled.");
+
+            await _fingerprintHandler(traceEntity, TraceFingerprint.Parse(outputParts));
+            return true;
+        }
+
+        if(outputParts[0] == "x")
+        {
+            // The wrapper reports testcases which could not be loaded, and worker processes which did not exit normally, so no trace will be announced
+            if(_forkServerWorkerCount > 0)
+                throw new IOException($"The wrapper could not run the testcase, or its worker process failed (wait status {(outputParts.Length >= 2 ? outputParts[1] : "unknown")}).");
+
+            // "x\t<ID>"
+            if(outputParts.Length < 2 || outputParts[1] != traceEntity.Id.ToString())
+                throw new IOException($"The wrapper reported testcase #{(outputParts.Length >= 2 ? outputParts[1] : "unknown")} as failed, but testcase #{traceEntity.Id} was expected.");
+            throw new IOException("The wrapper could not load the testcase.");
+        }
+
+        await _logger.LogWarningAsync($"{logMessagePrefix} Unexpected message from Pin tool.\nPlease make sure that the investigated program does not print anything on stdout, since this might interfere with the Pin tool's output pipe.");
+        await _logger.LogWarningAsync($"{logMessagePrefix}   >>> {string.Join('\t', outputParts)}");
+        return false;
+    }
+
+    /// <summary>
+    /// Ensures that the given trace name, which was announced by the Pin tool, belongs to the given testcase.
+    /// A mismatch means that the messages got out of order, e.g., because the wrapper skipped a testcase without reporting it.
+    /// </summary>
+    private static void CheckAnnouncedTraceName(TraceEntity traceEntity, string traceName)
+    {
+        // The traces of the main thread are named "t<ID>.trace", optionally followed by a compression suffix
+        if(!Path.GetFileName(traceName).StartsWith($"t{traceEntity.Id}.trace", StringComparison.Ordinal))
+            throw new IOException($"The Pin tool announced trace '{traceName}', but testcase #{traceEntity.Id} was expected.");
+    }
+}
@@ -105,11 +105,14 @@ public class PinTraceDumper : PreprocessorStage
 
         // Write prefix
         await outputWriter.WriteLineAsync("-- Trace prefix --");
-        DumpRawFile(Path.Combine(rawTraceFileDirectory, "prefix.trace"), outputWriter, $"[pin-dump:{traceEntity.Id}:prefix]");
+        DumpRawFile(RawTraceFileReader.ResolveTraceFilePath(rawTraceFileDirectory, "prefix.trace"), outputWriter, $"[pin-dump:{traceEntity.Id}:prefix]");
 
         // Write trace
         await outputWriter.WriteLineAsync("-- Trace --");
         DumpRawFile(traceEntity.RawTraceFilePath, outputWriter, $"[pin-dump:{traceEntity.Id}]");
+
+        // Raw traces are kept; if the trace resides in the shared memory ring, it is written to disk
+        RawTraceFileReader.ReleaseTrace(traceEntity.RawTraceFilePath, true);
     }
 
     /// <summary>
@@ -122,12 +125,26 @@ public class PinTraceDumper : PreprocessorStage
     private unsafe void DumpRawFile(string fileName, StreamWriter outputWriter, string logPrefix)
     {
         // Read entire trace file into memory
-        byte[] inputFile = File.ReadAllBytes(fileName);
+        var inputFile = RawTraceFileReader.ReadEntries(fileName, out var footer);
         int inputFileLength = inputFile.Length;
         int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
 
+        // Dump index footer
+        if(footer != null)
+        {
+            outputWriter.WriteLine($"Index: {footer.Chunks.Length} chunks of {footer.ChunkInterval} entries, checksum {footer.Checksum:x16}");
+            for(int i = 0; i < footer.EntryCounts.Length; ++i)
+            {
+                if(footer.EntryCounts[i] != 0)
+                    outputWriter.WriteLine($"  Count: {(PinTracePreprocessor.RawTraceEntryTypes)i} {footer.EntryCounts[i]}");
+            }
+
+            foreach(var chunk in footer.Chunks)
+                outputWriter.WriteLine($"  Chunk: entry {chunk.EntryIndex} offset {chunk.Offset:x} call depth {chunk.CallDepth} pending allocations {chunk.PendingAllocationCount} heap allocations {chunk.HeapAllocationCount}");
+        }
+
         // Dump trace entries
-        fixed(byte* inputFilePtr = inputFile)
+        fixed(byte* inputFilePtr = inputFile.Span)
             for(long pos = 0; pos < inputFileLength; pos += rawTraceEntrySize)
             {
                 // Read entry
@@ -154,6 +171,12 @@ public class PinTraceDumper : PreprocessorStage
                         break;
                     }
 
+                    case PinTracePreprocessor.RawTraceEntryTypes.AccessCount:
+                    {
+                        outputWriter.WriteLine($"  Count: {rawTraceEntry.Param1}");
+                        break;
+                    }
+
                     case PinTracePreprocessor.RawTraceEntryTypes.StackPointerInfo:
                     {
                         outputWriter.WriteLine($"StackPtr: {rawTraceEntry.Param1:x16} {rawTraceEntry.Param2:x16}");
@@ -257,6 +280,22 @@ public class PinTraceDumper : PreprocessorStage
 
                         break;
                     }
+
+                    case PinTracePreprocessor.RawTraceEntryTypes.StackFrame:
+                    {
+                        string formattedFunctionAddress = rawTraceEntry.Param1.ToString("x16");
+                        if(_mapFileCollection != null)
+                        {
+                            var functionImage = FindImage(rawTraceEntry.Param1);
+                            if(functionImage != null)
+                                formattedFunctionAddress = $"{_mapFileCollection.FormatAddress(functionImage.Id, functionImage.Name, (uint)(rawTraceEntry.Param1 - functionImage.StartAddress))} [{formattedFunctionAddress}]";
+                        }
+
+                        // The size is stored in 8-byte units
+                        ulong frameSize = 8ul * (ushort)rawTraceEntry.Param0;
+                        outputWriter.WriteLine($"StackFrame: {formattedFunctionAddress} entry RSP = {rawTraceEntry.Param2:x16}, frame {rawTraceEntry.Param2 - frameSize:x16}..{rawTraceEntry.Param2:x16} ({frameSize} bytes)");
+                        break;
+                    }
                 }
             }
     }
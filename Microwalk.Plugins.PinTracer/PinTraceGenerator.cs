@@ -3,6 +3,8 @@ using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
 using System.Linq;
+using System.Threading;
+using System.Threading.Channels;
 using System.Threading.Tasks;
 using Microwalk.FrameworkBase;
 using Microwalk.FrameworkBase.Configuration;
@@ -16,8 +18,12 @@ namespace Microwalk.Plugins.PinTracer;
 public class PinTraceGenerator : TraceStage
 {
     private const string _genericLogMessagePrefix = "[trace:pin]";
-    private const string _pinLogMessagePrefix = "[trace:pin:stderr]";
-    private const string _pinOutMessagePrefix = "[trace:pin:stdout]";
+
+    /// <summary>
+    /// File name prefix of the copy of the trace prefix metadata, which is used by the secondary Pin tool instances for verifying their prefix.
+    /// The preprocessor may delete the original files before all instances have read them.
+    /// </summary>
+    private const string _referencePrefixFileNamePrefix = "reference_";
 
     /// <summary>
     /// The trace output directory.
@@ -25,12 +31,89 @@ public class PinTraceGenerator : TraceStage
     private DirectoryInfo _outputDirectory = null!;
 
     /// <summary>
-    /// The Pin tool process handle.
+    /// The maximum number of testcases which are sent to the wrapper in a single batch.
+    /// </summary>
+    private int _batchSize;
+
+    /// <summary>
+    /// The Pin tool instances. The first instance records the trace prefix; the others are only started after the prefix is complete,
+    /// and verify their own prefix against it.
+    /// </summary>
+    private readonly List<PinToolInstance> _pinToolInstances = new();
+
+    /// <summary>
+    /// Pin tool instances which are currently not running a testcase (if batching is disabled).
+    /// </summary>
+    private Channel<PinToolInstance> _idleInstances = null!;
+
+    /// <summary>
+    /// Testcases waiting for the next batch (if batching is enabled).
+    /// </summary>
+    private Channel<(TraceEntity TraceEntity, TaskCompletionSource Completion)> _pendingTestcases = null!;
+
+    /// <summary>
+    /// Tasks which send the pending testcases in batches to the Pin tool instances.
+    /// </summary>
+    private readonly List<Task> _batchDispatcherTasks = new();
+
+    /// <summary>
+    /// Protects the start of the secondary Pin tool instances.
+    /// </summary>
+    private readonly SemaphoreSlim _instanceStartSemaphore = new(1, 1);
+
+    /// <summary>
+    /// Determines whether all Pin tool instances have been started.
+    /// </summary>
+    private volatile bool _allInstancesStarted;
+
+    /// <summary>
+    /// Protects the fingerprint triage state.
+    /// </summary>
+    private readonly SemaphoreSlim _fingerprintSemaphore = new(1, 1);
+
+    /// <summary>
+    /// Receives the fingerprint of each testcase, in fingerprint mode.
+    /// </summary>
+    private StreamWriter? _fingerprintWriter;
+
+    /// <summary>
+    /// The fingerprint of the first received testcase, which the other testcases are compared with.
+    /// </summary>
+    private TraceFingerprint? _referenceFingerprint;
+
+    /// <summary>
+    /// The ID of the testcase with the reference fingerprint.
+    /// </summary>
+    private int _referenceFingerprintTestcaseId;
+
+    /// <summary>
+    /// The number of received fingerprints.
+    /// </summary>
+    private int _fingerprintCount;
+
+    /// <summary>
+    /// The number of testcases whose fingerprint differs from the reference fingerprint.
+    /// </summary>
+    private int _differingFingerprintCount;
+
+    /// <summary>
+    /// The number of differing testcases for each instruction address.
+    /// </summary>
+    private readonly Dictionary<ulong, int> _differingInstructions = new();
+
+    /// <summary>
+    /// Protects the statistics writer.
+    /// </summary>
+    private readonly SemaphoreSlim _statisticsSemaphore = new(1, 1);
+
+    /// <summary>
+    /// Receives the tracer statistics of each testcase, if statistics are enabled.
     /// </summary>
-    private Process _pinToolProcess = null!;
+    private StreamWriter? _statisticsWriter;
 
-    // Not supported. This module only manages a single Pin instance, which currently is fast enough.
-    public override bool SupportsParallelism => false;
+    // Each Pin instance runs its testcases sequentially. If batching is enabled, concurrent calls are collected into batches, so the wrapper
+    // can run several testcases without waiting for the trace stage.
+    public override bool SupportsParallelism => _batchSize > 1 || _pinToolInstances.Count > 1;
 
     public override async Task GenerateTraceAsync(TraceEntity traceEntity)
     {
@@ -39,28 +122,141 @@ public class PinTraceGenerator : TraceStage
         // Debug
         await Logger.LogDebugAsync($"{logMessagePrefix} Trace #" + traceEntity.Id);
 
-        // Send test case
-        await _pinToolProcess.StandardInput.WriteLineAsync($"t {traceEntity.Id}");
-        await _pinToolProcess.StandardInput.WriteLineAsync(traceEntity.TestcaseFilePath);
-        while(true)
+        if(_batchSize > 1)
         {
-            // Read Pin tool output
-            await Logger.LogDebugAsync($"{logMessagePrefix} Read from Pin tool stdout...");
-            string pinToolOutput = await _pinToolProcess.StandardOutput.ReadLineAsync()
-                                   ?? throw new IOException("Could not read from Pin tool standard output (null). Probably the process has exited early.");
+            // Queue test case for the next batch
+            var completion = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            await _pendingTestcases.Writer.WriteAsync((traceEntity, completion), PipelineToken);
+            await completion.Task;
+        }
+        else
+        {
+            // Send test case to the next free instance
+            var pinToolInstance = await _idleInstances.Reader.ReadAsync(PipelineToken);
+            try
+            {
+                await pinToolInstance.RunTestcaseAsync(traceEntity);
+            }
+            finally
+            {
+                _idleInstances.Writer.TryWrite(pinToolInstance);
+            }
+        }
+
+        // The trace prefix is complete after the first testcase
+        if(!_allInstancesStarted)
+            await StartSecondaryInstancesAsync();
+    }
+
+    /// <summary>
+    /// Starts the Pin tool instances which verify their trace prefix against the one of the first instance.
+    /// </summary>
+    private async Task StartSecondaryInstancesAsync()
+    {
+        await _instanceStartSemaphore.WaitAsync();
+        try
+        {
+            if(_allInstancesStarted)
+                return;
 
-            // Parse output
-            await Logger.LogDebugAsync($"{_pinOutMessagePrefix} {pinToolOutput}");
-            string[] outputParts = pinToolOutput.Split('\t');
-            if(outputParts[0] == "t")
+            if(_pinToolInstances.Count > 1)
             {
-                // Store trace file name
-                traceEntity.RawTraceFilePath = outputParts[1];
-                break;
+                await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Trace prefix is complete, starting {_pinToolInstances.Count - 1} more Pin tool instances");
+
+                File.Copy(Path.Combine(_outputDirectory.FullName, "prefix_data.txt"), Path.Combine(_outputDirectory.FullName, _referencePrefixFileNamePrefix + "prefix_data.txt"), true);
+                File.Move(Path.Combine(_outputDirectory.FullName, "prefix_digest.txt"), Path.Combine(_outputDirectory.FullName, _referencePrefixFileNamePrefix + "prefix_digest.txt"), true);
+            }
+
+            foreach(var pinToolInstance in _pinToolInstances.Where(i => !i.IsStarted))
+                await StartInstanceAsync(pinToolInstance);
+
+            _allInstancesStarted = true;
+        }
+        finally
+        {
+            _instanceStartSemaphore.Release();
+        }
+    }
+
+    /// <summary>
+    /// Starts the given Pin tool instance and makes it available for running testcases.
+    /// </summary>
+    private async Task StartInstanceAsync(PinToolInstance pinToolInstance)
+    {
+        await pinToolInstance.StartAsync(PipelineToken);
+
+        if(_batchSize > 1)
+            _batchDispatcherTasks.Add(Task.Run(() => pinToolInstance.DispatchBatchesAsync(_pendingTestcases.Reader, _batchSize)));
+        else
+            _idleInstances.Writer.TryWrite(pinToolInstance);
+    }
+
+    /// <summary>
+    /// Compares the given trace fingerprint with the reference fingerprint and records the result.
+    /// </summary>
+    private async Task HandleFingerprintAsync(TraceEntity traceEntity, TraceFingerprint fingerprint)
+    {
+        await _fingerprintSemaphore.WaitAsync();
+        try
+        {
+            ++_fingerprintCount;
+
+            // The first fingerprint becomes the reference
+            int differingInstructionCount = 0;
+            if(_referenceFingerprint == null)
+            {
+                _referenceFingerprint = fingerprint;
+                _referenceFingerprintTestcaseId = traceEntity.Id;
+            }
+            else if(fingerprint.TraceHash != _referenceFingerprint.TraceHash)
+            {
+                ++_differingFingerprintCount;
+
+                // Find instructions which have different accesses or branches, or were only executed by one of the testcases
+                foreach(var instructionHash in fingerprint.InstructionHashes)
+                {
+                    if(!_referenceFingerprint.InstructionHashes.TryGetValue(instructionHash.Key, out ulong referenceHash) || referenceHash != instructionHash.Value)
+                    {
+                        ++differingInstructionCount;
+                        _differingInstructions[instructionHash.Key] = _differingInstructions.GetValueOrDefault(instructionHash.Key) + 1;
+                    }
+                }
+
+                foreach(var referenceInstructionHash in _referenceFingerprint.InstructionHashes)
+                {
+                    if(!fingerprint.InstructionHashes.ContainsKey(referenceInstructionHash.Key))
+                    {
+                        ++differingInstructionCount;
+                        _differingInstructions[referenceInstructionHash.Key] = _differingInstructions.GetValueOrDefault(referenceInstructionHash.Key) + 1;
+                    }
+                }
+
+                await Logger.LogDebugAsync($"[trace:pin:{traceEntity.Id}] Fingerprint differs from testcase #{_referenceFingerprintTestcaseId} at {differingInstructionCount} instructions");
             }
 
-            await Logger.LogWarningAsync($"{logMessagePrefix} Unexpected message from Pin tool.\nPlease make sure that the investigated program does not print anything on stdout, since this might interfere with the Pin tool's output pipe.");
-            await Logger.LogWarningAsync($"{logMessagePrefix}   >>> {pinToolOutput}");
+            // Testcase ID, trace fingerprint, number of differing instructions
+            await _fingerprintWriter!.WriteLineAsync($"{traceEntity.Id}\t{fingerprint.TraceHash:x16}\t{differingInstructionCount}");
+        }
+        finally
+        {
+            _fingerprintSemaphore.Release();
+        }
+    }
+
+    /// <summary>
+    /// Writes the given tracer statistics of a testcase into the statistics file.
+    /// </summary>
+    private async Task HandleStatisticsAsync(TraceEntity traceEntity, string statistics)
+    {
+        await _statisticsSemaphore.WaitAsync();
+        try
+        {
+            // Testcase ID, tab-separated counters
+            await _statisticsWriter!.WriteLineAsync($"{traceEntity.Id}\t{statistics}");
+        }
+        finally
+        {
+            _statisticsSemaphore.Release();
         }
     }
 
@@ -87,8 +283,80 @@ public class PinTraceGenerator : TraceStage
         string pinPath = moduleOptions.GetChildNodeOrDefault("pin-path")?.AsString() ?? "pin";
         ulong? fixedRdrand = moduleOptions.GetChildNodeOrDefault("rdrand")?.AsUnsignedLongHex();
         int cpuModelId = moduleOptions.GetChildNodeOrDefault("cpu")?.AsInteger() ?? 0;
+        _batchSize = moduleOptions.GetChildNodeOrDefault("batch-size")?.AsInteger() ?? 1;
+        string? testcaseBufferPath = moduleOptions.GetChildNodeOrDefault("testcase-buffer")?.AsString();
+        int instanceCount = moduleOptions.GetChildNodeOrDefault("instances")?.AsInteger() ?? 1;
+        int forkServerWorkerCount = moduleOptions.GetChildNodeOrDefault("fork-server-workers")?.AsInteger() ?? 0;
+        bool fingerprintMode = moduleOptions.GetChildNodeOrDefault("fingerprint")?.AsBoolean() ?? false;
+        bool aggregateMemoryAccesses = moduleOptions.GetChildNodeOrDefault("aggregate-memory-accesses")?.AsBoolean() ?? false;
+        bool basicBlockControlFlow = moduleOptions.GetChildNodeOrDefault("basic-block-control-flow")?.AsBoolean() ?? false;
+        bool runLengthEncoding = moduleOptions.GetChildNodeOrDefault("run-length-encoding")?.AsBoolean() ?? false;
+        bool differentialRecording = moduleOptions.GetChildNodeOrDefault("differential-recording")?.AsBoolean() ?? false;
+        int traceIndexInterval = moduleOptions.GetChildNodeOrDefault("trace-index-interval")?.AsInteger() ?? 0;
+        bool lazySymbols = moduleOptions.GetChildNodeOrDefault("lazy-symbols")?.AsBoolean() ?? false;
+        bool collectStatistics = moduleOptions.GetChildNodeOrDefault("statistics")?.AsBoolean() ?? false;
+        bool suppressDuplicateAccesses = moduleOptions.GetChildNodeOrDefault("suppress-duplicate-accesses")?.AsBoolean() ?? false;
+        bool secretRegionFilter = moduleOptions.GetChildNodeOrDefault("secret-region-filter")?.AsBoolean() ?? false;
+        int secretDependencyWindow = moduleOptions.GetChildNodeOrDefault("secret-dependency-window")?.AsInteger() ?? 0;
+        string taintTracking = moduleOptions.GetChildNodeOrDefault("taint-tracking")?.AsString() ?? "none";
+        int taintTrackingMode = taintTracking switch
+        {
+            "none" => 0,
+            "secret-regions" => 1,
+            "input" => 2,
+            _ => throw new ConfigurationException($"Unknown taint tracking mode '{taintTracking}'.")
+        };
+        bool pauseInstrumentation = moduleOptions.GetChildNodeOrDefault("pause-instrumentation")?.AsBoolean() ?? false;
+        string addressGranularity = moduleOptions.GetChildNodeOrDefault("address-granularity")?.AsString() ?? "byte";
+        int addressGranularityBits = addressGranularity switch
+        {
+            "byte" => 0,
+            "cache-line" => 6,
+            "page" => 12,
+            _ => throw new ConfigurationException($"Unknown address granularity '{addressGranularity}'.")
+        };
         bool enableStackTracking = moduleOptions.GetChildNodeOrDefault("stack-tracking")?.AsBoolean() ?? false;
-        
+        bool stackFrameSummaries = moduleOptions.GetChildNodeOrDefault("stack-frame-summaries")?.AsBoolean() ?? false;
+        string? sharedMemoryRingPath = moduleOptions.GetChildNodeOrDefault("shared-memory-ring")?.AsString();
+        int sharedMemoryRingSize = moduleOptions.GetChildNodeOrDefault("shared-memory-ring-size")?.AsInteger() ?? 256;
+        bool traceArchive = moduleOptions.GetChildNodeOrDefault("trace-archive")?.AsBoolean() ?? false;
+        string? prefixCachePath = moduleOptions.GetChildNodeOrDefault("prefix-cache")?.AsString();
+        int traceArchiveSegmentSize = moduleOptions.GetChildNodeOrDefault("trace-archive-segment-size")?.AsInteger() ?? 0;
+        bool traceAllThreads = moduleOptions.GetChildNodeOrDefault("trace-all-threads")?.AsBoolean() ?? false;
+        int asyncFlushBufferCount = moduleOptions.GetChildNodeOrDefault("async-flush-buffers")?.AsInteger() ?? 0;
+        int? entryBufferSize = moduleOptions.GetChildNodeOrDefault("entry-buffer-size")?.AsInteger();
+        bool adaptiveBufferSize = moduleOptions.GetChildNodeOrDefault("adaptive-buffer-size")?.AsBoolean() ?? false;
+        string hugePages = moduleOptions.GetChildNodeOrDefault("huge-pages")?.AsString() ?? "none";
+        int hugePageModeId = hugePages switch
+        {
+            "none" => 0,
+            "transparent" => 1,
+            "explicit" => 2,
+            _ => throw new ConfigurationException($"Unknown huge page mode '{hugePages}'.")
+        };
+        string traceFormat = moduleOptions.GetChildNodeOrDefault("trace-format")?.AsString() ?? "raw";
+        int traceFormatId = traceFormat switch
+        {
+            "raw" => 0,
+            "compact" => 1,
+            _ => throw new ConfigurationException($"Unknown trace format '{traceFormat}'.")
+        };
+        string compression = moduleOptions.GetChildNodeOrDefault("compression")?.AsString() ?? "none";
+        int compressionId = compression switch
+        {
+            "none" => 0,
+            "lz4" => 1,
+            _ => throw new ConfigurationException($"Unknown trace compression '{compression}'.")
+        };
+
+        // Routines which limit the tracing scope
+        string? traceScopeRoutineList = null;
+        var traceScopeNode = moduleOptions.GetChildNodeOrDefault("trace-scope");
+        if(traceScopeNode is ListNode traceScopeListNode)
+            traceScopeRoutineList = string.Join(':', traceScopeListNode.Children.Select(c => c.AsString()));
+        else if(traceScopeNode != null)
+            throw new ConfigurationException("Trace scope node has wrong type (should be a list node).");
+
         // Wrapper arguments
         List<string> wrapperArgs = new();
         var wrapperArgsNode = moduleOptions.GetChildNodeOrDefault("wrapper-args");
@@ -97,12 +365,82 @@ public class PinTraceGenerator : TraceStage
         else if(wrapperArgsNode != null)
             throw new ConfigurationException("Wrapper arguments node has wrong type (should be a list node).");
 
+        if(_batchSize < 1)
+            throw new ConfigurationException("The batch size must be at least 1.");
+        if(testcaseBufferPath != null)
+        {
+            if(_batchSize == 1)
+                throw new ConfigurationException("The testcase buffer can only be used in conjunction with batching.");
+            testcaseBufferPath = Path.GetFullPath(testcaseBufferPath);
+        }
+        if(instanceCount < 1)
+            throw new ConfigurationException("The number of Pin tool instances must be at least 1.");
+        if(secretDependencyWindow < 0)
+            throw new ConfigurationException("The secret dependency window must not be negative.");
+        if(taintTrackingMode != 0 && traceAllThreads)
+            throw new ConfigurationException("Taint tracking cannot be combined with trace-all-threads.");
+        if(forkServerWorkerCount < 0)
+            throw new ConfigurationException("The number of fork-server workers must not be negative.");
+        if(forkServerWorkerCount > 0)
+        {
+            // The worker processes do not share any tracer state with each other
+            if(traceAllThreads || basicBlockControlFlow || differentialRecording || sharedMemoryRingPath != null)
+                throw new ConfigurationException("Fork-server mode cannot be combined with trace-all-threads, basic-block-control-flow, differential-recording or shared-memory-ring.");
+
+            // The workers share the standard output of the Pin tool, where long reports of concurrent workers could get interleaved
+            if(fingerprintMode || collectStatistics)
+                throw new ConfigurationException("Fork-server mode cannot be combined with fingerprint or statistics.");
+        }
+        if(traceArchive)
+        {
+            // The archive is appended by a single process
+            if(sharedMemoryRingPath != null || forkServerWorkerCount > 0)
+                throw new ConfigurationException("The trace archive cannot be combined with shared-memory-ring or fork-server-workers.");
+            if(traceArchiveSegmentSize < 0)
+                throw new ConfigurationException("The trace archive segment size must not be negative.");
+        }
+        if(prefixCachePath != null)
+        {
+            // The cache holds the prefix of the main thread, which refers to the images and basic blocks of this run
+            if(traceAllThreads || basicBlockControlFlow)
+                throw new ConfigurationException("The prefix cache cannot be combined with trace-all-threads or basic-block-control-flow.");
+
+            prefixCachePath = Path.GetFullPath(prefixCachePath);
+            Directory.CreateDirectory(prefixCachePath);
+        }
+        if(differentialRecording && runLengthEncoding)
+        {
+            // Both traces would be collapsed at different buffer boundaries, so equal executions do not match
+            throw new ConfigurationException("Differential recording cannot be combined with run-length-encoding.");
+        }
+        if(differentialRecording && instanceCount > 1)
+        {
+            // Each instance would write its own first testcase to the same reference trace
+            throw new ConfigurationException("Differential recording cannot be used with multiple Pin tool instances.");
+        }
+        if(traceIndexInterval < 0)
+            throw new ConfigurationException("The trace index interval must not be negative.");
+        if(traceIndexInterval > 0)
+        {
+            // The chunk index refers to the stored entries, which must not be expanded or replaced while reading
+            if(aggregateMemoryAccesses || basicBlockControlFlow || runLengthEncoding || differentialRecording)
+                throw new ConfigurationException("The trace index cannot be combined with aggregate-memory-accesses, basic-block-control-flow, run-length-encoding or differential-recording.");
+        }
+        if(basicBlockControlFlow)
+        {
+            // The basic block IDs are assigned by each Pin tool instance individually
+            if(instanceCount > 1)
+                throw new ConfigurationException("Basic block control flow mode cannot be used with multiple Pin tool instances.");
+            if(!string.IsNullOrEmpty(traceScopeRoutineList))
+                throw new ConfigurationException("Basic block control flow mode cannot be used in conjunction with a trace scope.");
+        }
+
         // Prepare argument list
+        string outputPrefix = $"{Path.GetFullPath(_outputDirectory.FullName) + Path.DirectorySeparatorChar} "; // The trailing space is required on Windows: Pin's command line parser else believes that the final backslash is an escape character
         var pinArgs = new List<string>
         {
             "-t", $"{pinToolPath}",
-            "-o",
-            $"{Path.GetFullPath(_outputDirectory.FullName) + Path.DirectorySeparatorChar} ", // The trailing space is required on Windows: Pin's command line parser else believes that the final backslash is an escape character
+            "-o", outputPrefix,
             "-i", $"{imagesList}"
         };
 
@@ -112,92 +450,297 @@ public class PinTraceGenerator : TraceStage
             pinArgs.Add($"{fixedRdrand.Value}");
         }
 
-        if(enableStackTracking)
+        if(stackFrameSummaries)
+        {
+            pinArgs.Add("-s");
+            pinArgs.Add("2");
+        }
+        else if(enableStackTracking)
         {
             pinArgs.Add("-s");
             pinArgs.Add("1");
         }
 
+        if(!string.IsNullOrEmpty(traceScopeRoutineList))
+        {
+            pinArgs.Add("-n");
+            pinArgs.Add(traceScopeRoutineList);
+        }
+
+        if(sharedMemoryRingPath != null)
+        {
+            sharedMemoryRingPath = Path.GetFullPath(sharedMemoryRingPath);
+            pinArgs.Add("-xs");
+            pinArgs.Add($"{sharedMemoryRingSize}");
+        }
+
+        if(traceArchive && traceArchiveSegmentSize > 0)
+        {
+            pinArgs.Add("-as");
+            pinArgs.Add($"{traceArchiveSegmentSize}");
+        }
+
+        if(traceAllThreads)
+        {
+            pinArgs.Add("-m");
+            pinArgs.Add("1");
+        }
+
+        if(fingerprintMode)
+        {
+            pinArgs.Add("-fp");
+            pinArgs.Add("1");
+
+            _fingerprintWriter = new StreamWriter(Path.Combine(_outputDirectory.FullName, "fingerprints.txt"), false);
+        }
+
+        if(aggregateMemoryAccesses)
+        {
+            pinArgs.Add("-g");
+            pinArgs.Add("1");
+        }
+
+        if(basicBlockControlFlow)
+        {
+            pinArgs.Add("-b");
+            pinArgs.Add("1");
+        }
+
+        if(runLengthEncoding)
+        {
+            pinArgs.Add("-rl");
+            pinArgs.Add("1");
+        }
+
+        if(differentialRecording)
+        {
+            pinArgs.Add("-dr");
+            pinArgs.Add("1");
+        }
+
+        if(traceIndexInterval > 0)
+        {
+            pinArgs.Add("-ti");
+            pinArgs.Add($"{traceIndexInterval}");
+        }
+
+        if(forkServerWorkerCount > 0)
+        {
+            pinArgs.Add("-fs");
+            pinArgs.Add("1");
+        }
+
+        if(lazySymbols)
+        {
+            pinArgs.Add("-ls");
+            pinArgs.Add("1");
+        }
+
+        if(addressGranularityBits != 0)
+        {
+            pinArgs.Add("-ag");
+            pinArgs.Add($"{addressGranularityBits}");
+        }
+
+        if(suppressDuplicateAccesses)
+        {
+            pinArgs.Add("-ad");
+            pinArgs.Add("1");
+        }
+
+        if(secretRegionFilter)
+        {
+            pinArgs.Add("-sf");
+            pinArgs.Add("1");
+            pinArgs.Add("-sw");
+            pinArgs.Add($"{secretDependencyWindow}");
+        }
+
+        if(taintTrackingMode != 0)
+        {
+            pinArgs.Add("-tt");
+            pinArgs.Add($"{taintTrackingMode}");
+        }
+
+        if(pauseInstrumentation)
+        {
+            pinArgs.Add("-pi");
+            pinArgs.Add("1");
+        }
+
+        if(collectStatistics)
+        {
+            pinArgs.Add("-st");
+            pinArgs.Add("1");
+
+            _statisticsWriter = new StreamWriter(Path.Combine(_outputDirectory.FullName, "statistics.txt"), false);
+        }
+
+        if(traceFormatId != 0)
+        {
+            pinArgs.Add("-f");
+            pinArgs.Add($"{traceFormatId}");
+        }
+
+        if(compressionId != 0)
+        {
+            pinArgs.Add("-z");
+            pinArgs.Add($"{compressionId}");
+        }
+
+        if(asyncFlushBufferCount > 0)
+        {
+            pinArgs.Add("-a");
+            pinArgs.Add($"{asyncFlushBufferCount}");
+        }
+
+        if(entryBufferSize != null)
+        {
+            pinArgs.Add("-bs");
+            pinArgs.Add($"{entryBufferSize.Value}");
+        }
+
+        if(hugePageModeId != 0)
+        {
+            pinArgs.Add("-hp");
+            pinArgs.Add($"{hugePageModeId}");
+        }
+
+        if(adaptiveBufferSize)
+        {
+            pinArgs.Add("-ba");
+            pinArgs.Add("1");
+        }
+
         pinArgs.Add("-c");
         pinArgs.Add($"{cpuModelId}");
-        pinArgs.Add("--");           
-        pinArgs.Add(wrapperPath);
-        pinArgs.AddRange(wrapperArgs);
-
-        // Prepare Pin tool process
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Starting Pin tool process");
-        ProcessStartInfo pinToolProcessStartInfo = new()
-        {
-            Arguments = string.Empty,
-            FileName = pinPath,
-            WorkingDirectory = _outputDirectory.FullName, // Places pin.log at the trace directory
-            UseShellExecute = false,
-            RedirectStandardInput = true,
-            RedirectStandardOutput = true,
-            RedirectStandardError = true
-        };
-        pinToolProcessStartInfo.ArgumentList.AddRange(pinArgs);
 
         // Environment variables
+        Dictionary<string, string> environmentVariables = new();
         var environmentNode = moduleOptions.GetChildNodeOrDefault("environment");
         if(environmentNode is MappingNode environmentMappingNode)
         {
             foreach(var variable in environmentMappingNode.Children)
             {
                 string value = variable.Value.AsString() ?? throw new ConfigurationException($"Invalid value for environment variable '{variable.Key}'");
-                pinToolProcessStartInfo.EnvironmentVariables[variable.Key] = value;
+                environmentVariables[variable.Key] = value;
             }
         }
         else if(environmentNode != null)
             throw new ConfigurationException($"The 'environment' node is not a mapping node.");
 
-        pinToolProcessStartInfo.EnvironmentVariables["PATH"] += Path.PathSeparator + Path.GetDirectoryName(wrapperPath);
-
-        // Start Pin tool
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Pin tool command: {pinToolProcessStartInfo.FileName} {string.Join(" ", pinToolProcessStartInfo.ArgumentList)}");
-        _pinToolProcess = Process.Start(pinToolProcessStartInfo) ?? throw new Exception("Could not start the Pin process.");
-
-        // Ensure that the Pin process is eventually stopped when the Pipeline gets aborted early
-        PipelineToken.Register(() =>
+        // Prepare Pin tool instances
+        // All instances write to the same output directory, since the trace file names are unique.
+        // The first instance records the trace prefix, the others verify that they arrive at the same prefix, so all traces are valid against it.
+        for(int i = 0; i < instanceCount; ++i)
         {
-            if(_pinToolProcess.HasExited)
-                return;
+            var instanceArgs = new List<string>(pinArgs);
 
-            try
+            // Instance-specific temporary files
+            string? instanceSharedMemoryRingPath = sharedMemoryRingPath == null || i == 0 ? sharedMemoryRingPath : $"{sharedMemoryRingPath}.{i}";
+            string? instanceTestcaseBufferPath = testcaseBufferPath == null || i == 0 ? testcaseBufferPath : $"{testcaseBufferPath}.{i}";
+            if(instanceSharedMemoryRingPath != null)
             {
-                // Try to stop the Pin process the clean way
-                _pinToolProcess.StandardInput.WriteLineAsync("e 0").Wait(1000);
-                if(_pinToolProcess.WaitForExit(1000))
-                    return;
+                instanceArgs.Add("-x");
+                instanceArgs.Add(instanceSharedMemoryRingPath);
+            }
 
-                _pinToolProcess.Kill(true);
+            if(traceArchive)
+            {
+                instanceArgs.Add("-ar");
+                instanceArgs.Add(Path.Combine(Path.GetFullPath(_outputDirectory.FullName), i == 0 ? "traces.archive" : $"traces.{i}.archive"));
+            }
 
-                if(!_pinToolProcess.WaitForExit(1000))
-                    Logger.LogErrorAsync($"{_genericLogMessagePrefix} Sent a KILL signal to the Pin tool process, but it did not respond in time. Please check whether it still running.").Wait(2000);
+            // Only the first instance records the prefix, the others verify theirs against it
+            if(prefixCachePath != null && i == 0)
+            {
+                instanceArgs.Add("-pc");
+                instanceArgs.Add(prefixCachePath);
             }
-            catch(Exception ex)
+
+            if(instanceCount > 1)
             {
-                Logger.LogErrorAsync($"{_genericLogMessagePrefix} Could not safely stop the Pin tool process. Please check whether it still running. Error message:\n{ex}").Wait(2000);
+                if(i == 0)
+                {
+                    instanceArgs.Add("-pd");
+                    instanceArgs.Add("1");
+                }
+                else
+                {
+                    instanceArgs.Add("-pr");
+                    instanceArgs.Add(Path.Combine(Path.GetFullPath(_outputDirectory.FullName), _referencePrefixFileNamePrefix));
+                }
             }
-        });
 
-        // Read and log error output of Pin tool (avoids pipe contention leading to I/O hangs)
-        _pinToolProcess.ErrorDataReceived += async (_, e) =>
-        {
-            if(!string.IsNullOrWhiteSpace(e.Data))
-                await Logger.LogDebugAsync($"{_pinLogMessagePrefix} {e.Data}");
-        };
-        _pinToolProcess.BeginErrorReadLine();
+            instanceArgs.Add("--");
+            instanceArgs.Add(wrapperPath);
+            instanceArgs.AddRange(wrapperArgs);
+
+            ProcessStartInfo pinToolProcessStartInfo = new()
+            {
+                Arguments = string.Empty,
+                FileName = pinPath,
+                WorkingDirectory = _outputDirectory.FullName, // Places pin.log at the trace directory
+                UseShellExecute = false,
+                RedirectStandardInput = true,
+                RedirectStandardOutput = true,
+                RedirectStandardError = true
+            };
+            pinToolProcessStartInfo.ArgumentList.AddRange(instanceArgs);
+
+            foreach(var variable in environmentVariables)
+                pinToolProcessStartInfo.EnvironmentVariables[variable.Key] = variable.Value;
+            pinToolProcessStartInfo.EnvironmentVariables["PATH"] += Path.PathSeparator + Path.GetDirectoryName(wrapperPath);
+
+            _pinToolInstances.Add(new PinToolInstance(i, Logger, pinToolProcessStartInfo, instanceSharedMemoryRingPath, instanceTestcaseBufferPath, fingerprintMode ? HandleFingerprintAsync : null, collectStatistics ? HandleStatisticsAsync : null, forkServerWorkerCount));
+        }
+
+        if(_batchSize > 1)
+            _pendingTestcases = Channel.CreateUnbounded<(TraceEntity TraceEntity, TaskCompletionSource Completion)>();
+        else
+            _idleInstances = Channel.CreateUnbounded<PinToolInstance>();
+
+        // Start first Pin tool instance
+        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Starting Pin tool process");
+        await StartInstanceAsync(_pinToolInstances[0]);
+        if(instanceCount == 1)
+            _allInstancesStarted = true;
     }
 
     public override async Task UnInitAsync()
     {
-        // Exit Pin tool process
-        await Logger.LogDebugAsync($"{_genericLogMessagePrefix} Stopping Pin tool process");
-        if(!_pinToolProcess.HasExited)
+        // Wait for dispatchers to send the remaining batches
+        if(_batchSize > 1)
+        {
+            _pendingTestcases.Writer.TryComplete();
+            await Task.WhenAll(_batchDispatcherTasks);
+        }
+
+        // Exit Pin tool processes
+        foreach(var pinToolInstance in _pinToolInstances.Where(i => i.IsStarted))
+            await pinToolInstance.StopAsync();
+
+        // Write fingerprint summary
+        if(_fingerprintWriter != null)
+        {
+            await _fingerprintWriter.DisposeAsync();
+
+            // Instruction address, number of testcases with differing accesses or branches
+            await using var differingInstructionsWriter = new StreamWriter(Path.Combine(_outputDirectory.FullName, "fingerprint_instructions.txt"), false);
+            foreach(var differingInstruction in _differingInstructions.OrderByDescending(i => i.Value).ThenBy(i => i.Key))
+                await differingInstructionsWriter.WriteLineAsync($"{differingInstruction.Key:x16}\t{differingInstruction.Value}");
+
+            await Logger.LogResultAsync($"{_genericLogMessagePrefix} {_differingFingerprintCount} of {_fingerprintCount} testcases have a different trace fingerprint than testcase #{_referenceFingerprintTestcaseId}, at {_differingInstructions.Count} distinct instructions");
+        }
+
+        if(_statisticsWriter != null)
+            await _statisticsWriter.DisposeAsync();
+
+        // Remove copy of reference prefix
+        if(_pinToolInstances.Count > 1)
         {
-            await _pinToolProcess.StandardInput.WriteLineAsync("e 0");
-            await _pinToolProcess.WaitForExitAsync();
+            File.Delete(Path.Combine(_outputDirectory.FullName, _referencePrefixFileNamePrefix + "prefix_data.txt"));
+            File.Delete(Path.Combine(_outputDirectory.FullName, _referencePrefixFileNamePrefix + "prefix_digest.txt"));
         }
     }
-}
\ No newline at end of file
+}
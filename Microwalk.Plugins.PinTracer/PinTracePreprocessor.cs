@@ -103,7 +103,7 @@ public class PinTracePreprocessor : PreprocessorStage
                 // Paths
                 string rawTraceFileDirectory = Path.GetDirectoryName(traceEntity.RawTraceFilePath) ?? throw new Exception($"Could not determine directory: {traceEntity.RawTraceFilePath}");
                 string prefixDataFilePath = Path.Combine(rawTraceFileDirectory, "prefix_data.txt");
-                string tracePrefixFilePath = Path.Combine(rawTraceFileDirectory, "prefix.trace");
+                string tracePrefixFilePath = RawTraceFileReader.ResolveTraceFilePath(rawTraceFileDirectory, "prefix.trace");
 
                 // Read image data
                 string[] imageDataLines = await File.ReadAllLinesAsync(prefixDataFilePath);
@@ -182,17 +182,16 @@ public class PinTracePreprocessor : PreprocessorStage
         // Store to disk?
         if(_storeTraces)
         {
-            traceEntity.PreprocessedTraceFilePath = Path.Combine(_outputDirectory!.FullName, Path.GetFileName(traceEntity.RawTraceFilePath) + ".preprocessed");
+            traceEntity.PreprocessedTraceFilePath = Path.Combine(_outputDirectory!.FullName, RawTraceFileReader.GetUncompressedTraceFileName(traceEntity.RawTraceFilePath) + ".preprocessed");
             await using var writer = new BinaryWriter(File.Open(traceEntity.PreprocessedTraceFilePath, FileMode.Create, FileAccess.Write, FileShare.None));
             writer.Write(preprocessedTraceData.Span);
         }
 
         // Keep raw trace?
+        // Traces in the shared memory ring are always released, and written to disk if they should be kept
+        RawTraceFileReader.ReleaseTrace(traceEntity.RawTraceFilePath, _keepRawTraces);
         if(!_keepRawTraces)
-        {
-            File.Delete(traceEntity.RawTraceFilePath);
             traceEntity.RawTraceFilePath = null;
-        }
 
         // Keep trace data in memory for the analysis stages
         traceEntity.PreprocessedTraceFile = preprocessedTraceFile;
@@ -211,7 +210,7 @@ public class PinTracePreprocessor : PreprocessorStage
     private unsafe void PreprocessFile(string inputFileName, bool isPrefix, FastBinaryBufferWriter traceFileWriter, string logPrefix)
     {
         // Read entire trace file into memory, since these files should not get too big
-        byte[] inputFile = File.ReadAllBytes(inputFileName);
+        var inputFile = RawTraceFileReader.ReadEntries(inputFileName);
         int inputFileLength = inputFile.Length;
         int rawTraceEntrySize = Marshal.SizeOf(typeof(RawTraceEntry));
 
@@ -228,7 +227,7 @@ public class PinTracePreprocessor : PreprocessorStage
         var heapAllocationLookup = new SortedList<ulong, HeapAllocation>();
         int nextHeapAllocationId = isPrefix ? 0 : _tracePrefixLastHeapAllocationId + 1;
         int nextStackAllocationId = isPrefix ? 0 : _tracePrefixLastStackAllocationId + 1;
-        fixed(byte* inputFilePtr = inputFile)
+        fixed(byte* inputFilePtr = inputFile.Span)
         {
             for(long pos = 0; pos < inputFileLength; pos += rawTraceEntrySize)
             {
@@ -429,6 +428,13 @@ public class PinTracePreprocessor : PreprocessorStage
                         break;
                     }
 
+                    case RawTraceEntryTypes.StackFrame:
+                    {
+                        // Frame summaries are written when the function returns, i.e., after its memory accesses were already assigned to a stack frame.
+                        // Like the stack pointer modifications above, they are ignored for now, and all stack accesses refer to the dummy stack frame.
+                        break;
+                    }
+
                     case RawTraceEntryTypes.Branch when !isPrefix:
                     {
                         // Find image of source and destination instruction
@@ -758,7 +764,32 @@ public class PinTracePreprocessor : PreprocessorStage
         /// <summary>
         /// A modification of the stack pointer.
         /// </summary>
-        StackPointerModification = 8
+        StackPointerModification = 8,
+
+        /// <summary>
+        /// The number of occurrences of the preceding memory access (only in access histogram files).
+        /// </summary>
+        AccessCount = 9,
+
+        /// <summary>
+        /// The execution of a basic block (only in basic block control flow mode; converted into branches by <see cref="RawTraceFileReader"/>).
+        /// </summary>
+        BasicBlock = 10,
+
+        /// <summary>
+        /// A repetition of the preceding entries (only in run-length encoded files; expanded by <see cref="RawTraceFileReader"/>).
+        /// </summary>
+        Repeat = 11,
+
+        /// <summary>
+        /// A copy of a run of entries from the reference trace (only in differential trace files; expanded by <see cref="RawTraceFileReader"/>).
+        /// </summary>
+        ReferenceCopy = 12,
+
+        /// <summary>
+        /// A stack frame of a function which has returned (only in stack frame summary mode).
+        /// </summary>
+        StackFrame = 13
     }
 
     /// <summary>
@@ -0,0 +1,597 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.Collections.Generic;
+using System.IO;
+using System.Runtime.InteropServices;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Reads raw trace files produced by the Pin tool and converts them into a sequence of <see cref="PinTracePreprocessor.RawTraceEntry"/> objects.
+/// </summary>
+internal static class RawTraceFileReader
+{
+    /// <summary>
+    /// The magic number at the beginning of trace files with header ("MWTR").
+    /// Raw trace files without header always start with a valid entry type, so they never match this value.
+    /// </summary>
+    private const uint _traceFileMagic = 0x5254574D;
+
+    /// <summary>
+    /// The supported version of the trace file header.
+    /// </summary>
+    private const ushort _traceFileVersion = 1;
+
+    /// <summary>
+    /// The size of the trace file header.
+    /// </summary>
+    private const int _traceFileHeaderSize = 4 + 2 + 2;
+
+    /// <summary>
+    /// The number of distinct entry types in the compact encoding, including the unused 0 value.
+    /// </summary>
+    private const int _compactEntryTypeCount = 16;
+
+    /// <summary>
+    /// The flag of basic block entries which indicate that the control flow does not continue from the preceding basic block.
+    /// </summary>
+    private const byte _basicBlockDiscontinuityFlag = 1 << 0;
+
+    /// <summary>
+    /// The name of the reference trace file in the trace directory, which is used by differential trace files.
+    /// </summary>
+    private const string _referenceTraceFileName = "reference.trace";
+
+    /// <summary>
+    /// Protects the reference trace cache.
+    /// </summary>
+    private static readonly object _referenceTracesLock = new();
+
+    /// <summary>
+    /// The raw entries of the loaded reference traces, indexed by file name.
+    /// </summary>
+    private static readonly Dictionary<string, ReadOnlyMemory<byte>> _referenceTraces = new();
+
+    /// <summary>
+    /// Flags in the trace file header.
+    /// </summary>
+    [Flags]
+    private enum TraceFileFlags : ushort
+    {
+        /// <summary>
+        /// The records use the compact encoding.
+        /// </summary>
+        CompactEncoding = 1 << 0,
+
+        /// <summary>
+        /// The memory accesses are aggregated: Each distinct access is stored once at the end of the trace, followed by an access count entry.
+        /// The entries are otherwise regular trace entries, so this flag does not need special handling.
+        /// </summary>
+        AccessHistogram = 1 << 1,
+
+        /// <summary>
+        /// The control flow is recorded as basic block entries, which refer to the basic block table. They are converted back into branch entries while reading.
+        /// </summary>
+        BasicBlockControlFlow = 1 << 2,
+
+        /// <summary>
+        /// Repeated loop iterations are collapsed into repeat entries. They are expanded while reading.
+        /// </summary>
+        RunLengthEncoding = 1 << 3,
+
+        /// <summary>
+        /// The entries are stored as difference to the reference trace, which resides in a separate file with raw entries. The full entries are restored while reading.
+        /// </summary>
+        DifferentialEncoding = 1 << 4,
+
+        /// <summary>
+        /// The records are followed by an index footer (see <see cref="TraceFileFooter"/>), which is verified and removed while reading.
+        /// In compact encoding, the delta state is reset at the beginning of each chunk.
+        /// </summary>
+        IndexFooter = 1 << 5
+    }
+
+    /// <summary>
+    /// Reads the given trace file and returns its entries in raw format, i.e., as a sequence of <see cref="PinTracePreprocessor.RawTraceEntry"/> objects.
+    /// If the trace resides in the shared memory ring, raw entries are returned without copying; the returned memory is then valid until <see cref="ReleaseTrace"/> is called.
+    /// Traces in a trace archive are read from the respective archive record.
+    /// </summary>
+    /// <param name="fileName">Trace file.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    public static ReadOnlyMemory<byte> ReadEntries(string fileName)
+    {
+        return ReadEntries(fileName, out _);
+    }
+
+    /// <summary>
+    /// Reads the given trace file and returns its entries in raw format, along with its index footer.
+    /// </summary>
+    /// <param name="fileName">Trace file.</param>
+    /// <param name="footer">Receives the index footer, or null if the trace file does not have one.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    public static ReadOnlyMemory<byte> ReadEntries(string fileName, out TraceFileFooter? footer)
+    {
+        footer = null;
+
+        // Read entire trace file into memory, since these files should not get too big
+        if(!SharedTraceRing.TryGetSegment(fileName, out var inputFile) && !TraceArchive.TryGetRecord(fileName, out inputFile))
+            inputFile = File.ReadAllBytes(fileName);
+
+        // Compressed trace file? The LZ4 frame wraps the entire trace, including its header
+        if(Lz4FrameDecoder.IsFrame(inputFile.Span))
+            inputFile = Lz4FrameDecoder.Decode(inputFile.Span, fileName);
+        var inputFileSpan = inputFile.Span;
+
+        // Raw trace file without header?
+        if(inputFile.Length < _traceFileHeaderSize || BinaryPrimitives.ReadUInt32LittleEndian(inputFileSpan) != _traceFileMagic)
+            return inputFile;
+
+        // Check header
+        ushort version = BinaryPrimitives.ReadUInt16LittleEndian(inputFileSpan[4..]);
+        if(version != _traceFileVersion)
+            throw new TraceFormatException($"Unsupported trace file version {version} in file '{fileName}'.");
+        var flags = (TraceFileFlags)BinaryPrimitives.ReadUInt16LittleEndian(inputFileSpan[6..]);
+
+        // Strip index footer
+        var records = inputFile[_traceFileHeaderSize..];
+        if((flags & TraceFileFlags.IndexFooter) != 0)
+        {
+            footer = TraceFileFooter.Parse(records.Span, fileName);
+            records = records[..^footer.Size];
+        }
+
+        // Header only?
+        var entries = (flags & TraceFileFlags.CompactEncoding) != 0
+            ? DecodeCompactEntries(records.Span, footer?.Chunks ?? Array.Empty<TraceFileFooter.ChunkInfo>(), fileName)
+            : records;
+
+        // The Pin tool compares the entries with the reference after collapsing repetitions, so the differences are expanded first
+        if((flags & TraceFileFlags.DifferentialEncoding) != 0)
+            entries = ExpandDifferences(entries.Span, fileName);
+
+        // Repetitions may contain basic block entries, so they are expanded first
+        if((flags & TraceFileFlags.RunLengthEncoding) != 0)
+            entries = ExpandRepetitions(entries.Span, fileName);
+        if((flags & TraceFileFlags.BasicBlockControlFlow) != 0)
+            return ExpandBasicBlocks(entries.Span, fileName);
+        return entries;
+    }
+
+    /// <summary>
+    /// Returns the path of the given trace file in the given directory, which may have been compressed by the Pin tool.
+    /// </summary>
+    /// <param name="directory">Directory of the raw trace files.</param>
+    /// <param name="traceFileName">Name of the uncompressed trace file.</param>
+    public static string ResolveTraceFilePath(string directory, string traceFileName)
+    {
+        string path = Path.Combine(directory, traceFileName);
+        string compressedPath = path + Lz4FrameDecoder.FileExtension;
+        return !File.Exists(path) && File.Exists(compressedPath) ? compressedPath : path;
+    }
+
+    /// <summary>
+    /// Returns the name of the given trace file without the extension of compressed trace files.
+    /// </summary>
+    /// <param name="fileName">Trace file.</param>
+    public static string GetUncompressedTraceFileName(string fileName)
+    {
+        string name = Path.GetFileName(fileName);
+        return name.EndsWith(Lz4FrameDecoder.FileExtension, StringComparison.Ordinal) ? name[..^Lz4FrameDecoder.FileExtension.Length] : name;
+    }
+
+    /// <summary>
+    /// Frees the given trace after it has been processed. A trace file is deleted, a trace in the shared memory ring is released for reuse by the Pin tool.
+    /// A trace in a trace archive is released, and the archive file is deleted once all its traces are released.
+    /// </summary>
+    /// <param name="fileName">Trace file.</param>
+    /// <param name="keep">Keep the trace data: Trace files and archives are not deleted, traces in the shared memory ring are written to the given file before being released.</param>
+    public static void ReleaseTrace(string fileName, bool keep)
+    {
+        if(TraceArchive.ReleaseRecord(fileName, keep))
+            return;
+
+        if(keep && SharedTraceRing.TryGetSegment(fileName, out var data))
+        {
+            using var traceFileStream = File.Open(fileName, FileMode.Create, FileAccess.Write, FileShare.None);
+            traceFileStream.Write(data.Span);
+        }
+
+        if(!SharedTraceRing.ReleaseSegment(fileName) && !keep)
+            File.Delete(fileName);
+    }
+
+    /// <summary>
+    /// Decodes the given compact entry records into raw entries.
+    /// </summary>
+    /// <param name="input">Compact entry records.</param>
+    /// <param name="chunks">Chunks of the index footer, where the delta state is reset.</param>
+    /// <param name="fileName">Trace file name, for error messages.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    private static unsafe ReadOnlyMemory<byte> DecodeCompactEntries(ReadOnlySpan<byte> input, ReadOnlySpan<TraceFileFooter.ChunkInfo> chunks, string fileName)
+    {
+        int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
+
+        // Most records are much smaller than raw entries, so this should avoid most re-allocations
+        byte[] output = new byte[Math.Max(rawTraceEntrySize, input.Length * 4 / rawTraceEntrySize * rawTraceEntrySize)];
+        int outputLength = 0;
+
+        ulong* lastParam1 = stackalloc ulong[_compactEntryTypeCount];
+        ulong* lastParam2 = stackalloc ulong[_compactEntryTypeCount];
+        for(int i = 0; i < _compactEntryTypeCount; ++i)
+        {
+            lastParam1[i] = 0;
+            lastParam2[i] = 0;
+        }
+
+        fixed(byte* inputPtr = input)
+        {
+            int pos = 0;
+            int nextChunk = 0;
+            while(pos < input.Length)
+            {
+                // Each chunk starts with a fresh delta state
+                while(nextChunk < chunks.Length && chunks[nextChunk].Offset <= (ulong)pos)
+                {
+                    if(chunks[nextChunk].Offset != (ulong)pos)
+                        throw new TraceFormatException($"Chunk offset {chunks[nextChunk].Offset} is not at a record boundary in compact trace file '{fileName}'.");
+
+                    for(int i = 0; i < _compactEntryTypeCount; ++i)
+                    {
+                        lastParam1[i] = 0;
+                        lastParam2[i] = 0;
+                    }
+                    ++nextChunk;
+                }
+
+                // Read tag
+                byte tag = inputPtr[pos++];
+                int type = tag & 0x0F;
+                byte flag = (byte)(tag >> 4);
+
+                // Determine used parameters
+                bool hasParam0 = false;
+                bool hasParam1 = false;
+                bool hasParam2 = false;
+                switch((PinTracePreprocessor.RawTraceEntryTypes)type)
+                {
+                    case PinTracePreprocessor.RawTraceEntryTypes.MemoryRead:
+                    case PinTracePreprocessor.RawTraceEntryTypes.MemoryWrite:
+                    case PinTracePreprocessor.RawTraceEntryTypes.StackFrame:
+                        hasParam0 = true;
+                        hasParam1 = true;
+                        hasParam2 = true;
+                        break;
+
+                    case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocSizeParameter:
+                    case PinTracePreprocessor.RawTraceEntryTypes.AccessCount:
+                    case PinTracePreprocessor.RawTraceEntryTypes.BasicBlock:
+                        hasParam1 = true;
+                        break;
+
+                    case PinTracePreprocessor.RawTraceEntryTypes.HeapAllocAddressReturn:
+                    case PinTracePreprocessor.RawTraceEntryTypes.HeapFreeAddressParameter:
+                        hasParam2 = true;
+                        break;
+
+                    case PinTracePreprocessor.RawTraceEntryTypes.Repeat:
+                        hasParam0 = true;
+                        hasParam1 = true;
+                        break;
+
+                    case PinTracePreprocessor.RawTraceEntryTypes.Branch:
+                    case PinTracePreprocessor.RawTraceEntryTypes.StackPointerInfo:
+                    case PinTracePreprocessor.RawTraceEntryTypes.StackPointerModification:
+                    case PinTracePreprocessor.RawTraceEntryTypes.ReferenceCopy:
+                        hasParam1 = true;
+                        hasParam2 = true;
+                        break;
+
+                    default:
+                        throw new TraceFormatException($"Unknown entry type {type} at offset {_traceFileHeaderSize + pos - 1} in compact trace file '{fileName}'.");
+                }
+
+                ulong param0 = hasParam0 ? ReadVarUInt(inputPtr, input.Length, ref pos) : 0;
+                ulong param1 = 0;
+                if(hasParam1)
+                {
+                    param1 = lastParam1[type] + ReadDelta(inputPtr, input.Length, ref pos);
+                    lastParam1[type] = param1;
+                }
+
+                ulong param2 = 0;
+                if(hasParam2)
+                {
+                    param2 = lastParam2[type] + ReadDelta(inputPtr, input.Length, ref pos);
+                    lastParam2[type] = param2;
+                }
+
+                // Write raw entry
+                if(outputLength + rawTraceEntrySize > output.Length)
+                    Array.Resize(ref output, 2 * output.Length);
+                fixed(byte* outputPtr = &output[outputLength])
+                {
+                    *(uint*)outputPtr = (uint)type;
+                    outputPtr[4] = flag;
+                    outputPtr[5] = 0;
+                    *(ushort*)&outputPtr[6] = (ushort)param0;
+                    *(ulong*)&outputPtr[8] = param1;
+                    *(ulong*)&outputPtr[16] = param2;
+                }
+
+                outputLength += rawTraceEntrySize;
+            }
+        }
+
+        return output.AsMemory(0, outputLength);
+    }
+
+    /// <summary>
+    /// Replaces the reference copy entries by the respective entries of the reference trace.
+    /// </summary>
+    /// <param name="input">Raw entries with reference copy entries.</param>
+    /// <param name="fileName">Trace file name, for locating the reference trace.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    private static unsafe ReadOnlyMemory<byte> ExpandDifferences(ReadOnlySpan<byte> input, string fileName)
+    {
+        int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
+        var reference = GetReferenceEntries(fileName).Span;
+        long referenceEntryCount = reference.Length / rawTraceEntrySize;
+
+        fixed(byte* inputPtr = input)
+        fixed(byte* referencePtr = reference)
+        {
+            // Determine output size
+            long outputEntryCount = 0;
+            for(int pos = 0; pos + rawTraceEntrySize <= input.Length; pos += rawTraceEntrySize)
+            {
+                if(*(uint*)&inputPtr[pos] == (uint)PinTracePreprocessor.RawTraceEntryTypes.ReferenceCopy)
+                    outputEntryCount += (long)Math.Min(*(ulong*)&inputPtr[pos + 8], (ulong)referenceEntryCount);
+                else
+                    ++outputEntryCount;
+            }
+
+            if(outputEntryCount * rawTraceEntrySize > Array.MaxLength)
+                throw new TraceFormatException($"Trace file '{fileName}' is too large after expanding differences.");
+            byte[] output = new byte[outputEntryCount * rawTraceEntrySize];
+            int outputLength = 0;
+
+            fixed(byte* outputPtr = output)
+            {
+                // Divergent entries replace the entry at the current reference position
+                long referencePosition = 0;
+                for(int pos = 0; pos + rawTraceEntrySize <= input.Length; pos += rawTraceEntrySize)
+                {
+                    if(*(uint*)&inputPtr[pos] != (uint)PinTracePreprocessor.RawTraceEntryTypes.ReferenceCopy)
+                    {
+                        Buffer.MemoryCopy(&inputPtr[pos], &outputPtr[outputLength], rawTraceEntrySize, rawTraceEntrySize);
+                        outputLength += rawTraceEntrySize;
+                        ++referencePosition;
+                        continue;
+                    }
+
+                    ulong count = *(ulong*)&inputPtr[pos + 8];
+                    referencePosition += *(long*)&inputPtr[pos + 16];
+                    if(referencePosition < 0 || referencePosition > referenceEntryCount || count > (ulong)(referenceEntryCount - referencePosition))
+                        throw new TraceFormatException($"Invalid reference copy entry at offset {pos} in trace file '{fileName}'.");
+
+                    long length = (long)count * rawTraceEntrySize;
+                    Buffer.MemoryCopy(&referencePtr[referencePosition * rawTraceEntrySize], &outputPtr[outputLength], output.Length - outputLength, length);
+                    outputLength += (int)length;
+                    referencePosition += (long)count;
+                }
+            }
+
+            return output.AsMemory(0, outputLength);
+        }
+    }
+
+    /// <summary>
+    /// Returns the raw entries of the reference trace in the directory of the given differential trace file.
+    /// </summary>
+    /// <param name="fileName">Differential trace file.</param>
+    private static ReadOnlyMemory<byte> GetReferenceEntries(string fileName)
+    {
+        string traceDirectory = Path.GetDirectoryName(Path.GetFullPath(fileName)) ?? throw new Exception($"Could not determine directory: {fileName}");
+        string referenceFileName = Path.Combine(traceDirectory, _referenceTraceFileName);
+        lock(_referenceTracesLock)
+        {
+            if(_referenceTraces.TryGetValue(referenceFileName, out var referenceEntries))
+                return referenceEntries;
+
+            // The reference trace file always stores raw entries, which may only use run-length encoding and basic blocks, like the differential trace files
+            if(!File.Exists(referenceFileName))
+                throw new TraceFormatException($"Could not find reference trace file '{referenceFileName}' for differential trace file '{fileName}'.");
+            byte[] referenceFile = File.ReadAllBytes(referenceFileName);
+            if(referenceFile.Length < _traceFileHeaderSize || BinaryPrimitives.ReadUInt32LittleEndian(referenceFile) != _traceFileMagic)
+                throw new TraceFormatException($"Missing header in reference trace file '{referenceFileName}'.");
+            var flags = (TraceFileFlags)BinaryPrimitives.ReadUInt16LittleEndian(referenceFile.AsSpan(6));
+            if((flags & (TraceFileFlags.CompactEncoding | TraceFileFlags.DifferentialEncoding)) != 0)
+                throw new TraceFormatException($"Unsupported encoding of reference trace file '{referenceFileName}'.");
+
+            referenceEntries = referenceFile.AsMemory(_traceFileHeaderSize);
+            _referenceTraces.Add(referenceFileName, referenceEntries);
+            return referenceEntries;
+        }
+    }
+
+    /// <summary>
+    /// Replaces the repeat entries by the repeated entries.
+    /// </summary>
+    /// <param name="input">Raw entries with repeat entries.</param>
+    /// <param name="fileName">Trace file name, for error messages.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    private static unsafe ReadOnlyMemory<byte> ExpandRepetitions(ReadOnlySpan<byte> input, string fileName)
+    {
+        int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
+
+        fixed(byte* inputPtr = input)
+        {
+            // Determine output size
+            long outputEntryCount = 0;
+            for(int pos = 0; pos + rawTraceEntrySize <= input.Length; pos += rawTraceEntrySize)
+            {
+                if(*(uint*)&inputPtr[pos] == (uint)PinTracePreprocessor.RawTraceEntryTypes.Repeat)
+                {
+                    ushort period = *(ushort*)&inputPtr[pos + 6];
+                    ulong repetitions = *(ulong*)&inputPtr[pos + 8];
+                    outputEntryCount += (long)(period * repetitions);
+                }
+                else
+                {
+                    ++outputEntryCount;
+                }
+            }
+
+            if(outputEntryCount * rawTraceEntrySize > Array.MaxLength)
+                throw new TraceFormatException($"Trace file '{fileName}' is too large after expanding repetitions.");
+            byte[] output = new byte[outputEntryCount * rawTraceEntrySize];
+            int outputLength = 0;
+
+            fixed(byte* outputPtr = output)
+            {
+                for(int pos = 0; pos + rawTraceEntrySize <= input.Length; pos += rawTraceEntrySize)
+                {
+                    if(*(uint*)&inputPtr[pos] != (uint)PinTracePreprocessor.RawTraceEntryTypes.Repeat)
+                    {
+                        Buffer.MemoryCopy(&inputPtr[pos], &outputPtr[outputLength], rawTraceEntrySize, rawTraceEntrySize);
+                        outputLength += rawTraceEntrySize;
+                        continue;
+                    }
+
+                    // The two preceding iterations define the stride of each entry
+                    int periodLength = *(ushort*)&inputPtr[pos + 6] * rawTraceEntrySize;
+                    ulong repetitions = *(ulong*)&inputPtr[pos + 8];
+                    if(periodLength == 0 || outputLength < 2 * periodLength)
+                        throw new TraceFormatException($"Invalid repeat entry at offset {pos} in trace file '{fileName}'.");
+
+                    for(ulong r = 0; r < repetitions; ++r)
+                    {
+                        Buffer.MemoryCopy(&outputPtr[outputLength - periodLength], &outputPtr[outputLength], periodLength, periodLength);
+                        for(int entryOffset = outputLength; entryOffset < outputLength + periodLength; entryOffset += rawTraceEntrySize)
+                        {
+                            ulong param2 = *(ulong*)&outputPtr[entryOffset - periodLength + 16];
+                            *(ulong*)&outputPtr[entryOffset + 16] = 2 * param2 - *(ulong*)&outputPtr[entryOffset - 2 * periodLength + 16];
+                        }
+
+                        outputLength += periodLength;
+                    }
+                }
+            }
+
+            return output.AsMemory(0, outputLength);
+        }
+    }
+
+    /// <summary>
+    /// Replaces the basic block entries by the branch entries between consecutive blocks, as they would have been recorded without basic block control flow mode.
+    /// </summary>
+    /// <param name="input">Raw entries with basic block entries.</param>
+    /// <param name="fileName">Trace file name, for locating the basic block table.</param>
+    /// <returns>A buffer containing the raw entries.</returns>
+    private static unsafe ReadOnlyMemory<byte> ExpandBasicBlocks(ReadOnlySpan<byte> input, string fileName)
+    {
+        int rawTraceEntrySize = Marshal.SizeOf(typeof(PinTracePreprocessor.RawTraceEntry));
+        string traceDirectory = Path.GetDirectoryName(Path.GetFullPath(fileName)) ?? throw new Exception($"Could not determine directory: {fileName}");
+
+        // Each basic block entry is replaced by at most one branch entry
+        byte[] output = new byte[input.Length];
+        int outputLength = 0;
+
+        List<BasicBlockTable.BasicBlock>? basicBlocks = null;
+        BasicBlockTable.BasicBlock previousBlock = default;
+        bool hasPreviousBlock = false;
+
+        // The entries which were recorded by the terminating branch of the previous block come after the branch entry
+        int branchOffset = 0;
+
+        fixed(byte* inputPtr = input)
+        fixed(byte* outputPtr = output)
+        {
+            for(int pos = 0; pos + rawTraceEntrySize <= input.Length; pos += rawTraceEntrySize)
+            {
+                var type = (PinTracePreprocessor.RawTraceEntryTypes)(*(uint*)&inputPtr[pos]);
+                byte flag = inputPtr[pos + 4];
+                if(type != PinTracePreprocessor.RawTraceEntryTypes.BasicBlock)
+                {
+                    Buffer.MemoryCopy(&inputPtr[pos], &outputPtr[outputLength], rawTraceEntrySize, rawTraceEntrySize);
+                    outputLength += rawTraceEntrySize;
+
+                    bool recordedByBranch = type is PinTracePreprocessor.RawTraceEntryTypes.HeapAllocSizeParameter or PinTracePreprocessor.RawTraceEntryTypes.HeapAllocAddressReturn
+                                         || (type == PinTracePreprocessor.RawTraceEntryTypes.StackPointerModification
+                                             && (PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags)(flag & (byte)PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.InstructionTypeMask)
+                                             is PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Call or PinTracePreprocessor.RawTraceStackPointerModificationEntryFlags.Return);
+                    if(!recordedByBranch)
+                        branchOffset = outputLength;
+                    continue;
+                }
+
+                // The control flow does not continue from the previous block, e.g. after the first return of a testcase
+                if((flag & _basicBlockDiscontinuityFlag) != 0)
+                {
+                    hasPreviousBlock = false;
+                    continue;
+                }
+
+                uint basicBlockId = (uint)*(ulong*)&inputPtr[pos + 8];
+                if(basicBlocks == null || basicBlockId >= basicBlocks.Count)
+                    basicBlocks = BasicBlockTable.GetBlocks(traceDirectory, basicBlockId);
+                var block = basicBlocks[(int)basicBlockId];
+
+                if(hasPreviousBlock && previousBlock.BranchType != 0)
+                {
+                    // A conditional jump was not taken, if execution continues directly behind it
+                    bool taken = !(previousBlock.Conditional && block.Address == previousBlock.Address + previousBlock.Size);
+                    var branchFlags = previousBlock.BranchType | (taken ? PinTracePreprocessor.RawTraceBranchEntryFlags.Taken : 0);
+
+                    // Insert branch entry
+                    Buffer.MemoryCopy(&outputPtr[branchOffset], &outputPtr[branchOffset + rawTraceEntrySize], output.Length - branchOffset - rawTraceEntrySize, outputLength - branchOffset);
+                    byte* branchEntryPtr = &outputPtr[branchOffset];
+                    *(uint*)branchEntryPtr = (uint)PinTracePreprocessor.RawTraceEntryTypes.Branch;
+                    branchEntryPtr[4] = (byte)branchFlags;
+                    branchEntryPtr[5] = 0;
+                    *(ushort*)&branchEntryPtr[6] = 0;
+                    *(ulong*)&branchEntryPtr[8] = previousBlock.LastInstructionAddress;
+                    *(ulong*)&branchEntryPtr[16] = taken ? block.Address : previousBlock.BranchTarget;
+                    outputLength += rawTraceEntrySize;
+                }
+
+                previousBlock = block;
+                hasPreviousBlock = true;
+                branchOffset = outputLength;
+            }
+        }
+
+        return output.AsMemory(0, outputLength);
+    }
+
+    /// <summary>
+    /// Reads a LEB128 varint.
+    /// </summary>
+    private static unsafe ulong ReadVarUInt(byte* input, int inputLength, ref int pos)
+    {
+        ulong value = 0;
+        int shift = 0;
+        while(true)
+        {
+            if(pos >= inputLength)
+                throw new TraceFormatException("Unexpected end of compact trace file.");
+
+            byte b = input[pos++];
+            value |= (ulong)(b & 0x7F) << shift;
+            if((b & 0x80) == 0)
+                return value;
+
+            shift += 7;
+        }
+    }
+
+    /// <summary>
+    /// Reads a zigzag-encoded difference and returns it as an unsigned value, which can be added to the previous value.
+    /// </summary>
+    private static unsafe ulong ReadDelta(byte* input, int inputLength, ref int pos)
+    {
+        ulong zigzag = ReadVarUInt(input, inputLength, ref pos);
+        return (zigzag >> 1) ^ (ulong)-(long)(zigzag & 1);
+    }
+}
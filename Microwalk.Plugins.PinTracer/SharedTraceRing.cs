@@ -0,0 +1,218 @@
+﻿using System;
+using System.Buffers;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Provides access to the shared memory rings where the Pin tool instances write their testcase traces, if shared memory output is enabled.
+/// The trace generator registers the announced segments under the names of the respective trace files, so the preprocessor can read them through <see cref="RawTraceFileReader"/>.
+/// </summary>
+internal static unsafe class SharedTraceRing
+{
+    /// <summary>
+    /// The magic number at the beginning of the shared memory ring file ("MWRB").
+    /// </summary>
+    private const uint _ringMagic = 0x4252574D;
+
+    /// <summary>
+    /// The supported version of the shared memory ring layout.
+    /// </summary>
+    private const uint _ringVersion = 1;
+
+    /// <summary>
+    /// The size of the ring header. The data area follows directly after the header.
+    /// </summary>
+    private const int _ringHeaderSize = 64;
+
+    /// <summary>
+    /// The offset of the read offset field in the ring header.
+    /// </summary>
+    private const int _readOffsetFieldOffset = 24;
+
+    /// <summary>
+    /// Protects the ring state.
+    /// </summary>
+    private static readonly object _lock = new();
+
+    /// <summary>
+    /// The opened rings, indexed by ring file name.
+    /// </summary>
+    private static readonly Dictionary<string, Ring> _rings = new();
+
+    /// <summary>
+    /// The segments which were announced by the Pin tool and have not yet been released, indexed by trace file name.
+    /// </summary>
+    private static readonly Dictionary<string, (Ring ring, ulong offset, ulong length)> _segments = new();
+
+    /// <summary>
+    /// Maps the given shared memory ring file, if this has not happened yet.
+    /// </summary>
+    /// <param name="fileName">Shared memory ring file, as created by the Pin tool.</param>
+    public static void Open(string fileName)
+    {
+        lock(_lock)
+        {
+            if(_rings.ContainsKey(fileName))
+                return;
+
+            var ring = new Ring
+            {
+                File = MemoryMappedFile.CreateFromFile(fileName, FileMode.Open, null, 0, MemoryMappedFileAccess.ReadWrite)
+            };
+            ring.View = ring.File.CreateViewAccessor(0, 0, MemoryMappedFileAccess.ReadWrite);
+            ring.View.SafeMemoryMappedViewHandle.AcquirePointer(ref ring.Header);
+            ring.Header += ring.View.PointerOffset;
+
+            // Check header
+            if(*(uint*)ring.Header != _ringMagic)
+                throw new TraceFormatException($"Invalid shared memory ring file '{fileName}'.");
+            uint version = *(uint*)(ring.Header + 4);
+            if(version != _ringVersion)
+                throw new TraceFormatException($"Unsupported shared memory ring version {version} in file '{fileName}'.");
+            ring.Capacity = *(ulong*)(ring.Header + 8);
+            ring.ReadOffset = Volatile.Read(ref *(ulong*)(ring.Header + _readOffsetFieldOffset));
+
+            _rings.Add(fileName, ring);
+        }
+    }
+
+    /// <summary>
+    /// Registers a segment which was announced by the Pin tool.
+    /// </summary>
+    /// <param name="ringFileName">Shared memory ring file containing the segment.</param>
+    /// <param name="traceFileName">Name of the trace file represented by the segment.</param>
+    /// <param name="offset">Segment offset.</param>
+    /// <param name="length">Segment length.</param>
+    public static void RegisterSegment(string ringFileName, string traceFileName, ulong offset, ulong length)
+    {
+        lock(_lock)
+        {
+            if(!_rings.TryGetValue(ringFileName, out var ring))
+                throw new InvalidOperationException($"The shared memory ring '{ringFileName}' is not opened.");
+
+            _segments[traceFileName] = (ring, offset, length);
+        }
+    }
+
+    /// <summary>
+    /// Returns the contents of the segment with the given trace file name.
+    /// If the segment is stored contiguously, the returned memory directly references the shared memory and is valid until the segment is released.
+    /// </summary>
+    /// <param name="traceFileName">Name of the trace file represented by the segment.</param>
+    /// <param name="data">Segment contents.</param>
+    /// <returns>Whether a segment with the given name exists.</returns>
+    public static bool TryGetSegment(string traceFileName, out ReadOnlyMemory<byte> data)
+    {
+        lock(_lock)
+        {
+            if(!_segments.TryGetValue(traceFileName, out var segment))
+            {
+                data = ReadOnlyMemory<byte>.Empty;
+                return false;
+            }
+
+            byte* ringData = segment.ring.Header + _ringHeaderSize;
+            int length = checked((int)segment.length);
+            int position = (int)(segment.offset % segment.ring.Capacity);
+            int firstPartLength = (int)Math.Min(segment.length, segment.ring.Capacity - (ulong)position);
+            if(firstPartLength == length)
+            {
+                data = new UnmanagedMemoryManager(ringData + position, length).Memory;
+                return true;
+            }
+
+            // The segment wraps around the end of the ring, so we have to copy it
+            byte[] buffer = new byte[length];
+            new ReadOnlySpan<byte>(ringData + position, firstPartLength).CopyTo(buffer);
+            new ReadOnlySpan<byte>(ringData, length - firstPartLength).CopyTo(buffer.AsSpan(firstPartLength));
+            data = buffer;
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Releases the segment with the given trace file name, so the Pin tool can reuse its space.
+    /// Memory obtained by <see cref="TryGetSegment"/> must not be used afterwards.
+    /// </summary>
+    /// <param name="traceFileName">Name of the trace file represented by the segment.</param>
+    /// <returns>Whether a segment with the given name existed.</returns>
+    public static bool ReleaseSegment(string traceFileName)
+    {
+        lock(_lock)
+        {
+            if(!_segments.Remove(traceFileName, out var segment))
+                return false;
+
+            // Empty segments do not occupy space
+            if(segment.length == 0)
+                return true;
+
+            // Segments may be released out of order, but the Pin tool only sees a single read offset
+            var ring = segment.ring;
+            ring.ReleasedSegments.Add(segment.offset, segment.offset + segment.length);
+            while(ring.ReleasedSegments.Remove(ring.ReadOffset, out ulong endOffset))
+                ring.ReadOffset = endOffset;
+            Volatile.Write(ref *(ulong*)(ring.Header + _readOffsetFieldOffset), ring.ReadOffset);
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// State of a single mapped ring.
+    /// </summary>
+    private sealed class Ring
+    {
+        /// <summary>
+        /// The memory-mapped ring file.
+        /// </summary>
+        public MemoryMappedFile File = null!;
+
+        /// <summary>
+        /// The view on the ring file.
+        /// </summary>
+        public MemoryMappedViewAccessor View = null!;
+
+        /// <summary>
+        /// Pointer to the ring header.
+        /// </summary>
+        public byte* Header;
+
+        /// <summary>
+        /// The size of the data area.
+        /// </summary>
+        public ulong Capacity;
+
+        /// <summary>
+        /// The offset after the last byte which was handed back to the Pin tool.
+        /// </summary>
+        public ulong ReadOffset;
+
+        /// <summary>
+        /// Released segments which could not yet be handed back to the Pin tool, since an earlier segment is still in use. Maps segment offsets to end offsets.
+        /// </summary>
+        public readonly SortedDictionary<ulong, ulong> ReleasedSegments = new();
+    }
+
+    /// <summary>
+    /// Exposes unmanaged memory as <see cref="Memory{T}"/>.
+    /// </summary>
+    private sealed class UnmanagedMemoryManager(byte* pointer, int length) : MemoryManager<byte>
+    {
+        public override Span<byte> GetSpan() => new(pointer, length);
+
+        public override MemoryHandle Pin(int elementIndex = 0) => new(pointer + elementIndex);
+
+        public override void Unpin()
+        {
+        }
+
+        protected override void Dispose(bool disposing)
+        {
+        }
+    }
+}
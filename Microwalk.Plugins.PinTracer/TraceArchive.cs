@@ -0,0 +1,165 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Provides access to the trace archives where the Pin tool instances append their testcase traces, if archive output is enabled.
+/// The trace generator registers the announced records under the names of the respective trace files, so the preprocessor can read them through <see cref="RawTraceFileReader"/>.
+/// </summary>
+internal static class TraceArchive
+{
+    /// <summary>
+    /// Protects the archive state.
+    /// </summary>
+    private static readonly object _lock = new();
+
+    /// <summary>
+    /// The archive files which contain registered records, indexed by archive file name.
+    /// </summary>
+    private static readonly Dictionary<string, Archive> _archives = new();
+
+    /// <summary>
+    /// The records which were announced by the Pin tool and have not yet been released, indexed by trace file name.
+    /// </summary>
+    private static readonly Dictionary<string, (Archive archive, ulong offset, ulong length)> _records = new();
+
+    /// <summary>
+    /// Registers a record which was announced by the Pin tool.
+    /// </summary>
+    /// <param name="archiveFileName">Archive file containing the record.</param>
+    /// <param name="traceFileName">Name of the trace file represented by the record.</param>
+    /// <param name="offset">Offset of the record's trace data.</param>
+    /// <param name="length">Length of the record's trace data.</param>
+    public static void RegisterRecord(string archiveFileName, string traceFileName, ulong offset, ulong length)
+    {
+        lock(_lock)
+        {
+            if(!_archives.TryGetValue(archiveFileName, out var archive))
+            {
+                archive = new Archive { FileName = archiveFileName };
+                _archives.Add(archiveFileName, archive);
+            }
+
+            ++archive.PendingRecordCount;
+            _records[traceFileName] = (archive, offset, length);
+        }
+    }
+
+    /// <summary>
+    /// Marks the given archive file as complete, i.e., the Pin tool has moved on to the next archive segment.
+    /// The file is deleted as soon as all its records have been released, unless one of them was kept.
+    /// </summary>
+    /// <param name="archiveFileName">Archive file.</param>
+    public static void CompleteArchive(string archiveFileName)
+    {
+        lock(_lock)
+        {
+            if(!_archives.TryGetValue(archiveFileName, out var archive))
+                return;
+
+            archive.Complete = true;
+            DeleteIfUnused(archive);
+        }
+    }
+
+    /// <summary>
+    /// Returns the contents of the record with the given trace file name.
+    /// </summary>
+    /// <param name="traceFileName">Name of the trace file represented by the record.</param>
+    /// <param name="data">Record contents.</param>
+    /// <returns>Whether a record with the given name exists.</returns>
+    public static bool TryGetRecord(string traceFileName, out ReadOnlyMemory<byte> data)
+    {
+        (Archive archive, ulong offset, ulong length) record;
+        lock(_lock)
+        {
+            if(!_records.TryGetValue(traceFileName, out record))
+            {
+                data = ReadOnlyMemory<byte>.Empty;
+                return false;
+            }
+        }
+
+        // The record is complete and is not modified anymore, so it can be read without holding the lock
+        byte[] buffer = new byte[checked((int)record.length)];
+        using var archiveFileHandle = File.OpenHandle(record.archive.FileName, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete);
+        int position = 0;
+        while(position < buffer.Length)
+        {
+            int bytesRead = RandomAccess.Read(archiveFileHandle, buffer.AsSpan(position), (long)record.offset + position);
+            if(bytesRead == 0)
+                throw new TraceFormatException($"Unexpected end of trace archive '{record.archive.FileName}' while reading trace '{traceFileName}'.");
+            position += bytesRead;
+        }
+
+        data = buffer;
+        return true;
+    }
+
+    /// <summary>
+    /// Releases the record with the given trace file name.
+    /// </summary>
+    /// <param name="traceFileName">Name of the trace file represented by the record.</param>
+    /// <param name="keep">Keep the trace data: The record stays readable, and its archive file is not deleted.</param>
+    /// <returns>Whether a record with the given name existed.</returns>
+    public static bool ReleaseRecord(string traceFileName, bool keep)
+    {
+        lock(_lock)
+        {
+            if(!_records.TryGetValue(traceFileName, out var record))
+                return false;
+
+            if(keep)
+            {
+                record.archive.Kept = true;
+                return true;
+            }
+
+            _records.Remove(traceFileName);
+            --record.archive.PendingRecordCount;
+            DeleteIfUnused(record.archive);
+            return true;
+        }
+    }
+
+    /// <summary>
+    /// Deletes the given archive file, if it is complete and all its records have been released without keeping them.
+    /// </summary>
+    private static void DeleteIfUnused(Archive archive)
+    {
+        if(!archive.Complete || archive.Kept || archive.PendingRecordCount > 0)
+            return;
+
+        _archives.Remove(archive.FileName);
+        File.Delete(archive.FileName);
+    }
+
+    /// <summary>
+    /// State of a single archive file.
+    /// </summary>
+    private sealed class Archive
+    {
+        /// <summary>
+        /// The path of the archive file.
+        /// </summary>
+        public string FileName = null!;
+
+        /// <summary>
+        /// The number of registered records which have not yet been released.
+        /// </summary>
+        public int PendingRecordCount;
+
+        /// <summary>
+        /// Determines whether the Pin tool has stopped writing to this archive file.
+        /// </summary>
+        public bool Complete;
+
+        /// <summary>
+        /// Determines whether a record of this archive file was kept, so the file must not be deleted.
+        /// </summary>
+        public bool Kept;
+    }
+}
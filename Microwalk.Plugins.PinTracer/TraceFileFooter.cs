@@ -0,0 +1,167 @@
+﻿using System;
+using System.Buffers.Binary;
+using Microwalk.FrameworkBase.Exceptions;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// The index footer of a trace file, which is written by the Pin tool in trace index mode.
+/// It summarizes the stored entries and describes the state at the beginning of each chunk, so chunks can be processed independently.
+/// </summary>
+internal class TraceFileFooter
+{
+    /// <summary>
+    /// The magic number at the end of the footer ("MWTF").
+    /// </summary>
+    private const uint _footerMagic = 0x4654574D;
+
+    /// <summary>
+    /// The number of entry types which are counted in the footer.
+    /// </summary>
+    private const int _entryTypeCount = 16;
+
+    /// <summary>
+    /// The size of the fixed part of the footer, which is stored at the very end of the trace data.
+    /// </summary>
+    private const int _fixedFooterSize = 8 * _entryTypeCount + 8 + 8 + 8 + 4 + 4;
+
+    /// <summary>
+    /// The size of a chunk index entry.
+    /// </summary>
+    private const int _chunkInfoSize = 8 + 8 + 4 + 4 + 8;
+
+    /// <summary>
+    /// The initial value of the 64-bit FNV-1a hash which is used as checksum.
+    /// </summary>
+    private const ulong _checksumBasis = 0xcbf29ce484222325UL;
+
+    /// <summary>
+    /// The prime of the 64-bit FNV-1a hash which is used as checksum.
+    /// </summary>
+    private const ulong _checksumPrime = 0x100000001b3UL;
+
+    /// <summary>
+    /// The number of stored entries, indexed by their type.
+    /// </summary>
+    public ulong[] EntryCounts { get; init; } = new ulong[_entryTypeCount];
+
+    /// <summary>
+    /// The number of entries per chunk.
+    /// </summary>
+    public ulong ChunkInterval { get; init; }
+
+    /// <summary>
+    /// The state at the beginning of each chunk.
+    /// </summary>
+    public ChunkInfo[] Chunks { get; init; } = Array.Empty<ChunkInfo>();
+
+    /// <summary>
+    /// The checksum of the records.
+    /// </summary>
+    public ulong Checksum { get; init; }
+
+    /// <summary>
+    /// The size of the chunk index and the footer in the trace data.
+    /// </summary>
+    public int Size { get; init; }
+
+    /// <summary>
+    /// Reads the footer at the end of the given trace data and verifies the checksum of the preceding records.
+    /// </summary>
+    /// <param name="data">Trace data following the file header, i.e., the records, the chunk index and the footer.</param>
+    /// <param name="fileName">Trace file name, for error messages.</param>
+    public static TraceFileFooter Parse(ReadOnlySpan<byte> data, string fileName)
+    {
+        if(data.Length < _fixedFooterSize || BinaryPrimitives.ReadUInt32LittleEndian(data[^4..]) != _footerMagic)
+            throw new TraceFormatException($"Missing index footer in trace file '{fileName}'.");
+
+        // Check size of chunk index
+        var fixedFooter = data[^_fixedFooterSize..];
+        ulong chunkInterval = BinaryPrimitives.ReadUInt64LittleEndian(fixedFooter[(8 * _entryTypeCount)..]);
+        ulong chunkCount = BinaryPrimitives.ReadUInt64LittleEndian(fixedFooter[(8 * _entryTypeCount + 8)..]);
+        ulong checksum = BinaryPrimitives.ReadUInt64LittleEndian(fixedFooter[(8 * _entryTypeCount + 16)..]);
+        uint size = BinaryPrimitives.ReadUInt32LittleEndian(fixedFooter[(8 * _entryTypeCount + 24)..]);
+        if(size > data.Length || chunkCount > (ulong)(data.Length / _chunkInfoSize) || size != (ulong)_fixedFooterSize + chunkCount * _chunkInfoSize)
+            throw new TraceFormatException($"Invalid index footer size in trace file '{fileName}'.");
+
+        var footer = new TraceFileFooter
+        {
+            ChunkInterval = chunkInterval,
+            Chunks = new ChunkInfo[chunkCount],
+            Checksum = checksum,
+            Size = (int)size
+        };
+        for(int i = 0; i < _entryTypeCount; ++i)
+            footer.EntryCounts[i] = BinaryPrimitives.ReadUInt64LittleEndian(fixedFooter[(8 * i)..]);
+
+        // Read chunk index
+        int recordsLength = data.Length - (int)size;
+        var chunkIndex = data[recordsLength..];
+        for(int i = 0; i < footer.Chunks.Length; ++i)
+        {
+            var chunkInfo = chunkIndex[(i * _chunkInfoSize)..];
+            footer.Chunks[i] = new ChunkInfo
+            {
+                EntryIndex = BinaryPrimitives.ReadUInt64LittleEndian(chunkInfo),
+                Offset = BinaryPrimitives.ReadUInt64LittleEndian(chunkInfo[8..]),
+                CallDepth = BinaryPrimitives.ReadInt32LittleEndian(chunkInfo[16..]),
+                PendingAllocationCount = BinaryPrimitives.ReadUInt32LittleEndian(chunkInfo[20..]),
+                HeapAllocationCount = BinaryPrimitives.ReadUInt64LittleEndian(chunkInfo[24..])
+            };
+
+            if(footer.Chunks[i].Offset > (ulong)recordsLength || (i > 0 && footer.Chunks[i].Offset < footer.Chunks[i - 1].Offset))
+                throw new TraceFormatException($"Invalid chunk offset {footer.Chunks[i].Offset} in index footer of trace file '{fileName}'.");
+        }
+
+        // Verify records
+        ulong actualChecksum = ComputeChecksum(data[..recordsLength]);
+        if(actualChecksum != checksum)
+            throw new TraceFormatException($"Checksum mismatch in trace file '{fileName}': Expected {checksum:x16}, got {actualChecksum:x16}.");
+
+        return footer;
+    }
+
+    /// <summary>
+    /// Computes the checksum of the given records.
+    /// </summary>
+    /// <param name="records">Records of a trace file.</param>
+    private static ulong ComputeChecksum(ReadOnlySpan<byte> records)
+    {
+        ulong checksum = _checksumBasis;
+        foreach(byte b in records)
+            checksum = (checksum ^ b) * _checksumPrime;
+        return checksum;
+    }
+
+    /// <summary>
+    /// The state at the beginning of a chunk, derived from the preceding entries of the trace.
+    /// </summary>
+    public readonly struct ChunkInfo
+    {
+        /// <summary>
+        /// The index of the first entry of the chunk.
+        /// </summary>
+        public ulong EntryIndex { get; init; }
+
+        /// <summary>
+        /// The offset of the first record of the chunk, relative to the end of the file header.
+        /// In compact encoding, the delta state is reset at this offset.
+        /// </summary>
+        public ulong Offset { get; init; }
+
+        /// <summary>
+        /// The number of calls minus the number of returns before the chunk.
+        /// </summary>
+        public int CallDepth { get; init; }
+
+        /// <summary>
+        /// The number of heap allocation size entries before the chunk, which have not been followed by an address return yet.
+        /// </summary>
+        public uint PendingAllocationCount { get; init; }
+
+        /// <summary>
+        /// The number of heap allocation address returns before the chunk.
+        /// </summary>
+        public ulong HeapAllocationCount { get; init; }
+    }
+}
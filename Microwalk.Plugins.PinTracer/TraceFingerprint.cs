@@ -0,0 +1,47 @@
+﻿using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+
+namespace Microwalk.Plugins.PinTracer;
+
+/// <summary>
+/// Fingerprints of a testcase trace, as reported by the Pin tool in fingerprint mode.
+/// </summary>
+internal class TraceFingerprint
+{
+    /// <summary>
+    /// Fingerprint of the entire trace.
+    /// </summary>
+    public ulong TraceHash { get; init; }
+
+    /// <summary>
+    /// Fingerprints of the memory accesses and branches of each instruction, indexed by instruction address.
+    /// </summary>
+    public Dictionary<ulong, ulong> InstructionHashes { get; init; } = new();
+
+    /// <summary>
+    /// Parses a fingerprint line of the Pin tool: "f\t&lt;name&gt;\t&lt;trace fingerprint&gt;\t&lt;instruction&gt;=&lt;fingerprint&gt;,...".
+    /// </summary>
+    /// <param name="outputParts">The tab-separated parts of the line.</param>
+    public static TraceFingerprint Parse(string[] outputParts)
+    {
+        if(outputParts.Length < 4)
+            throw new IOException("Invalid trace fingerprint line.");
+
+        var fingerprint = new TraceFingerprint
+        {
+            TraceHash = ulong.Parse(outputParts[2], NumberStyles.HexNumber)
+        };
+
+        if(outputParts[3].Length > 0)
+        {
+            foreach(string instructionHash in outputParts[3].Split(','))
+            {
+                int separatorIndex = instructionHash.IndexOf('=');
+                fingerprint.InstructionHashes[ulong.Parse(instructionHash[..separatorIndex], NumberStyles.HexNumber)] = ulong.Parse(instructionHash[(separatorIndex + 1)..], NumberStyles.HexNumber);
+            }
+        }
+
+        return fingerprint;
+    }
+}
@@ -0,0 +1,89 @@
+/* INCLUDES */
+#include "AccessHistogram.h"
+#include <algorithm>
+
+
+/* TYPES */
+
+void AccessHistogram::Reset()
+{
+    if(_buckets.empty())
+        _buckets.resize(ACCESS_HISTOGRAM_INITIAL_CAPACITY);
+    else if(_usedBucketCount > 0)
+        std::fill(_buckets.begin(), _buckets.end(), AccessHistogramBucket{});
+    _usedBucketCount = 0;
+}
+
+void AccessHistogram::Add(UINT64 instructionAddress, UINT64 memoryAddress, UINT32 typeAndSize)
+{
+    // Keep the load factor below 50%, so probe sequences stay short
+    if(2 * (_usedBucketCount + 1) > _buckets.size())
+        Grow();
+
+    size_t mask = _buckets.size() - 1;
+    size_t index = GetBucketIndex(instructionAddress, memoryAddress, typeAndSize, mask);
+    while(true)
+    {
+        AccessHistogramBucket& bucket = _buckets[index];
+        if(bucket.Count == 0)
+        {
+            bucket.InstructionAddress = instructionAddress;
+            bucket.MemoryAddress = memoryAddress;
+            bucket.TypeAndSize = typeAndSize;
+            bucket.Count = 1;
+            ++_usedBucketCount;
+            return;
+        }
+
+        if(bucket.InstructionAddress == instructionAddress && bucket.MemoryAddress == memoryAddress && bucket.TypeAndSize == typeAndSize)
+        {
+            // Saturate instead of overflowing into the empty marker
+            if(bucket.Count != 0xFFFFFFFF)
+                ++bucket.Count;
+            return;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+void AccessHistogram::Grow()
+{
+    std::vector<AccessHistogramBucket> oldBuckets;
+    oldBuckets.swap(_buckets);
+    _buckets.resize(oldBuckets.empty() ? ACCESS_HISTOGRAM_INITIAL_CAPACITY : 2 * oldBuckets.size());
+
+    // Re-insert used buckets
+    size_t mask = _buckets.size() - 1;
+    for(const AccessHistogramBucket& oldBucket : oldBuckets)
+    {
+        if(oldBucket.Count == 0)
+            continue;
+
+        size_t index = GetBucketIndex(oldBucket.InstructionAddress, oldBucket.MemoryAddress, oldBucket.TypeAndSize, mask);
+        while(_buckets[index].Count != 0)
+            index = (index + 1) & mask;
+        _buckets[index] = oldBucket;
+    }
+}
+
+std::vector<AccessHistogramBucket> AccessHistogram::GetSortedBuckets() const
+{
+    std::vector<AccessHistogramBucket> usedBuckets;
+    usedBuckets.reserve(_usedBucketCount);
+    for(const AccessHistogramBucket& bucket : _buckets)
+    {
+        if(bucket.Count != 0)
+            usedBuckets.push_back(bucket);
+    }
+
+    std::sort(usedBuckets.begin(), usedBuckets.end(), [](const AccessHistogramBucket& a, const AccessHistogramBucket& b)
+    {
+        if(a.InstructionAddress != b.InstructionAddress)
+            return a.InstructionAddress < b.InstructionAddress;
+        if(a.MemoryAddress != b.MemoryAddress)
+            return a.MemoryAddress < b.MemoryAddress;
+        return a.TypeAndSize < b.TypeAndSize;
+    });
+    return usedBuckets;
+}
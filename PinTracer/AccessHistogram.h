@@ -0,0 +1,65 @@
+#pragma once
+/*
+Contains a hash table which counts distinct memory accesses, for aggregating testcase traces instead of storing every single access.
+*/
+
+// The initial number of buckets of an access histogram. Must be a power of two.
+#define ACCESS_HISTOGRAM_INITIAL_CAPACITY 4096
+
+
+/* INCLUDES */
+#include "pin.H"
+#include <vector>
+
+
+/* TYPES */
+
+// One bucket of an access histogram, representing a distinct memory access.
+struct AccessHistogramBucket
+{
+    // The address of the accessing instruction.
+    UINT64 InstructionAddress;
+
+    // The accessed memory address.
+    UINT64 MemoryAddress;
+
+    // The access type (lower 16 bits) and the access size (upper 16 bits).
+    UINT32 TypeAndSize;
+
+    // The number of accesses. 0 marks an empty bucket.
+    UINT32 Count;
+};
+static_assert(sizeof(AccessHistogramBucket) == 8 + 8 + 4 + 4, "Wrong size of AccessHistogramBucket struct");
+
+// Counts the accesses of each instruction to each memory address.
+// The buckets are stored in a single flat array with linear probing, so a lookup usually touches a single cache line.
+class AccessHistogram
+{
+private:
+    // The buckets. The size is always a power of two.
+    std::vector<AccessHistogramBucket> _buckets;
+
+    // The number of used buckets.
+    size_t _usedBucketCount = 0;
+
+private:
+    // Returns the preferred bucket index for the given access.
+    static size_t GetBucketIndex(UINT64 instructionAddress, UINT64 memoryAddress, UINT32 typeAndSize, size_t mask)
+    {
+        UINT64 hash = (instructionAddress * 0x9e3779b97f4a7c15ull) ^ (memoryAddress * 0xc2b2ae3d27d4eb4full) ^ typeAndSize;
+        return static_cast<size_t>(hash ^ (hash >> 32)) & mask;
+    }
+
+    // Doubles the number of buckets.
+    void Grow();
+
+public:
+    // Removes all accesses. The memory is kept for the next testcase.
+    void Reset();
+
+    // Counts the given access.
+    void Add(UINT64 instructionAddress, UINT64 memoryAddress, UINT32 typeAndSize);
+
+    // Returns the used buckets, ordered by instruction address, memory address, type and size.
+    std::vector<AccessHistogramBucket> GetSortedBuckets() const;
+};
@@ -12,6 +12,15 @@ bool _emulateCpuModel = true;
 // The emulated CPU.
 static cpuid_model_t* _emulatedCpuModelInfo = nullptr;
 
+// The number of precomputed basic (0x0000000x) and extended (0x8000000x) leaves.
+#define CPUID_BASIC_LEAF_COUNT 8
+#define CPUID_EXTENDED_LEAF_COUNT 2
+
+// The precomputed outputs of the basic and extended CPUID leaves of the emulated CPU, indexed by the lower bits of the leaf number.
+// Leaves with an empty override mask are not changed.
+static CpuIdLeafOverride _basicLeaves[CPUID_BASIC_LEAF_COUNT] = {};
+static CpuIdLeafOverride _extendedLeaves[CPUID_EXTENDED_LEAF_COUNT] = {};
+
 
 /* FUNCTIONS */
 
@@ -34,57 +43,55 @@ void SetEmulatedCpu(int id)
             break;
         default:
             _emulateCpuModel = false;
-            break;
+            return;
     }
+
+    // Precompute leaf outputs, so the analysis routine only needs a table lookup
+    // We are on Intel
+    _basicLeaves[0] = { 0b1111, false, _emulatedCpuModelInfo->max_input, 0x756e6547 /* Genu */, 0x6c65746e /* ntel */, 0x49656e69 /* ineI */ };
+    _basicLeaves[1] = { 0b1101, false, _emulatedCpuModelInfo->encoded_family, 0, _emulatedCpuModelInfo->features_ecx, _emulatedCpuModelInfo->features_edx };
+    _basicLeaves[7] = { 0b0010, true, 0, _emulatedCpuModelInfo->max_input >= 7 ? _emulatedCpuModelInfo->features_sext_ebx : 0, 0, 0 };
+    _extendedLeaves[0] = { 0b0001, false, _emulatedCpuModelInfo->max_ext_input, 0, 0, 0 };
+    if(_emulatedCpuModelInfo->max_ext_input >= 0x80000001)
+        _extendedLeaves[1] = { 0b1100, false, 0, 0, _emulatedCpuModelInfo->features_ext_ecx, _emulatedCpuModelInfo->features_ext_edx };
+    else
+        _extendedLeaves[1] = { 0b1100, false, 0, 0, 0, 0 };
+}
+
+bool IsCpuEmulated()
+{
+    return _emulateCpuModel;
+}
+
+ADDRINT PackCpuIdInput(ADDRINT inputEax, ADDRINT inputEcx)
+{
+    return (static_cast<UINT64>(static_cast<UINT32>(inputEcx)) << 32) | static_cast<UINT32>(inputEax);
 }
 
-void ChangeCpuId(UINT32 inputEax, UINT32 inputEcx, UINT32* outputEax, UINT32* outputEbx, UINT32* outputEcx, UINT32* outputEdx)
+void ChangeCpuId(ADDRINT packedInput, UINT32* outputEax, UINT32* outputEbx, UINT32* outputEcx, UINT32* outputEdx)
 {
-    // Do emulation?
-    if(!_emulateCpuModel)
+    UINT32 inputEax = static_cast<UINT32>(packedInput);
+    UINT32 inputEcx = static_cast<UINT32>(static_cast<UINT64>(packedInput) >> 32);
+
+    // Look up leaf
+    const CpuIdLeafOverride* leaf;
+    if(inputEax < CPUID_BASIC_LEAF_COUNT)
+        leaf = &_basicLeaves[inputEax];
+    else if(inputEax - 0x80000000u < CPUID_EXTENDED_LEAF_COUNT)
+        leaf = &_extendedLeaves[inputEax - 0x80000000u];
+    else
+        return;
+    if(leaf->SubleafZeroOnly && inputEcx != 0)
         return;
-    
+
     // Modify output depending on requested fields
-    if(inputEax == 0)
-    {
-        // We are on Intel
-        *outputEax = _emulatedCpuModelInfo->max_input;
-        *outputEbx = 0x756e6547; // Genu
-        *outputEdx = 0x49656e69; // ineI
-        *outputEcx = 0x6c65746e; // ntel
-    }
-    else if(inputEax == 1)
-    {
-        *outputEax = _emulatedCpuModelInfo->encoded_family;
-        *outputEdx = _emulatedCpuModelInfo->features_edx;
-        *outputEcx = _emulatedCpuModelInfo->features_ecx;
-    }
-    else if(inputEax == 0x80000000)
-    {
-        *outputEax = _emulatedCpuModelInfo->max_ext_input;
-    }
-    else if(inputEax == 0x80000001)
-    {
-        if(_emulatedCpuModelInfo->max_ext_input >= 0x80000001)
-        {
-            *outputEdx = _emulatedCpuModelInfo->features_ext_edx;
-            *outputEcx = _emulatedCpuModelInfo->features_ext_ecx;
-        }
-        else
-        {
-            *outputEdx = 0;
-            *outputEcx = 0;
-        }
-    }
-    else if(inputEax == 7 && inputEcx == 0)
-    {
-        if(_emulatedCpuModelInfo->max_input >= 7)
-        {
-            *outputEbx = _emulatedCpuModelInfo->features_sext_ebx;
-        }
-        else
-        {
-            *outputEbx = 0;
-        }
-    }
+    UINT32 mask = leaf->OverrideMask;
+    if(mask & 1)
+        *outputEax = leaf->Eax;
+    if(mask & 2)
+        *outputEbx = leaf->Ebx;
+    if(mask & 4)
+        *outputEcx = leaf->Ecx;
+    if(mask & 8)
+        *outputEdx = leaf->Edx;
 }
\ No newline at end of file
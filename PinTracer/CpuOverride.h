@@ -7,10 +7,36 @@ Contains functions to override the CPUID command.
 
 #include <pin.H>
 
+/* TYPES */
+
+// The emulated output of a CPUID leaf.
+struct CpuIdLeafOverride
+{
+    // Bit mask of the output registers which are overwritten (1 = EAX, 2 = EBX, 4 = ECX, 8 = EDX).
+    UINT32 OverrideMask;
+
+    // Determines whether the output is only overwritten for sub-leaf 0 (ECX input).
+    bool SubleafZeroOnly;
+
+    // The emulated output values.
+    UINT32 Eax;
+    UINT32 Ebx;
+    UINT32 Ecx;
+    UINT32 Edx;
+};
+
 /* FUNCTIONS */
 
-// Sets the emulated CPU.
+// Sets the emulated CPU, and precomputes the overridden CPUID leaves.
 void SetEmulatedCpu(int id);
 
+// Returns whether a CPU model is emulated, i.e., CPUID instructions need to be instrumented.
+bool IsCpuEmulated();
+
+// Combines the EAX and ECX inputs of a CPUID instruction into a single value, which can be kept in a tool register until the instruction has executed.
+// This is simple enough to be inlined by Pin.
+ADDRINT PackCpuIdInput(ADDRINT inputEax, ADDRINT inputEcx);
+
 // Changes the output of the CPUID instruction.
-void ChangeCpuId(UINT32 inputEax, UINT32 inputEcx, UINT32* outputEax, UINT32* outputEbx, UINT32* outputEcx, UINT32* outputEdx);
\ No newline at end of file
+// -> packedInput: The EAX and ECX inputs, as returned by PackCpuIdInput().
+void ChangeCpuId(ADDRINT packedInput, UINT32* outputEax, UINT32* outputEbx, UINT32* outputEcx, UINT32* outputEdx);
\ No newline at end of file
@@ -0,0 +1,193 @@
+/* INCLUDES */
+#include "Lz4FrameEncoder.h"
+#include <cstring>
+
+
+/* CONSTANTS */
+
+// Magic number of LZ4 frames.
+static constexpr UINT32 Lz4FrameMagic = 0x184D2204;
+
+// Frame descriptor flags: Version 01, independent blocks, no checksums, no content size, no dictionary.
+static constexpr UINT8 Lz4FrameFlags = 0x60;
+
+// Frame descriptor block maximum size: ID 6 (1 MB).
+static constexpr UINT8 Lz4FrameBlockDescriptor = 0x60;
+
+// The minimum length of a match.
+static constexpr size_t MinMatchLength = 4;
+
+// The last bytes of a block are always literals.
+static constexpr size_t LastLiteralCount = 5;
+
+// The last match must start at least this number of bytes before the end of the block.
+static constexpr size_t MatchFindLimit = 12;
+
+// The maximum distance of a match.
+static constexpr size_t MaxMatchOffset = 65535;
+
+
+/* FUNCTIONS */
+
+static UINT32 Read32(const UINT8* data)
+{
+    UINT32 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void Write32(UINT8* output, UINT32 value)
+{
+    output[0] = static_cast<UINT8>(value);
+    output[1] = static_cast<UINT8>(value >> 8);
+    output[2] = static_cast<UINT8>(value >> 16);
+    output[3] = static_cast<UINT8>(value >> 24);
+}
+
+// Writes the remainder of a literal or match length, which did not fit into the token, and returns the address after the last written byte.
+static UINT8* WriteLengthExtension(UINT8* output, size_t length)
+{
+    while(length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = static_cast<UINT8>(length);
+    return output;
+}
+
+
+/* TYPES */
+
+size_t Lz4FrameEncoder::WriteFrameHeader(UINT8* output)
+{
+    Write32(output, Lz4FrameMagic);
+    output[4] = Lz4FrameFlags;
+    output[5] = Lz4FrameBlockDescriptor;
+    output[6] = static_cast<UINT8>(ComputeShortXxHash32(&output[4], 2) >> 8);
+    return LZ4_FRAME_HEADER_SIZE;
+}
+
+size_t Lz4FrameEncoder::EncodeBlock(const UINT8* input, size_t length, UINT8* output)
+{
+    // Store the block uncompressed, if compression does not save anything
+    size_t compressedLength = CompressBlock(input, length, output + 4);
+    if(compressedLength >= length)
+    {
+        Write32(output, static_cast<UINT32>(length) | 0x80000000u);
+        memcpy(output + 4, input, length);
+        return 4 + length;
+    }
+
+    Write32(output, static_cast<UINT32>(compressedLength));
+    return 4 + compressedLength;
+}
+
+size_t Lz4FrameEncoder::WriteEndMark(UINT8* output)
+{
+    Write32(output, 0);
+    return LZ4_END_MARK_SIZE;
+}
+
+size_t Lz4FrameEncoder::CompressBlock(const UINT8* input, size_t length, UINT8* output)
+{
+    UINT8* outputPtr = output;
+    const UINT8* anchor = input;
+    const UINT8* end = input + length;
+
+    if(length > MatchFindLimit)
+    {
+        // The blocks are independent, so matches are only searched in the current block
+        memset(_hashTable, 0, sizeof(_hashTable));
+
+        const UINT8* matchLimit = end - LastLiteralCount;
+        const UINT8* inputLimit = end - MatchFindLimit;
+        const UINT8* inputPtr = input + 1;
+        while(inputPtr < inputLimit)
+        {
+            // Look up the last occurrence of the current sequence
+            UINT32 sequence = Read32(inputPtr);
+            UINT32 hash = (sequence * 2654435761u) >> (32 - HashBits);
+            const UINT8* candidate = input + _hashTable[hash];
+            _hashTable[hash] = static_cast<UINT32>(inputPtr - input);
+            if(candidate >= inputPtr || static_cast<size_t>(inputPtr - candidate) > MaxMatchOffset || Read32(candidate) != sequence)
+            {
+                // Skip faster through incompressible data
+                inputPtr += 1 + ((inputPtr - anchor) >> 6);
+                continue;
+            }
+
+            // Extend match in both directions
+            const UINT8* matchEnd = inputPtr + MinMatchLength;
+            const UINT8* candidateEnd = candidate + MinMatchLength;
+            while(matchEnd < matchLimit && *matchEnd == *candidateEnd)
+            {
+                ++matchEnd;
+                ++candidateEnd;
+            }
+            while(inputPtr > anchor && candidate > input && inputPtr[-1] == candidate[-1])
+            {
+                --inputPtr;
+                --candidate;
+            }
+
+            // Token, literals, offset, match length
+            size_t literalLength = static_cast<size_t>(inputPtr - anchor);
+            size_t matchLength = static_cast<size_t>(matchEnd - inputPtr) - MinMatchLength;
+            UINT8* token = outputPtr++;
+            *token = static_cast<UINT8>(((literalLength >= 15 ? 15 : literalLength) << 4) | (matchLength >= 15 ? 15 : matchLength));
+            if(literalLength >= 15)
+                outputPtr = WriteLengthExtension(outputPtr, literalLength - 15);
+            memcpy(outputPtr, anchor, literalLength);
+            outputPtr += literalLength;
+            size_t offset = static_cast<size_t>(inputPtr - candidate);
+            *outputPtr++ = static_cast<UINT8>(offset);
+            *outputPtr++ = static_cast<UINT8>(offset >> 8);
+            if(matchLength >= 15)
+                outputPtr = WriteLengthExtension(outputPtr, matchLength - 15);
+
+            inputPtr = matchEnd;
+            anchor = inputPtr;
+        }
+    }
+
+    // The last sequence only consists of literals
+    size_t literalLength = static_cast<size_t>(end - anchor);
+    *outputPtr++ = static_cast<UINT8>((literalLength >= 15 ? 15 : literalLength) << 4);
+    if(literalLength >= 15)
+        outputPtr = WriteLengthExtension(outputPtr, literalLength - 15);
+    memcpy(outputPtr, anchor, literalLength);
+    outputPtr += literalLength;
+
+    return static_cast<size_t>(outputPtr - output);
+}
+
+UINT32 Lz4FrameEncoder::ComputeShortXxHash32(const UINT8* data, size_t length)
+{
+    constexpr UINT32 prime1 = 2654435761u;
+    constexpr UINT32 prime2 = 2246822519u;
+    constexpr UINT32 prime3 = 3266489917u;
+    constexpr UINT32 prime4 = 668265263u;
+    constexpr UINT32 prime5 = 374761393u;
+
+    // Seed 0; inputs shorter than 16 bytes skip the striped accumulation
+    UINT32 hash = prime5 + static_cast<UINT32>(length);
+    size_t i = 0;
+    for(; i + 4 <= length; i += 4)
+    {
+        hash += Read32(data + i) * prime3;
+        hash = ((hash << 17) | (hash >> 15)) * prime4;
+    }
+    for(; i < length; ++i)
+    {
+        hash += data[i] * prime5;
+        hash = ((hash << 11) | (hash >> 21)) * prime1;
+    }
+
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return hash;
+}
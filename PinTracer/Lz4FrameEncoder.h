@@ -0,0 +1,57 @@
+#pragma once
+/*
+Contains an encoder for the LZ4 frame format, for compressing trace files while they are written.
+*/
+
+// The maximum number of uncompressed bytes per LZ4 block (block maximum size ID 6).
+#define LZ4_BLOCK_SIZE (1 << 20)
+
+// The size of the LZ4 frame header (magic number, frame descriptor and header checksum).
+#define LZ4_FRAME_HEADER_SIZE (4 + 3)
+
+// The size of the LZ4 frame end mark.
+#define LZ4_END_MARK_SIZE 4
+
+
+/* INCLUDES */
+#include "pin.H"
+
+
+/* TYPES */
+
+// Encodes data as LZ4 frame (see https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md), which can be decompressed by the lz4 tool and library.
+// The blocks are independent and compressed with a greedy single-probe match search, which favors speed over compression ratio.
+class Lz4FrameEncoder
+{
+private:
+    // The number of bits of the match finder's hash table index.
+    static constexpr int HashBits = 14;
+
+    // The positions of the last occurrences of 4-byte sequences in the current block, indexed by their hash.
+    UINT32 _hashTable[1 << HashBits]{};
+
+private:
+    // Compresses the given data into a single LZ4 block, and returns the compressed size.
+    // The output buffer must hold at least GetEncodedBlockBound(length) - 4 bytes.
+    size_t CompressBlock(const UINT8* input, size_t length, UINT8* output);
+
+    // Computes the XXH32 hash of the given data, which must be shorter than 16 bytes.
+    static UINT32 ComputeShortXxHash32(const UINT8* data, size_t length);
+
+public:
+    // Returns the maximum size of an encoded block with the given number of uncompressed bytes, including its size field.
+    static size_t GetEncodedBlockBound(size_t length)
+    {
+        return 4 + length + length / 255 + 16;
+    }
+
+    // Writes the frame header and returns its size (LZ4_FRAME_HEADER_SIZE).
+    static size_t WriteFrameHeader(UINT8* output);
+
+    // Encodes the given data, which must not be longer than LZ4_BLOCK_SIZE, as block with size field, and returns the number of written bytes.
+    // If the data cannot be compressed, it is stored uncompressed.
+    size_t EncodeBlock(const UINT8* input, size_t length, UINT8* output);
+
+    // Writes the end mark of the frame and returns its size (LZ4_END_MARK_SIZE).
+    static size_t WriteEndMark(UINT8* output);
+};
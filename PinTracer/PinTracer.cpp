@@ -10,11 +10,19 @@ To get meaningful outputs, make sure that these functions are called with "call"
 #include "TraceWriter.h"
 #include "Utilities.h"
 #include "CpuOverride.h"
+#include "SymbolTable.h"
+#include "TaintTracker.h"
+#include <map>
 
 // Feature flag for legacy allocation function return tracking.
 // Sometimes the compiler replaces tail calls by jump instructions, tripping Pin's IPOINT_AFTER function end detection, leading to missing allocation address returns.
 //#define USE_LEGACY_ALLOC_RETURN_TRACKING
 
+// The code versions of instrumented traces, if instrumentation is paused outside of testcases.
+// Traces inherit the version of their predecessor, and switch it at their head depending on the recording state of the thread.
+#define TRACE_VERSION_RECORDING 0
+#define TRACE_VERSION_IDLE 1
+
 
 /* GLOBAL VARIABLES */
 
@@ -32,11 +40,104 @@ KNOB<int> KnobCpuFeatureLevel(KNOB_MODE_WRITEONCE, "pintool", "c", "0", "specify
 KNOB<UINT64> KnobFixedRandomNumbers(KNOB_MODE_WRITEONCE, "pintool", "r", "841534158063459245", "set constant output for RDRAND instruction");
 
 // Enable stack allocation tracking.
-KNOB<int> KnobEnableStackAllocationTracking(KNOB_MODE_WRITEONCE, "pintool", "s", "0", "enable stack allocation tracking");
+KNOB<int> KnobEnableStackAllocationTracking(KNOB_MODE_WRITEONCE, "pintool", "s", "0", "enable stack allocation tracking: 0 = disabled, 1 = record each stack pointer modification, 2 = record one summary per stack frame (function, entry stack pointer and frame size) when the function returns");
+
+// The trace file format.
+KNOB<int> KnobTraceFormat(KNOB_MODE_WRITEONCE, "pintool", "f", "0", "specify trace file format: 0 = Raw, 1 = Compact (delta-encoded variable-length records)");
+
+// Enable asynchronous trace buffer flushing.
+KNOB<int> KnobAsyncFlushBufferCount(KNOB_MODE_WRITEONCE, "pintool", "a", "0", "enable asynchronous trace flushing: number of entry buffers per thread (0 = disabled)");
+
+// Trace all application threads, not only the main thread.
+KNOB<int> KnobTraceAllThreads(KNOB_MODE_WRITEONCE, "pintool", "m", "0", "trace all threads: 0 = main thread only, 1 = all threads (one trace file per thread and testcase)");
+
+// The names of the routines which limit the tracing scope, separated by colons.
+KNOB<std::string> KnobTraceScopeRoutineList(KNOB_MODE_WRITEONCE, "pintool", "n", "", "specify list of routine names which limit the tracing scope, separated by colons: only memory accesses and branches inside these routines and their callees are traced (empty = no limit)");
+
+// The shared memory file for trace output.
+KNOB<std::string> KnobSharedMemoryRingFile(KNOB_MODE_WRITEONCE, "pintool", "x", "", "specify shared memory file which receives the testcase traces instead of trace files, e.g. on /dev/shm (empty = write trace files)");
+
+// The size of the shared memory ring.
+KNOB<UINT64> KnobSharedMemoryRingSize(KNOB_MODE_WRITEONCE, "pintool", "xs", "256", "specify size of the shared memory ring in MB");
+
+// Write digests of the trace prefix.
+KNOB<int> KnobWritePrefixDigests(KNOB_MODE_WRITEONCE, "pintool", "pd", "0", "write digests of the prefix traces, so other instances can verify their prefix against this one");
+
+// The path prefix of the reference trace prefix.
+KNOB<std::string> KnobReferencePrefix(KNOB_MODE_WRITEONCE, "pintool", "pr", "", "specify path prefix of a trace prefix recorded by another instance with -pd: the own prefix is verified against it instead of being written (empty = write prefix)");
+
+// Enable fingerprint mode.
+KNOB<int> KnobFingerprintMode(KNOB_MODE_WRITEONCE, "pintool", "fp", "0", "enable fingerprint mode: only report fingerprints of the testcase traces (per trace and per instruction), instead of writing them");
+
+// Enable aggregation of memory accesses.
+KNOB<int> KnobAggregationMode(KNOB_MODE_WRITEONCE, "pintool", "g", "0", "enable aggregation mode: store the memory accesses of each testcase as histogram of distinct accesses, and omit control flow");
+
+// Enable basic block control flow encoding.
+KNOB<int> KnobBasicBlockControlFlow(KNOB_MODE_WRITEONCE, "pintool", "b", "0", "record control flow as sequence of executed basic block IDs, which refer to a basic block table, instead of individual branches");
+
+// Enable run-length encoding of repeated loop iterations.
+KNOB<int> KnobRunLengthEncoding(KNOB_MODE_WRITEONCE, "pintool", "rl", "0", "enable run-length encoding: collapse repeated loop iterations with constant address strides (e.g., array traversals and rep movs) into single repeat entries");
+
+// The granularity of memory access addresses.
+KNOB<int> KnobAddressGranularity(KNOB_MODE_WRITEONCE, "pintool", "ag", "0", "specify number of low address bits which are cleared in memory accesses: 0 = byte, 6 = cache line, 12 = page");
+
+// Suppress duplicate memory accesses.
+KNOB<int> KnobSuppressDuplicateAccesses(KNOB_MODE_WRITEONCE, "pintool", "ad", "0", "omit memory accesses which are identical to the preceding access of the same instruction in the current trace (after applying the address granularity)");
+
+// Enable lazy symbol loading.
+KNOB<int> KnobLazySymbols(KNOB_MODE_WRITEONCE, "pintool", "ls", "0", "only load export symbols, and read the symbols of interesting images on demand when a routine is not exported (reduces startup time for images with large debug information; Linux only)");
+
+// Enables per-testcase overhead and volume counters.
+KNOB<int> KnobStatistics(KNOB_MODE_WRITEONCE, "pintool", "st", "0", "collect tracer statistics: report entry counts, buffer flushes, written bytes and instrumentation overhead for each testcase, and summarize them for each thread at exit");
+
+// The size of the entry buffers.
+KNOB<UINT64> KnobEntryBufferSize(KNOB_MODE_WRITEONCE, "pintool", "bs", "16384", "specify number of entries per trace buffer (larger buffers need fewer flushes)");
+
+// The pages which back the entry buffers.
+KNOB<int> KnobHugePages(KNOB_MODE_WRITEONCE, "pintool", "hp", "0", "back the trace buffers by 2 MB huge pages: 0 = disabled, 1 = transparent huge pages, 2 = explicit huge pages (falls back to transparent huge pages); Linux only");
+
+// Enables adaptive entry buffer sizes.
+KNOB<int> KnobAdaptiveBufferSize(KNOB_MODE_WRITEONCE, "pintool", "ba", "0", "adapt the trace buffer size of each thread at testcase start: double it if the previous trace needed many flushes, halve it if the trace used only a small part of it");
+
+// Compression of the trace files.
+KNOB<int> KnobTraceCompression(KNOB_MODE_WRITEONCE, "pintool", "z", "0", "compress trace files: 0 = disabled, 1 = LZ4 frames (.trace.lz4); the compression runs on the flush thread if asynchronous flushing is enabled");
+
+// Enables differential trace recording.
+KNOB<int> KnobDifferentialMode(KNOB_MODE_WRITEONCE, "pintool", "dr", "0", "enable differential recording: keep the first testcase trace of the main thread as reference, and only write the entries of later testcase traces that diverge from it (the reference is written to reference.trace)");
+
+// Enables the secret region filter.
+KNOB<int> KnobSecretRegionFilter(KNOB_MODE_WRITEONCE, "pintool", "sf", "0", "enable secret region filter: only record memory accesses and branches of testcases from instructions which accessed a region passed to PinNotifySecretRegion() in the current testcase, or which follow such an access within the dependency window");
+
+// The dependency window of the secret region filter.
+KNOB<UINT64> KnobSecretDependencyWindow(KNOB_MODE_WRITEONCE, "pintool", "sw", "0", "specify number of memory accesses and branches after each secret region access, which are recorded by the secret region filter as well");
+
+// The archive file for the testcase traces.
+KNOB<std::string> KnobTraceArchiveFile(KNOB_MODE_WRITEONCE, "pintool", "ar", "", "specify archive file which receives the testcase traces of the main thread as consecutive records, instead of one trace file per testcase (empty = write trace files)");
+
+// The segment size of the trace archive.
+KNOB<UINT64> KnobTraceArchiveSegmentSize(KNOB_MODE_WRITEONCE, "pintool", "as", "0", "specify size in MB after which a new trace archive segment file (<archive>.<index>) is started (0 = single archive file)");
+
+// The chunk size of the trace index footer.
+KNOB<UINT64> KnobTraceIndexInterval(KNOB_MODE_WRITEONCE, "pintool", "ti", "0", "append an index footer to each trace file, which holds the entry counts per type, a checksum, and the offset, call depth and allocation state at the beginning of every chunk of the given number of entries (0 = disabled)");
+
+// Pauses the instrumentation outside of testcases.
+KNOB<int> KnobPauseInstrumentation(KNOB_MODE_WRITEONCE, "pintool", "pi", "0", "pause instrumentation outside of testcases: code between testcases and in untraced threads runs in a separate code version without entry writers, instead of recording entries which are discarded");
+
+// The directory of the persistent prefix cache.
+KNOB<std::string> KnobPrefixCacheDirectory(KNOB_MODE_WRITEONCE, "pintool", "pc", "", "specify directory of a persistent prefix cache: if the Pin tool, the target and their options match a cached trace prefix, it is restored instead of being recorded, and the prefix runs with paused instrumentation (empty = no cache)");
+
+// Enables taint tracking.
+KNOB<int> KnobTaintTracking(KNOB_MODE_WRITEONCE, "pintool", "tt", "0", "enable taint tracking: only record memory accesses with secret-dependent addresses and jumps with secret-dependent conditions or targets; 0 = disabled, 1 = taint the regions passed to PinNotifySecretRegion(), 2 = additionally taint the testcase input (data read during a testcase and the region passed to PinNotifyTestcaseInput())");
+
+// Enables fork-server mode.
+KNOB<int> KnobForkServer(KNOB_MODE_WRITEONCE, "pintool", "fs", "0", "enable fork-server mode: the wrapper runs each testcase in a forked worker process after the trace prefix, and the testcase messages on stdout are prefixed with the testcase ID");
 
 // The names of interesting images, parsed from the command line option.
 std::vector<std::string> _interestingImages;
 
+// The names of the routines which limit the tracing scope, parsed from the command line option.
+std::vector<std::string> _traceScopeRoutines;
+
 // The trace writer object (per thread).
 REG _traceWriterReg;
 
@@ -46,14 +147,14 @@ REG _nextBufferEntryReg;
 // The end of the entry buffer (per thread).
 REG _entryBufferEndReg;
 
-// The EAX input register of a CPUID instruction.
-REG _cpuIdEaxInputReg;
+// The EAX and ECX inputs of a CPUID instruction, packed by PackCpuIdInput().
+REG _cpuIdInputReg;
 
-// The ECX input register of a CPUID instruction.
-REG _cpuIdEcxInputReg;
+// The recording state of the trace writer, as returned by TraceWriter::CheckRecording(), which selects the code version if instrumentation is paused (per thread).
+REG _recordingReg;
 
-// Data of loaded images for lookup during trace instrumentation.
-std::vector<ImageData*> _images;
+// Data of loaded images for lookup during trace instrumentation, indexed by their start addresses.
+std::map<UINT64, ImageData> _images;
 
 // Controls whether RDRAND random numbers are replaced by fixed ones.
 bool _useFixedRandomNumber = false;
@@ -61,6 +162,36 @@ bool _useFixedRandomNumber = false;
 // Controls whether stack allocation tracking is enabled.
 bool _enableStackAllocationTracking = false;
 
+// Determines whether stack frame summaries are recorded instead of individual stack pointer modifications.
+bool _enableStackFrameSummaries = false;
+
+// Controls whether all threads are traced, instead of only the main thread.
+bool _traceAllThreads = false;
+
+// Controls whether the tracing scope is limited to certain routines.
+bool _limitTraceScope = false;
+
+// Controls whether the control flow is recorded as sequence of basic blocks, instead of individual branches.
+bool _basicBlockControlFlow = false;
+
+// Controls whether only export symbols are loaded by Pin, and the symbols of interesting images are read on demand.
+bool _lazySymbols = false;
+
+// Controls whether tracer statistics are collected.
+bool _collectStatistics = false;
+
+// Controls whether only memory accesses and branches related to secret regions are recorded.
+bool _filterSecretRegions = false;
+
+// Controls whether memory accesses and jumps are only recorded if they depend on tainted data.
+bool _taintTracking = false;
+
+// Controls whether the code outside of testcases runs in an idle version without entry writers.
+bool _pauseInstrumentation = false;
+
+// The number of entry writer call sites inserted so far, in statistics mode.
+UINT64 _insertedCallSiteCount = 0;
+
 // Tracks whether libc was loaded.
 #ifdef WIN32
 	bool _libcLoadDetected = true;
@@ -71,11 +202,6 @@ bool _enableStackAllocationTracking = false;
 // The fixed random number to be returned after each RDRAND instruction.
 UINT64 _fixedRandomNumber = 0;
 
-// Depth of the allocation call stack.
-// 0 is the call stack level of the allocation function itself.
-// -1 indicates that allocation tracking is inactive.
-int _allocationCallStackDepth = -1;
-
 
 /* CALLBACK PROTOTYPES */
 
@@ -83,15 +209,30 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v);
 VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[maybe_unused]] VOID* v);
 VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] INT32 code, [[maybe_unused]] VOID* v);
 VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v);
-TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId);
+VOID UnloadImage(IMG img, [[maybe_unused]] VOID* v);
+VOID PrepareForFini([[maybe_unused]] VOID* v);
+VOID BeforeFork(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] VOID* v);
+VOID AfterForkInChild(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] VOID* v);
+VOID SystemCallEntry(THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD standard, [[maybe_unused]] VOID* v);
+VOID SystemCallExit(THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD standard, [[maybe_unused]] VOID* v);
+void GetImageBounds(IMG img, UINT64& imageStart, UINT64& imageEnd);
+const ImageData* FindImage(BBL bbl);
+RTN FindRoutine(IMG img, const std::string& name, SymbolTable* symbolTable);
+TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT* entryBufferEnd, ADDRINT newTestcaseId);
 TraceEntry* TestcaseEnd(TraceWriter *traceWriter, TraceEntry* nextEntry);
+VOID SwitchOtherThreadsTestcase(int testcaseId);
 EXCEPT_HANDLING_RESULT HandlePinToolException([[maybe_unused]] THREADID tid, EXCEPTION_INFO* exceptionInfo,
                                               [[maybe_unused]] PHYSICAL_CONTEXT* physicalContext, [[maybe_unused]] VOID* v);
-ADDRINT CheckNextTraceEntryPointerValid(TraceEntry* nextEntry);
-VOID StartAllocationTracking(TraceEntry *nextEntry);
-VOID TrackAllocationCall();
+VOID InsertBufferCheck(INS ins, IPOINT ipoint, bool taintFiltered = false);
+VOID InsertTaintPropagation(INS ins, bool filtered, bool isJump);
+VOID InstrumentIdleControlFlow(INS ins, const ImageData* img);
+VOID EnterTraceScope(TraceWriter *traceWriter);
+VOID TrackTraceScopeCall(TraceWriter *traceWriter);
+VOID TrackTraceScopeReturn(TraceWriter *traceWriter);
+VOID StartAllocationTracking(TraceWriter *traceWriter, ADDRINT stackPointer);
 TraceEntry* TrackAllocationReturn(TraceWriter *traceWriter, TraceEntry *nextEntry, ADDRINT returnValue);
 void ChangeRandomNumber(ADDRINT* outputReg);
+ADDRINT ReturnFixedRandomNumber(ADDRINT fixedRandomNumber);
 
 
 /* FUNCTIONS */
@@ -117,14 +258,19 @@ int main(int argc, char* argv[])
 			_interestingImages.push_back(item);
 		}
 
+	// Split list of routines which limit the tracing scope
+	std::stringstream traceScopeRoutinesStringStream(KnobTraceScopeRoutineList);
+	while(std::getline(traceScopeRoutinesStringStream, item, ':'))
+		if(!item.empty())
+			_traceScopeRoutines.push_back(item);
+
 	// Create trace entry buffer and all associated variables
     _traceWriterReg = PIN_ClaimToolRegister();
 	_nextBufferEntryReg = PIN_ClaimToolRegister();
 	_entryBufferEndReg = PIN_ClaimToolRegister();
 
-	// Reserve tool registers for CPUID modification
-	_cpuIdEaxInputReg = PIN_ClaimToolRegister();
-	_cpuIdEcxInputReg = PIN_ClaimToolRegister();
+	// Reserve tool register for CPUID modification
+	_cpuIdInputReg = PIN_ClaimToolRegister();
 
 	// Set model for CPU emulation
 	SetEmulatedCpu(KnobCpuFeatureLevel.Value());
@@ -138,28 +284,313 @@ int main(int argc, char* argv[])
 	}
 
 	// Check if stack allocation tracking is enabled
-	if(KnobEnableStackAllocationTracking.Value() != 0)
+	if(KnobEnableStackAllocationTracking.Value() == 1)
 	{
 		_enableStackAllocationTracking = true;
 		std::cerr << "Stack allocation tracking is enabled" << std::endl;
 	}
+	else if(KnobEnableStackAllocationTracking.Value() == 2)
+	{
+		_enableStackFrameSummaries = true;
+		std::cerr << "Stack allocation tracking is enabled, recording stack frame summaries" << std::endl;
+	}
+	else if(KnobEnableStackAllocationTracking.Value() != 0)
+	{
+		std::cerr << "Error: Unknown stack allocation tracking mode " << KnobEnableStackAllocationTracking.Value() << std::endl;
+		return -1;
+	}
+
+	// Set trace file format
+	if(KnobTraceFormat.Value() == static_cast<int>(TraceFormats::Compact))
+		TraceWriter::InitTraceFormat(TraceFormats::Compact);
+	else if(KnobTraceFormat.Value() != static_cast<int>(TraceFormats::Raw))
+	{
+		std::cerr << "Error: Unknown trace format " << KnobTraceFormat.Value() << std::endl;
+		return -1;
+	}
+
+	// Set trace file compression
+	if(KnobTraceCompression.Value() == static_cast<int>(TraceCompressions::Lz4))
+		TraceWriter::InitTraceCompression(TraceCompressions::Lz4);
+	else if(KnobTraceCompression.Value() != static_cast<int>(TraceCompressions::None))
+	{
+		std::cerr << "Error: Unknown trace compression " << KnobTraceCompression.Value() << std::endl;
+		return -1;
+	}
+
+	// Check if all threads should be traced
+	if(KnobTraceAllThreads.Value() != 0)
+	{
+		_traceAllThreads = true;
+		std::cerr << "Tracing all threads" << std::endl;
+	}
+
+	// Check if the tracing scope is limited
+	if(!_traceScopeRoutines.empty())
+	{
+		_limitTraceScope = true;
+		TraceWriter::InitTraceScope();
+		std::cerr << "Tracing scope is limited to " << std::dec << _traceScopeRoutines.size() << " routine(s)" << std::endl;
+	}
+
+	// Check if the control flow should be recorded as basic block sequence
+	if(KnobBasicBlockControlFlow.Value() != 0)
+	{
+		// The branches at the tracing scope boundaries cannot be told apart in the basic block sequence
+		if(_limitTraceScope)
+		{
+			std::cerr << "Error: Basic block control flow mode cannot be combined with a limited tracing scope" << std::endl;
+			return -1;
+		}
+
+		_basicBlockControlFlow = true;
+		TraceWriter::InitBasicBlockMode(trim(KnobOutputFilePrefix.Value()));
+	}
+
+	// Check if memory accesses should be filtered
+	if(KnobAddressGranularity.Value() < 0 || KnobAddressGranularity.Value() > 32)
+	{
+		std::cerr << "Error: Invalid address granularity " << KnobAddressGranularity.Value() << std::endl;
+		return -1;
+	}
+	if(KnobAddressGranularity.Value() > 0 || KnobSuppressDuplicateAccesses.Value() != 0)
+		TraceWriter::InitMemoryAccessFilter(KnobAddressGranularity.Value(), KnobSuppressDuplicateAccesses.Value() != 0);
+
+	// Check if repeated loop iterations should be collapsed
+	if(KnobRunLengthEncoding.Value() != 0)
+		TraceWriter::InitRunLengthEncoding();
+
+	// Check if testcase traces should be written as difference to a reference trace
+	if(KnobDifferentialMode.Value() != 0)
+	{
+		// Fingerprint mode does not write any testcase traces
+		if(KnobFingerprintMode.Value() != 0)
+		{
+			std::cerr << "Error: Differential recording cannot be combined with fingerprint mode" << std::endl;
+			return -1;
+		}
+
+		// Runs are collapsed per buffer, and the buffers of the reference and the later traces end at different points, so equal executions would get different repeat entries
+		if(KnobRunLengthEncoding.Value() != 0)
+		{
+			std::cerr << "Error: Differential recording cannot be combined with run-length encoding" << std::endl;
+			return -1;
+		}
+
+		// Prefix digests are only exchanged between multiple instances, which would start from different testcases and overwrite each other's reference trace
+		if(KnobWritePrefixDigests.Value() != 0 || !trim(KnobReferencePrefix.Value()).empty())
+		{
+			std::cerr << "Error: Differential recording cannot be combined with writing or verifying prefix digests (multiple instances)" << std::endl;
+			return -1;
+		}
+
+		TraceWriter::InitDifferentialMode();
+	}
+
+	// Check if only accesses related to secret regions should be recorded
+	if(KnobSecretRegionFilter.Value() != 0)
+	{
+		_filterSecretRegions = true;
+		TraceWriter::InitSecretRegionFilter(KnobSecretDependencyWindow.Value());
+	}
+
+	// Check if only secret-dependent accesses and jumps should be recorded
+	if(KnobTaintTracking.Value() != 0)
+	{
+		if(KnobTaintTracking.Value() < 0 || KnobTaintTracking.Value() > 2)
+		{
+			std::cerr << "Error: Unknown taint tracking mode " << KnobTaintTracking.Value() << std::endl;
+			return -1;
+		}
+
+		// The shadow memory is not synchronized, so only the main thread can be tracked
+		if(_traceAllThreads)
+		{
+			std::cerr << "Error: Taint tracking cannot be combined with tracing all threads" << std::endl;
+			return -1;
+		}
+
+		_taintTracking = true;
+		TaintTracker::Init(KnobTaintTracking.Value() == 2);
+	}
+
+	// Check if the trace prefix should be restored from or stored in the prefix cache
+	if(!KnobPrefixCacheDirectory.Value().empty())
+	{
+		// The cache holds the prefix of the main thread, whose images and basic blocks do not depend on other instances
+		if(_traceAllThreads || _basicBlockControlFlow || !trim(KnobReferencePrefix.Value()).empty())
+		{
+			std::cerr << "Error: The prefix cache cannot be combined with tracing all threads, basic block control flow or a reference prefix" << std::endl;
+			return -1;
+		}
+
+		// The key covers the options of the Pin tool and the command line of the target, and the contents of the Pin tool and the target executable
+		// Output paths do not influence the prefix
+		std::stringstream settingsStream;
+		std::vector<std::string> keyFiles;
+		bool toolArgs = false;
+		bool targetArgs = false;
+		for(int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if(targetArgs)
+			{
+				if(keyFiles.size() < 2)
+					keyFiles.push_back(arg);
+				settingsStream << "\t" << arg;
+			}
+			else if(arg == "--")
+			{
+				targetArgs = true;
+				settingsStream << "\t--";
+			}
+			else if(arg == "-t" && i + 1 < argc)
+			{
+				toolArgs = true;
+				keyFiles.push_back(argv[++i]);
+			}
+			else if(toolArgs)
+			{
+				if((arg == "-o" || arg == "-pc" || arg == "-ar" || arg == "-x") && i + 1 < argc)
+					++i;
+				else
+					settingsStream << "\t" << arg;
+			}
+		}
+		TraceWriter::InitPrefixCache(trim(KnobPrefixCacheDirectory.Value()), trim(KnobOutputFilePrefix.Value()), settingsStream.str(), keyFiles);
+	}
+
+	// Check if the instrumentation should be paused outside of testcases
+	// A restored prefix is not recorded again, so it runs in the idle version as well
+	if(KnobPauseInstrumentation.Value() != 0 || TraceWriter::IsPrefixCached())
+	{
+		_pauseInstrumentation = true;
+		_recordingReg = PIN_ClaimToolRegister();
+		TraceWriter::InitPausedInstrumentation();
+	}
+
+	// Set size and backing pages of the entry buffers
+	if(KnobHugePages.Value() < static_cast<int>(HugePageModes::None) || KnobHugePages.Value() > static_cast<int>(HugePageModes::Explicit))
+	{
+		std::cerr << "Error: Unknown huge page mode " << KnobHugePages.Value() << std::endl;
+		return -1;
+	}
+	TraceWriter::InitEntryBuffers(KnobEntryBufferSize.Value(), static_cast<HugePageModes>(KnobHugePages.Value()), KnobAdaptiveBufferSize.Value() != 0);
+
+	// Check if tracer statistics should be collected
+	if(KnobStatistics.Value() != 0)
+	{
+		_collectStatistics = true;
+		TraceWriter::InitStatistics();
+	}
+
+	// Check if asynchronous trace flushing is enabled
+	if(KnobAsyncFlushBufferCount.Value() > 0)
+		TraceWriter::InitAsyncFlushing(KnobAsyncFlushBufferCount.Value());
+
+	// Check if only trace fingerprints should be computed
+	if(KnobFingerprintMode.Value() != 0)
+		TraceWriter::InitFingerprintMode();
+
+	// Check if memory accesses should be aggregated
+	if(KnobAggregationMode.Value() != 0)
+		TraceWriter::InitAggregationMode();
+
+	// Check if trace files should get an index footer
+	if(KnobTraceIndexInterval.Value() > 0)
+	{
+		// The index refers to the stored entries, which must correspond one-to-one to the entries of the trace
+		if(_basicBlockControlFlow || KnobRunLengthEncoding.Value() != 0 || KnobDifferentialMode.Value() != 0 || KnobAggregationMode.Value() != 0)
+		{
+			std::cerr << "Error: The trace index cannot be combined with basic block control flow, run-length encoding, differential recording or aggregation mode" << std::endl;
+			return -1;
+		}
+
+		TraceWriter::InitTraceIndex(KnobTraceIndexInterval.Value());
+	}
+
+	// Check if testcases run in forked worker processes
+	bool forkServerMode = KnobForkServer.Value() != 0;
+	if(forkServerMode)
+	{
+		// The workers only contain the forking thread, and cannot share trace writer state with each other
+		if(_traceAllThreads || _basicBlockControlFlow || KnobDifferentialMode.Value() != 0 || !KnobSharedMemoryRingFile.Value().empty())
+		{
+			std::cerr << "Error: Fork-server mode cannot be combined with tracing all threads, basic block control flow, differential recording or a shared memory ring" << std::endl;
+			return -1;
+		}
+
+		// The workers share the standard output, where only short lines are written atomically
+		if(KnobFingerprintMode.Value() != 0 || _collectStatistics)
+		{
+			std::cerr << "Error: Fork-server mode cannot be combined with fingerprint mode or tracer statistics" << std::endl;
+			return -1;
+		}
+
+		TraceWriter::InitForkServerMode();
+	}
+
+	// Check if traces should be written to shared memory
+	if(!KnobSharedMemoryRingFile.Value().empty())
+		TraceWriter::InitSharedMemoryRing(trim(KnobSharedMemoryRingFile.Value()), KnobSharedMemoryRingSize.Value() << 20);
+
+	// Check if traces should be collected in an archive
+	if(!KnobTraceArchiveFile.Value().empty())
+	{
+		// The archive has a single writer, which appends one record after another
+		if(!KnobSharedMemoryRingFile.Value().empty() || forkServerMode)
+		{
+			std::cerr << "Error: A trace archive cannot be combined with a shared memory ring or fork-server mode" << std::endl;
+			return -1;
+		}
+
+		TraceWriter::InitTraceArchive(trim(KnobTraceArchiveFile.Value()), KnobTraceArchiveSegmentSize.Value() << 20);
+	}
 
 	// Initialize prefix mode
-	TraceWriter::InitPrefixMode(trim(KnobOutputFilePrefix.Value()));
+	TraceWriter::InitPrefixMode(trim(KnobOutputFilePrefix.Value()), KnobWritePrefixDigests.Value() != 0, trim(KnobReferencePrefix.Value()));
 
 	// Instrument instructions and routines
 	IMG_AddInstrumentFunction(InstrumentImage, nullptr);
+	IMG_AddUnloadFunction(UnloadImage, nullptr);
 	TRACE_AddInstrumentFunction(InstrumentTrace, nullptr);
 
 	// Set thread event handlers
 	PIN_AddThreadStartFunction(ThreadStart, nullptr);
 	PIN_AddThreadFiniFunction(ThreadFini, nullptr);
 
+	// Taint the data which is read during testcases
+	if(_taintTracking && TaintTracker::SeedsFromInput())
+	{
+		PIN_AddSyscallEntryFunction(SystemCallEntry, nullptr);
+		PIN_AddSyscallExitFunction(SystemCallExit, nullptr);
+	}
+
+	// Stop internal threads before the process exits
+	PIN_AddPrepareForFiniFunction(PrepareForFini, nullptr);
+
+	// Pin follows forked processes without further configuration, so the worker processes are traced with the already instrumented code
+	if(forkServerMode)
+	{
+		PIN_AddForkFunction(FPOINT_BEFORE, BeforeFork, nullptr);
+		PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, AfterForkInChild, nullptr);
+	}
+
 	// Handle internal exceptions (for debugging)
 	PIN_AddInternalExceptionHandler(HandlePinToolException, nullptr);
 
 	// Load symbols to access function name information
-	PIN_InitSymbols();
+	// Debug symbols of large dependencies can take very long to load, so lazy mode restricts itself to export symbols
+	if(KnobLazySymbols.Value() != 0)
+	{
+		_lazySymbols = true;
+		PIN_InitSymbolsAlt(EXPORT_SYMBOLS);
+		std::cerr << "Lazy symbol loading enabled" << std::endl;
+	}
+	else
+	{
+		PIN_InitSymbols();
+	}
 
 	// Start the target program
 	PIN_StartProgram();
@@ -172,17 +603,28 @@ int main(int argc, char* argv[])
 // [Callback] Instruments memory access instructions.
 VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 {
+	UINT64 startCycles = _collectStatistics ? TraceWriter::ReadTimestampCounter() : 0;
+	UINT64 startCallSiteCount = _insertedCallSiteCount;
+
+	// If instrumentation is paused, each trace has a recording and an idle version, which is selected by the recording state of the thread at the trace head
+	// The check precedes the routine instrumentation of the head, so a testcase start or end at the head takes effect at the next trace
+	bool recording = true;
+	if(_pauseInstrumentation)
+	{
+		recording = TRACE_Version(trace) == TRACE_VERSION_RECORDING;
+		INS_InsertVersionCase(BBL_InsHead(TRACE_BblHead(trace)), _recordingReg, recording ? 0 : 1, recording ? TRACE_VERSION_IDLE : TRACE_VERSION_RECORDING,
+			IARG_CALL_ORDER, CALL_ORDER_FIRST,
+			IARG_END);
+	}
+
 	// Check each instruction in each basic block
+	const ImageData* img = nullptr;
 	for(BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
 	{
 		// Before instrumentation check first whether we are in an interesting image
-		ImageData* img = nullptr;
-		for(ImageData* i : _images)
-			if(i->ContainsBasicBlock(bbl))
-			{
-				img = i;
-				break;
-			}
+		// The basic blocks of a trace usually belong to the same image, so we only search the image index if the previous image does not match
+		if(img == nullptr || !img->ContainsBasicBlock(bbl))
+			img = FindImage(bbl);
 		bool interesting;
 		if(img == nullptr)
 		{
@@ -201,6 +643,19 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			interesting = img->IsInteresting();
 		}
 
+		// Record the execution of the basic block, before anything else is recorded for its first instruction
+		// This replaces the branch entries, so it is done in all images
+		if(_basicBlockControlFlow && recording)
+		{
+			INS head = BBL_InsHead(bbl);
+			INS_InsertCall(head, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteBasicBlockEntry),
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_UINT32, TraceWriter::GetBasicBlockId(bbl),
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
+			InsertBufferCheck(head, IPOINT_BEFORE);
+		}
+
 		// Run through instructions
 		for(INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
 		{
@@ -211,6 +666,15 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			if(INS_SegmentPrefix(ins))
 				continue;
 
+			// Propagate taint before anything else is recorded for the instruction
+			// Taint flows through all images (e.g., memcpy in libc), so this is done before filtering uninteresting instructions
+			if(_taintTracking)
+			{
+				bool isJump = !_basicBlockControlFlow && INS_IsBranch(ins) && INS_IsControlFlow(ins) && !INS_IsCall(ins) && !INS_IsRet(ins);
+				bool isFilteredAccess = interesting && INS_IsStandardMemop(ins) && (INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins));
+				InsertTaintPropagation(ins, isJump || isFilteredAccess, isJump);
+			}
+
 			// Ignore frequent and uninteresting instructions to reduce instrumentation time
 			OPCODE opc = INS_Opcode(ins);
 			if(opc >= XED_ICLASS_PUSH && opc <= XED_ICLASS_PUSHFQ)
@@ -223,22 +687,21 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			// Change CPUID instruction
 			if(opc == XED_ICLASS_CPUID)
 			{
+				// Nothing to do if the real CPU is exposed
+				if(!IsCpuEmulated())
+					continue;
+
 				// Save input registers
-				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(PIN_SetContextReg),
-					IARG_CONTEXT,
-					IARG_UINT32, _cpuIdEaxInputReg,
+				// Both values fit into one tool register, so they can be stored by an inlined function instead of modifying the context
+				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(PackCpuIdInput),
 					IARG_REG_VALUE, REG_EAX,
-					IARG_END);
-				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(PIN_SetContextReg),
-					IARG_CONTEXT,
-					IARG_UINT32, _cpuIdEcxInputReg,
 					IARG_REG_VALUE, REG_ECX,
+					IARG_RETURN_REGS, _cpuIdInputReg,
 					IARG_END);
 
 				// Modify output registers
 				INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(ChangeCpuId),
-					IARG_REG_VALUE, _cpuIdEaxInputReg,
-					IARG_REG_VALUE, _cpuIdEcxInputReg,
+					IARG_REG_VALUE, _cpuIdInputReg,
 					IARG_REG_REFERENCE, REG_EAX,
 					IARG_REG_REFERENCE, REG_EBX,
 					IARG_REG_REFERENCE, REG_ECX,
@@ -252,115 +715,190 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			if(opc == XED_ICLASS_RDRAND && _useFixedRandomNumber)
 			{
 				// Modify output register
-				INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(ChangeRandomNumber),
-					IARG_REG_REFERENCE, INS_RegW(ins, 0),
-					IARG_END);
+				// 32-bit and 64-bit outputs are written as return value of an inlined function; writing a 32-bit register clears the upper half anyway
+				REG outputReg = INS_RegW(ins, 0);
+				if(REG_is_gr64(outputReg) || REG_is_gr32(outputReg))
+				{
+					ADDRINT fixedRandomNumber = REG_is_gr32(outputReg) ? static_cast<UINT32>(_fixedRandomNumber) : static_cast<ADDRINT>(_fixedRandomNumber);
+					INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(ReturnFixedRandomNumber),
+						IARG_ADDRINT, fixedRandomNumber,
+						IARG_RETURN_REGS, REG_FullRegName(outputReg),
+						IARG_END);
+				}
+				else
+				{
+					INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(ChangeRandomNumber),
+						IARG_REG_REFERENCE, outputReg,
+						IARG_END);
+				}
 
 				continue;
 			}
 
+			// The idle version does not write any entries, and only keeps the state up to date which carries over into the next testcase
+			if(!recording)
+			{
+				InstrumentIdleControlFlow(ins, img);
+				continue;
+			}
+
 			// Trace branch instructions (conditional and unconditional)
 			if(INS_IsCall(ins) && INS_IsControlFlow(ins))
 			{
 				// call instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_BOOL, 1,
-					IARG_UINT32, TraceEntryFlags::BranchTypeCall,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				if(!_basicBlockControlFlow)
+				{
+					INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteBranchEntry<TraceEntryFlags::BranchTypeCall>),
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_INST_PTR,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_BOOL, 1,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+					InsertBufferCheck(ins, IPOINT_BEFORE);
+				}
+
+				// Track call depth inside the tracing scope
+				if(_limitTraceScope)
+				{
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckTraceScopeActive),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackTraceScopeCall),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+				}
 
 				// Store stack pointer value
 				if(_enableStackAllocationTracking)
 				{
-					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-						IARG_REG_VALUE, _nextBufferEntryReg,
-						IARG_END);
-					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
-                        IARG_REG_VALUE, _traceWriterReg,
+					INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::WriteStackPointerModificationEntry<TraceEntryFlags::StackIsCall>),
 						IARG_REG_VALUE, _nextBufferEntryReg,
 						IARG_INST_PTR,
 						IARG_REG_VALUE, REG_RSP,
-						IARG_UINT32, TraceEntryFlags::StackIsCall,
 						IARG_RETURN_REGS, _nextBufferEntryReg,
 						IARG_END);
+					InsertBufferCheck(ins, IPOINT_TAKEN_BRANCH);
 				}
 
-#ifndef USE_LEGACY_ALLOC_RETURN_TRACKING
-                // Trace allocation function returns
-                INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-                    IARG_REG_VALUE, _nextBufferEntryReg,
-                    IARG_END);
-                INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationCall),
-                    IARG_END);
-#endif
+				// Open stack frame of the called function
+				if(_enableStackFrameSummaries)
+				{
+					INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::EnterStackFrame),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_REG_VALUE, REG_RSP,
+						IARG_END);
+				}
 
 				continue;
 			}
 			if(INS_IsBranch(ins) && INS_IsControlFlow(ins))
 			{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_BRANCH_TAKEN,
-					IARG_UINT32, TraceEntryFlags::BranchTypeJump,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				if(!_basicBlockControlFlow)
+				{
+					INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteBranchEntry<TraceEntryFlags::BranchTypeJump>),
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_INST_PTR,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_BRANCH_TAKEN,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+					InsertBufferCheck(ins, IPOINT_BEFORE, _taintTracking);
+				}
 
 				continue;
 			}
 			if(INS_IsRet(ins) && INS_IsControlFlow(ins))
 			{
-				// ret instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
-				INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertRetBranchEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_INST_PTR,
-					IARG_BRANCH_TARGET_ADDR,
-					IARG_RETURN_REGS, _nextBufferEntryReg,
-					IARG_END);
+				// Track call depth inside the tracing scope
+				// This is done before writing the branch entry, so the return from the routine which opened the scope is not traced, just as the respective call
+				if(_limitTraceScope)
+				{
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckTraceScopeActive),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackTraceScopeReturn),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+				}
+
+				if(_basicBlockControlFlow)
+				{
+					// Skip the very first return after testcase begin (else we get an invalid call stack)
+					// The return is only visible as transition between two basic blocks, so it is suppressed by a discontinuity marker
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckFirstReturnPending),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::MarkFirstReturn),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+					InsertBufferCheck(ins, IPOINT_TAKEN_BRANCH);
+				}
+				else
+				{
+					// ret instructions cannot be instrumented with IPOINT_AFTER, since they do have no fallthrough
+					INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::WriteBranchEntry<TraceEntryFlags::BranchTypeReturn>),
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_INST_PTR,
+						IARG_BRANCH_TARGET_ADDR,
+						IARG_BOOL, 1,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+
+					// Skip the very first return after testcase begin (else we get an invalid call stack)
+					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckFirstReturnPending),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_END);
+					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::DiscardFirstReturn),
+						IARG_REG_VALUE, _traceWriterReg,
+						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
+						IARG_END);
+					InsertBufferCheck(ins, IPOINT_TAKEN_BRANCH);
+				}
 
 				// Store stack pointer value
 				if(_enableStackAllocationTracking)
 				{
-					INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
+					INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::WriteStackPointerModificationEntry<TraceEntryFlags::StackIsReturn>),
 						IARG_REG_VALUE, _nextBufferEntryReg,
+						IARG_INST_PTR,
+						IARG_REG_VALUE, REG_RSP,
+						IARG_RETURN_REGS, _nextBufferEntryReg,
 						IARG_END);
-					INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
-                        IARG_REG_VALUE, _traceWriterReg,
+					InsertBufferCheck(ins, IPOINT_TAKEN_BRANCH);
+				}
+
+				// Close stack frame of the returning function, and record its summary
+				if(_enableStackFrameSummaries)
+				{
+					INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::LeaveStackFrames),
+						IARG_REG_VALUE, _traceWriterReg,
 						IARG_REG_VALUE, _nextBufferEntryReg,
-						IARG_INST_PTR,
 						IARG_REG_VALUE, REG_RSP,
-						IARG_UINT32, TraceEntryFlags::StackIsReturn,
 						IARG_RETURN_REGS, _nextBufferEntryReg,
 						IARG_END);
 				}
 
 #ifndef USE_LEGACY_ALLOC_RETURN_TRACKING
                 // Trace allocation function returns
-                INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(CheckNextTraceEntryPointerValid),
-                    IARG_REG_VALUE, _nextBufferEntryReg,
-                    IARG_END);
-                INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationReturn),
-                    IARG_REG_VALUE, _traceWriterReg,
-                    IARG_REG_VALUE, _nextBufferEntryReg,
-                    IARG_FUNCRET_EXITPOINT_VALUE,
-                    IARG_RETURN_REGS, _nextBufferEntryReg,
-                    IARG_END);
+                // The allocation function or a routine it tail-called returns once the stack pointer moves above the return address, so only the images of the allocation functions need this check
+                if(img != nullptr && img->ContainsAllocator())
+                {
+                    INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckAllocationReturn),
+                        IARG_REG_VALUE, _traceWriterReg,
+                        IARG_REG_VALUE, REG_RSP,
+                        IARG_END);
+                    INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationReturn),
+                        IARG_REG_VALUE, _traceWriterReg,
+                        IARG_REG_VALUE, _nextBufferEntryReg,
+                        IARG_FUNCRET_EXITPOINT_VALUE,
+                        IARG_RETURN_REGS, _nextBufferEntryReg,
+                        IARG_END);
+                }
 #endif
 				continue;
 			}
@@ -373,109 +911,272 @@ VOID InstrumentTrace(TRACE trace, [[maybe_unused]] VOID* v)
 			// ret is already tracked above; push/pop are ignored
 			if(_enableStackAllocationTracking && INS_FullRegWContain(ins, REG_RSP))
 			{
-				INS_InsertIfCall(ins, IPOINT_AFTER, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_AFTER, AFUNPTR(TraceWriter::InsertStackPointerModificationEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
+				INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(TraceWriter::WriteStackPointerModificationEntry<TraceEntryFlags::StackIsOther>),
 					IARG_REG_VALUE, _nextBufferEntryReg,
 					IARG_INST_PTR,
 					IARG_REG_VALUE, REG_RSP,
-					IARG_UINT32, TraceEntryFlags::StackIsOther,
 					IARG_RETURN_REGS, _nextBufferEntryReg,
 					IARG_END);
+				InsertBufferCheck(ins, IPOINT_AFTER);
+			}
+			if(_enableStackFrameSummaries && INS_FullRegWContain(ins, REG_RSP))
+			{
+				INS_InsertCall(ins, IPOINT_AFTER, AFUNPTR(TraceWriter::UpdateStackFrameMinimum),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, REG_RSP,
+					IARG_END);
 			}
 
 			// Trace instructions with memory read
 			if(INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
 			{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertMemoryReadEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
+				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteMemoryAccessEntry<TraceEntryTypes::MemoryRead>),
 					IARG_REG_VALUE, _nextBufferEntryReg,
 					IARG_INST_PTR,
 					IARG_MEMORYREAD_EA,
 					IARG_MEMORYREAD_SIZE,
 					IARG_RETURN_REGS, _nextBufferEntryReg,
 					IARG_END);
+				InsertBufferCheck(ins, IPOINT_BEFORE, _taintTracking);
 			}
 
 			// Trace instructions with a second memory read operand
 			if(INS_HasMemoryRead2(ins) && INS_IsStandardMemop(ins))
 			{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertMemoryReadEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
+				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteMemoryAccessEntry<TraceEntryTypes::MemoryRead>),
 					IARG_REG_VALUE, _nextBufferEntryReg,
 					IARG_INST_PTR,
 					IARG_MEMORYREAD2_EA,
 					IARG_MEMORYREAD_SIZE, // IARG_MEMORYREAD2_SIZE does not exist, but we can assume that both operands have the same size
 					IARG_RETURN_REGS, _nextBufferEntryReg,
 					IARG_END);
+				InsertBufferCheck(ins, IPOINT_BEFORE, _taintTracking);
 			}
 
 			// Trace instructions with memory write
 			if(INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
 			{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, AFUNPTR(CheckNextTraceEntryPointerValid),
-					IARG_REG_VALUE, _nextBufferEntryReg,
-					IARG_END);
-				INS_InsertThenCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::InsertMemoryWriteEntry),
-                    IARG_REG_VALUE, _traceWriterReg,
+				INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TraceWriter::WriteMemoryAccessEntry<TraceEntryTypes::MemoryWrite>),
 					IARG_REG_VALUE, _nextBufferEntryReg,
 					IARG_INST_PTR,
 					IARG_MEMORYWRITE_EA,
 					IARG_MEMORYWRITE_SIZE,
 					IARG_RETURN_REGS, _nextBufferEntryReg,
 					IARG_END);
+				InsertBufferCheck(ins, IPOINT_BEFORE, _taintTracking);
 			}
 		}
 	}
+
+	// The call sites are attributed to the image of the last basic block, as traces usually do not cross image boundaries
+	if(_collectStatistics)
+	{
+		std::string imageName = img == nullptr ? "<unknown>" : img->_name.substr(img->_name.find_last_of("/\\") + 1);
+		TraceWriter::RecordTraceInstrumentation(TRACE_Address(trace), TraceWriter::ReadTimestampCounter() - startCycles, imageName, _insertedCallSiteCount - startCallSiteCount);
+	}
 }
 
-// [Callback] Creates a new trace logger for the given new thread.
-VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[maybe_unused]] VOID* v)
+// Inserts a check whether the entry buffer is full, which flushes the buffer if necessary.
+// Both the check and the preceding entry write function are simple enough to be inlined by Pin, so only the flush itself is an actual function call.
+// If the tracing scope is limited, the preceding entry is removed again when the thread is outside of the scope.
+// If the entry is filtered by taint, it is also removed when the relevant operands of the instruction are not tainted.
+VOID InsertBufferCheck(INS ins, IPOINT ipoint, bool taintFiltered)
 {
-	// Only instrument main thread
-	if(tid == 0)
+	++_insertedCallSiteCount;
+
+	if(taintFiltered)
+	{
+		INS_InsertCall(ins, ipoint, AFUNPTR(TraceWriter::ApplyTaintFilter),
+			IARG_REG_VALUE, _traceWriterReg,
+			IARG_REG_VALUE, _nextBufferEntryReg,
+			IARG_RETURN_REGS, _nextBufferEntryReg,
+			IARG_END);
+	}
+	else if(_limitTraceScope)
 	{
-		// Create new trace logger for this thread
-		auto* traceWriter = new TraceWriter(trim(KnobOutputFilePrefix.Value()));
+		INS_InsertCall(ins, ipoint, AFUNPTR(TraceWriter::ApplyTraceScope),
+			IARG_REG_VALUE, _traceWriterReg,
+			IARG_REG_VALUE, _nextBufferEntryReg,
+			IARG_RETURN_REGS, _nextBufferEntryReg,
+			IARG_END);
+	}
 
-		// Store logger
-        PIN_SetContextReg(ctxt, _traceWriterReg, reinterpret_cast<ADDRINT>(traceWriter));
+	INS_InsertIfCall(ins, ipoint, AFUNPTR(TraceWriter::CheckBufferFull),
+		IARG_REG_VALUE, _nextBufferEntryReg,
+		IARG_REG_VALUE, _entryBufferEndReg,
+		IARG_END);
+	INS_InsertThenCall(ins, ipoint, AFUNPTR(TraceWriter::FlushBuffer),
+		IARG_REG_VALUE, _traceWriterReg,
+		IARG_REG_VALUE, _nextBufferEntryReg,
+		IARG_REG_REFERENCE, _entryBufferEndReg,
+		IARG_RETURN_REGS, _nextBufferEntryReg,
+		IARG_END);
+}
 
-		// Initialize entry buffer pointers
-		PIN_SetContextReg(ctxt, _nextBufferEntryReg, reinterpret_cast<ADDRINT>(traceWriter->Begin()));
-		PIN_SetContextReg(ctxt, _entryBufferEndReg, reinterpret_cast<ADDRINT>(traceWriter->End()));
-	}
+// Inserts the taint propagation of the given instruction, which also determines whether the instruction's trace entries are recorded.
+// The propagation is inserted before the entry writers, which are filtered using the stored taint of the instruction's address registers (or, for jumps, of all sources).
+VOID InsertTaintPropagation(INS ins, bool filtered, bool isJump)
+{
+	const InstructionTaintInfo* taintInfo = TaintTracker::AnalyzeInstruction(ins, filtered, isJump);
+	if(taintInfo == nullptr)
+		return;
+
+	// Non-standard memory operands (e.g., gather and scatter) cannot be described by a single address, so they are not shadowed
+	bool standardMemop = INS_IsStandardMemop(ins);
+	IARGLIST args = IARGLIST_Alloc();
+	if(standardMemop && INS_IsMemoryRead(ins))
+		IARGLIST_AddArguments(args, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+	else
+		IARGLIST_AddArguments(args, IARG_ADDRINT, static_cast<ADDRINT>(0), IARG_UINT32, 0, IARG_END);
+	if(standardMemop && INS_HasMemoryRead2(ins))
+		IARGLIST_AddArguments(args, IARG_MEMORYREAD2_EA, IARG_END);
 	else
+		IARGLIST_AddArguments(args, IARG_ADDRINT, static_cast<ADDRINT>(0), IARG_END);
+	if(standardMemop && INS_IsMemoryWrite(ins))
+		IARGLIST_AddArguments(args, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+	else
+		IARGLIST_AddArguments(args, IARG_ADDRINT, static_cast<ADDRINT>(0), IARG_UINT32, 0, IARG_END);
+
+	INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(TaintTracker::PropagateTaint),
+		IARG_REG_VALUE, _traceWriterReg,
+		IARG_PTR, taintInfo,
+		IARG_IARGLIST, args,
+		IARG_END);
+	IARGLIST_Free(args);
+}
+
+// Instruments the idle version of a call or return instruction, which runs outside of testcases if instrumentation is paused.
+// No entries are written, but the tracing scope, the first return after testcase start and the allocation function returns are still tracked.
+VOID InstrumentIdleControlFlow(INS ins, const ImageData* img)
+{
+	if(INS_IsCall(ins) && INS_IsControlFlow(ins))
 	{
-		// Set entry buffer pointers as null pointers
-		std::cerr << "Ignoring thread #" << tid << std::endl;
-        PIN_SetContextReg(ctxt, _traceWriterReg, 0);
-		PIN_SetContextReg(ctxt, _nextBufferEntryReg, 0);
-		PIN_SetContextReg(ctxt, _entryBufferEndReg, 0);
+		if(_limitTraceScope)
+		{
+			INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckTraceScopeActive),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_END);
+			INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackTraceScopeCall),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_END);
+		}
+	}
+	else if(INS_IsRet(ins) && INS_IsControlFlow(ins))
+	{
+		if(_limitTraceScope)
+		{
+			INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckTraceScopeActive),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_END);
+			INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackTraceScopeReturn),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_END);
+		}
+
+		// The return from PinNotifyTestcaseStart() still runs in the idle version, if it belongs to the trace which started the testcase
+		INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckFirstReturnPending),
+			IARG_REG_VALUE, _traceWriterReg,
+			IARG_END);
+		INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::SkipFirstReturn),
+			IARG_REG_VALUE, _traceWriterReg,
+			IARG_END);
+
+#ifndef USE_LEGACY_ALLOC_RETURN_TRACKING
+		// The allocation functions are also called between testcases, so their returns must be detected to stop allocation tracking
+		if(img != nullptr && img->ContainsAllocator())
+		{
+			INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TraceWriter::CheckAllocationReturn),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, REG_RSP,
+				IARG_END);
+			INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, AFUNPTR(TrackAllocationReturn),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_REG_VALUE, _nextBufferEntryReg,
+				IARG_FUNCRET_EXITPOINT_VALUE,
+				IARG_RETURN_REGS, _nextBufferEntryReg,
+				IARG_END);
+		}
+#endif
 	}
 }
 
-// [Callback] Cleans up after thread exit.
-VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] INT32 code, [[maybe_unused]] VOID* v)
+// [Callback] Creates a new trace logger for the given new thread.
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, [[maybe_unused]] INT32 flags, [[maybe_unused]] VOID* v)
 {
-	// Only the main thread is instrumented
-	if(tid != 0)
-		return;
+	// Only trace the main thread, unless all threads are requested
+	// Other threads get a trace writer as well, which discards all entries, so the inlined entry writers do not need to check them
+	bool traced = _traceAllThreads || tid == 0;
+	if(!traced)
+		std::cerr << "Ignoring thread #" << tid << std::endl;
+
+	// Create new trace logger for this thread
+	auto* traceWriter = new TraceWriter(trim(KnobOutputFilePrefix.Value()), tid, traced);
+
+	// Only traced threads propagate taint
+	if(_taintTracking && traced)
+		traceWriter->_taintState = new TaintState();
+
+	// Store logger
+	PIN_SetContextReg(ctxt, _traceWriterReg, reinterpret_cast<ADDRINT>(traceWriter));
+
+	// Initialize entry buffer pointers
+	PIN_SetContextReg(ctxt, _nextBufferEntryReg, reinterpret_cast<ADDRINT>(traceWriter->Begin()));
+	PIN_SetContextReg(ctxt, _entryBufferEndReg, reinterpret_cast<ADDRINT>(traceWriter->End()));
 
+	// Threads which are not traced, or which are created between testcases, start in the idle code version
+	if(_pauseInstrumentation)
+		PIN_SetContextReg(ctxt, _recordingReg, TraceWriter::CheckRecording(traceWriter));
+}
+
+// [Callback] Cleans up after thread exit.
+VOID ThreadFini([[maybe_unused]] THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] INT32 code, [[maybe_unused]] VOID* v)
+{
 	// Finalize trace logger of this thread
 	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
-	traceWriter->WriteBufferToFile(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)));
+	traceWriter->ThreadEnd(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)));
+	delete traceWriter->_taintState;
 	delete traceWriter;
 }
 
+// [Callback] Stops the flush threads, since internal threads must exit before the application does.
+// Entries which are written afterwards (e.g., in ThreadFini) are flushed synchronously.
+VOID PrepareForFini([[maybe_unused]] VOID* v)
+{
+	TraceWriter::StopAsyncFlushing();
+}
+
+// [Callback] Ends the trace prefix before the wrapper forks a testcase worker.
+VOID BeforeFork([[maybe_unused]] THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] VOID* v)
+{
+	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+	if(traceWriter != nullptr && traceWriter->IsTraced())
+		traceWriter->PrepareFork(reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg)));
+}
+
+// [Callback] Prepares the trace writer of the forking thread for tracing the testcase in the worker.
+VOID AfterForkInChild([[maybe_unused]] THREADID tid, const CONTEXT* ctxt, [[maybe_unused]] VOID* v)
+{
+	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+	if(traceWriter != nullptr && traceWriter->IsTraced())
+		traceWriter->ResumeAfterFork();
+}
+
+// [Callback] Remembers the buffer of read() system calls, so the data read during a testcase can be tainted.
+VOID SystemCallEntry([[maybe_unused]] THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD standard, [[maybe_unused]] VOID* v)
+{
+	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+	if(traceWriter != nullptr)
+		TaintTracker::HandleSystemCallEntry(traceWriter, ctxt, standard);
+}
+
+// [Callback] Taints the data returned by a read() system call during a testcase.
+VOID SystemCallExit([[maybe_unused]] THREADID tid, CONTEXT* ctxt, SYSCALL_STANDARD standard, [[maybe_unused]] VOID* v)
+{
+	auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+	if(traceWriter != nullptr)
+		TaintTracker::HandleSystemCallExit(traceWriter, ctxt, standard);
+}
+
 // [Callback] Instruments the memory allocation/deallocation functions.
 VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 {
@@ -488,27 +1189,21 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	INT8 interesting = (find_if(_interestingImages.begin(), _interestingImages.end(), [&](std::string& interestingImageName) { return imageNameLower.find(interestingImageName) != std::string::npos; }) != _interestingImages.end()) ? 1 : 0;
 
 	// Retrieve image memory offsets
-	UINT64 imageStart = IMG_LowAddress(img);
-	UINT64 imageEnd = IMG_HighAddress(img);
-	UINT32 numRegions = IMG_NumRegions(img);
-	for(UINT32 r = 0; r < numRegions; ++r)
-	{
-		UINT64 low = IMG_RegionLowAddress(img, r);
-		if(low < imageStart)
-			imageStart = low;
-		
-		UINT64 high = IMG_RegionHighAddress(img, r);
-		if(high > imageEnd)
-			imageEnd = high;
-	}
+	UINT64 imageStart;
+	UINT64 imageEnd;
+	GetImageBounds(img, imageStart, imageEnd);
 
 	// Record image data
 	TraceWriter::WriteImageLoadData(static_cast<int>(interesting), imageStart, imageEnd, imageName);
 
 	// Remember image for filtered trace instrumentation
-	_images.push_back(new ImageData(interesting, imageName, imageStart, imageEnd));
+	ImageData& imageData = _images.insert_or_assign(imageStart, ImageData(interesting != 0, imageName, imageStart, imageEnd)).first->second;
 	std::cerr << "Image '" << imageName << "' loaded at " << std::hex << imageStart << " ... " << std::hex << imageEnd << (interesting != 0 ? " [interesting]" : "") << std::endl;
 
+	// Symbols of interesting images which are not exported are read on demand in lazy mode
+	SymbolTable symbolTable(imageName);
+	SymbolTable* interestingSymbolTable = _lazySymbols && interesting != 0 ? &symbolTable : nullptr;
+
 	// libc?
 	if (!_libcLoadDetected && imageName.find("libc.so") != std::string::npos)
 	{
@@ -517,7 +1212,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	}
 
 	// Find the Pin notification functions to insert testcase markers
-	RTN notifyStartRtn = RTN_FindByName(img, "PinNotifyTestcaseStart");
+	RTN notifyStartRtn = FindRoutine(img, "PinNotifyTestcaseStart", interestingSymbolTable);
 	if(RTN_Valid(notifyStartRtn))
 	{
 		// Switch to next testcase
@@ -525,14 +1220,22 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		RTN_InsertCall(notifyStartRtn, IPOINT_BEFORE, AFUNPTR(TestcaseStart),
 			IARG_REG_VALUE, _traceWriterReg,
 			IARG_REG_VALUE, _nextBufferEntryReg,
+			IARG_REG_REFERENCE, _entryBufferEndReg,
             IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
 			IARG_RETURN_REGS, _nextBufferEntryReg,
 			IARG_END);
+		if(_pauseInstrumentation)
+		{
+			RTN_InsertCall(notifyStartRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::CheckRecording),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_RETURN_REGS, _recordingReg,
+				IARG_END);
+		}
 		RTN_Close(notifyStartRtn);
 
 		std::cerr << "    PinNotifyTestcaseStart() instrumented." << std::endl;
 	}
-	RTN notifyEndRtn = RTN_FindByName(img, "PinNotifyTestcaseEnd");
+	RTN notifyEndRtn = FindRoutine(img, "PinNotifyTestcaseEnd", interestingSymbolTable);
 	if(RTN_Valid(notifyEndRtn))
 	{
 		// Close testcase
@@ -542,13 +1245,20 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			IARG_REG_VALUE, _nextBufferEntryReg,
 			IARG_RETURN_REGS, _nextBufferEntryReg,
 			IARG_END);
+		if(_pauseInstrumentation)
+		{
+			RTN_InsertCall(notifyEndRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::CheckRecording),
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_RETURN_REGS, _recordingReg,
+				IARG_END);
+		}
 		RTN_Close(notifyEndRtn);
 
 		std::cerr << "    PinNotifyTestcaseEnd() instrumented." << std::endl;
 	}
 
 	// Find the Pin stack pointer notification function
-	RTN notifyStackPointerRtn = RTN_FindByName(img, "PinNotifyStackPointer");
+	RTN notifyStackPointerRtn = FindRoutine(img, "PinNotifyStackPointer", interestingSymbolTable);
 	if(RTN_Valid(notifyStackPointerRtn))
 	{
 		// Save stack pointer value
@@ -565,8 +1275,100 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		std::cerr << "    PinNotifyStackPointer() instrumented." << std::endl;
 	}
 
+	// Find the Pin secret region notification functions
+	// These feed both the secret region filter and the taint tracker
+	if(_filterSecretRegions || _taintTracking)
+	{
+		RTN notifySecretRegionRtn = FindRoutine(img, "PinNotifySecretRegion", interestingSymbolTable);
+		if(RTN_Valid(notifySecretRegionRtn))
+		{
+			RTN_Open(notifySecretRegionRtn);
+			if(_filterSecretRegions)
+			{
+				RTN_InsertCall(notifySecretRegionRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::AddSecretRegion),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
+			}
+			if(_taintTracking)
+			{
+				RTN_InsertCall(notifySecretRegionRtn, IPOINT_BEFORE, AFUNPTR(TaintTracker::TaintMemory),
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_END);
+			}
+			RTN_Close(notifySecretRegionRtn);
+
+			std::cerr << "    PinNotifySecretRegion() instrumented." << std::endl;
+		}
+
+		RTN notifyClearSecretRegionRtn = FindRoutine(img, "PinNotifyClearSecretRegion", interestingSymbolTable);
+		if(RTN_Valid(notifyClearSecretRegionRtn))
+		{
+			RTN_Open(notifyClearSecretRegionRtn);
+			if(_filterSecretRegions)
+			{
+				RTN_InsertCall(notifyClearSecretRegionRtn, IPOINT_BEFORE, AFUNPTR(TraceWriter::RemoveSecretRegion),
+					IARG_REG_VALUE, _traceWriterReg,
+					IARG_REG_VALUE, _nextBufferEntryReg,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_RETURN_REGS, _nextBufferEntryReg,
+					IARG_END);
+			}
+			if(_taintTracking)
+			{
+				RTN_InsertCall(notifyClearSecretRegionRtn, IPOINT_BEFORE, AFUNPTR(TaintTracker::UntaintMemory),
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+					IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+					IARG_END);
+			}
+			RTN_Close(notifyClearSecretRegionRtn);
+
+			std::cerr << "    PinNotifyClearSecretRegion() instrumented." << std::endl;
+		}
+	}
+
+	// Find the Pin testcase input notification function
+	if(_taintTracking && TaintTracker::SeedsFromInput())
+	{
+		RTN notifyTestcaseInputRtn = FindRoutine(img, "PinNotifyTestcaseInput", interestingSymbolTable);
+		if(RTN_Valid(notifyTestcaseInputRtn))
+		{
+			RTN_Open(notifyTestcaseInputRtn);
+			RTN_InsertCall(notifyTestcaseInputRtn, IPOINT_BEFORE, AFUNPTR(TaintTracker::TaintMemory),
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+				IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+				IARG_END);
+			RTN_Close(notifyTestcaseInputRtn);
+
+			std::cerr << "    PinNotifyTestcaseInput() instrumented." << std::endl;
+		}
+	}
+
+	// Find the routines which limit the tracing scope
+	for(const std::string& traceScopeRoutineName : _traceScopeRoutines)
+	{
+		RTN traceScopeRtn = FindRoutine(img, traceScopeRoutineName, interestingSymbolTable);
+		if(RTN_Valid(traceScopeRtn))
+		{
+			// Open tracing scope before anything else is recorded for the first instruction
+			RTN_Open(traceScopeRtn);
+			RTN_InsertCall(traceScopeRtn, IPOINT_BEFORE, AFUNPTR(EnterTraceScope),
+				IARG_CALL_ORDER, CALL_ORDER_FIRST,
+				IARG_REG_VALUE, _traceWriterReg,
+				IARG_END);
+			RTN_Close(traceScopeRtn);
+
+			std::cerr << "    " << traceScopeRoutineName << "() instrumented as tracing scope." << std::endl;
+		}
+	}
+
 	// Find the Pin allocation notification function
-	RTN notifyAllocationRtn = RTN_FindByName(img, "PinNotifyAllocation");
+	RTN notifyAllocationRtn = FindRoutine(img, "PinNotifyAllocation", interestingSymbolTable);
 	if(RTN_Valid(notifyAllocationRtn))
 	{
 		// Send allocation info
@@ -590,7 +1392,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 
 	// Find allocation and free functions to log allocation sizes and addresses
 #if defined(_WIN32)
-	RTN mallocRtn = RTN_FindByName(img, "RtlAllocateHeap");
+	RTN mallocRtn = FindRoutine(img, "RtlAllocateHeap", interestingSymbolTable);
 	if(RTN_Valid(mallocRtn))
 	{
 		// Trace size parameter
@@ -612,8 +1414,10 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			IARG_END);
 #else
         RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-           IARG_REG_VALUE, _nextBufferEntryReg,
+           IARG_REG_VALUE, _traceWriterReg,
+           IARG_REG_VALUE, REG_RSP,
            IARG_END);
+        imageData._containsAllocator = true;
 #endif
 
 		RTN_Close(mallocRtn);
@@ -621,7 +1425,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 		std::cerr << "    RtlAllocateHeap() instrumented." << std::endl;
 	}
 
-	RTN freeRtn = RTN_FindByName(img, "RtlFreeHeap");
+	RTN freeRtn = FindRoutine(img, "RtlFreeHeap", interestingSymbolTable);
 	if(RTN_Valid(freeRtn))
 	{
 		// Trace address parameter
@@ -640,7 +1444,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 	// Only instrument allocation methods from libc
 	if(imageName.find("libc.so") != std::string::npos)
 	{
-		RTN mallocRtn = RTN_FindByName(img, "malloc");
+		RTN mallocRtn = FindRoutine(img, "malloc", interestingSymbolTable);
 		if(RTN_Valid(mallocRtn))
 		{
 			// Trace size parameter
@@ -662,8 +1466,10 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(mallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
+               IARG_REG_VALUE, REG_RSP,
                IARG_END);
+            imageData._containsAllocator = true;
 #endif
 
 			RTN_Close(mallocRtn);
@@ -671,7 +1477,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			std::cerr << "    malloc() instrumented." << std::endl;
 		}
 
-		RTN callocRtn = RTN_FindByName(img, "calloc");
+		RTN callocRtn = FindRoutine(img, "calloc", interestingSymbolTable);
 		if(RTN_Valid(callocRtn))
 		{
 			// Trace size parameter
@@ -694,8 +1500,10 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(callocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
+               IARG_REG_VALUE, REG_RSP,
                IARG_END);
+            imageData._containsAllocator = true;
 #endif
 
 			RTN_Close(callocRtn);
@@ -703,7 +1511,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			std::cerr << "    calloc() instrumented." << std::endl;
 		}
 
-		RTN reallocRtn = RTN_FindByName(img, "realloc");
+		RTN reallocRtn = FindRoutine(img, "realloc", interestingSymbolTable);
 		if(RTN_Valid(reallocRtn))
 		{
 			// Trace size parameter
@@ -725,8 +1533,10 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 				IARG_END);
 #else
             RTN_InsertCall(reallocRtn, IPOINT_BEFORE, AFUNPTR(StartAllocationTracking),
-               IARG_REG_VALUE, _nextBufferEntryReg,
+               IARG_REG_VALUE, _traceWriterReg,
+               IARG_REG_VALUE, REG_RSP,
                IARG_END);
+            imageData._containsAllocator = true;
 #endif
 
 			RTN_Close(reallocRtn);
@@ -734,7 +1544,7 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 			std::cerr << "    realloc() instrumented." << std::endl;
 		}
 
-		RTN freeRtn = RTN_FindByName(img, "free");
+		RTN freeRtn = FindRoutine(img, "free", interestingSymbolTable);
 		if(RTN_Valid(freeRtn))
 		{
 			// Trace address parameter
@@ -753,22 +1563,142 @@ VOID InstrumentImage(IMG img, [[maybe_unused]] VOID* v)
 #endif
 }
 
+// [Callback] Removes unloaded images from the image index, so their address range can be reused by subsequently loaded images.
+VOID UnloadImage(IMG img, [[maybe_unused]] VOID* v)
+{
+	UINT64 imageStart;
+	UINT64 imageEnd;
+	GetImageBounds(img, imageStart, imageEnd);
+
+	if(_images.erase(imageStart) > 0)
+		std::cerr << "Image '" << IMG_Name(img) << "' unloaded" << std::endl;
+}
+
+// Determines the address range covered by the given image, including all of its regions.
+void GetImageBounds(IMG img, UINT64& imageStart, UINT64& imageEnd)
+{
+	imageStart = IMG_LowAddress(img);
+	imageEnd = IMG_HighAddress(img);
+	UINT32 numRegions = IMG_NumRegions(img);
+	for(UINT32 r = 0; r < numRegions; ++r)
+	{
+		UINT64 low = IMG_RegionLowAddress(img, r);
+		if(low < imageStart)
+			imageStart = low;
+		
+		UINT64 high = IMG_RegionHighAddress(img, r);
+		if(high > imageEnd)
+			imageEnd = high;
+	}
+}
+
+// Returns the loaded image containing the given basic block, or nullptr if there is none.
+const ImageData* FindImage(BBL bbl)
+{
+	// Find the image with the largest start address not greater than the basic block address
+	auto imageIt = _images.upper_bound(BBL_Address(bbl));
+	if(imageIt == _images.begin())
+		return nullptr;
+	--imageIt;
+
+	return imageIt->second.ContainsBasicBlock(bbl) ? &imageIt->second : nullptr;
+}
+
+// Returns the routine with the given name in the given image.
+// If the routine is unknown to Pin and a symbol table is passed, the routine is created from the respective symbol.
+RTN FindRoutine(IMG img, const std::string& name, SymbolTable* symbolTable)
+{
+	RTN rtn = RTN_FindByName(img, name.c_str());
+	if(RTN_Valid(rtn) || symbolTable == nullptr)
+		return rtn;
+
+	UINT64 symbolAddress;
+	if(!symbolTable->TryFindFunction(name, symbolAddress))
+		return RTN_Invalid();
+
+	// Without symbols, Pin may have placed the function into a larger routine
+	ADDRINT address = IMG_LoadOffset(img) + symbolAddress;
+	rtn = RTN_FindByAddress(address);
+	if(RTN_Valid(rtn) && RTN_Address(rtn) == address)
+		return rtn;
+	return RTN_CreateAt(address, name);
+}
+
 // Handles the beginning of a testcase.
-TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT newTestcaseId)
+TraceEntry* TestcaseStart(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT* entryBufferEnd, ADDRINT newTestcaseId)
 {
+	// Testcases can only be controlled from a traced thread
+	if(!traceWriter->IsTraced())
+	{
+		std::cerr << "Warning: Ignoring testcase start from untraced thread #" << std::dec << PIN_ThreadId() << std::endl;
+		return nextEntry;
+	}
+
+	// Switch the other threads first, so threads which are created in the meantime end up in the new testcase as well
+	SwitchOtherThreadsTestcase(static_cast<int>(newTestcaseId));
+
 	// Get trace logger object and set the new testcase ID
+	// The entry buffer may have been resized
 	traceWriter->TestcaseStart(static_cast<int>(newTestcaseId), nextEntry);
+	*entryBufferEnd = reinterpret_cast<ADDRINT>(traceWriter->End());
 	return traceWriter->Begin();
 }
 
 // Handles the ending of a testcase.
 TraceEntry* TestcaseEnd(TraceWriter *traceWriter, TraceEntry* nextEntry)
 {
-	// Get trace logger object and set the new testcase ID
-	traceWriter->TestcaseEnd(nextEntry);
+	if(!traceWriter->IsTraced())
+	{
+		std::cerr << "Warning: Ignoring testcase end from untraced thread #" << std::dec << PIN_ThreadId() << std::endl;
+		return nextEntry;
+	}
+
+	// Close the files of the other threads first, so they are complete when the caller is notified
+	SwitchOtherThreadsTestcase(-1);
+
+	// Get trace logger object and close the testcase
+	traceWriter->TestcaseEnd(nextEntry, true);
 	return traceWriter->Begin();
 }
 
+// Moves the trace writers of all other threads to the given testcase, or closes their testcase if the ID is -1.
+// The threads are stopped meanwhile, so their trace writers and buffer registers can be safely modified.
+VOID SwitchOtherThreadsTestcase(int testcaseId)
+{
+	if(!_traceAllThreads)
+		return;
+
+	THREADID currentTid = PIN_ThreadId();
+	if(!PIN_StopApplicationThreads(currentTid))
+	{
+		std::cerr << "Error: Could not stop application threads for switching testcase" << std::endl;
+		return;
+	}
+
+	UINT32 stoppedThreadCount = PIN_GetStoppedThreadCount();
+	for(UINT32 i = 0; i < stoppedThreadCount; ++i)
+	{
+		CONTEXT* ctxt = PIN_GetStoppedThreadWriteableContext(PIN_GetStoppedThreadId(i));
+		auto* traceWriter = reinterpret_cast<TraceWriter*>(PIN_GetContextReg(ctxt, _traceWriterReg));
+		auto* nextEntry = reinterpret_cast<TraceEntry*>(PIN_GetContextReg(ctxt, _nextBufferEntryReg));
+		if(traceWriter == nullptr || !traceWriter->IsTraced())
+			continue;
+
+		if(testcaseId == -1)
+			traceWriter->TestcaseEnd(nextEntry, false);
+		else
+			traceWriter->TestcaseStart(testcaseId, nextEntry);
+
+		// Closing the file may have switched the buffer
+		PIN_SetContextReg(ctxt, _nextBufferEntryReg, reinterpret_cast<ADDRINT>(traceWriter->Begin()));
+		PIN_SetContextReg(ctxt, _entryBufferEndReg, reinterpret_cast<ADDRINT>(traceWriter->End()));
+		if(_pauseInstrumentation)
+			PIN_SetContextReg(ctxt, _recordingReg, TraceWriter::CheckRecording(traceWriter));
+	}
+
+	PIN_ResumeApplicationThreads(currentTid);
+}
+
 // Handles an internal exception of this trace tool.
 EXCEPT_HANDLING_RESULT HandlePinToolException([[maybe_unused]] THREADID tid, EXCEPTION_INFO* exceptionInfo, [[maybe_unused]] PHYSICAL_CONTEXT* physicalContext, [[maybe_unused]] VOID* v)
 {
@@ -777,47 +1707,55 @@ EXCEPT_HANDLING_RESULT HandlePinToolException([[maybe_unused]] THREADID tid, EXC
 	return EHR_UNHANDLED;
 }
 
-// Converts the given trace entry pointer into its address integer (which is then checked for NULL by Pin).
-ADDRINT CheckNextTraceEntryPointerValid(TraceEntry* nextEntry)
+// Opens the tracing scope, if the thread is not already inside of it.
+VOID EnterTraceScope(TraceWriter *traceWriter)
 {
-	return reinterpret_cast<ADDRINT>(nextEntry);
+	if(traceWriter->_inTraceScope)
+		return;
+
+	traceWriter->_inTraceScope = 1;
+	traceWriter->_traceScopeCallDepth = 0;
 }
 
-VOID StartAllocationTracking(TraceEntry *nextEntry)
+// Increments the call depth inside the tracing scope. Only called when the thread is inside the tracing scope.
+VOID TrackTraceScopeCall(TraceWriter *traceWriter)
 {
-    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
-    if(nextEntry == nullptr)
-        return;
+	++traceWriter->_traceScopeCallDepth;
+}
 
-    _allocationCallStackDepth = 0;
+// Decrements the call depth inside the tracing scope, and closes the scope when the routine which opened it returns. Only called when the thread is inside the tracing scope.
+VOID TrackTraceScopeReturn(TraceWriter *traceWriter)
+{
+	--traceWriter->_traceScopeCallDepth;
+	if(traceWriter->_traceScopeCallDepth < 0)
+		traceWriter->_inTraceScope = 0;
 }
 
-VOID TrackAllocationCall()
+// Remembers the location of the return address of the allocation function which was just entered.
+// A nested allocation replaces the outer one, so only the innermost allocation address is recorded.
+VOID StartAllocationTracking(TraceWriter *traceWriter, ADDRINT stackPointer)
 {
-    if(_allocationCallStackDepth >= 0)
-        ++_allocationCallStackDepth;
+    traceWriter->_allocationStackPointer = stackPointer;
 }
 
-// Checks whether the current allocation tracking call stack is exited. If it is, the returned allocation address is stored in the trace.
+// Stores the returned allocation address in the trace, and stops allocation tracking. Only called when the allocation function has returned.
 TraceEntry* TrackAllocationReturn(TraceWriter *traceWriter, TraceEntry *nextEntry, ADDRINT returnValue)
 {
-    // Tracking active?
-    if(_allocationCallStackDepth < 0)
-        return nextEntry;
-
-    // Return
-    --_allocationCallStackDepth;
-
-    // Have we reached the end of the call stack?
-    if(_allocationCallStackDepth < 0)
-        return TraceWriter::InsertHeapAllocAddressReturnEntry(traceWriter, nextEntry, returnValue);
-
-    return nextEntry;
+    traceWriter->_allocationStackPointer = ~static_cast<ADDRINT>(0);
+    return TraceWriter::InsertHeapAllocAddressReturnEntry(traceWriter, nextEntry, returnValue);
 }
 
 // Overwrites the given destination register of the RDRAND instruction with a constant value.
+// Only used for 16-bit destination registers, see ReturnFixedRandomNumber() for the others.
 void ChangeRandomNumber(ADDRINT* outputReg)
 {
-	*outputReg = static_cast<ADDRINT>(_fixedRandomNumber);
+	*reinterpret_cast<UINT16*>(outputReg) = static_cast<UINT16>(_fixedRandomNumber);
+}
+
+// Returns the given constant, which is written into the full destination register of the RDRAND instruction.
+// This is simple enough to be inlined by Pin.
+ADDRINT ReturnFixedRandomNumber(ADDRINT fixedRandomNumber)
+{
+	return fixedRandomNumber;
 }
 #pragma clang diagnostic pop
\ No newline at end of file
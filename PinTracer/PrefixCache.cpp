@@ -0,0 +1,219 @@
+/* INCLUDES */
+#include "PrefixCache.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+
+
+/* TYPES */
+
+PrefixCache::PrefixCache(const std::string& directory, const std::string& outputPrefix, const std::string& settings, const std::vector<std::string>& keyFiles)
+{
+    _outputPrefix = outputPrefix;
+
+    // Derive key
+    UINT64 key = PREFIX_CACHE_HASH_BASIS;
+    for(char c : settings)
+    {
+        key ^= static_cast<UINT8>(c);
+        key *= PREFIX_CACHE_HASH_PRIME;
+    }
+    for(const std::string& keyFile : keyFiles)
+    {
+        if(!HashFile(keyFile, key))
+        {
+            std::cerr << "Error: Could not read file '" << keyFile << "' for the prefix cache key." << std::endl;
+            exit(1);
+        }
+    }
+
+    std::stringstream entryPrefixStream;
+    entryPrefixStream << directory;
+    if(!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+        entryPrefixStream << "/";
+    entryPrefixStream << std::hex << key << "_";
+    _entryPrefix = entryPrefixStream.str();
+
+    _hit = ReadManifest();
+    if(_hit)
+        std::cerr << "Found cached trace prefix '" << _entryPrefix << "'" << std::endl;
+    else
+    {
+        // Drop the contents of an incomplete entry, it is overwritten after the prefix was recorded
+        _fileNames.clear();
+        _images.clear();
+        std::cerr << "No cached trace prefix found, recording prefix to '" << _entryPrefix << "'" << std::endl;
+    }
+}
+
+bool PrefixCache::HashFile(const std::string& fileName, UINT64& hash)
+{
+    std::ifstream fileStream(fileName.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!fileStream)
+        return false;
+
+    // FNV-1a
+    std::vector<char> chunk(PREFIX_CACHE_FILE_CHUNK_SIZE);
+    UINT64 result = hash;
+    while(fileStream)
+    {
+        fileStream.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        std::streamsize length = fileStream.gcount();
+        for(std::streamsize i = 0; i < length; ++i)
+        {
+            result ^= static_cast<UINT8>(chunk[i]);
+            result *= PREFIX_CACHE_HASH_PRIME;
+        }
+    }
+    hash = result;
+    return true;
+}
+
+bool PrefixCache::CopyCacheFile(const std::string& sourceFileName, const std::string& destinationFileName)
+{
+    std::ifstream sourceFileStream(sourceFileName.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!sourceFileStream)
+        return false;
+    std::ofstream destinationFileStream(destinationFileName.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+    if(!destinationFileStream)
+        return false;
+
+    std::vector<char> chunk(PREFIX_CACHE_FILE_CHUNK_SIZE);
+    while(sourceFileStream)
+    {
+        sourceFileStream.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        destinationFileStream.write(chunk.data(), sourceFileStream.gcount());
+    }
+    return static_cast<bool>(destinationFileStream);
+}
+
+bool PrefixCache::ReadManifest()
+{
+    std::ifstream manifestFileStream((_entryPrefix + "manifest.txt").c_str(), std::ifstream::in);
+    if(!manifestFileStream)
+        return false;
+
+    // "f\t<file name>" or "i\t<hash>\t<image name>"
+    std::string line;
+    while(std::getline(manifestFileStream, line))
+    {
+        if(line.size() < 2 || line[1] != '\t')
+            continue;
+
+        if(line[0] == 'f')
+        {
+            // All files of the entry must exist
+            std::string fileName = line.substr(2);
+            std::ifstream cachedFileStream((_entryPrefix + fileName).c_str(), std::ifstream::in | std::ifstream::binary);
+            if(!cachedFileStream)
+                return false;
+            _fileNames.push_back(fileName);
+        }
+        else if(line[0] == 'i')
+        {
+            size_t separatorIndex = line.find('\t', 2);
+            if(separatorIndex == std::string::npos)
+                return false;
+            // Truncated or foreign lines invalidate the entry, so it is recorded again
+            std::string hashString = line.substr(2, separatorIndex - 2);
+            char* hashEnd;
+            errno = 0;
+            UINT64 hash = std::strtoull(hashString.c_str(), &hashEnd, 16);
+            if(hashString.empty() || *hashEnd != '\0' || errno == ERANGE)
+                return false;
+            _images.emplace_back(hash, line.substr(separatorIndex + 1));
+        }
+    }
+    return !_fileNames.empty();
+}
+
+void PrefixCache::Restore()
+{
+    for(const std::string& fileName : _fileNames)
+    {
+        if(!CopyCacheFile(_entryPrefix + fileName, _outputPrefix + fileName))
+        {
+            std::cerr << "Error: Could not restore cached prefix file '" << _entryPrefix << fileName << "'." << std::endl;
+            exit(1);
+        }
+    }
+    std::cerr << "Restored " << std::dec << _fileNames.size() << " cached prefix file(s)" << std::endl;
+}
+
+bool PrefixCache::CheckImage(const std::string& imageName)
+{
+    // Images without a file (e.g., the vDSO) are only compared by name
+    UINT64 hash = PREFIX_CACHE_HASH_BASIS;
+    if(!HashFile(imageName, hash))
+        hash = 0;
+
+    if(!_hit)
+    {
+        _images.emplace_back(hash, imageName);
+        return true;
+    }
+
+    if(_nextImageIndex >= _images.size())
+        return false;
+    const auto& expectedImage = _images[_nextImageIndex++];
+    return expectedImage.first == hash && expectedImage.second == imageName;
+}
+
+void PrefixCache::AddFile(const std::string& fileName)
+{
+    _fileNames.push_back(fileName.substr(_outputPrefix.size()));
+}
+
+void PrefixCache::Store()
+{
+    // Write the files under temporary names first, so concurrent runs never see partial files or overwrite each other's files
+    // Failures are not fatal, as the prefix itself is complete; the entry is just not stored
+    for(const std::string& fileName : _fileNames)
+    {
+        std::string cachedFileName = _entryPrefix + fileName;
+        std::string temporaryFileName = cachedFileName + "." + std::to_string(PIN_GetPid()) + ".tmp";
+        if(!CopyCacheFile(_outputPrefix + fileName, temporaryFileName))
+        {
+            std::cerr << "Warning: Could not store prefix file '" << fileName << "' in the prefix cache." << std::endl;
+            return;
+        }
+#ifdef _WIN32
+        std::remove(cachedFileName.c_str());
+#endif
+        std::rename(temporaryFileName.c_str(), cachedFileName.c_str());
+    }
+
+    // Write manifest
+    std::string manifestFileName = _entryPrefix + "manifest.txt";
+    std::string temporaryManifestFileName = manifestFileName + "." + std::to_string(PIN_GetPid()) + ".tmp";
+    {
+        std::ofstream manifestFileStream(temporaryManifestFileName.c_str(), std::ofstream::out | std::ofstream::trunc);
+        if(!manifestFileStream)
+        {
+            std::cerr << "Warning: Could not write the prefix cache manifest '" << manifestFileName << "'." << std::endl;
+            return;
+        }
+        for(const std::string& fileName : _fileNames)
+            manifestFileStream << "f\t" << fileName << "\n";
+        for(const auto& image : _images)
+            manifestFileStream << "i\t" << std::hex << image.first << "\t" << image.second << "\n";
+    }
+#ifdef _WIN32
+    std::remove(manifestFileName.c_str());
+#endif
+    std::rename(temporaryManifestFileName.c_str(), manifestFileName.c_str());
+
+    std::cerr << "Stored trace prefix in prefix cache '" << _entryPrefix << "'" << std::endl;
+}
+
+void PrefixCache::Invalidate()
+{
+    std::remove((_entryPrefix + "manifest.txt").c_str());
+    for(const std::string& fileName : _fileNames)
+        std::remove((_entryPrefix + fileName).c_str());
+
+    std::cerr << "Removed outdated cached trace prefix '" << _entryPrefix << "', the prefix is recorded again on the next run" << std::endl;
+}
@@ -0,0 +1,87 @@
+#pragma once
+/*
+Contains a persistent cache of trace prefixes, which allows repeated runs with the same target and settings to restore a previously recorded prefix instead of tracing it again.
+*/
+
+// The offset basis and prime of the FNV-1a hash, which is used for the cache key and the image hashes.
+#define PREFIX_CACHE_HASH_BASIS 0xcbf29ce484222325ull
+#define PREFIX_CACHE_HASH_PRIME 0x100000001b3ull
+
+// The size of the chunks in which files are read for hashing and copying.
+#define PREFIX_CACHE_FILE_CHUNK_SIZE (1 << 20)
+
+
+/* INCLUDES */
+#include "pin.H"
+#include <string>
+#include <vector>
+#include <utility>
+
+
+/* TYPES */
+
+// A cache directory holding trace prefixes, indexed by a key derived from the Pin tool settings and the contents of the target and the Pin tool.
+// Each entry consists of copies of the prefix files and a manifest ("<key>_manifest.txt"), which lists the files and the content hashes of the images loaded during the prefix.
+// The manifest is written last, so incomplete entries are never used.
+class PrefixCache
+{
+private:
+    // The path prefix of the files of the cache entry ("<cache directory>/<key>_").
+    std::string _entryPrefix;
+
+    // The path prefix of the output files.
+    std::string _outputPrefix;
+
+    // Determines whether the cache holds a complete entry for the key.
+    bool _hit = false;
+
+    // The names of the prefix files, relative to the output path prefix.
+    std::vector<std::string> _fileNames;
+
+    // The content hashes and names of the images loaded during the prefix. These are recorded on a cache miss, and expected on a hit.
+    std::vector<std::pair<UINT64, std::string>> _images;
+
+    // The index of the next expected image, if the cache entry is used.
+    size_t _nextImageIndex = 0;
+
+private:
+    // Adds the contents of the given file to the given FNV-1a hash.
+    // Returns false if the file cannot be read.
+    static bool HashFile(const std::string& fileName, UINT64& hash);
+
+    // Copies the given file. Returns false if one of the files cannot be opened.
+    static bool CopyCacheFile(const std::string& sourceFileName, const std::string& destinationFileName);
+
+    // Reads the manifest of the cache entry. Returns false if the entry does not exist or is incomplete.
+    bool ReadManifest();
+
+public:
+    // Derives the cache key and looks up the corresponding cache entry.
+    // -> directory: The cache directory, which must already exist.
+    // -> outputPrefix: The path prefix of the output files.
+    // -> settings: The settings which influence the prefix, e.g., the command lines of Pin tool and target.
+    // -> keyFiles: The files whose contents influence the prefix, e.g., the target executable and the Pin tool.
+    PrefixCache(const std::string& directory, const std::string& outputPrefix, const std::string& settings, const std::vector<std::string>& keyFiles);
+
+    // Returns whether the cache holds a prefix for the current settings.
+    bool IsHit() const { return _hit; }
+
+    // Returns the path prefix of the files of the cache entry.
+    const std::string& GetEntryPrefix() const { return _entryPrefix; }
+
+    // Copies the cached prefix files to the output path prefix.
+    void Restore();
+
+    // Checks the given image, which was loaded during the prefix, against the cache entry, or records it for storing the entry.
+    // Returns false if the image does not match the cache entry.
+    bool CheckImage(const std::string& imageName);
+
+    // Adds the given prefix file, which must reside at the output path prefix, to the files of the cache entry.
+    void AddFile(const std::string& fileName);
+
+    // Stores the prefix files and the manifest as cache entry, after the prefix was recorded.
+    void Store();
+
+    // Removes an outdated cache entry, so the prefix is recorded again on the next run.
+    void Invalidate();
+};
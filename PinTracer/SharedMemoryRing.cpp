@@ -0,0 +1,108 @@
+/* INCLUDES */
+#include "SharedMemoryRing.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+
+/* TYPES */
+
+SharedMemoryRing::SharedMemoryRing(const std::string& fileName, UINT64 capacity)
+{
+    _fileName = fileName;
+    _capacity = capacity;
+
+#ifdef _WIN32
+    std::cerr << "Error: Shared memory trace output is not supported on Windows." << std::endl;
+    exit(1);
+#else
+    // Create file with the desired size
+    int fd = open(_fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0)
+    {
+        std::cerr << "Error: Could not create shared memory file '" << _fileName << "'." << std::endl;
+        exit(1);
+    }
+    size_t mappingSize = sizeof(SharedMemoryRingHeader) + _capacity;
+    if(ftruncate(fd, static_cast<off_t>(mappingSize)) != 0)
+    {
+        std::cerr << "Error: Could not resize shared memory file '" << _fileName << "'." << std::endl;
+        exit(1);
+    }
+
+    // Map file; the mapping stays valid after closing the descriptor
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "Error: Could not map shared memory file '" << _fileName << "'." << std::endl;
+        exit(1);
+    }
+    _header = static_cast<SharedMemoryRingHeader*>(mapping);
+    _data = static_cast<UINT8*>(mapping) + sizeof(SharedMemoryRingHeader);
+
+    // Initialize header
+    _header->Magic = SHARED_MEMORY_RING_MAGIC;
+    _header->Version = SHARED_MEMORY_RING_VERSION;
+    _header->Capacity = _capacity;
+    _header->WriteOffset = 0;
+    _header->ReadOffset = 0;
+#endif
+
+    std::cerr << "Writing traces to shared memory file '" << _fileName << "' (" << std::dec << (_capacity >> 20) << " MB)" << std::endl;
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+#ifndef _WIN32
+    if(_header != nullptr)
+        munmap(_header, sizeof(SharedMemoryRingHeader) + _capacity);
+#endif
+}
+
+void SharedMemoryRing::BeginSegment()
+{
+    _segmentStart = _header->WriteOffset;
+}
+
+void SharedMemoryRing::Write(const void* data, size_t length)
+{
+    UINT64 writeOffset = _header->WriteOffset;
+
+    // The consumer only releases complete segments, so a segment must fit into the ring
+    if(writeOffset + length - _segmentStart > _capacity)
+    {
+        std::cerr << "Error: Trace does not fit into shared memory ring (" << std::dec << (_capacity >> 20) << " MB), please increase its size." << std::endl;
+        exit(1);
+    }
+
+    // Wait until the consumer has released enough space
+    while(writeOffset + length - _header->ReadOffset > _capacity)
+        PIN_Sleep(1);
+
+    // Copy data, wrapping around at the end of the data area
+    size_t position = static_cast<size_t>(writeOffset % _capacity);
+    size_t firstPartLength = std::min(length, static_cast<size_t>(_capacity - position));
+    memcpy(_data + position, data, firstPartLength);
+    memcpy(_data, static_cast<const UINT8*>(data) + firstPartLength, length - firstPartLength);
+
+    _header->WriteOffset = writeOffset + length;
+}
+
+void SharedMemoryRing::EndSegment(UINT64& start, UINT64& length)
+{
+    // Make sure that the segment contents are visible before it is announced
+#ifndef _WIN32
+    __sync_synchronize();
+#endif
+
+    start = _segmentStart;
+    length = _header->WriteOffset - _segmentStart;
+    _segmentStart = _header->WriteOffset;
+}
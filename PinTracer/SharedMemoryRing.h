@@ -0,0 +1,86 @@
+#pragma once
+/*
+Contains a ring buffer in a shared memory file, which transfers trace data to the trace preprocessor without going through the file system.
+*/
+
+// The magic number at the beginning of a shared memory ring file ("MWRB").
+#define SHARED_MEMORY_RING_MAGIC 0x4252574D
+
+// The current version of the shared memory ring layout.
+#define SHARED_MEMORY_RING_VERSION 1
+
+
+/* INCLUDES */
+#include "pin.H"
+#include <string>
+
+
+/* TYPES */
+
+// Header at the beginning of a shared memory ring file. The data area follows directly after the header.
+// All offsets are monotonically increasing byte counts; the position in the data area is the offset modulo the capacity.
+#pragma pack(push, 1)
+struct SharedMemoryRingHeader
+{
+    // The magic number SHARED_MEMORY_RING_MAGIC.
+    UINT32 Magic;
+
+    // The layout version SHARED_MEMORY_RING_VERSION.
+    UINT32 Version;
+
+    // The size of the data area.
+    UINT64 Capacity;
+
+    // The offset after the last byte written by the producer (the Pin tool).
+    volatile UINT64 WriteOffset;
+
+    // The offset after the last byte released by the consumer (the trace preprocessor). The producer does not overwrite data after this offset.
+    volatile UINT64 ReadOffset;
+
+    // (Padding to 64 bytes)
+    UINT8 _reserved[32];
+};
+#pragma pack(pop)
+static_assert(sizeof(SharedMemoryRingHeader) == 64, "Wrong size of SharedMemoryRingHeader struct");
+
+// A single-producer ring buffer in a memory-mapped file.
+// Data is written in segments (one per trace file), which are announced to the consumer after they are complete.
+// If the ring is full, the producer waits until the consumer releases old segments.
+class SharedMemoryRing
+{
+private:
+    // The name of the shared memory file.
+    std::string _fileName;
+
+    // The mapped header of the shared memory file.
+    SharedMemoryRingHeader* _header = nullptr;
+
+    // The mapped data area.
+    UINT8* _data = nullptr;
+
+    // The size of the data area.
+    UINT64 _capacity;
+
+    // The offset of the currently written segment.
+    UINT64 _segmentStart = 0;
+
+public:
+    // Creates and maps the given shared memory file. Existing files are overwritten.
+    // -> fileName: The path of the shared memory file, usually on a memory-backed file system like /dev/shm.
+    // -> capacity: The size of the data area.
+    SharedMemoryRing(const std::string& fileName, UINT64 capacity);
+
+    // Unmaps the shared memory file.
+    ~SharedMemoryRing();
+
+    // Starts a new segment at the current write offset.
+    void BeginSegment();
+
+    // Appends the given data to the current segment. Blocks until the consumer has released enough space.
+    void Write(const void* data, size_t length);
+
+    // Completes the current segment and makes its contents visible to the consumer.
+    // -> start: Receives the offset of the segment.
+    // -> length: Receives the length of the segment.
+    void EndSegment(UINT64& start, UINT64& length);
+};
@@ -0,0 +1,148 @@
+/* INCLUDES */
+#include "SymbolTable.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+
+/* TYPES */
+
+// The parts of the ELF64 structures which are needed for reading the symbol table.
+#pragma pack(push, 1)
+struct Elf64FileHeader
+{
+    UINT8 Ident[16];
+    UINT16 Type;
+    UINT16 Machine;
+    UINT32 Version;
+    UINT64 Entry;
+    UINT64 ProgramHeaderOffset;
+    UINT64 SectionHeaderOffset;
+    UINT32 Flags;
+    UINT16 HeaderSize;
+    UINT16 ProgramHeaderEntrySize;
+    UINT16 ProgramHeaderCount;
+    UINT16 SectionHeaderEntrySize;
+    UINT16 SectionHeaderCount;
+    UINT16 SectionNameTableIndex;
+};
+static_assert(sizeof(Elf64FileHeader) == 64, "Wrong size of Elf64FileHeader struct");
+
+struct Elf64SectionHeader
+{
+    UINT32 Name;
+    UINT32 Type;
+    UINT64 Flags;
+    UINT64 Address;
+    UINT64 Offset;
+    UINT64 Size;
+    UINT32 Link;
+    UINT32 Info;
+    UINT64 AddressAlignment;
+    UINT64 EntrySize;
+};
+static_assert(sizeof(Elf64SectionHeader) == 64, "Wrong size of Elf64SectionHeader struct");
+
+struct Elf64Symbol
+{
+    UINT32 Name;
+    UINT8 Info;
+    UINT8 Other;
+    UINT16 SectionIndex;
+    UINT64 Value;
+    UINT64 Size;
+};
+static_assert(sizeof(Elf64Symbol) == 24, "Wrong size of Elf64Symbol struct");
+#pragma pack(pop)
+
+// Section type of the static symbol table.
+#define ELF_SECTION_TYPE_SYMTAB 2
+
+// Symbol type of functions.
+#define ELF_SYMBOL_TYPE_FUNC 2
+
+SymbolTable::SymbolTable(const std::string& imageFileName)
+{
+    _imageFileName = imageFileName;
+}
+
+bool SymbolTable::TryFindFunction(const std::string& name, UINT64& address)
+{
+    if(!_loaded)
+    {
+        Load();
+        _loaded = true;
+    }
+
+    auto functionIt = _functionAddresses.find(name);
+    if(functionIt == _functionAddresses.end())
+        return false;
+
+    address = functionIt->second;
+    return true;
+}
+
+void SymbolTable::Load()
+{
+#ifdef _WIN32
+    std::cerr << "Warning: Reading symbols of image '" << _imageFileName << "' is not supported on Windows, only exported functions are found." << std::endl;
+#else
+    std::ifstream imageFileStream(_imageFileName.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!imageFileStream)
+    {
+        std::cerr << "Warning: Could not open image file '" << _imageFileName << "' for reading symbols." << std::endl;
+        return;
+    }
+
+    // Check file header: 64-bit little endian ELF
+    Elf64FileHeader fileHeader{};
+    if(!imageFileStream.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader))
+       || memcmp(fileHeader.Ident, "\x7f" "ELF", 4) != 0 || fileHeader.Ident[4] != 2 || fileHeader.Ident[5] != 1
+       || fileHeader.SectionHeaderEntrySize != sizeof(Elf64SectionHeader))
+    {
+        std::cerr << "Warning: Image file '" << _imageFileName << "' is not a supported ELF file, cannot read symbols." << std::endl;
+        return;
+    }
+
+    // Read section headers
+    std::vector<Elf64SectionHeader> sectionHeaders(fileHeader.SectionHeaderCount);
+    imageFileStream.seekg(static_cast<std::streamoff>(fileHeader.SectionHeaderOffset));
+    if(!imageFileStream.read(reinterpret_cast<char*>(sectionHeaders.data()), static_cast<std::streamsize>(sectionHeaders.size() * sizeof(Elf64SectionHeader))))
+    {
+        std::cerr << "Warning: Could not read section headers of image file '" << _imageFileName << "'." << std::endl;
+        return;
+    }
+
+    for(const Elf64SectionHeader& sectionHeader : sectionHeaders)
+    {
+        if(sectionHeader.Type != ELF_SECTION_TYPE_SYMTAB || sectionHeader.Link >= sectionHeaders.size())
+            continue;
+
+        // Read symbols and the associated string table
+        const Elf64SectionHeader& stringTableHeader = sectionHeaders[sectionHeader.Link];
+        std::vector<Elf64Symbol> symbols(sectionHeader.Size / sizeof(Elf64Symbol));
+        std::vector<char> strings(stringTableHeader.Size + 1, '\0');
+        imageFileStream.seekg(static_cast<std::streamoff>(sectionHeader.Offset));
+        imageFileStream.read(reinterpret_cast<char*>(symbols.data()), static_cast<std::streamsize>(symbols.size() * sizeof(Elf64Symbol)));
+        imageFileStream.seekg(static_cast<std::streamoff>(stringTableHeader.Offset));
+        imageFileStream.read(strings.data(), static_cast<std::streamsize>(stringTableHeader.Size));
+        if(!imageFileStream)
+        {
+            std::cerr << "Warning: Could not read symbol table of image file '" << _imageFileName << "'." << std::endl;
+            return;
+        }
+
+        for(const Elf64Symbol& symbol : symbols)
+        {
+            // Skip undefined symbols
+            if((symbol.Info & 0x0F) != ELF_SYMBOL_TYPE_FUNC || symbol.SectionIndex == 0 || symbol.Name >= stringTableHeader.Size)
+                continue;
+
+            _functionAddresses.emplace(&strings[symbol.Name], symbol.Value);
+        }
+    }
+
+    std::cerr << "    Read " << std::dec << _functionAddresses.size() << " function symbols from image file" << std::endl;
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+Contains a reader for the function symbols of image files, for resolving routines which are not known to Pin when only export symbols are loaded.
+*/
+
+
+/* INCLUDES */
+#include "pin.H"
+#include <string>
+#include <unordered_map>
+
+
+/* TYPES */
+
+// Reads the function symbols of an ELF image file on first use.
+// Only the static symbol table (.symtab) is read, since the dynamic symbol table is already covered by Pin's export symbols.
+class SymbolTable
+{
+private:
+    // The path of the image file.
+    std::string _imageFileName;
+
+    // Determines whether the symbols have already been read.
+    bool _loaded = false;
+
+    // The addresses of the function symbols (relative to the image load address), indexed by name.
+    std::unordered_map<std::string, UINT64> _functionAddresses;
+
+private:
+    // Reads the function symbols from the image file.
+    void Load();
+
+public:
+    // Creates a new symbol table for the given image file. The file is not read until the first lookup.
+    explicit SymbolTable(const std::string& imageFileName);
+
+    // Looks up the address of the given function, relative to the image load address.
+    // Returns false if there is no such function, or if the symbols cannot be read.
+    bool TryFindFunction(const std::string& name, UINT64& address);
+};
@@ -0,0 +1,295 @@
+/* INCLUDES */
+#include "TaintTracker.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+
+/* STATIC VARIABLES */
+
+bool TaintTracker::_seedFromInput = false;
+std::unordered_map<ADDRINT, UINT8*> TaintTracker::_shadowPages;
+ADDRINT TaintTracker::_lastShadowPageAddress = ~static_cast<ADDRINT>(0);
+UINT8* TaintTracker::_lastShadowPage = nullptr;
+std::unordered_map<ADDRINT, InstructionTaintInfo> TaintTracker::_instructionTaintInfos;
+
+
+/* FUNCTIONS */
+
+// Returns whether the given register is an explicit register operand of the given instruction.
+static bool IsExplicitRegisterOperand(INS ins, REG fullReg)
+{
+    for(UINT32 i = 0; i < INS_OperandCount(ins); ++i)
+    {
+        if(INS_OperandIsReg(ins, i) && !INS_OperandIsImplicit(ins, i) && REG_FullRegName(INS_OperandReg(ins, i)) == fullReg)
+            return true;
+    }
+    return false;
+}
+
+// Returns whether the given instruction always produces zero, independently of its operand values (e.g., "xor eax, eax").
+static bool IsZeroIdiom(INS ins)
+{
+    UINT32 firstOperand;
+    switch(INS_Opcode(ins))
+    {
+        case XED_ICLASS_XOR:
+        case XED_ICLASS_SUB:
+        case XED_ICLASS_PXOR:
+        case XED_ICLASS_XORPS:
+        case XED_ICLASS_XORPD:
+            firstOperand = 0;
+            break;
+
+        // The VEX encoded variants have a separate destination operand
+        case XED_ICLASS_VPXOR:
+        case XED_ICLASS_VXORPS:
+        case XED_ICLASS_VXORPD:
+            firstOperand = 1;
+            break;
+
+        default:
+            return false;
+    }
+
+    return INS_OperandCount(ins) > firstOperand + 1
+        && INS_OperandIsReg(ins, firstOperand) && INS_OperandIsReg(ins, firstOperand + 1)
+        && INS_OperandReg(ins, firstOperand) == INS_OperandReg(ins, firstOperand + 1);
+}
+
+// Adds the given register to the given register list, if it is not yet contained.
+// Returns the index of the register, or -1 if the list is full.
+static int AddRegister(UINT16* registers, UINT8& count, UINT32 maxCount, REG reg)
+{
+    for(UINT8 i = 0; i < count; ++i)
+    {
+        if(registers[i] == static_cast<UINT16>(reg))
+            return i;
+    }
+
+    if(count == maxCount)
+        return -1;
+    registers[count] = static_cast<UINT16>(reg);
+    return count++;
+}
+
+
+/* TYPES */
+
+UINT8* TaintTracker::GetShadowPage(ADDRINT address, bool create)
+{
+    ADDRINT pageAddress = address & ~static_cast<ADDRINT>(TAINT_SHADOW_PAGE_SIZE - 1);
+    if(pageAddress == _lastShadowPageAddress && (_lastShadowPage != nullptr || !create))
+        return _lastShadowPage;
+
+    UINT8* page = nullptr;
+    auto pageIt = _shadowPages.find(pageAddress);
+    if(pageIt != _shadowPages.end())
+        page = pageIt->second;
+    else if(create)
+    {
+        page = new UINT8[TAINT_SHADOW_PAGE_SIZE];
+        memset(page, 0, TAINT_SHADOW_PAGE_SIZE);
+        _shadowPages[pageAddress] = page;
+    }
+
+    _lastShadowPageAddress = pageAddress;
+    _lastShadowPage = page;
+    return page;
+}
+
+UINT8 TaintTracker::ReadMemoryTaint(ADDRINT address, UINT64 size)
+{
+    UINT8 taint = 0;
+    while(size > 0)
+    {
+        // Handle the part of the range which is in the current page
+        UINT64 pageOffset = address & (TAINT_SHADOW_PAGE_SIZE - 1);
+        UINT64 chunkSize = std::min(size, TAINT_SHADOW_PAGE_SIZE - pageOffset);
+        UINT8* page = GetShadowPage(address, false);
+        if(page != nullptr)
+        {
+            for(UINT64 i = 0; i < chunkSize; ++i)
+                taint |= page[pageOffset + i];
+        }
+
+        address += chunkSize;
+        size -= chunkSize;
+    }
+    return taint;
+}
+
+void TaintTracker::WriteMemoryTaint(ADDRINT address, UINT64 size, UINT8 taint)
+{
+    while(size > 0)
+    {
+        // Handle the part of the range which is in the current page
+        // Untainted memory does not need a shadow page
+        UINT64 pageOffset = address & (TAINT_SHADOW_PAGE_SIZE - 1);
+        UINT64 chunkSize = std::min(size, TAINT_SHADOW_PAGE_SIZE - pageOffset);
+        UINT8* page = GetShadowPage(address, taint != 0);
+        if(page != nullptr)
+            memset(page + pageOffset, taint, chunkSize);
+
+        address += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+void TaintTracker::Init(bool seedFromInput)
+{
+    _seedFromInput = seedFromInput;
+    if(seedFromInput)
+        std::cerr << "Taint tracking enabled, seeded from the secret regions and the testcase input" << std::endl;
+    else
+        std::cerr << "Taint tracking enabled, seeded from the secret regions" << std::endl;
+}
+
+const InstructionTaintInfo* TaintTracker::AnalyzeInstruction(INS ins, bool filtered, bool isJump)
+{
+    InstructionTaintInfo info;
+    info.FiltersBySources = isJump;
+    info.ClearsDestinations = IsZeroIdiom(ins);
+
+    // Address registers of the memory operands
+    // The address generator of "lea" does not access memory, so its registers are only sources
+    for(UINT32 i = 0; i < INS_OperandCount(ins); ++i)
+    {
+        if(!INS_OperandIsMemory(ins, i) || INS_OperandIsAddressGenerator(ins, i))
+            continue;
+
+        REG baseReg = INS_OperandMemoryBaseReg(ins, i);
+        if(REG_valid(baseReg) && baseReg != REG_INST_PTR && REG_FullRegName(baseReg) != REG_RIP)
+            AddRegister(info.AddressRegisters, info.AddressRegisterCount, MAX_TAINT_ADDRESS_REGISTERS, REG_FullRegName(baseReg));
+        REG indexReg = INS_OperandMemoryIndexReg(ins, i);
+        if(REG_valid(indexReg))
+            AddRegister(info.AddressRegisters, info.AddressRegisterCount, MAX_TAINT_ADDRESS_REGISTERS, REG_FullRegName(indexReg));
+    }
+
+    // Source registers
+    // RegR also contains the address registers. These only taint the result if memory is read, e.g. for table lookups, but not for pure stores.
+    // The implicit stack pointer accesses of push, pop, call and ret are ignored, else a single pushed secret would taint all subsequent stack accesses.
+    bool readsMemory = INS_IsMemoryRead(ins);
+    for(UINT32 i = 0; i < INS_MaxNumRRegs(ins); ++i)
+    {
+        REG reg = REG_FullRegName(INS_RegR(ins, i));
+        if(!REG_valid(reg) || reg == REG_INST_PTR || reg == REG_RIP)
+            continue;
+        if(reg == REG_STACK_PTR && !IsExplicitRegisterOperand(ins, reg))
+            continue;
+
+        bool isAddressRegister = false;
+        for(UINT8 j = 0; j < info.AddressRegisterCount; ++j)
+            isAddressRegister |= info.AddressRegisters[j] == static_cast<UINT16>(reg);
+        if(isAddressRegister && !readsMemory && !IsExplicitRegisterOperand(ins, reg))
+            continue;
+
+        // If there are too many sources, the remaining ones are dropped; this only affects a few complex instructions
+        AddRegister(info.SourceRegisters, info.SourceRegisterCount, MAX_TAINT_REGISTERS, reg);
+    }
+
+    // Destination registers
+    for(UINT32 i = 0; i < INS_MaxNumWRegs(ins); ++i)
+    {
+        REG reg = INS_RegW(ins, i);
+        REG fullReg = REG_FullRegName(reg);
+        if(!REG_valid(fullReg) || fullReg == REG_INST_PTR || fullReg == REG_RIP)
+            continue;
+        if(fullReg == REG_STACK_PTR && !IsExplicitRegisterOperand(ins, fullReg))
+            continue;
+
+        int index = AddRegister(info.DestinationRegisters, info.DestinationRegisterCount, MAX_TAINT_REGISTERS, fullReg);
+        if(index < 0)
+            continue;
+
+        // Writes to 32-bit general purpose registers clear the upper half, and the flags are always considered as a whole
+        if(fullReg != reg && !REG_is_gr32(reg) && !REG_is_flags(reg))
+            info.PartialDestinationMask |= static_cast<UINT8>(1 << index);
+    }
+
+    // Instructions without any effect on the taint state do not need to be instrumented, unless their entries are filtered
+    if(!filtered && info.DestinationRegisterCount == 0 && !INS_IsMemoryWrite(ins))
+        return nullptr;
+
+    // The instruction may be instrumented several times, e.g. if it is part of multiple traces, but its rule does not change
+    InstructionTaintInfo& storedInfo = _instructionTaintInfos[INS_Address(ins)];
+    storedInfo = info;
+    return &storedInfo;
+}
+
+void TaintTracker::PropagateTaint(TraceWriter* traceWriter, const InstructionTaintInfo* info, ADDRINT readAddress, UINT32 readSize, ADDRINT read2Address, ADDRINT writeAddress, UINT32 writeSize)
+{
+    // Only traced threads have a taint state
+    TaintState* state = traceWriter->_taintState;
+    if(state == nullptr)
+        return;
+
+    // Combine taint of the source operands
+    UINT8 sourceTaint = 0;
+    for(UINT8 i = 0; i < info->SourceRegisterCount; ++i)
+        sourceTaint |= state->RegisterTaint[info->SourceRegisters[i]];
+    if(readSize > 0)
+    {
+        sourceTaint |= ReadMemoryTaint(readAddress, readSize);
+        if(read2Address != 0)
+            sourceTaint |= ReadMemoryTaint(read2Address, readSize);
+    }
+
+    UINT8 addressTaint = 0;
+    for(UINT8 i = 0; i < info->AddressRegisterCount; ++i)
+        addressTaint |= state->RegisterTaint[info->AddressRegisters[i]];
+
+    // Store whether the trace entries of this instruction are recorded
+    // This happens before the destination taint is updated, so a jump which overwrites its source (e.g., "loop") is judged by the old value
+    traceWriter->_taintedOperands = (info->FiltersBySources ? (sourceTaint | addressTaint) : addressTaint) != 0 ? 1 : 0;
+
+    // Update destination operands
+    UINT8 resultTaint = info->ClearsDestinations ? 0 : sourceTaint;
+    for(UINT8 i = 0; i < info->DestinationRegisterCount; ++i)
+    {
+        if(info->PartialDestinationMask & (1 << i))
+            state->RegisterTaint[info->DestinationRegisters[i]] |= resultTaint;
+        else
+            state->RegisterTaint[info->DestinationRegisters[i]] = resultTaint;
+    }
+    if(writeSize > 0)
+        WriteMemoryTaint(writeAddress, writeSize, resultTaint);
+}
+
+VOID TaintTracker::TaintMemory(ADDRINT address, UINT64 size)
+{
+    WriteMemoryTaint(address, size, 1);
+}
+
+VOID TaintTracker::UntaintMemory(ADDRINT address, UINT64 size)
+{
+    WriteMemoryTaint(address, size, 0);
+}
+
+void TaintTracker::HandleSystemCallEntry(TraceWriter* traceWriter, CONTEXT* ctxt, SYSCALL_STANDARD standard)
+{
+#ifndef _WIN32
+    // read(fd, buffer, count) has number 0 on x86-64 Linux
+    if(traceWriter->_taintState == nullptr)
+        return;
+    if(_seedFromInput && traceWriter->IsInTestcase() && PIN_GetSyscallNumber(ctxt, standard) == 0)
+        traceWriter->_taintState->PendingReadBuffer = PIN_GetSyscallArgument(ctxt, standard, 1);
+    else
+        traceWriter->_taintState->PendingReadBuffer = 0;
+#endif
+}
+
+void TaintTracker::HandleSystemCallExit(TraceWriter* traceWriter, CONTEXT* ctxt, SYSCALL_STANDARD standard)
+{
+#ifndef _WIN32
+    TaintState* state = traceWriter->_taintState;
+    if(state == nullptr || state->PendingReadBuffer == 0)
+        return;
+
+    // The return value is the number of bytes read, or a negative error code
+    ADDRINT bytesRead = PIN_GetSyscallReturn(ctxt, standard);
+    if(static_cast<INT64>(bytesRead) > 0)
+        WriteMemoryTaint(state->PendingReadBuffer, bytesRead, 1);
+    state->PendingReadBuffer = 0;
+#endif
+}
@@ -0,0 +1,119 @@
+#pragma once
+/*
+Contains a lightweight taint tracker, which determines the registers and memory bytes that depend on secret data.
+*/
+
+// The maximum number of source or destination registers of an instruction, which are considered for taint propagation.
+#define MAX_TAINT_REGISTERS 8
+
+// The maximum number of address registers of an instruction (base and index register of up to two memory operands).
+#define MAX_TAINT_ADDRESS_REGISTERS 4
+
+// The size of a shadow memory page.
+#define TAINT_SHADOW_PAGE_SIZE 4096
+
+
+/* INCLUDES */
+#include "pin.H"
+#include "TraceWriter.h"
+#include <unordered_map>
+
+
+/* TYPES */
+
+// The taint propagation rule of an instruction, which is derived once when the instruction is instrumented.
+struct InstructionTaintInfo
+{
+    // The full registers whose taint flows into the destination operands.
+    UINT16 SourceRegisters[MAX_TAINT_REGISTERS];
+    UINT8 SourceRegisterCount = 0;
+
+    // The full registers which receive the taint of the source operands.
+    UINT16 DestinationRegisters[MAX_TAINT_REGISTERS];
+    UINT8 DestinationRegisterCount = 0;
+
+    // Bit mask of the destination registers which are only partially written, and thus keep their previous taint.
+    UINT8 PartialDestinationMask = 0;
+
+    // The base and index registers of the memory operands.
+    UINT16 AddressRegisters[MAX_TAINT_ADDRESS_REGISTERS];
+    UINT8 AddressRegisterCount = 0;
+
+    // Determines whether the destination operands are untainted regardless of the source operands (e.g., "xor eax, eax").
+    bool ClearsDestinations = false;
+
+    // Determines whether the trace entry of the instruction is recorded depending on the taint of its source operands, instead of its memory addresses.
+    // This is the case for jumps, which depend on the flags or on the target register.
+    bool FiltersBySources = false;
+};
+
+// The taint state of a thread.
+struct TaintState
+{
+    // The taint of each full register, indexed by its REG value.
+    UINT8 RegisterTaint[REG_LAST] = {};
+
+    // The buffer of a pending read() system call during a testcase, whose result is tainted as testcase input.
+    ADDRINT PendingReadBuffer = 0;
+};
+
+// Propagates taint through registers and memory, and decides which memory accesses and jumps are secret-dependent.
+// Memory is shadowed byte-wise, registers as a whole. Only one thread is supported, since the shadow memory is not synchronized.
+class TaintTracker
+{
+private:
+    // Determines whether the data read by the traced thread during a testcase is tainted, in addition to the secret regions.
+    static bool _seedFromInput;
+
+    // The shadow memory pages, indexed by their page address. Each byte holds the taint of the respective memory byte.
+    static std::unordered_map<ADDRINT, UINT8*> _shadowPages;
+
+    // The address of the most recently used shadow memory page.
+    static ADDRINT _lastShadowPageAddress;
+
+    // The most recently used shadow memory page, or nullptr if it does not exist.
+    static UINT8* _lastShadowPage;
+
+    // The propagation rules of all instrumented instructions, indexed by instruction address.
+    static std::unordered_map<ADDRINT, InstructionTaintInfo> _instructionTaintInfos;
+
+private:
+    // Returns the shadow page of the given address, or nullptr if it does not exist and should not be created.
+    static UINT8* GetShadowPage(ADDRINT address, bool create);
+
+    // Returns the combined taint of the given memory bytes.
+    static UINT8 ReadMemoryTaint(ADDRINT address, UINT64 size);
+
+    // Sets the taint of the given memory bytes.
+    static void WriteMemoryTaint(ADDRINT address, UINT64 size, UINT8 taint);
+
+public:
+    // Enables taint tracking.
+    // -> seedFromInput: Determines whether the data read by the traced thread during a testcase and the testcase buffers of the wrapper are tainted, in addition to the secret regions.
+    static void Init(bool seedFromInput);
+
+    // Returns whether the testcase input is tainted.
+    static bool SeedsFromInput() { return _seedFromInput; }
+
+    // Derives the taint propagation rule of the given instruction.
+    // Returns nullptr if the instruction does not propagate any taint, and its trace entries are not filtered.
+    // -> filtered: Determines whether the trace entries of the instruction are filtered by taint.
+    // -> isJump: Determines whether the instruction's Branch entry is filtered by the taint of its source operands.
+    static const InstructionTaintInfo* AnalyzeInstruction(INS ins, bool filtered, bool isJump);
+
+    // Propagates the taint of the given instruction, and stores whether its trace entries are recorded.
+    // Memory operands which are not accessed by the instruction have a size of 0.
+    static void PropagateTaint(TraceWriter* traceWriter, const InstructionTaintInfo* info, ADDRINT readAddress, UINT32 readSize, ADDRINT read2Address, ADDRINT writeAddress, UINT32 writeSize);
+
+    // Taints the given memory range.
+    static VOID TaintMemory(ADDRINT address, UINT64 size);
+
+    // Removes the taint of the given memory range.
+    static VOID UntaintMemory(ADDRINT address, UINT64 size);
+
+    // Remembers the buffer of a read() system call during a testcase, if the testcase input is tainted.
+    static void HandleSystemCallEntry(TraceWriter* traceWriter, CONTEXT* ctxt, SYSCALL_STANDARD standard);
+
+    // Taints the data returned by a pending read() system call.
+    static void HandleSystemCallExit(TraceWriter* traceWriter, CONTEXT* ctxt, SYSCALL_STANDARD standard);
+};
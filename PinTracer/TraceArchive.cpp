@@ -0,0 +1,136 @@
+/* INCLUDES */
+#include "TraceArchive.h"
+#include <iostream>
+#include <sstream>
+#include <cstddef>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+/* TYPES */
+
+TraceArchive::TraceArchive(const std::string& fileName, UINT64 segmentSize)
+{
+    _fileName = fileName;
+    _segmentSize = segmentSize;
+
+#ifdef _WIN32
+    std::cerr << "Error: Trace archives are not supported on Windows." << std::endl;
+    exit(1);
+#else
+    OpenNextSegment();
+#endif
+
+    if(_segmentSize > 0)
+        std::cerr << "Writing testcase traces to archive '" << _fileName << "' (segments of " << std::dec << (_segmentSize >> 20) << " MB)" << std::endl;
+    else
+        std::cerr << "Writing testcase traces to archive '" << _fileName << "'" << std::endl;
+}
+
+TraceArchive::~TraceArchive()
+{
+#ifndef _WIN32
+    if(_fd >= 0)
+        close(_fd);
+#endif
+}
+
+void TraceArchive::OpenNextSegment()
+{
+#ifndef _WIN32
+    if(_fd >= 0)
+        close(_fd);
+
+    // Segmented archives always carry the segment index, so the file names do not change when the first segment fills up
+    ++_segmentIndex;
+    if(_segmentSize > 0)
+    {
+        std::stringstream segmentFileNameStream;
+        segmentFileNameStream << _fileName << "." << std::dec << _segmentIndex;
+        _segmentFileName = segmentFileNameStream.str();
+    }
+    else
+        _segmentFileName = _fileName;
+
+    _fd = open(_segmentFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(_fd < 0)
+    {
+        std::cerr << "Error: Could not create trace archive file '" << _segmentFileName << "'." << std::endl;
+        exit(1);
+    }
+    _writeOffset = 0;
+    _allocatedSize = 0;
+#endif
+}
+
+void TraceArchive::WriteAt(const void* data, size_t length, UINT64 offset)
+{
+#ifndef _WIN32
+    const UINT8* input = static_cast<const UINT8*>(data);
+    while(length > 0)
+    {
+        ssize_t written = pwrite(_fd, input, length, static_cast<off_t>(offset));
+        if(written <= 0)
+        {
+            std::cerr << "Error: Could not write to trace archive file '" << _segmentFileName << "'." << std::endl;
+            exit(1);
+        }
+
+        input += written;
+        length -= static_cast<size_t>(written);
+        offset += static_cast<UINT64>(written);
+    }
+#endif
+}
+
+void TraceArchive::BeginRecord(int testcaseId, THREADID threadId)
+{
+    // Records are not split across segments, so a segment may exceed its size by one record
+    if(_segmentSize > 0 && _writeOffset >= _segmentSize)
+        OpenNextSegment();
+
+    // The length is filled in when the record is complete
+    TraceArchiveRecordHeader header{};
+    header.Magic = TRACE_ARCHIVE_RECORD_MAGIC;
+    header.TestcaseId = testcaseId;
+    header.ThreadId = threadId;
+    header.Length = 0;
+
+    _recordStart = _writeOffset;
+    Write(&header, sizeof(header));
+}
+
+void TraceArchive::Write(const void* data, size_t length)
+{
+#ifndef _WIN32
+    // Reserve disk space in large steps, so the file system can allocate contiguous extents
+    // The file size is not changed, so readers never see the preallocated area
+#ifdef FALLOC_FL_KEEP_SIZE
+    if(_writeOffset + length > _allocatedSize)
+    {
+        UINT64 newAllocatedSize = _writeOffset + length + TRACE_ARCHIVE_PREALLOCATION_SIZE;
+        if(fallocate(_fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(_allocatedSize), static_cast<off_t>(newAllocatedSize - _allocatedSize)) == 0)
+            _allocatedSize = newAllocatedSize;
+        else
+            _allocatedSize = ~0ull; // Not supported by the file system, do not try again
+    }
+#endif
+#endif
+
+    WriteAt(data, length, _writeOffset);
+    _writeOffset += length;
+}
+
+void TraceArchive::EndRecord(std::string& segmentFileName, UINT64& offset, UINT64& length)
+{
+    offset = _recordStart + sizeof(TraceArchiveRecordHeader);
+    length = _writeOffset - offset;
+
+    // Complete the record header
+    WriteAt(&length, sizeof(length), _recordStart + offsetof(TraceArchiveRecordHeader, Length));
+
+    segmentFileName = _segmentFileName;
+}
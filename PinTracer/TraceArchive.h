@@ -0,0 +1,98 @@
+#pragma once
+/*
+Contains an append-only container file, which stores the testcase traces as consecutive records instead of individual trace files.
+*/
+
+// The magic number at the beginning of each archive record ("MWAR").
+#define TRACE_ARCHIVE_RECORD_MAGIC 0x5241574D
+
+// The number of bytes which are preallocated at once when the archive grows.
+#define TRACE_ARCHIVE_PREALLOCATION_SIZE (64ull << 20)
+
+
+/* INCLUDES */
+#include "pin.H"
+#include <string>
+
+
+/* TYPES */
+
+// Header of an archive record. The trace data follows directly after the header.
+#pragma pack(push, 1)
+struct TraceArchiveRecordHeader
+{
+    // The magic number TRACE_ARCHIVE_RECORD_MAGIC.
+    UINT32 Magic;
+
+    // The ID of the testcase.
+    INT32 TestcaseId;
+
+    // The ID of the thread which recorded the trace.
+    UINT32 ThreadId;
+
+    // (Padding)
+    UINT32 _reserved;
+
+    // The length of the trace data.
+    UINT64 Length;
+};
+#pragma pack(pop)
+static_assert(sizeof(TraceArchiveRecordHeader) == 24, "Wrong size of TraceArchiveRecordHeader struct");
+
+// A single-writer archive of trace records, which is optionally split into segment files of a maximum size.
+// Each record is announced to the caller with the segment file name, offset and length of its trace data.
+class TraceArchive
+{
+private:
+    // The path of the archive file. Segment files get their index as suffix.
+    std::string _fileName;
+
+    // The size after which a new segment file is started, or 0 if the archive consists of a single file.
+    UINT64 _segmentSize;
+
+    // The index of the current segment file.
+    int _segmentIndex = -1;
+
+    // The name of the current segment file.
+    std::string _segmentFileName;
+
+    // The file descriptor of the current segment file.
+    int _fd = -1;
+
+    // The number of bytes written to the current segment file.
+    UINT64 _writeOffset = 0;
+
+    // The number of bytes which were preallocated in the current segment file.
+    UINT64 _allocatedSize = 0;
+
+    // The offset of the header of the current record.
+    UINT64 _recordStart = 0;
+
+private:
+    // Closes the current segment file, and creates the next one.
+    void OpenNextSegment();
+
+    // Writes the given data at the given offset of the current segment file.
+    void WriteAt(const void* data, size_t length, UINT64 offset);
+
+public:
+    // Creates the first archive file. Existing files are overwritten.
+    // -> fileName: The path of the archive file.
+    // -> segmentSize: The size after which a new segment file is started (0 = single file).
+    TraceArchive(const std::string& fileName, UINT64 segmentSize);
+
+    // Closes the current archive file.
+    ~TraceArchive();
+
+    // Starts a new record at the end of the archive.
+    void BeginRecord(int testcaseId, THREADID threadId);
+
+    // Appends the given data to the current record.
+    void Write(const void* data, size_t length);
+
+    // Completes the current record.
+    // -> segmentFileName: Receives the name of the segment file containing the record.
+    // -> offset: Receives the offset of the record's trace data in the segment file.
+    // -> length: Receives the length of the record's trace data.
+    void EndRecord(std::string& segmentFileName, UINT64& offset, UINT64& length);
+};
@@ -5,149 +5,1811 @@
 #include <fstream>
 #include <sstream>
 #include <utility>
+#include <algorithm>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
 
 
 /* STATIC VARIABLES */
 
-bool TraceWriter::_prefixMode;
-std::ofstream TraceWriter::_prefixDataFileStream;
-bool TraceWriter::_sawFirstReturn;
+bool TraceWriter::_prefixActive;
+int TraceWriter::_currentTestcaseId = -1;
+std::ofstream TraceWriter::_prefixDataFileStream;
+bool TraceWriter::_writePrefixDigests = false;
+std::ofstream TraceWriter::_prefixDigestFileStream;
+bool TraceWriter::_verifyPrefix = false;
+std::ifstream TraceWriter::_referencePrefixDataFileStream;
+std::map<THREADID, UINT64> TraceWriter::_referencePrefixDigests;
+PrefixCache* TraceWriter::_prefixCache = nullptr;
+bool TraceWriter::_restoredPrefix = false;
+size_t TraceWriter::_defaultEntryBufferSize = 16384;
+HugePageModes TraceWriter::_hugePageMode = HugePageModes::None;
+bool TraceWriter::_adaptiveBufferSize = false;
+TraceFormats TraceWriter::_traceFormat = TraceFormats::Raw;
+TraceCompressions TraceWriter::_traceCompression = TraceCompressions::None;
+int TraceWriter::_asyncBufferCount = 0;
+bool TraceWriter::_traceScopeLimited = false;
+SharedMemoryRing* TraceWriter::_sharedMemoryRing = nullptr;
+TraceArchive* TraceWriter::_traceArchive = nullptr;
+bool TraceWriter::_fingerprintMode = false;
+bool TraceWriter::_aggregationMode = false;
+bool TraceWriter::_basicBlockMode = false;
+bool TraceWriter::_runLengthEncoding = false;
+bool TraceWriter::_differentialMode = false;
+bool TraceWriter::_forkServerMode = false;
+UINT64 TraceWriter::_traceIndexInterval = 0;
+bool TraceWriter::_pausedInstrumentation = false;
+UINT64 TraceWriter::_memoryAddressMask = ~0ull;
+bool TraceWriter::_suppressDuplicateAccesses = false;
+bool TraceWriter::_secretRegionFilter = false;
+UINT64 TraceWriter::_secretDependencyWindow = 0;
+std::map<ADDRINT, ADDRINT> TraceWriter::_secretRegions;
+PIN_LOCK TraceWriter::_secretRegionsLock;
+std::ofstream TraceWriter::_basicBlockTableFileStream;
+std::map<std::pair<ADDRINT, USIZE>, UINT32> TraceWriter::_basicBlockIds;
+bool TraceWriter::_statisticsMode = false;
+InstrumentationStatistics TraceWriter::_instrumentationStatistics;
+InstrumentationStatistics TraceWriter::_reportedInstrumentationStatistics;
+std::map<std::string, UINT64> TraceWriter::_instrumentedCallSites;
+std::map<std::string, UINT64> TraceWriter::_reportedInstrumentedCallSites;
+std::unordered_set<ADDRINT> TraceWriter::_instrumentedTraceAddresses;
+PIN_LOCK TraceWriter::_statisticsLock;
+std::vector<TraceWriter*> TraceWriter::_asyncTraceWriters;
+PIN_LOCK TraceWriter::_asyncTraceWritersLock;
+
+
+/* TYPES */
+
+void TraceStatistics::Add(const TraceStatistics& other)
+{
+    for(int i = 0; i < 16; ++i)
+        EntryCounts[i] += other.EntryCounts[i];
+    BufferFlushes += other.BufferFlushes;
+    BytesWritten += other.BytesWritten;
+    WriteCycles += other.WriteCycles;
+}
+
+TraceWriter::TraceWriter(const std::string& filenamePrefix, THREADID threadId, bool traced)
+{
+    // Remember prefix and thread
+    _outputFilenamePrefix = filenamePrefix;
+    _threadId = threadId;
+    _traced = traced;
+    _inTraceScope = _traceScopeLimited ? 0 : 1;
+    _entryBufferSize = _defaultEntryBufferSize;
+
+    // Let threads which are not traced write into a small private buffer, which is discarded whenever it is full, so the inlined entry writers do not need to check them
+    // The buffer is not shared, so the threads do not contend for its cache lines; if instrumentation is paused, they run the idle code and do not write at all
+    if(!_traced)
+    {
+        _entryBufferSize = MIN_ENTRY_BUFFER_SIZE;
+        _entries = new TraceEntry[_entryBufferSize];
+        return;
+    }
+
+    // Allocate entry buffers
+    int bufferCount = _asyncBufferCount > 0 ? _asyncBufferCount : 1;
+    for(int i = 0; i < bufferCount; ++i)
+        _bufferRing.push_back(AllocateEntryBuffer(_entryBufferSize));
+    _bufferRingEnds.resize(bufferCount, nullptr);
+    _entries = _bufferRing[0];
+
+    // Open output file: Either the prefix file, or the file of the currently running testcase, if the thread was created during a testcase
+    // A restored prefix is not recorded again, so the thread waits for the first testcase
+    if(_prefixActive && !_restoredPrefix)
+    {
+        _prefixMode = true;
+        std::string filename = GetOutputFilename(-1);
+        OpenOutputFile(filename);
+    }
+    else if(_currentTestcaseId != -1)
+    {
+        _testcaseId = _currentTestcaseId;
+        std::string filename = GetOutputFilename(_testcaseId);
+        OpenOutputFile(filename);
+    }
+
+    // Start flush thread
+    if(_asyncBufferCount > 0)
+    {
+        PIN_MutexInit(&_bufferRingMutex);
+        PIN_SemaphoreInit(&_bufferReadyEvent);
+        PIN_SemaphoreInit(&_bufferFreedEvent);
+
+        _flushThreadRunning = true;
+        if(PIN_SpawnInternalThread(FlushThreadMain, this, 0, &_flushThreadUid) == INVALID_THREADID)
+        {
+            std::cerr << "Error: Could not spawn trace flush thread." << std::endl;
+            exit(1);
+        }
+
+        PIN_GetLock(&_asyncTraceWritersLock, 0);
+        _asyncTraceWriters.push_back(this);
+        PIN_ReleaseLock(&_asyncTraceWritersLock);
+    }
+}
+
+TraceWriter::~TraceWriter()
+{
+    // Write pending buffers
+    if(_traced && _asyncBufferCount > 0)
+    {
+        StopFlushThread();
+
+        PIN_GetLock(&_asyncTraceWritersLock, 0);
+        _asyncTraceWriters.erase(std::remove(_asyncTraceWriters.begin(), _asyncTraceWriters.end(), this), _asyncTraceWriters.end());
+        PIN_ReleaseLock(&_asyncTraceWritersLock);
+
+        PIN_SemaphoreFini(&_bufferFreedEvent);
+        PIN_SemaphoreFini(&_bufferReadyEvent);
+        PIN_MutexFini(&_bufferRingMutex);
+    }
+
+    // Summarize the counters of the entire thread, including a trace which is still open
+    if(_traced && _statisticsMode)
+    {
+        TraceStatistics statistics = _totalStatistics;
+        if(_prefixMode || _testcaseId != -1)
+            statistics.Add(_traceStatistics);
+        std::cerr << "Statistics of thread #" << std::dec << _threadId << ":\t" << FormatStatistics(statistics) << std::endl;
+    }
+
+    // Close file stream
+    _outputFileStream.close();
+
+    // Free entry buffers
+    for(TraceEntry* buffer : _bufferRing)
+        FreeEntryBuffer(buffer, _entryBufferSize);
+    if(!_traced)
+        delete[] _entries;
+}
+
+void TraceWriter::InitPrefixMode(const std::string& filenamePrefix, bool writeDigests, const std::string& referencePrefix)
+{
+    // Start trace prefix mode
+    _prefixActive = true;
+
+    // Restore cached prefix? Its image loads are still verified, since the image files are not part of the cache key
+    if(_prefixCache != nullptr && _prefixCache->IsHit())
+    {
+        _restoredPrefix = true;
+        _prefixCache->Restore();
+
+        std::string cachedPrefixDataFilename = _prefixCache->GetEntryPrefix() + "prefix_data.txt";
+        _referencePrefixDataFileStream.open(cachedPrefixDataFilename.c_str(), std::ifstream::in);
+        if(!_referencePrefixDataFileStream)
+        {
+            std::cerr << "Error: Could not open cached prefix metadata file '" << cachedPrefixDataFilename << "'." << std::endl;
+            exit(1);
+        }
+
+        std::cerr << "Trace prefix mode started, using cached prefix" << std::endl;
+        return;
+    }
+
+    // Verify against reference prefix?
+    if(!referencePrefix.empty())
+    {
+        _verifyPrefix = true;
+
+        std::string referencePrefixDataFilename = referencePrefix + "prefix_data.txt";
+        _referencePrefixDataFileStream.open(referencePrefixDataFilename.c_str(), std::ifstream::in);
+        if(!_referencePrefixDataFileStream)
+        {
+            std::cerr << "Error: Could not open reference prefix metadata file '" << referencePrefixDataFilename << "'." << std::endl;
+            exit(1);
+        }
+
+        // Read prefix trace digests: "<thread ID>\t<digest>"
+        std::string referencePrefixDigestFilename = referencePrefix + "prefix_digest.txt";
+        std::ifstream referencePrefixDigestFileStream(referencePrefixDigestFilename.c_str(), std::ifstream::in);
+        if(!referencePrefixDigestFileStream)
+        {
+            std::cerr << "Error: Could not open reference prefix digest file '" << referencePrefixDigestFilename << "'." << std::endl;
+            exit(1);
+        }
+        THREADID threadId;
+        UINT64 digest;
+        while(referencePrefixDigestFileStream >> std::dec >> threadId >> std::hex >> digest)
+            _referencePrefixDigests[threadId] = digest;
+
+        std::cerr << "Trace prefix mode started, verifying against reference prefix '" << referencePrefix << "'" << std::endl;
+        return;
+    }
+
+    // Open prefix metadata output file
+    _prefixDataFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+	std::string prefixDataFilename = filenamePrefix + "prefix_data.txt";
+    _prefixDataFileStream.open(prefixDataFilename.c_str(), std::ofstream::out | std::ofstream::trunc);
+    if(!_prefixDataFileStream)
+    {
+        std::cerr << "Error: Could not open prefix metadata output file '" << prefixDataFilename << "'." << std::endl;
+        exit(1);
+    }
+    if(_prefixCache != nullptr)
+        _prefixCache->AddFile(prefixDataFilename);
+
+    // Open prefix digest output file
+    if(writeDigests)
+    {
+        _writePrefixDigests = true;
+        _prefixDigestFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        std::string prefixDigestFilename = filenamePrefix + "prefix_digest.txt";
+        _prefixDigestFileStream.open(prefixDigestFilename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        if(!_prefixDigestFileStream)
+        {
+            std::cerr << "Error: Could not open prefix digest output file '" << prefixDigestFilename << "'." << std::endl;
+            exit(1);
+        }
+        if(_prefixCache != nullptr)
+            _prefixCache->AddFile(prefixDigestFilename);
+    }
+    std::cerr << "Trace prefix mode started" << std::endl;
+}
+
+void TraceWriter::InitTraceFormat(TraceFormats format)
+{
+    _traceFormat = format;
+    if(_traceFormat == TraceFormats::Compact)
+        std::cerr << "Using compact trace format" << std::endl;
+}
+
+void TraceWriter::InitTraceCompression(TraceCompressions compression)
+{
+    _traceCompression = compression;
+    if(_traceCompression == TraceCompressions::Lz4)
+        std::cerr << "Compressing trace files with LZ4" << std::endl;
+}
+
+void TraceWriter::InitEntryBuffers(size_t entryCount, HugePageModes hugePageMode, bool adaptive)
+{
+#ifdef _WIN32
+    // Large pages need a special privilege on Windows
+    if(hugePageMode != HugePageModes::None)
+    {
+        std::cerr << "Warning: Huge pages are not supported on Windows, using regular entry buffers" << std::endl;
+        hugePageMode = HugePageModes::None;
+    }
+#endif
+
+    _hugePageMode = hugePageMode;
+    _adaptiveBufferSize = adaptive;
+    _defaultEntryBufferSize = RoundEntryBufferSize(entryCount);
+
+    std::cerr << "Entry buffers hold " << std::dec << _defaultEntryBufferSize << " entries";
+    if(_hugePageMode == HugePageModes::Transparent)
+        std::cerr << ", backed by transparent huge pages";
+    else if(_hugePageMode == HugePageModes::Explicit)
+        std::cerr << ", backed by explicit huge pages";
+    if(_adaptiveBufferSize)
+        std::cerr << ", adapted to the trace volume";
+    std::cerr << std::endl;
+}
+
+size_t TraceWriter::RoundEntryBufferSize(size_t entryCount)
+{
+    entryCount = std::max<size_t>(MIN_ENTRY_BUFFER_SIZE, std::min<size_t>(MAX_ENTRY_BUFFER_SIZE, entryCount));
+
+    // Use the entire huge pages
+    if(_hugePageMode != HugePageModes::None)
+    {
+        size_t size = (entryCount * sizeof(TraceEntry) + HUGE_PAGE_SIZE - 1) & ~static_cast<size_t>(HUGE_PAGE_SIZE - 1);
+        entryCount = size / sizeof(TraceEntry);
+    }
+    return entryCount;
+}
+
+TraceEntry* TraceWriter::AllocateEntryBuffer(size_t entryCount)
+{
+#ifndef _WIN32
+    if(_hugePageMode != HugePageModes::None)
+    {
+        size_t size = (entryCount * sizeof(TraceEntry) + HUGE_PAGE_SIZE - 1) & ~static_cast<size_t>(HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+        if(_hugePageMode == HugePageModes::Explicit)
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(mapping != MAP_FAILED)
+                return static_cast<TraceEntry*>(mapping);
+
+            std::cerr << "Warning: Could not allocate explicit huge pages, falling back to transparent huge pages" << std::endl;
+            _hugePageMode = HugePageModes::Transparent;
+        }
+#endif
+
+        // Reserve an additional huge page, so the buffer can be aligned to a huge page boundary, and release the unused parts afterwards
+        void* mapping = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED)
+        {
+            std::cerr << "Error: Could not allocate entry buffer of " << std::dec << size << " bytes." << std::endl;
+            exit(1);
+        }
+        auto mappingStart = reinterpret_cast<UINT8*>(mapping);
+        auto bufferStart = reinterpret_cast<UINT8*>((reinterpret_cast<ADDRINT>(mappingStart) + HUGE_PAGE_SIZE - 1) & ~static_cast<ADDRINT>(HUGE_PAGE_SIZE - 1));
+        if(bufferStart > mappingStart)
+            munmap(mappingStart, static_cast<size_t>(bufferStart - mappingStart));
+        size_t tailSize = static_cast<size_t>(mappingStart + size + HUGE_PAGE_SIZE - (bufferStart + size));
+        if(tailSize > 0)
+            munmap(bufferStart + size, tailSize);
+
+#ifdef MADV_HUGEPAGE
+        madvise(bufferStart, size, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<TraceEntry*>(bufferStart);
+    }
+#endif
+
+    return new TraceEntry[entryCount]{};
+}
+
+void TraceWriter::FreeEntryBuffer(TraceEntry* buffer, size_t entryCount)
+{
+#ifndef _WIN32
+    if(_hugePageMode != HugePageModes::None)
+    {
+        size_t size = (entryCount * sizeof(TraceEntry) + HUGE_PAGE_SIZE - 1) & ~static_cast<size_t>(HUGE_PAGE_SIZE - 1);
+        munmap(buffer, size);
+        return;
+    }
+#endif
+
+    delete[] buffer;
+}
+
+void TraceWriter::AdaptEntryBufferSize()
+{
+    // Grow the buffers if the last trace needed many flushes, and shrink them if it used only a small part of a buffer
+    size_t newEntryBufferSize = _entryBufferSize;
+    if(_lastTraceEntryCount >= 8 * _entryBufferSize)
+        newEntryBufferSize = 2 * _entryBufferSize;
+    else if(_lastTraceEntryCount < _entryBufferSize / 4)
+        newEntryBufferSize = _entryBufferSize / 2;
+    newEntryBufferSize = RoundEntryBufferSize(newEntryBufferSize);
+    if(newEntryBufferSize == _entryBufferSize)
+        return;
+
+    // The buffers do not hold any pending entries, so they can be replaced
+    WaitForFlush();
+    for(TraceEntry*& buffer : _bufferRing)
+    {
+        FreeEntryBuffer(buffer, _entryBufferSize);
+        buffer = AllocateEntryBuffer(newEntryBufferSize);
+    }
+    _entryBufferSize = newEntryBufferSize;
+    _entries = _bufferRing[_currentBufferIndex];
+}
+
+void TraceWriter::InitAsyncFlushing(int bufferCount)
+{
+    // We need at least one buffer for the instrumented thread and one for the flush thread
+    if(bufferCount < 2)
+        bufferCount = 2;
+    if(bufferCount > MAX_ASYNC_BUFFER_COUNT)
+        bufferCount = MAX_ASYNC_BUFFER_COUNT;
+
+    _asyncBufferCount = bufferCount;
+    PIN_InitLock(&_asyncTraceWritersLock);
+    std::cerr << "Asynchronous trace flushing enabled with " << std::dec << _asyncBufferCount << " buffers per thread" << std::endl;
+}
+
+void TraceWriter::InitSharedMemoryRing(const std::string& fileName, UINT64 capacity)
+{
+    _sharedMemoryRing = new SharedMemoryRing(fileName, capacity);
+}
+
+void TraceWriter::InitPrefixCache(const std::string& directory, const std::string& filenamePrefix, const std::string& settings, const std::vector<std::string>& keyFiles)
+{
+    _prefixCache = new PrefixCache(directory, filenamePrefix, settings, keyFiles);
+}
+
+void TraceWriter::InitTraceArchive(const std::string& fileName, UINT64 segmentSize)
+{
+    _traceArchive = new TraceArchive(fileName, segmentSize);
+}
+
+void TraceWriter::InitFingerprintMode()
+{
+    _fingerprintMode = true;
+    std::cerr << "Fingerprint mode enabled, testcase traces are not written" << std::endl;
+}
+
+void TraceWriter::InitAggregationMode()
+{
+    _aggregationMode = true;
+    std::cerr << "Aggregation mode enabled, memory accesses of testcases are stored as histograms" << std::endl;
+}
+
+void TraceWriter::InitBasicBlockMode(const std::string& filenamePrefix)
+{
+    _basicBlockMode = true;
+
+    // Open basic block table output file
+    _basicBlockTableFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    std::string basicBlockTableFilename = filenamePrefix + "bbl_table.txt";
+    _basicBlockTableFileStream.open(basicBlockTableFilename.c_str(), std::ofstream::out | std::ofstream::trunc);
+    if(!_basicBlockTableFileStream)
+    {
+        std::cerr << "Error: Could not open basic block table output file '" << basicBlockTableFilename << "'." << std::endl;
+        exit(1);
+    }
+    std::cerr << "Basic block control flow mode enabled" << std::endl;
+}
+
+UINT32 TraceWriter::GetBasicBlockId(BBL bbl)
+{
+    // Pin may instrument the same code multiple times, with differing block boundaries; each distinct block gets its own ID
+    auto key = std::make_pair(BBL_Address(bbl), BBL_Size(bbl));
+    auto basicBlockIdIt = _basicBlockIds.find(key);
+    if(basicBlockIdIt != _basicBlockIds.end())
+        return basicBlockIdIt->second;
+
+    auto basicBlockId = static_cast<UINT32>(_basicBlockIds.size());
+    _basicBlockIds.emplace(key, basicBlockId);
+
+    // Determine the branch that terminates the block, using the same criteria as the branch instrumentation
+    INS tail = BBL_InsTail(bbl);
+    TraceEntryFlags branchType = TraceEntryFlags::BranchNotTaken;
+    if(!INS_SegmentPrefix(tail) && INS_IsControlFlow(tail))
+    {
+        if(INS_IsCall(tail))
+            branchType = TraceEntryFlags::BranchTypeCall;
+        else if(INS_IsBranch(tail))
+            branchType = TraceEntryFlags::BranchTypeJump;
+        else if(INS_IsRet(tail))
+            branchType = TraceEntryFlags::BranchTypeReturn;
+    }
+    int conditional = branchType == TraceEntryFlags::BranchTypeJump && INS_HasFallThrough(tail) ? 1 : 0;
+    ADDRINT target = branchType != TraceEntryFlags::BranchNotTaken && INS_IsDirectControlFlow(tail) ? INS_DirectControlFlowTargetAddress(tail) : 0;
+
+    // The table is flushed when the caller is notified about a completed testcase, so it covers all blocks of the trace
+    _basicBlockTableFileStream << std::dec << basicBlockId << "\t" << std::hex << BBL_Address(bbl) << "\t" << std::hex << BBL_Size(bbl)
+                               << "\t" << std::hex << INS_Address(tail) << "\t" << std::dec << static_cast<int>(branchType)
+                               << "\t" << std::dec << conditional << "\t" << std::hex << target << "\n";
+    return basicBlockId;
+}
+
+void TraceWriter::InitMemoryAccessFilter(int granularityBits, bool suppressDuplicates)
+{
+    if(granularityBits > 0)
+    {
+        _memoryAddressMask = ~((1ull << granularityBits) - 1);
+        std::cerr << "Memory access addresses are reduced to a granularity of " << std::dec << (1ull << granularityBits) << " bytes" << std::endl;
+    }
+
+    _suppressDuplicateAccesses = suppressDuplicates;
+    if(_suppressDuplicateAccesses)
+        std::cerr << "Duplicate memory accesses are suppressed" << std::endl;
+}
+
+void TraceWriter::InitSecretRegionFilter(UINT64 dependencyWindow)
+{
+    _secretRegionFilter = true;
+    _secretDependencyWindow = dependencyWindow;
+    PIN_InitLock(&_secretRegionsLock);
+    std::cerr << "Only memory accesses and branches related to secret regions are recorded, with a dependency window of " << std::dec << dependencyWindow << " entries" << std::endl;
+}
+
+void TraceWriter::InitRunLengthEncoding()
+{
+    _runLengthEncoding = true;
+    std::cerr << "Run-length encoding of repeated loop iterations enabled" << std::endl;
+}
+
+void TraceWriter::InitDifferentialMode()
+{
+    _differentialMode = true;
+    std::cerr << "Differential trace recording enabled" << std::endl;
+}
+
+void TraceWriter::InitForkServerMode()
+{
+    _forkServerMode = true;
+    std::cerr << "Fork-server mode enabled" << std::endl;
+}
+
+void TraceWriter::InitTraceIndex(UINT64 chunkInterval)
+{
+    _traceIndexInterval = chunkInterval;
+    std::cerr << "Trace index footer enabled, with chunks of " << std::dec << chunkInterval << " entries" << std::endl;
+}
+
+void TraceWriter::InitPausedInstrumentation()
+{
+    _pausedInstrumentation = true;
+    std::cerr << "Instrumentation is paused outside of testcases" << std::endl;
+}
+
+void TraceWriter::InitStatistics()
+{
+    _statisticsMode = true;
+    PIN_InitLock(&_statisticsLock);
+    std::cerr << "Tracer statistics enabled" << std::endl;
+}
+
+void TraceWriter::RecordTraceInstrumentation(ADDRINT traceAddress, UINT64 cycles, const std::string& imageName, UINT64 callSiteCount)
+{
+    PIN_GetLock(&_statisticsLock, 0);
+
+    ++_instrumentationStatistics.Traces;
+    if(!_instrumentedTraceAddresses.insert(traceAddress).second)
+        ++_instrumentationStatistics.ReinstrumentedTraces;
+    _instrumentationStatistics.Cycles += cycles;
+    _instrumentedCallSites[imageName] += callSiteCount;
+
+    PIN_ReleaseLock(&_statisticsLock);
+}
+
+std::string TraceWriter::FormatStatistics(const TraceStatistics& statistics)
+{
+    static const char* entryTypeNames[16] = {
+        "", "MemoryRead", "MemoryWrite", "HeapAllocSizeParameter", "HeapAllocAddressReturn", "HeapFreeAddressParameter", "Branch",
+        "StackPointerInfo", "StackPointerModification", "AccessCount", "BasicBlock", "Repeat", "ReferenceCopy", "StackFrame", "", ""
+    };
+
+    std::stringstream statisticsStream;
+    statisticsStream << "entries=";
+    bool first = true;
+    for(int i = 0; i < 16; ++i)
+    {
+        if(statistics.EntryCounts[i] == 0)
+            continue;
+        if(!first)
+            statisticsStream << ",";
+        statisticsStream << entryTypeNames[i] << ":" << std::dec << statistics.EntryCounts[i];
+        first = false;
+    }
+    statisticsStream << "\tflushes=" << std::dec << statistics.BufferFlushes
+                     << "\tbytes=" << std::dec << statistics.BytesWritten
+                     << "\twrite_cycles=" << std::dec << statistics.WriteCycles;
+    return statisticsStream.str();
+}
+
+void TraceWriter::InitTraceScope()
+{
+    _traceScopeLimited = true;
+}
+
+void TraceWriter::StopAsyncFlushing()
+{
+    if(_asyncBufferCount == 0)
+        return;
+
+    PIN_GetLock(&_asyncTraceWritersLock, 0);
+    for(TraceWriter* traceWriter : _asyncTraceWriters)
+        traceWriter->StopFlushThread();
+    PIN_ReleaseLock(&_asyncTraceWritersLock);
+}
+
+VOID TraceWriter::FlushThreadMain(VOID* arg)
+{
+    auto* traceWriter = static_cast<TraceWriter*>(arg);
+
+    while(true)
+    {
+        // Wait for new buffers; the timeout ensures that we notice when the process exits without stopping this thread
+        PIN_SemaphoreTimedWait(&traceWriter->_bufferReadyEvent, 100);
+        PIN_SemaphoreClear(&traceWriter->_bufferReadyEvent);
+
+        // Write all pending buffers in order
+        PIN_MutexLock(&traceWriter->_bufferRingMutex);
+        while(traceWriter->_pendingBufferCount > 0)
+        {
+            int bufferIndex = traceWriter->_nextFlushBufferIndex;
+            PIN_MutexUnlock(&traceWriter->_bufferRingMutex);
+
+            traceWriter->WriteEntries(traceWriter->_bufferRing[bufferIndex], traceWriter->_bufferRingEnds[bufferIndex]);
+
+            PIN_MutexLock(&traceWriter->_bufferRingMutex);
+            traceWriter->_nextFlushBufferIndex = (bufferIndex + 1) % static_cast<int>(traceWriter->_bufferRing.size());
+            --traceWriter->_pendingBufferCount;
+            PIN_SemaphoreSet(&traceWriter->_bufferFreedEvent);
+        }
+        bool stop = traceWriter->_stopFlushThread || PIN_IsProcessExiting();
+        PIN_MutexUnlock(&traceWriter->_bufferRingMutex);
+
+        if(stop)
+            break;
+    }
+}
+
+void TraceWriter::StopFlushThread()
+{
+    if(!_flushThreadRunning)
+        return;
+
+    // The flush thread writes all pending buffers before it exits
+    PIN_MutexLock(&_bufferRingMutex);
+    _stopFlushThread = true;
+    PIN_SemaphoreSet(&_bufferReadyEvent);
+    PIN_MutexUnlock(&_bufferRingMutex);
+    PIN_WaitForThreadTermination(_flushThreadUid, PIN_INFINITE_TIMEOUT, nullptr);
+
+    // Remaining entries are written synchronously
+    _flushThreadRunning = false;
+}
+
+void TraceWriter::EnqueueBuffer(TraceEntry* end)
+{
+    PIN_MutexLock(&_bufferRingMutex);
+
+    // Pass current buffer to flush thread
+    _bufferRingEnds[_currentBufferIndex] = end;
+    ++_pendingBufferCount;
+    PIN_SemaphoreSet(&_bufferReadyEvent);
+
+    // Wait until the next buffer is free
+    int bufferCount = static_cast<int>(_bufferRing.size());
+    while(_pendingBufferCount == bufferCount)
+    {
+        PIN_SemaphoreClear(&_bufferFreedEvent);
+        PIN_MutexUnlock(&_bufferRingMutex);
+        PIN_SemaphoreWait(&_bufferFreedEvent);
+        PIN_MutexLock(&_bufferRingMutex);
+    }
+
+    _currentBufferIndex = (_currentBufferIndex + 1) % bufferCount;
+    _entries = _bufferRing[_currentBufferIndex];
+
+    PIN_MutexUnlock(&_bufferRingMutex);
+}
+
+void TraceWriter::WaitForFlush()
+{
+    if(!_flushThreadRunning)
+        return;
+
+    PIN_MutexLock(&_bufferRingMutex);
+    while(_pendingBufferCount > 0)
+    {
+        PIN_SemaphoreClear(&_bufferFreedEvent);
+        PIN_MutexUnlock(&_bufferRingMutex);
+        PIN_SemaphoreWait(&_bufferFreedEvent);
+        PIN_MutexLock(&_bufferRingMutex);
+    }
+    PIN_MutexUnlock(&_bufferRingMutex);
+}
+
+TraceEntry* TraceWriter::Begin()
+{
+    return _entries;
+}
+
+TraceEntry* TraceWriter::End()
+{
+    return &_entries[_entryBufferSize];
+}
+
+void TraceWriter::OpenOutputFile(std::string& filename)
+{
+    _currentOutputFilename = filename;
+    _traceStatistics = TraceStatistics{};
+    _traceEntryCount = 0;
+
+    // Duplicate accesses are only suppressed within the same trace
+    if(_suppressDuplicateAccesses)
+        _lastMemoryAccesses.assign(LAST_ACCESS_FILTER_SIZE, LastMemoryAccess{});
+
+    // Instructions are only considered secret-dependent for the trace where they accessed a secret region
+    _secretInstructions.clear();
+    _secretDependencyRemaining = 0;
+
+    // The prefix trace is only digested, if it is verified against a reference prefix
+    if(_prefixMode)
+    {
+        _prefixDigest = 0;
+        _prefixDigestEncoder.Reset();
+        if(_verifyPrefix)
+            return;
+    }
+
+    // In fingerprint mode, testcase traces are not written at all
+    if(_fingerprintMode && !_prefixMode)
+    {
+        _writingToSharedMemoryRing = false;
+        _writingToTraceArchive = false;
+        _traceFingerprint = 0;
+        _instructionFingerprints.clear();
+        return;
+    }
+
+    // The testcase traces of the main thread go to the shared memory ring or the trace archive, if there is one
+    _writingToSharedMemoryRing = _sharedMemoryRing != nullptr && _threadId == 0 && !_prefixMode;
+    _writingToTraceArchive = _traceArchive != nullptr && _threadId == 0 && !_prefixMode;
+    if(_writingToSharedMemoryRing)
+    {
+        _sharedMemoryRing->BeginSegment();
+    }
+    else if(_writingToTraceArchive)
+    {
+        _traceArchive->BeginRecord(_testcaseId, _threadId);
+    }
+    else
+    {
+        // Open file for writing
+        _outputFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        _outputFileStream.open(_currentOutputFilename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        if(!_outputFileStream)
+        {
+            std::cerr << "Error: Could not open output file '" << _currentOutputFilename << "'." << std::endl;
+            exit(1);
+        }
+    }
+
+    // Compressed traces are wrapped into a single LZ4 frame, which covers the entire trace including the header
+    _compressingOutput = _traceCompression == TraceCompressions::Lz4;
+    if(_compressingOutput)
+    {
+        UINT8 frameHeader[LZ4_FRAME_HEADER_SIZE];
+        Lz4FrameEncoder::WriteFrameHeader(frameHeader);
+        WriteOutputDirect(frameHeader, sizeof(frameHeader));
+        _uncompressedOutput.clear();
+        _uncompressedOutput.reserve(LZ4_BLOCK_SIZE);
+    }
+
+    // In differential mode, the first testcase trace of the main thread becomes the reference for all later testcase traces
+    bool differential = _differentialMode && _threadId == 0 && !_prefixMode;
+    _recordingReference = differential && !_referenceRecorded;
+    _writingDifferential = differential && _referenceRecorded;
+    if(_recordingReference)
+        _referenceEntries.clear();
+    if(_writingDifferential)
+    {
+        _referencePosition = 0;
+        _pendingReferenceCopyCount = 0;
+        _pendingReferenceOffset = 0;
+        _differentialEntries.clear();
+    }
+
+    // Write file header
+    // Access histograms, basic block, run-length encoded and differential traces always need a header, so they can be distinguished from full traces
+    _aggregatingMemoryAccesses = _aggregationMode && !_prefixMode;
+    bool runLengthEncoded = _runLengthEncoding && !_aggregatingMemoryAccesses;
+    UINT16 flags = 0;
+    if(_traceFormat == TraceFormats::Compact)
+        flags |= static_cast<UINT16>(TraceFileFlags::CompactEncoding);
+    if(_aggregatingMemoryAccesses)
+        flags |= static_cast<UINT16>(TraceFileFlags::AccessHistogram);
+    if(_basicBlockMode)
+        flags |= static_cast<UINT16>(TraceFileFlags::BasicBlockControlFlow);
+    if(runLengthEncoded)
+        flags |= static_cast<UINT16>(TraceFileFlags::RunLengthEncoding);
+    if(_writingDifferential)
+        flags |= static_cast<UINT16>(TraceFileFlags::DifferentialEncoding);
+
+    // The chunk index is built while the records are written, and stored in the footer when the trace is closed
+    _writingTraceIndex = _traceIndexInterval > 0;
+    if(_writingTraceIndex)
+    {
+        flags |= static_cast<UINT16>(TraceFileFlags::IndexFooter);
+        _traceFooter = TraceFileFooter{};
+        _traceFooter.ChunkInterval = _traceIndexInterval;
+        _traceFooter.Checksum = TRACE_FILE_CHECKSUM_BASIS;
+        _traceIndexState = TraceChunkInfo{};
+        _traceChunks.clear();
+    }
+
+    // The reference trace file always stores raw entries
+    if(_recordingReference)
+        _referenceFileFlags = flags & ~static_cast<UINT16>(TraceFileFlags::CompactEncoding);
+
+    if(flags != 0)
+    {
+        TraceFileHeader header{};
+        header.Magic = TRACE_FILE_MAGIC;
+        header.Version = TRACE_FILE_VERSION;
+        header.Flags = flags;
+        WriteOutput(&header, sizeof(header));
+
+        _compactEncoder.Reset();
+    }
+
+    if(_aggregatingMemoryAccesses)
+    {
+        _accessHistogram.Reset();
+        _deferredFreeEntries.clear();
+    }
+}
+
+void TraceWriter::WriteOutput(const void* data, size_t length)
+{
+    if(!_compressingOutput)
+    {
+        WriteOutputDirect(data, length);
+        return;
+    }
+
+    // Collect data until a block is full
+    const UINT8* input = static_cast<const UINT8*>(data);
+    while(length > 0)
+    {
+        size_t chunkLength = std::min(length, static_cast<size_t>(LZ4_BLOCK_SIZE) - _uncompressedOutput.size());
+        _uncompressedOutput.insert(_uncompressedOutput.end(), input, input + chunkLength);
+        input += chunkLength;
+        length -= chunkLength;
+
+        if(_uncompressedOutput.size() == LZ4_BLOCK_SIZE)
+            FlushCompressedOutput();
+    }
+}
+
+void TraceWriter::FlushCompressedOutput()
+{
+    if(_uncompressedOutput.empty())
+        return;
+
+    _compressedOutput.resize(Lz4FrameEncoder::GetEncodedBlockBound(_uncompressedOutput.size()));
+    size_t length = _lz4Encoder.EncodeBlock(_uncompressedOutput.data(), _uncompressedOutput.size(), _compressedOutput.data());
+    WriteOutputDirect(_compressedOutput.data(), length);
+    _uncompressedOutput.clear();
+}
+
+void TraceWriter::WriteOutputDirect(const void* data, size_t length)
+{
+    if(_statisticsMode)
+        _traceStatistics.BytesWritten += length;
+
+    if(_writingToSharedMemoryRing)
+        _sharedMemoryRing->Write(data, length);
+    else if(_writingToTraceArchive)
+        _traceArchive->Write(data, length);
+    else
+        _outputFileStream.write(static_cast<const char*>(data), static_cast<std::streamsize>(length));
+}
+
+void TraceWriter::WriteEntries(TraceEntry* begin, TraceEntry* end)
+{
+    if(!_statisticsMode)
+    {
+        DispatchEntries(begin, end);
+        return;
+    }
+
+    UINT64 startCycles = ReadTimestampCounter();
+    ++_traceStatistics.BufferFlushes;
+    for(TraceEntry* entry = begin; entry < end; ++entry)
+        ++_traceStatistics.EntryCounts[static_cast<UINT32>(entry->Type) & 0xF];
+
+    DispatchEntries(begin, end);
+    _traceStatistics.WriteCycles += ReadTimestampCounter() - startCycles;
+}
+
+void TraceWriter::DispatchEntries(TraceEntry* begin, TraceEntry* end)
+{
+    // The prefix is kept complete, as the testcase traces depend on its allocations
+    if(_secretRegionFilter && !_prefixMode)
+        end = FilterSecretAccesses(begin, end);
+
+    if(_memoryAddressMask != ~0ull || _suppressDuplicateAccesses)
+        end = FilterMemoryAccesses(begin, end);
+
+    if(_prefixMode && (_writePrefixDigests || _verifyPrefix))
+    {
+        UpdatePrefixDigest(begin, end);
+        if(_verifyPrefix)
+            return;
+    }
+
+    if(_fingerprintMode && !_prefixMode)
+    {
+        UpdateFingerprints(begin, end);
+        return;
+    }
+
+    if(_aggregatingMemoryAccesses)
+    {
+        AggregateEntries(begin, end);
+        return;
+    }
+
+    if(_runLengthEncoding)
+    {
+        CollapseRuns(begin, end);
+        return;
+    }
+
+    WriteRecords(begin, end);
+}
+
+void TraceWriter::WriteRecords(const TraceEntry* begin, const TraceEntry* end)
+{
+    if(_writingDifferential)
+    {
+        WriteDifferentialRecords(begin, end);
+        return;
+    }
+
+    if(_recordingReference)
+    {
+        for(const TraceEntry* entry = begin; entry != end; ++entry)
+            _referenceEntries.push_back(CompactTraceEncoder::NormalizeEntry(*entry));
+    }
+
+    SerializeRecords(begin, end);
+}
+
+void TraceWriter::SerializeRecords(const TraceEntry* begin, const TraceEntry* end)
+{
+    if(!_writingTraceIndex)
+    {
+        EncodeRecords(begin, end);
+        return;
+    }
+
+    // Split the entries at the chunk boundaries, and track the state which is needed for processing each chunk independently
+    const TraceEntry* chunkBegin = begin;
+    for(const TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        if(_traceIndexState.EntryIndex % _traceIndexInterval == 0)
+        {
+            EncodeRecords(chunkBegin, entry);
+            chunkBegin = entry;
+
+            _traceChunks.push_back(_traceIndexState);
+            _compactEncoder.Reset();
+        }
+
+        ++_traceFooter.EntryCounts[static_cast<UINT32>(entry->Type) % TRACE_FILE_FOOTER_ENTRY_TYPE_COUNT];
+        ++_traceIndexState.EntryIndex;
+        switch(entry->Type)
+        {
+            case TraceEntryTypes::Branch:
+            {
+                UINT8 branchType = entry->Flag & static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn);
+                if(branchType == static_cast<UINT8>(TraceEntryFlags::BranchTypeCall))
+                    ++_traceIndexState.CallDepth;
+                else if(branchType == static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn))
+                    --_traceIndexState.CallDepth;
+                break;
+            }
+
+            case TraceEntryTypes::HeapAllocSizeParameter:
+                ++_traceIndexState.PendingAllocationCount;
+                break;
+
+            case TraceEntryTypes::HeapAllocAddressReturn:
+                if(_traceIndexState.PendingAllocationCount > 0)
+                    --_traceIndexState.PendingAllocationCount;
+                ++_traceIndexState.HeapAllocationCount;
+                break;
+
+            default:
+                break;
+        }
+    }
+    EncodeRecords(chunkBegin, end);
+}
+
+void TraceWriter::EncodeRecords(const TraceEntry* begin, const TraceEntry* end)
+{
+    if(begin == end)
+        return;
+
+    if(_traceFormat == TraceFormats::Compact)
+    {
+        // Encode entries
+        size_t maxLength = static_cast<size_t>(end - begin) * COMPACT_ENTRY_MAX_SIZE;
+        if(_encodedEntries.size() < maxLength)
+            _encodedEntries.resize(maxLength);
+        size_t length = _compactEncoder.Encode(begin, end, _encodedEntries.data());
+
+        WriteRecordData(_encodedEntries.data(), length);
+    }
+    else
+    {
+        WriteRecordData(begin, static_cast<size_t>(reinterpret_cast<ADDRINT>(end) - reinterpret_cast<ADDRINT>(begin)));
+    }
+}
+
+void TraceWriter::WriteRecordData(const void* data, size_t length)
+{
+    if(_writingTraceIndex)
+    {
+        const UINT8* input = static_cast<const UINT8*>(data);
+        UINT64 checksum = _traceFooter.Checksum;
+        for(size_t i = 0; i < length; ++i)
+            checksum = (checksum ^ input[i]) * TRACE_FILE_CHECKSUM_PRIME;
+        _traceFooter.Checksum = checksum;
+        _traceIndexState.Offset += length;
+    }
+
+    WriteOutput(data, length);
+}
+
+void TraceWriter::WriteTraceFooter()
+{
+    _traceFooter.ChunkCount = _traceChunks.size();
+    _traceFooter.Size = static_cast<UINT32>(_traceChunks.size() * sizeof(TraceChunkInfo) + sizeof(TraceFileFooter));
+    _traceFooter.Magic = TRACE_FILE_FOOTER_MAGIC;
+
+    WriteOutput(_traceChunks.data(), _traceChunks.size() * sizeof(TraceChunkInfo));
+    WriteOutput(&_traceFooter, sizeof(_traceFooter));
+}
+
+void TraceWriter::WriteDifferentialRecords(const TraceEntry* begin, const TraceEntry* end)
+{
+    // Matching runs may span several buffers, so the last one is kept pending
+    for(const TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        TraceEntry normalizedEntry = CompactTraceEncoder::NormalizeEntry(*entry);
+        if(MatchesReference(normalizedEntry, _referencePosition))
+        {
+            ++_pendingReferenceCopyCount;
+            ++_referencePosition;
+            continue;
+        }
+
+        FlushReferenceCopy();
+
+        // If the control flow has diverged, the trace may continue at another reference position
+        INT64 offset = FindReferenceMatch(entry, end);
+        if(offset != 0)
+        {
+            _pendingReferenceOffset = offset;
+            _pendingReferenceCopyCount = 1;
+            _referencePosition += offset + 1;
+            continue;
+        }
+
+        // Divergent entry, which replaces the entry at the current reference position
+        _differentialEntries.push_back(normalizedEntry);
+        ++_referencePosition;
+    }
+
+    SerializeRecords(_differentialEntries.data(), _differentialEntries.data() + _differentialEntries.size());
+    _differentialEntries.clear();
+}
+
+bool TraceWriter::MatchesReference(const TraceEntry& normalizedEntry, INT64 position) const
+{
+    if(position < 0 || position >= static_cast<INT64>(_referenceEntries.size()))
+        return false;
+
+    const TraceEntry& referenceEntry = _referenceEntries[static_cast<size_t>(position)];
+    return normalizedEntry.Type == referenceEntry.Type
+        && normalizedEntry.Flag == referenceEntry.Flag
+        && normalizedEntry.Param0 == referenceEntry.Param0
+        && normalizedEntry.Param1 == referenceEntry.Param1
+        && normalizedEntry.Param2 == referenceEntry.Param2;
+}
+
+INT64 TraceWriter::FindReferenceMatch(const TraceEntry* entry, const TraceEntry* end) const
+{
+    // Only entries of the current buffer can be used for confirming a match
+    const TraceEntry* confirmationEnd = entry + std::min<ptrdiff_t>(end - entry, DIFFERENTIAL_RESYNC_LENGTH);
+
+    // Prefer close positions, and skipped reference entries over repeated ones
+    for(INT64 distance = 1; distance <= DIFFERENTIAL_RESYNC_WINDOW; ++distance)
+    {
+        for(INT64 offset : { distance, -distance })
+        {
+            bool matches = true;
+            for(const TraceEntry* confirmationEntry = entry; matches && confirmationEntry != confirmationEnd; ++confirmationEntry)
+                matches = MatchesReference(CompactTraceEncoder::NormalizeEntry(*confirmationEntry), _referencePosition + offset + (confirmationEntry - entry));
+            if(matches)
+                return offset;
+        }
+    }
+
+    return 0;
+}
+
+void TraceWriter::FlushReferenceCopy()
+{
+    if(_pendingReferenceCopyCount == 0)
+        return;
+
+    TraceEntry copyEntry{};
+    copyEntry.Type = TraceEntryTypes::ReferenceCopy;
+    copyEntry.Param1 = _pendingReferenceCopyCount;
+    copyEntry.Param2 = static_cast<UINT64>(_pendingReferenceOffset);
+    _differentialEntries.push_back(copyEntry);
+
+    _pendingReferenceCopyCount = 0;
+    _pendingReferenceOffset = 0;
+}
+
+void TraceWriter::WriteReferenceFile()
+{
+    std::string filename = _outputFilenamePrefix + "reference.trace";
+    std::ofstream referenceFileStream(filename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+    if(!referenceFileStream)
+    {
+        std::cerr << "Error: Could not open reference trace file '" << filename << "'." << std::endl;
+        exit(1);
+    }
+
+    TraceFileHeader header{};
+    header.Magic = TRACE_FILE_MAGIC;
+    header.Version = TRACE_FILE_VERSION;
+    header.Flags = _referenceFileFlags;
+    referenceFileStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    referenceFileStream.write(reinterpret_cast<const char*>(_referenceEntries.data()), static_cast<std::streamsize>(_referenceEntries.size() * sizeof(TraceEntry)));
+    referenceFileStream.close();
+
+    std::cerr << "Recorded reference trace with " << std::dec << _referenceEntries.size() << " entries" << std::endl;
+}
+
+TraceEntry* TraceWriter::FilterMemoryAccesses(TraceEntry* begin, TraceEntry* end)
+{
+    // The buffer is not used by the instrumented thread while it is written, so the entries are filtered in place
+    TraceEntry* output = begin;
+    for(TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        if(entry->Type == TraceEntryTypes::MemoryRead || entry->Type == TraceEntryTypes::MemoryWrite)
+        {
+            entry->Param2 &= _memoryAddressMask;
+
+            if(_suppressDuplicateAccesses)
+            {
+                UINT32 typeAndSize = static_cast<UINT32>(entry->Type) | (static_cast<UINT32>(entry->Param0) << 16);
+                LastMemoryAccess& lastAccess = _lastMemoryAccesses[(entry->Param1 ^ (entry->Param1 >> 10)) & (LAST_ACCESS_FILTER_SIZE - 1)];
+                if(lastAccess.Instruction == entry->Param1 && lastAccess.Address == entry->Param2 && lastAccess.TypeAndSize == typeAndSize)
+                    continue;
+
+                lastAccess.Instruction = entry->Param1;
+                lastAccess.Address = entry->Param2;
+                lastAccess.TypeAndSize = typeAndSize;
+            }
+        }
+
+        *output++ = *entry;
+    }
+
+    return output;
+}
+
+TraceEntry* TraceWriter::FilterSecretAccesses(TraceEntry* begin, TraceEntry* end)
+{
+    PIN_GetLock(&_secretRegionsLock, 0);
+
+    // The buffer is not used by the instrumented thread while it is written, so the entries are filtered in place
+    TraceEntry* output = begin;
+    for(TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        bool isMemoryAccess = entry->Type == TraceEntryTypes::MemoryRead || entry->Type == TraceEntryTypes::MemoryWrite;
+        if(isMemoryAccess || entry->Type == TraceEntryTypes::Branch)
+        {
+            if(isMemoryAccess && IsSecretAccess(entry->Param2, entry->Param0))
+            {
+                _secretInstructions.insert(entry->Param1);
+                _secretDependencyRemaining = _secretDependencyWindow;
+            }
+            else if(_secretDependencyRemaining > 0)
+                --_secretDependencyRemaining;
+            else if(_secretInstructions.find(entry->Param1) == _secretInstructions.end())
+                continue;
+        }
 
+        *output++ = *entry;
+    }
 
-/* TYPES */
+    PIN_ReleaseLock(&_secretRegionsLock);
+    return output;
+}
 
-TraceWriter::TraceWriter(const std::string& filenamePrefix)
+bool TraceWriter::IsSecretAccess(UINT64 address, UINT64 size)
 {
-    // Remember prefix
-    _outputFilenamePrefix = filenamePrefix;
+    // Find the last region which starts before the end of the access
+    auto region = _secretRegions.lower_bound(address + size);
+    if(region == _secretRegions.begin())
+        return false;
+    --region;
+    return region->second > address;
+}
 
-    // Open prefix output file
-	std::string filename = filenamePrefix + "prefix.trace";
-    OpenOutputFile(filename);
+void TraceWriter::CollapseRuns(const TraceEntry* begin, const TraceEntry* end)
+{
+    // Runs are only detected within a single buffer, which keeps the encoder stateless
+    _collapsedEntries.clear();
+    const TraceEntry* entry = begin;
+    while(entry != end)
+    {
+        // Find the period which covers the most entries, starting with the third iteration
+        // The first two iterations are kept, as they define the stride of each entry
+        size_t bestPeriod = 0;
+        size_t bestRepetitions = 0;
+        for(size_t period = 1; period <= MAX_RUN_PERIOD; ++period)
+        {
+            if(static_cast<size_t>(end - entry) <= 2 * period)
+                break;
+            const TraceEntry* runEnd = entry + 2 * period;
+            while(runEnd != end && ContinuesRun(runEnd, period))
+                ++runEnd;
+
+            size_t repetitions = static_cast<size_t>(runEnd - (entry + 2 * period)) / period;
+            if(repetitions * period > bestRepetitions * bestPeriod)
+            {
+                bestPeriod = period;
+                bestRepetitions = repetitions;
+            }
+        }
+
+        // A Repeat entry only pays off if it replaces at least two entries
+        if(bestRepetitions * bestPeriod < 2)
+        {
+            _collapsedEntries.push_back(*entry);
+            ++entry;
+            continue;
+        }
+
+        _collapsedEntries.insert(_collapsedEntries.end(), entry, entry + 2 * bestPeriod);
+
+        TraceEntry repeatEntry{};
+        repeatEntry.Type = TraceEntryTypes::Repeat;
+        repeatEntry.Param0 = static_cast<UINT16>(bestPeriod);
+        repeatEntry.Param1 = bestRepetitions;
+        _collapsedEntries.push_back(repeatEntry);
+
+        entry += (2 + bestRepetitions) * bestPeriod;
+    }
+
+    WriteRecords(_collapsedEntries.data(), _collapsedEntries.data() + _collapsedEntries.size());
 }
 
-TraceWriter::~TraceWriter()
+bool TraceWriter::ContinuesRun(const TraceEntry* entry, size_t period)
 {
-    // Close file stream
-    _outputFileStream.close();
+    const TraceEntry* previous = entry - period;
+    const TraceEntry* first = previous - period;
+    if(entry->Type != previous->Type || entry->Type != first->Type)
+        return false;
+
+    // Only compare the fields which are used by the respective entry type
+    switch(entry->Type)
+    {
+        case TraceEntryTypes::MemoryRead:
+        case TraceEntryTypes::MemoryWrite:
+            if(entry->Param0 != previous->Param0 || entry->Param0 != first->Param0)
+                return false;
+            break;
+
+        case TraceEntryTypes::Branch:
+        case TraceEntryTypes::StackPointerModification:
+            if(entry->Flag != previous->Flag || entry->Flag != first->Flag)
+                return false;
+            break;
+
+        // Basic blocks do not have a Param2 value
+        case TraceEntryTypes::BasicBlock:
+            return entry->Flag == previous->Flag && entry->Flag == first->Flag
+                   && entry->Param1 == previous->Param1 && entry->Param1 == first->Param1;
+
+        // Allocations and other rare entries are always kept
+        default:
+            return false;
+    }
+
+    return entry->Param1 == previous->Param1 && entry->Param1 == first->Param1
+           && entry->Param2 - previous->Param2 == previous->Param2 - first->Param2;
 }
 
-void TraceWriter::InitPrefixMode(const std::string& filenamePrefix)
+void TraceWriter::AggregateEntries(TraceEntry* begin, TraceEntry* end)
 {
-    // Start trace prefix mode
-    _prefixMode = true;
-    _sawFirstReturn = true;
+    _aggregatedEntries.clear();
+    for(TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        switch(entry->Type)
+        {
+            case TraceEntryTypes::MemoryRead:
+            case TraceEntryTypes::MemoryWrite:
+                _accessHistogram.Add(entry->Param1, entry->Param2, static_cast<UINT32>(entry->Type) | (static_cast<UINT32>(entry->Param0) << 16));
+                break;
 
-    // Open prefix metadata output file
-    _prefixDataFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-	std::string prefixDataFilename = filenamePrefix + "prefix_data.txt";
-    _prefixDataFileStream.open(prefixDataFilename.c_str(), std::ofstream::out | std::ofstream::trunc);
-    if(!_prefixDataFileStream)
+            // The memory accesses are written at the end of the testcase, so deallocations must not come before them
+            case TraceEntryTypes::HeapFreeAddressParameter:
+                _deferredFreeEntries.push_back(*entry);
+                break;
+
+            // Control flow is not recorded
+            case TraceEntryTypes::Branch:
+            case TraceEntryTypes::StackPointerModification:
+            case TraceEntryTypes::StackFrame:
+            case TraceEntryTypes::BasicBlock:
+                break;
+
+            default:
+                _aggregatedEntries.push_back(*entry);
+                break;
+        }
+    }
+
+    if(!_aggregatedEntries.empty())
+        WriteRecords(_aggregatedEntries.data(), _aggregatedEntries.data() + _aggregatedEntries.size());
+}
+
+void TraceWriter::WriteAccessHistogram()
+{
+    // Each distinct access is followed by its number of occurrences
+    std::vector<AccessHistogramBucket> buckets = _accessHistogram.GetSortedBuckets();
+    _aggregatedEntries.clear();
+    _aggregatedEntries.reserve(2 * buckets.size() + _deferredFreeEntries.size());
+    for(const AccessHistogramBucket& bucket : buckets)
     {
-        std::cerr << "Error: Could not open prefix metadata output file '" << prefixDataFilename << "'." << std::endl;
-        exit(1);
+        TraceEntry accessEntry{};
+        accessEntry.Type = static_cast<TraceEntryTypes>(bucket.TypeAndSize & 0xFFFF);
+        accessEntry.Param0 = static_cast<UINT16>(bucket.TypeAndSize >> 16);
+        accessEntry.Param1 = bucket.InstructionAddress;
+        accessEntry.Param2 = bucket.MemoryAddress;
+        _aggregatedEntries.push_back(accessEntry);
+
+        TraceEntry countEntry{};
+        countEntry.Type = TraceEntryTypes::AccessCount;
+        countEntry.Param1 = bucket.Count;
+        _aggregatedEntries.push_back(countEntry);
     }
-    std::cerr << "Trace prefix mode started" << std::endl;
+    _aggregatedEntries.insert(_aggregatedEntries.end(), _deferredFreeEntries.begin(), _deferredFreeEntries.end());
+
+    if(!_aggregatedEntries.empty())
+        WriteRecords(_aggregatedEntries.data(), _aggregatedEntries.data() + _aggregatedEntries.size());
+    _deferredFreeEntries.clear();
 }
 
-TraceEntry* TraceWriter::Begin()
+void TraceWriter::WriteBufferToFile(TraceEntry* end)
 {
-    return _entries;
+    // Discard entries outside of testcases
+    if(_testcaseId == -1 && !_prefixMode)
+        return;
+
+    // Write buffer contents
+    _traceEntryCount += static_cast<UINT64>(end - _entries);
+    if(_flushThreadRunning)
+        EnqueueBuffer(end);
+    else
+        WriteEntries(_entries, end);
 }
 
-TraceEntry* TraceWriter::End()
+void TraceWriter::WriteBufferToFileInPlace(TraceEntry* end)
+{
+    // Discard entries outside of testcases
+    if(_testcaseId == -1 && !_prefixMode)
+        return;
+
+    // Write pending buffers first, so the entries stay in order
+    WaitForFlush();
+    _traceEntryCount += static_cast<UINT64>(end - _entries);
+    WriteEntries(_entries, end);
+}
+
+void TraceWriter::ThreadEnd(TraceEntry* nextEntry)
 {
-    return &_entries[ENTRY_BUFFER_SIZE];
+    // The trace is finished like at the end of a testcase, else pending compressed data, the footer and the LZ4 end mark would be lost
+    if(_prefixMode || _testcaseId != -1)
+        CloseOutputFile(nextEntry);
 }
 
-void TraceWriter::OpenOutputFile(std::string& filename)
+std::string TraceWriter::GetOutputFilename(int testcaseId)
 {
-    // Open file for writing
-    _outputFileStream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-    _currentOutputFilename = filename;
-    _outputFileStream.open(_currentOutputFilename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-    if(!_outputFileStream)
+    std::stringstream filenameStream;
+    filenameStream << _outputFilenamePrefix;
+    if(testcaseId == -1)
+        filenameStream << "prefix";
+    else
+        filenameStream << "t" << std::dec << testcaseId;
+    if(_threadId != 0)
+        filenameStream << "_th" << std::dec << _threadId;
+    filenameStream << ".trace";
+    if(_traceCompression == TraceCompressions::Lz4)
+        filenameStream << ".lz4";
+    return filenameStream.str();
+}
+
+void TraceWriter::CloseOutputFile(TraceEntry* nextEntry)
+{
+    // Save remaining trace data
+    // This also makes sure that the flush thread has written everything before the file is closed
+    if(nextEntry != _entries)
+        WriteBufferToFileInPlace(nextEntry);
+    else
+        WaitForFlush();
+
+    if(_prefixMode)
     {
-        std::cerr << "Error: Could not open output file '" << _currentOutputFilename << "'." << std::endl;
-        exit(1);
+        FinishPrefixDigest();
+        if(_prefixCache != nullptr)
+            _prefixCache->AddFile(_currentOutputFilename);
+    }
+    if(_aggregatingMemoryAccesses)
+    {
+        WriteAccessHistogram();
+        _aggregatingMemoryAccesses = false;
+    }
+
+    // Write the last pending reference copy, or store the reference for the subsequent traces
+    if(_writingDifferential)
+    {
+        FlushReferenceCopy();
+        SerializeRecords(_differentialEntries.data(), _differentialEntries.data() + _differentialEntries.size());
+        _differentialEntries.clear();
+        _writingDifferential = false;
+    }
+    else if(_recordingReference)
+    {
+        WriteReferenceFile();
+        _recordingReference = false;
+        _referenceRecorded = true;
     }
+
+    // The footer is the last part of the trace data
+    if(_writingTraceIndex)
+    {
+        WriteTraceFooter();
+        _writingTraceIndex = false;
+    }
+
+    // Terminate LZ4 frame
+    if(_compressingOutput)
+    {
+        FlushCompressedOutput();
+        UINT8 endMark[LZ4_END_MARK_SIZE];
+        Lz4FrameEncoder::WriteEndMark(endMark);
+        WriteOutputDirect(endMark, sizeof(endMark));
+        _compressingOutput = false;
+    }
+
+    // Close file handle and reset flags
+    if(_writingToSharedMemoryRing)
+    {
+        _sharedMemoryRing->EndSegment(_sharedMemoryRingSegmentStart, _sharedMemoryRingSegmentLength);
+        _writingToSharedMemoryRing = false;
+        _wroteSharedMemoryRingSegment = true;
+        _wroteTraceArchiveRecord = false;
+    }
+    else if(_writingToTraceArchive)
+    {
+        _traceArchive->EndRecord(_traceArchiveRecordFileName, _traceArchiveRecordOffset, _traceArchiveRecordLength);
+        _writingToTraceArchive = false;
+        _wroteSharedMemoryRingSegment = false;
+        _wroteTraceArchiveRecord = true;
+    }
+    else
+    {
+        if(_outputFileStream.is_open())
+            _outputFileStream.close();
+        _outputFileStream.clear();
+        _wroteSharedMemoryRingSegment = false;
+        _wroteTraceArchiveRecord = false;
+    }
+
+    if(_statisticsMode)
+        _totalStatistics.Add(_traceStatistics);
+    _lastTraceEntryCount = _traceEntryCount;
+
+    // Disable tracing until next test case starts
+    _prefixMode = false;
+    _testcaseId = -1;
 }
 
-void TraceWriter::WriteBufferToFile(TraceEntry* end)
+void TraceWriter::EndPrefixPhase()
 {
-    // Write buffer contents
-    if(_testcaseId != -1 || _prefixMode)
-        _outputFileStream.write(reinterpret_cast<char*>(_entries), static_cast<std::streamsize>(reinterpret_cast<ADDRINT>(end) - reinterpret_cast<ADDRINT>(_entries)));
+    if(!_prefixActive)
+        return;
+
+    // All images of the reference prefix must have been loaded
+    if(_verifyPrefix || _restoredPrefix)
+    {
+        std::string referenceLine;
+        if(std::getline(_referencePrefixDataFileStream, referenceLine) && !referenceLine.empty())
+        {
+            std::cerr << "Error: Trace prefix mismatch: Image of reference prefix was not loaded: " << referenceLine << std::endl;
+            if(_restoredPrefix)
+                _prefixCache->Invalidate();
+            exit(1);
+        }
+        _referencePrefixDataFileStream.close();
+    }
+    else
+    {
+        _prefixDataFileStream.close();
+        if(_writePrefixDigests)
+            _prefixDigestFileStream.close();
+
+        // The prefix files are complete
+        if(_prefixCache != nullptr)
+            _prefixCache->Store();
+    }
+    _prefixActive = false;
+    std::cerr << "Trace prefix mode ended" << std::endl;
 }
 
 void TraceWriter::TestcaseStart(int testcaseId, TraceEntry* nextEntry)
 {
     // Exit prefix mode if necessary
     if(_prefixMode)
-        TestcaseEnd(nextEntry);
+        CloseOutputFile(nextEntry);
+    EndPrefixPhase();
+
+    // All buffers have been written when the previous trace was closed
+    if(_adaptiveBufferSize && _testcaseId == -1)
+        AdaptEntryBufferSize();
 
     // Remember new testcase ID
     _testcaseId = testcaseId;
+    _currentTestcaseId = testcaseId;
     _sawFirstReturn = false;
 
+    // The idle code does not track stack frames, so the shadow stack is outdated
+    if(_pausedInstrumentation)
+    {
+        _shadowStack.clear();
+        _frameMinimumStackPointer = ~static_cast<ADDRINT>(0);
+    }
+
     // Open file for writing
-    std::stringstream filenameStream;
-    filenameStream << _outputFilenamePrefix << "t" << std::dec << _testcaseId << ".trace";
-	std::string filename = filenameStream.str();
+	std::string filename = GetOutputFilename(_testcaseId);
     OpenOutputFile(filename);
-    std::cerr << "Switched to testcase #" << std::dec << _testcaseId << std::endl;
+    if(_threadId == 0)
+        std::cerr << "Switched to testcase #" << std::dec << _testcaseId << std::endl;
+    else
+        std::cerr << "Switched thread #" << std::dec << _threadId << " to testcase #" << std::dec << _testcaseId << std::endl;
 }
 
-void TraceWriter::TestcaseEnd(TraceEntry* nextEntry)
+void TraceWriter::TestcaseEnd(TraceEntry* nextEntry, bool notifyCaller)
 {
-    // Save remaining trace data
-    if(nextEntry != _entries)
-        WriteBufferToFile(nextEntry);
+    // Nothing to do if the thread was created after the testcase start and is thus not associated with a file
+    if(!_prefixMode && _testcaseId == -1)
+        return;
 
-    // Close file handle and reset flags
-    _outputFileStream.close();
-    _outputFileStream.clear();
+    int testcaseId = _testcaseId;
+    bool wasPrefixMode = _prefixMode;
+    CloseOutputFile(nextEntry);
+    _currentTestcaseId = -1;
 
     // Exit prefix mode if necessary
-    if(_prefixMode)
+    if(wasPrefixMode)
     {
-        _prefixDataFileStream.close();
-        _prefixMode = false;
-        std::cerr << "Trace prefix mode ended" << std::endl;
+        EndPrefixPhase();
     }
-    else
+    else if(notifyCaller)
     {
+        // The trace may refer to basic blocks which were instrumented during the testcase
+        if(_basicBlockMode)
+            _basicBlockTableFileStream.flush();
+
+        // Report the counters of the testcase before its trace, so the caller can associate them
+        // "s\t<name>\t<key>=<value>\t..."
+        if(_statisticsMode)
+        {
+            std::stringstream statisticsStream;
+            statisticsStream << "s\t" << _currentOutputFilename << "\t" << FormatStatistics(_traceStatistics);
+
+            PIN_GetLock(&_statisticsLock, 0);
+            statisticsStream << "\tjit_traces=" << std::dec << (_instrumentationStatistics.Traces - _reportedInstrumentationStatistics.Traces)
+                             << "\tjit_retraces=" << std::dec << (_instrumentationStatistics.ReinstrumentedTraces - _reportedInstrumentationStatistics.ReinstrumentedTraces)
+                             << "\tjit_cycles=" << std::dec << (_instrumentationStatistics.Cycles - _reportedInstrumentationStatistics.Cycles)
+                             << "\tcall_sites=";
+            bool first = true;
+            for(auto& imageCallSites : _instrumentedCallSites)
+            {
+                // Only list the images which got new call sites during the testcase
+                UINT64 callSiteCount = imageCallSites.second - _reportedInstrumentedCallSites[imageCallSites.first];
+                if(callSiteCount == 0)
+                    continue;
+                if(!first)
+                    statisticsStream << ",";
+                statisticsStream << imageCallSites.first << ":" << std::dec << callSiteCount;
+                first = false;
+            }
+            _reportedInstrumentationStatistics = _instrumentationStatistics;
+            _reportedInstrumentedCallSites = _instrumentedCallSites;
+            PIN_ReleaseLock(&_statisticsLock);
+
+            NotifyCaller(testcaseId, statisticsStream.str());
+        }
+
         // Notify caller that the trace file is complete
-		std::cout << "t\t" << _currentOutputFilename << std::endl;
+        // Traces in the shared memory ring or the trace archive keep their file name for identification, but are not written to individual files
+        if(_fingerprintMode)
+        {
+            // "f\t<name>\t<trace fingerprint>\t<instruction>=<fingerprint>,..."
+            std::stringstream fingerprintStream;
+            fingerprintStream << "f\t" << _currentOutputFilename << "\t" << std::hex << _traceFingerprint << "\t";
+            bool first = true;
+            for(auto& instructionFingerprint : _instructionFingerprints)
+            {
+                if(!first)
+                    fingerprintStream << ",";
+                fingerprintStream << std::hex << instructionFingerprint.first << "=" << std::hex << instructionFingerprint.second;
+                first = false;
+            }
+            NotifyCaller(testcaseId, fingerprintStream.str());
+        }
+        else if(_wroteSharedMemoryRingSegment)
+        {
+            std::stringstream announcementStream;
+            announcementStream << "t\t" << _currentOutputFilename << "\t" << std::dec << _sharedMemoryRingSegmentStart << "\t" << std::dec << _sharedMemoryRingSegmentLength;
+            NotifyCaller(testcaseId, announcementStream.str());
+        }
+        else if(_wroteTraceArchiveRecord)
+        {
+            // "a\t<name>\t<archive file>\t<offset>\t<length>"
+            std::stringstream announcementStream;
+            announcementStream << "a\t" << _currentOutputFilename << "\t" << _traceArchiveRecordFileName << "\t" << std::dec << _traceArchiveRecordOffset << "\t" << std::dec << _traceArchiveRecordLength;
+            NotifyCaller(testcaseId, announcementStream.str());
+        }
+        else
+            NotifyCaller(testcaseId, "t\t" + _currentOutputFilename);
     }
+}
 
-    // Disable tracing until next test case starts
-    _testcaseId = -1;
+void TraceWriter::NotifyCaller(int testcaseId, const std::string& message)
+{
+    // The line is written at once, so it does not get interleaved with the messages of other worker processes
+    // This relies on pipe writes of up to PIPE_BUF bytes being atomic, which is why fork-server mode excludes the unbounded fingerprint and statistics lines
+    std::stringstream lineStream;
+    if(_forkServerMode)
+        lineStream << std::dec << testcaseId << "\t";
+    lineStream << message << "\n";
+    std::cout << lineStream.str() << std::flush;
+}
+
+void TraceWriter::PrepareFork(TraceEntry* nextEntry)
+{
+    // The first testcase worker ends the trace prefix, so the following workers do not write it again
+    if(_prefixMode)
+        CloseOutputFile(nextEntry);
+    EndPrefixPhase();
+
+    // The flush thread is not duplicated into the worker, so it must not have any pending buffers
+    WaitForFlush();
+}
+
+void TraceWriter::ResumeAfterFork()
+{
+    // Internal threads do not exist in the worker, so the remaining trace buffers are written synchronously
+    _flushThreadRunning = false;
 }
 
 void TraceWriter::WriteImageLoadData(int interesting, uint64_t startAddress, uint64_t endAddress, std::string& name)
 {
     // Prefix mode active?
-    if(!_prefixMode)
+    if(!_prefixActive)
     {
         std::cerr << "Image load ignored: " << name << std::endl;
         return;
     }
 
+    // The image file must not have changed since the cached prefix was recorded
+    if(_prefixCache != nullptr && !_prefixCache->CheckImage(name))
+    {
+        std::cerr << "Error: Trace prefix mismatch: Image '" << name << "' differs from the cached prefix" << std::endl;
+        _prefixCache->Invalidate();
+        exit(1);
+    }
+
     // Write image data
-    _prefixDataFileStream << "i\t" << interesting << "\t" << std::hex << startAddress << "\t" << std::hex << endAddress << "\t" << name << std::endl;
+    std::stringstream lineStream;
+    lineStream << "i\t" << interesting << "\t" << std::hex << startAddress << "\t" << std::hex << endAddress << "\t" << name;
+    std::string line = lineStream.str();
+    if(!_verifyPrefix && !_restoredPrefix)
+    {
+        _prefixDataFileStream << line << std::endl;
+        return;
+    }
+
+    // The image must have been loaded at the same position by the instance which recorded the reference prefix
+    std::string referenceLine;
+    if(!std::getline(_referencePrefixDataFileStream, referenceLine) || referenceLine != line)
+    {
+        std::cerr << "Error: Trace prefix mismatch: Image load '" << line << "' does not match reference '" << referenceLine << "'" << std::endl;
+        if(_restoredPrefix)
+            _prefixCache->Invalidate();
+        exit(1);
+    }
 }
 
-TraceEntry* TraceWriter::CheckBufferAndStore(TraceWriter *traceWriter, TraceEntry* nextEntry)
+void TraceWriter::UpdatePrefixDigest(TraceEntry* begin, TraceEntry* end)
+{
+    // Unused entry fields are not initialized, so the digest is computed over the compact encoding
+    size_t maxLength = static_cast<size_t>(end - begin) * COMPACT_ENTRY_MAX_SIZE;
+    if(_encodedEntries.size() < maxLength)
+        _encodedEntries.resize(maxLength);
+    size_t length = _prefixDigestEncoder.Encode(begin, end, _encodedEntries.data());
+
+    // FNV-1a
+    UINT64 digest = _prefixDigest;
+    for(size_t i = 0; i < length; ++i)
+    {
+        digest ^= _encodedEntries[i];
+        digest *= 0x100000001b3ull;
+    }
+    _prefixDigest = digest;
+}
+
+void TraceWriter::UpdateFingerprints(TraceEntry* begin, TraceEntry* end)
+{
+    UINT64 traceFingerprint = _traceFingerprint;
+    for(TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        // Only include the fields which are used by the respective entry type
+        auto type = static_cast<UINT64>(entry->Type);
+        switch(entry->Type)
+        {
+            case TraceEntryTypes::MemoryRead:
+            case TraceEntryTypes::MemoryWrite:
+            {
+                UINT64 typeAndSize = type | (static_cast<UINT64>(entry->Param0) << 8);
+                UINT64& instructionFingerprint = _instructionFingerprints[entry->Param1];
+                instructionFingerprint = MixFingerprint(MixFingerprint(instructionFingerprint, typeAndSize), entry->Param2);
+
+                traceFingerprint = MixFingerprint(MixFingerprint(MixFingerprint(traceFingerprint, typeAndSize), entry->Param1), entry->Param2);
+                break;
+            }
+
+            case TraceEntryTypes::Branch:
+            {
+                UINT64 typeAndFlag = type | (static_cast<UINT64>(entry->Flag) << 8);
+                UINT64& instructionFingerprint = _instructionFingerprints[entry->Param1];
+                instructionFingerprint = MixFingerprint(MixFingerprint(instructionFingerprint, typeAndFlag), entry->Param2);
+
+                traceFingerprint = MixFingerprint(MixFingerprint(MixFingerprint(traceFingerprint, typeAndFlag), entry->Param1), entry->Param2);
+                break;
+            }
+
+            case TraceEntryTypes::HeapAllocSizeParameter:
+            case TraceEntryTypes::AccessCount:
+                traceFingerprint = MixFingerprint(MixFingerprint(traceFingerprint, type), entry->Param1);
+                break;
+
+            case TraceEntryTypes::HeapAllocAddressReturn:
+            case TraceEntryTypes::HeapFreeAddressParameter:
+                traceFingerprint = MixFingerprint(MixFingerprint(traceFingerprint, type), entry->Param2);
+                break;
+
+            case TraceEntryTypes::StackPointerInfo:
+                traceFingerprint = MixFingerprint(MixFingerprint(MixFingerprint(traceFingerprint, type), entry->Param1), entry->Param2);
+                break;
+
+            case TraceEntryTypes::StackPointerModification:
+                traceFingerprint = MixFingerprint(MixFingerprint(MixFingerprint(traceFingerprint, type | (static_cast<UINT64>(entry->Flag) << 8)), entry->Param1), entry->Param2);
+                break;
+
+            case TraceEntryTypes::BasicBlock:
+                traceFingerprint = MixFingerprint(MixFingerprint(traceFingerprint, type | (static_cast<UINT64>(entry->Flag) << 8)), entry->Param1);
+                break;
+
+            case TraceEntryTypes::Repeat:
+                traceFingerprint = MixFingerprint(MixFingerprint(traceFingerprint, type | (static_cast<UINT64>(entry->Param0) << 8)), entry->Param1);
+                break;
+
+            case TraceEntryTypes::StackFrame:
+                traceFingerprint = MixFingerprint(MixFingerprint(MixFingerprint(traceFingerprint, type | (static_cast<UINT64>(entry->Param0) << 8)), entry->Param1), entry->Param2);
+                break;
+
+            case TraceEntryTypes::ReferenceCopy:
+                // Only created when writing differential traces
+                break;
+        }
+    }
+    _traceFingerprint = traceFingerprint;
+}
+
+void TraceWriter::FinishPrefixDigest()
 {
-    if(traceWriter == nullptr || nextEntry == nullptr)
-        return nullptr;
+    if(_writePrefixDigests)
+    {
+        _prefixDigestFileStream << std::dec << _threadId << "\t" << std::hex << _prefixDigest << std::endl;
+    }
+    else if(_verifyPrefix)
+    {
+        auto referenceDigestIt = _referencePrefixDigests.find(_threadId);
+        if(referenceDigestIt == _referencePrefixDigests.end() || referenceDigestIt->second != _prefixDigest)
+        {
+            std::cerr << "Error: Trace prefix mismatch: Prefix trace of thread #" << std::dec << _threadId << " does not match the reference prefix" << std::endl;
+            exit(1);
+        }
+        std::cerr << "Verified prefix trace of thread #" << std::dec << _threadId << std::endl;
+    }
+}
 
+TraceEntry* TraceWriter::CheckBufferAndStore(TraceWriter *traceWriter, TraceEntry* nextEntry)
+{
     // Entry list full?
     if(nextEntry == traceWriter->End())
     {
         // Write entries to file, restart writing entries at the list begin
-        traceWriter->WriteBufferToFile(traceWriter->End());
+        traceWriter->WriteBufferToFileInPlace(traceWriter->End());
         return traceWriter->Begin();
     }
 
@@ -155,34 +1817,32 @@ TraceEntry* TraceWriter::CheckBufferAndStore(TraceWriter *traceWriter, TraceEntr
     return nextEntry;
 }
 
-TraceEntry* TraceWriter::InsertMemoryReadEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size)
+TraceEntry* TraceWriter::FlushBuffer(TraceWriter* traceWriter, TraceEntry* nextEntry, ADDRINT* entryBufferEnd)
 {
-    // Create entry
-    nextEntry->Type = TraceEntryTypes::MemoryRead;
-    nextEntry->Param0 = size;
-    nextEntry->Param1 = instructionAddress;
-    nextEntry->Param2 = memoryAddress;
+    // Write entries to file, restart writing entries at the begin of the (possibly new) buffer
+    traceWriter->WriteBufferToFile(nextEntry);
+    *entryBufferEnd = reinterpret_cast<ADDRINT>(traceWriter->End());
+    return traceWriter->Begin();
+}
 
-    return CheckBufferAndStore(traceWriter, nextEntry + 1);
+TraceEntry* TraceWriter::DiscardFirstReturn(TraceWriter* traceWriter, TraceEntry* nextEntry)
+{
+    traceWriter->_sawFirstReturn = true;
+    return nextEntry - traceWriter->_inTraceScope;
 }
 
-TraceEntry* TraceWriter::InsertMemoryWriteEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size)
+TraceEntry* TraceWriter::MarkFirstReturn(TraceWriter* traceWriter, TraceEntry* nextEntry)
 {
-    // Create entry
-    nextEntry->Type = TraceEntryTypes::MemoryWrite;
-    nextEntry->Param0 = size;
-    nextEntry->Param1 = instructionAddress;
-    nextEntry->Param2 = memoryAddress;
+    traceWriter->_sawFirstReturn = true;
 
-    return CheckBufferAndStore(traceWriter, nextEntry + 1);
+    nextEntry->Type = TraceEntryTypes::BasicBlock;
+    nextEntry->Flag = static_cast<UINT8>(TraceEntryFlags::BasicBlockDiscontinuity);
+    nextEntry->Param1 = 0;
+    return nextEntry + 1;
 }
 
 TraceEntry* TraceWriter::InsertHeapAllocSizeParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT64 size)
 {
-    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
-    if(nextEntry == nullptr)
-        return nextEntry;
-
     // Create entry
     nextEntry->Type = TraceEntryTypes::HeapAllocSizeParameter;
     nextEntry->Param1 = size;
@@ -197,10 +1857,6 @@ TraceEntry* TraceWriter::InsertCallocSizeParameterEntry(TraceWriter *traceWriter
 
 TraceEntry* TraceWriter::InsertHeapAllocAddressReturnEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT memoryAddress)
 {
-    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
-    if(nextEntry == nullptr)
-        return nextEntry;
-
     // Create entry
     nextEntry->Type = TraceEntryTypes::HeapAllocAddressReturn;
     nextEntry->Param2 = memoryAddress;
@@ -210,10 +1866,6 @@ TraceEntry* TraceWriter::InsertHeapAllocAddressReturnEntry(TraceWriter *traceWri
 
 TraceEntry* TraceWriter::InsertHeapFreeAddressParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT memoryAddress)
 {
-    // Check whether given entry pointer is valid (we might be in a non-instrumented thread)
-    if(nextEntry == nullptr)
-        return nextEntry;
-
     // Create entry
     nextEntry->Type = TraceEntryTypes::HeapFreeAddressParameter;
     nextEntry->Param2 = memoryAddress;
@@ -221,39 +1873,90 @@ TraceEntry* TraceWriter::InsertHeapFreeAddressParameterEntry(TraceWriter *traceW
     return CheckBufferAndStore(traceWriter, nextEntry + 1);
 }
 
-TraceEntry* TraceWriter::InsertStackPointerModificationEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT newStackPointer, UINT8 flags)
+void TraceWriter::EnterStackFrame(TraceWriter* traceWriter, ADDRINT function, ADDRINT stackPointer)
 {
-    // Create entry
-    nextEntry->Type = TraceEntryTypes::StackPointerModification;
-    nextEntry->Flag = flags;
-    nextEntry->Param1 = instructionAddress;
-    nextEntry->Param2 = newStackPointer;
+    // The calling frame extends at least to the stack pointer before the call
+    if(!traceWriter->_shadowStack.empty())
+        traceWriter->_shadowStack.back().MinimumStackPointer = std::min(traceWriter->_frameMinimumStackPointer, static_cast<ADDRINT>(stackPointer + sizeof(ADDRINT)));
 
-    return CheckBufferAndStore(traceWriter, nextEntry + 1);
+    traceWriter->_shadowStack.push_back(ShadowStackFrame{ function, stackPointer, stackPointer });
+    traceWriter->_frameMinimumStackPointer = stackPointer;
 }
 
-TraceEntry* TraceWriter::InsertBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress, UINT8 taken, UINT8 type)
+TraceEntry* TraceWriter::LeaveStackFrames(TraceWriter* traceWriter, TraceEntry* nextEntry, ADDRINT stackPointer)
 {
-    // Create entry
-    nextEntry->Type = TraceEntryTypes::Branch;
-    nextEntry->Param1 = sourceAddress;
-    nextEntry->Param2 = targetAddress;
-    nextEntry->Flag = static_cast<UINT8>(type) | static_cast<UINT8>(taken == 0 ? TraceEntryFlags::BranchNotTaken : TraceEntryFlags::BranchTaken);
+    // A return from a frame moves the stack pointer above the return address
+    std::vector<ShadowStackFrame>& shadowStack = traceWriter->_shadowStack;
+    while(!shadowStack.empty() && shadowStack.back().EntryStackPointer < stackPointer)
+    {
+        const ShadowStackFrame& frame = shadowStack.back();
+        UINT64 frameSize = (frame.EntryStackPointer - std::min(traceWriter->_frameMinimumStackPointer, frame.EntryStackPointer) + 7) / 8;
 
-    return CheckBufferAndStore(traceWriter, nextEntry + 1);
+        nextEntry->Type = TraceEntryTypes::StackFrame;
+        nextEntry->Param0 = static_cast<UINT16>(std::min<UINT64>(frameSize, 0xFFFF));
+        nextEntry->Param1 = frame.Function;
+        nextEntry->Param2 = frame.EntryStackPointer;
+        nextEntry = CheckBufferAndStore(traceWriter, nextEntry + 1);
+
+        shadowStack.pop_back();
+        traceWriter->_frameMinimumStackPointer = shadowStack.empty() ? stackPointer : shadowStack.back().MinimumStackPointer;
+    }
+
+    return nextEntry;
 }
 
-TraceEntry* TraceWriter::InsertRetBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress)
+TraceEntry* TraceWriter::AddSecretRegion(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT address, UINT64 size)
 {
-    // Skip the very first return after testcase begin (else we get an invalid call stack)
-    if(!_sawFirstReturn)
+    // The preceding entries are filtered with the previous regions
+    traceWriter->WriteBufferToFileInPlace(nextEntry);
+
+    PIN_GetLock(&_secretRegionsLock, 0);
+
+    // Merge with overlapping and adjacent regions
+    ADDRINT start = address;
+    ADDRINT end = address + size;
+    auto region = _secretRegions.upper_bound(start);
+    if(region != _secretRegions.begin() && std::prev(region)->second >= start)
+        --region;
+    while(region != _secretRegions.end() && region->first <= end)
     {
-        _sawFirstReturn = true;
-        return nextEntry;
+        start = std::min(start, region->first);
+        end = std::max(end, region->second);
+        region = _secretRegions.erase(region);
     }
-    
-    // Create entry
-    return InsertBranchEntry(traceWriter, nextEntry, sourceAddress, targetAddress, true, static_cast<UINT8>(TraceEntryFlags::BranchTypeReturn));
+    if(start < end)
+        _secretRegions[start] = end;
+
+    PIN_ReleaseLock(&_secretRegionsLock);
+    return traceWriter->Begin();
+}
+
+TraceEntry* TraceWriter::RemoveSecretRegion(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT address, UINT64 size)
+{
+    // The preceding entries are filtered with the previous regions
+    traceWriter->WriteBufferToFileInPlace(nextEntry);
+
+    PIN_GetLock(&_secretRegionsLock, 0);
+
+    // Cut the range out of all overlapping regions, and keep their remaining parts
+    ADDRINT start = address;
+    ADDRINT end = address + size;
+    auto region = _secretRegions.upper_bound(start);
+    if(region != _secretRegions.begin() && std::prev(region)->second > start)
+        --region;
+    while(region != _secretRegions.end() && region->first < end)
+    {
+        ADDRINT regionStart = region->first;
+        ADDRINT regionEnd = region->second;
+        region = _secretRegions.erase(region);
+        if(regionStart < start)
+            _secretRegions[regionStart] = start;
+        if(regionEnd > end)
+            _secretRegions[end] = regionEnd;
+    }
+
+    PIN_ReleaseLock(&_secretRegionsLock);
+    return traceWriter->Begin();
 }
 
 TraceEntry* TraceWriter::InsertStackPointerInfoEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT stackPointerMin, ADDRINT stackPointerMax)
@@ -266,21 +1969,149 @@ TraceEntry* TraceWriter::InsertStackPointerInfoEntry(TraceWriter *traceWriter, T
     return CheckBufferAndStore(traceWriter, nextEntry + 1);
 }
 
+UINT8* CompactTraceEncoder::WriteVarUInt(UINT8* output, UINT64 value)
+{
+    while(value >= 0x80)
+    {
+        *output++ = static_cast<UINT8>(value | 0x80);
+        value >>= 7;
+    }
+    *output++ = static_cast<UINT8>(value);
+
+    return output;
+}
+
+UINT8* CompactTraceEncoder::WriteDelta(UINT8* output, UINT64 value, UINT64 lastValue)
+{
+    // Zigzag encoding maps small negative differences to small unsigned numbers
+    auto delta = static_cast<INT64>(value - lastValue);
+    return WriteVarUInt(output, (static_cast<UINT64>(delta) << 1) ^ static_cast<UINT64>(delta >> 63));
+}
+
+UINT8 CompactTraceEncoder::GetUsedFields(TraceEntryTypes type)
+{
+    const auto flag = static_cast<UINT8>(TraceEntryFields::Flag);
+    const auto param0 = static_cast<UINT8>(TraceEntryFields::Param0);
+    const auto param1 = static_cast<UINT8>(TraceEntryFields::Param1);
+    const auto param2 = static_cast<UINT8>(TraceEntryFields::Param2);
+    switch(type)
+    {
+        case TraceEntryTypes::MemoryRead:
+        case TraceEntryTypes::MemoryWrite:
+            return param0 | param1 | param2;
+
+        case TraceEntryTypes::HeapAllocSizeParameter:
+        case TraceEntryTypes::AccessCount:
+            return param1;
+
+        case TraceEntryTypes::HeapAllocAddressReturn:
+        case TraceEntryTypes::HeapFreeAddressParameter:
+            return param2;
+
+        case TraceEntryTypes::BasicBlock:
+            return flag | param1;
+
+        case TraceEntryTypes::Repeat:
+            return param0 | param1;
+
+        case TraceEntryTypes::StackFrame:
+            return param0 | param1 | param2;
+
+        case TraceEntryTypes::Branch:
+        case TraceEntryTypes::StackPointerModification:
+            return flag | param1 | param2;
+
+        case TraceEntryTypes::StackPointerInfo:
+        case TraceEntryTypes::ReferenceCopy:
+            return param1 | param2;
+    }
+
+    return 0;
+}
+
+TraceEntry CompactTraceEncoder::NormalizeEntry(const TraceEntry& entry)
+{
+    UINT8 fields = GetUsedFields(entry.Type);
+
+    TraceEntry normalizedEntry{};
+    normalizedEntry.Type = entry.Type;
+    if(fields & static_cast<UINT8>(TraceEntryFields::Flag))
+        normalizedEntry.Flag = entry.Flag;
+    if(fields & static_cast<UINT8>(TraceEntryFields::Param0))
+        normalizedEntry.Param0 = entry.Param0;
+    if(fields & static_cast<UINT8>(TraceEntryFields::Param1))
+        normalizedEntry.Param1 = entry.Param1;
+    if(fields & static_cast<UINT8>(TraceEntryFields::Param2))
+        normalizedEntry.Param2 = entry.Param2;
+    return normalizedEntry;
+}
+
+void CompactTraceEncoder::Reset()
+{
+    for(int i = 0; i < EntryTypeCount; ++i)
+    {
+        _lastParam1[i] = 0;
+        _lastParam2[i] = 0;
+    }
+}
+
+size_t CompactTraceEncoder::Encode(const TraceEntry* begin, const TraceEntry* end, UINT8* output)
+{
+    UINT8* outputBegin = output;
+    for(const TraceEntry* entry = begin; entry != end; ++entry)
+    {
+        auto type = static_cast<UINT32>(entry->Type) & 0x0F;
+
+        // Only store the parameters which are used by the respective entry type
+        UINT8 fields = GetUsedFields(entry->Type);
+        bool hasFlag = (fields & static_cast<UINT8>(TraceEntryFields::Flag)) != 0;
+        bool hasParam0 = (fields & static_cast<UINT8>(TraceEntryFields::Param0)) != 0;
+        bool hasParam1 = (fields & static_cast<UINT8>(TraceEntryFields::Param1)) != 0;
+        bool hasParam2 = (fields & static_cast<UINT8>(TraceEntryFields::Param2)) != 0;
+
+        // The flag is not initialized for entry types which do not use it
+        *output++ = static_cast<UINT8>(type | (hasFlag ? (entry->Flag & 0x0F) << 4 : 0));
+
+        if(hasParam0)
+            output = WriteVarUInt(output, entry->Param0);
+        if(hasParam1)
+        {
+            output = WriteDelta(output, entry->Param1, _lastParam1[type]);
+            _lastParam1[type] = entry->Param1;
+        }
+        if(hasParam2)
+        {
+            output = WriteDelta(output, entry->Param2, _lastParam2[type]);
+            _lastParam2[type] = entry->Param2;
+        }
+    }
+
+    return static_cast<size_t>(output - outputBegin);
+}
+
 ImageData::ImageData(bool interesting, std::string name, UINT64 startAddress, UINT64 endAddress)
 {
     _interesting = interesting;
     _name = std::move(name);
     _startAddress = startAddress;
     _endAddress = endAddress;
+    _containsAllocator = false;
 }
 
 bool ImageData::ContainsBasicBlock(BBL basicBlock) const
 {
-    // Check start address
-    return _startAddress <= INS_Address(BBL_InsHead(basicBlock)) && INS_Address(BBL_InsTail(basicBlock)) <= _endAddress;
+    // Check start and end address
+    // BBL_Address() and BBL_Size() do not need to decode the head and tail instructions
+    UINT64 address = BBL_Address(basicBlock);
+    return _startAddress <= address && address + BBL_Size(basicBlock) - 1 <= _endAddress;
 }
 
 bool ImageData::IsInteresting() const
 {
     return _interesting;
+}
+
+bool ImageData::ContainsAllocator() const
+{
+    return _containsAllocator;
 }
\ No newline at end of file
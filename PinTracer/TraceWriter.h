@@ -3,15 +3,49 @@
 Contains structs to store the trace data.
 */
 
-// The size of the entry buffer.
-#define ENTRY_BUFFER_SIZE 16384
+// The bounds of the entry buffer size, in entries.
+#define MIN_ENTRY_BUFFER_SIZE 1024
+#define MAX_ENTRY_BUFFER_SIZE (1 << 24)
+
+// The size of a huge page, which is used as size granularity and alignment of entry buffers in huge page mode.
+#define HUGE_PAGE_SIZE (2 << 20)
+
+// The maximum number of entry buffers used for asynchronous flushing.
+#define MAX_ASYNC_BUFFER_COUNT 64
+
+// The maximum number of entries per loop iteration that are collapsed by run-length encoding.
+#define MAX_RUN_PERIOD 8
+
+// The number of slots of the per-instruction filter for duplicate memory accesses. Must be a power of two.
+#define LAST_ACCESS_FILTER_SIZE 1024
+
+// The number of reference positions before and after the expected one, which are searched for a match when a differential trace diverges.
+#define DIFFERENTIAL_RESYNC_WINDOW 16
+
+// The number of consecutive entries that must match the reference trace at a new position, to resynchronize a differential trace.
+#define DIFFERENTIAL_RESYNC_LENGTH 4
 
 
 /* INCLUDES */
 #include "pin.H"
+#include "SharedMemoryRing.h"
+#include "TraceArchive.h"
+#include "PrefixCache.h"
+#include "AccessHistogram.h"
+#include "Lz4FrameEncoder.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#ifdef _WIN32
+    #include <intrin.h>
+#else
+    #include <x86intrin.h>
+#endif
 
 
 /* TYPES */
@@ -41,7 +75,26 @@ enum struct TraceEntryTypes : UINT32
     StackPointerInfo = 7,
 
     // A modification of the stack pointer.
-    StackPointerModification = 8
+    StackPointerModification = 8,
+
+    // The number of occurrences of the preceding memory access. Only used in access histogram files.
+    AccessCount = 9,
+
+    // The execution of a basic block, identified by its ID in the basic block table. Replaces Branch entries in basic block control flow mode.
+    BasicBlock = 10,
+
+    // Repetition of the preceding Param0 entries for Param1 more times, where the Param2 value of each entry continues to advance by its difference to the entry one period before.
+    // Only used in run-length encoded trace files.
+    Repeat = 11,
+
+    // Copy of Param1 entries of the reference trace, starting at the current reference position after moving it by the signed offset in Param2.
+    // Only used in differential trace files.
+    ReferenceCopy = 12,
+
+    // A stack frame of a function which has returned: Param1 holds the function address, Param2 the stack pointer at function entry (pointing to the return address),
+    // and Param0 the size of the frame below that stack pointer in 8-byte units, saturated to the maximum value.
+    // Only used in stack frame summary mode, replaces StackPointerModification entries.
+    StackFrame = 13
 };
 
 // Represents one entry in a trace buffer.
@@ -52,22 +105,22 @@ struct TraceEntry
     TraceEntryTypes Type;
 
     // Flag.
-    // Used with: Branch, StackAllocation, StackDeallocation.
+    // Used with: Branch, StackAllocation, StackDeallocation, BasicBlock.
     UINT8 Flag;
 
     // (Padding for reliable parsing by analysis programs)
     UINT8 _padding1;
 
-    // The size of a memory access.
-    // Used with: MemoryRead, MemoryWrite
+    // The size of a memory access, the period of a repetition, or the size of a stack frame.
+    // Used with: MemoryRead, MemoryWrite, Repeat, StackFrame
     UINT16 Param0;
 
-    // The address of the instruction triggering the trace entry creation, or the size of an allocation.
-    // Used with: MemoryRead, MemoryWrite, Branch, AllocSizeParameter, StackPointerInfo, StackPointerModification.
+    // The address of the instruction triggering the trace entry creation, the size of an allocation, the ID of a basic block, or the number of repetitions.
+    // Used with: MemoryRead, MemoryWrite, Branch, AllocSizeParameter, StackPointerInfo, StackPointerModification, BasicBlock, Repeat, ReferenceCopy, StackFrame.
     UINT64 Param1;
 
-    // The accessed/passed memory address.
-    // Used with: MemoryRead, MemoryWrite, AllocAddressReturn, FreeAddressParameter, Branch, StackPointerInfo, StackPointerModification.
+    // The accessed/passed memory address, or the offset of a reference copy.
+    // Used with: MemoryRead, MemoryWrite, AllocAddressReturn, FreeAddressParameter, Branch, StackPointerInfo, StackPointerModification, ReferenceCopy, StackFrame.
     UINT64 Param2;
 };
 #pragma pack(pop)
@@ -88,48 +141,762 @@ enum struct TraceEntryFlags : UINT8
     // Stack (de)allocations
     StackIsCall = 1 << 0,
     StackIsReturn = 2 << 0,
-    StackIsOther = 3 << 0
+    StackIsOther = 3 << 0,
+
+    // Basic block: The control flow does not continue from the preceding basic block, so no branch must be derived from it
+    BasicBlockDiscontinuity = 1 << 0
+};
+
+// The fields of a trace entry which are used by a given entry type.
+enum struct TraceEntryFields : UINT8
+{
+    Flag = 1 << 0,
+    Param0 = 1 << 1,
+    Param1 = 1 << 2,
+    Param2 = 1 << 3
+};
+
+// The kinds of pages which back the entry buffers.
+enum struct HugePageModes : int
+{
+    // Regular heap memory.
+    None = 0,
+
+    // Anonymous memory, which is aligned and marked for transparent huge pages.
+    Transparent = 1,
+
+    // Explicitly reserved huge pages; falls back to transparent huge pages if none are available.
+    Explicit = 2
+};
+
+// The on-disk formats of trace files.
+enum struct TraceFormats : int
+{
+    // Fixed-size TraceEntry records without file header.
+    Raw = 0,
+
+    // File header followed by variable-length, delta-encoded records (see CompactTraceEncoder).
+    Compact = 1
+};
+
+// The compression of trace files.
+enum struct TraceCompressions : int
+{
+    // Uncompressed trace files.
+    None = 0,
+
+    // Trace files are wrapped into an LZ4 frame and get the extension ".lz4".
+    Lz4 = 1
+};
+
+// Flags in the trace file header.
+enum struct TraceFileFlags : UINT16
+{
+    // The records use the compact encoding.
+    CompactEncoding = 1 << 0,
+
+    // The memory accesses are aggregated: Each distinct access is stored once at the end of the trace and followed by an AccessCount entry.
+    // Branches and stack pointer modifications are not recorded, and heap deallocations are moved behind the memory accesses.
+    AccessHistogram = 1 << 1,
+
+    // The control flow is recorded as BasicBlock entries, which refer to the basic block table, instead of Branch entries.
+    BasicBlockControlFlow = 1 << 2,
+
+    // Repeated loop iterations are collapsed into Repeat entries.
+    RunLengthEncoding = 1 << 3,
+
+    // The entries are stored as difference to the reference trace: ReferenceCopy entries stand for matching runs of the reference trace, and every other entry replaces the entry at the current reference position.
+    // The reference trace is stored in a separate file, with raw entries that are normalized by CompactTraceEncoder::NormalizeEntry().
+    DifferentialEncoding = 1 << 4,
+
+    // The records are followed by a TraceFileFooter, which holds entry counts, a checksum and a chunk index.
+    // In compact encoding, the delta state is reset at the beginning of each chunk, so the chunks can be decoded independently.
+    IndexFooter = 1 << 5
+};
+
+// The magic number at the beginning of trace files which have a header ("MWTR").
+#define TRACE_FILE_MAGIC 0x5254574D
+
+// The current version of the trace file header and the compact encoding.
+#define TRACE_FILE_VERSION 1
+
+// Header of trace files. Raw trace files do not have a header; they can be distinguished by their first four bytes, which hold a valid TraceEntryTypes value.
+#pragma pack(push, 1)
+struct TraceFileHeader
+{
+    // The magic number TRACE_FILE_MAGIC.
+    UINT32 Magic;
+
+    // The format version TRACE_FILE_VERSION.
+    UINT16 Version;
+
+    // A combination of TraceFileFlags.
+    UINT16 Flags;
+};
+#pragma pack(pop)
+static_assert(sizeof(TraceFileHeader) == 4 + 2 + 2, "Wrong size of TraceFileHeader struct");
+
+// The magic number at the end of the trace file footer ("MWTF").
+#define TRACE_FILE_FOOTER_MAGIC 0x4654574D
+
+// The number of entry types which are counted in the trace file footer.
+#define TRACE_FILE_FOOTER_ENTRY_TYPE_COUNT 16
+
+// The state at the beginning of a chunk of the trace file, as stored in the chunk index of the footer.
+// The state is derived from the stored entries, which start with the testcase (or the prefix).
+#pragma pack(push, 1)
+struct TraceChunkInfo
+{
+    // The index of the first entry of the chunk.
+    UINT64 EntryIndex;
+
+    // The offset of the first record of the chunk, relative to the end of the file header.
+    UINT64 Offset;
+
+    // The number of calls minus the number of returns before the chunk.
+    INT32 CallDepth;
+
+    // The number of heap allocation size entries before the chunk, which have not been followed by an address return yet.
+    UINT32 PendingAllocationCount;
+
+    // The number of heap allocation address returns before the chunk.
+    UINT64 HeapAllocationCount;
+};
+#pragma pack(pop)
+static_assert(sizeof(TraceChunkInfo) == 8 + 8 + 4 + 4 + 8, "Wrong size of TraceChunkInfo struct");
+
+// Footer of trace files with the IndexFooter flag. The footer follows the last record, and is preceded by ChunkCount TraceChunkInfo objects.
+// Both are part of the LZ4 frame of compressed trace files.
+#pragma pack(push, 1)
+struct TraceFileFooter
+{
+    // The number of stored entries, indexed by their type.
+    UINT64 EntryCounts[TRACE_FILE_FOOTER_ENTRY_TYPE_COUNT];
+
+    // The number of entries per chunk.
+    UINT64 ChunkInterval;
+
+    // The number of chunks in the chunk index.
+    UINT64 ChunkCount;
+
+    // The 64-bit FNV-1a hash of the records, i.e., the bytes between the file header and the chunk index.
+    UINT64 Checksum;
+
+    // The size of the chunk index and the footer.
+    UINT32 Size;
+
+    // The magic number TRACE_FILE_FOOTER_MAGIC.
+    UINT32 Magic;
+};
+#pragma pack(pop)
+static_assert(sizeof(TraceFileFooter) == 8 * TRACE_FILE_FOOTER_ENTRY_TYPE_COUNT + 8 + 8 + 8 + 4 + 4, "Wrong size of TraceFileFooter struct");
+
+// The initial value of the 64-bit FNV-1a hash which is used as trace file checksum.
+#define TRACE_FILE_CHECKSUM_BASIS 0xcbf29ce484222325ull
+
+// The prime of the 64-bit FNV-1a hash which is used as trace file checksum.
+#define TRACE_FILE_CHECKSUM_PRIME 0x100000001b3ull
+
+// The maximum number of bytes needed for encoding a single trace entry in compact format.
+// Tag byte + LEB128-encoded Param0 (16 bits) + LEB128-encoded Param1 and Param2 (64 bits each).
+#define COMPACT_ENTRY_MAX_SIZE (1 + 3 + 10 + 10)
+
+// The last memory access of an instruction, as stored in the duplicate access filter.
+struct LastMemoryAccess
+{
+    // The address of the accessing instruction, or 0 if the slot is empty.
+    UINT64 Instruction;
+
+    // The accessed address, with the address granularity applied.
+    UINT64 Address;
+
+    // The access type in the lower 16 bits, and the access size in the upper 16 bits.
+    UINT32 TypeAndSize;
+};
+
+// A frame on the shadow stack, in stack frame summary mode.
+struct ShadowStackFrame
+{
+    // The address of the called function.
+    UINT64 Function;
+
+    // The stack pointer at function entry, which points to the return address.
+    UINT64 EntryStackPointer;
+
+    // The minimum stack pointer of this frame, while a callee is running.
+    UINT64 MinimumStackPointer;
+};
+
+// Overhead and volume counters of a trace writer, in statistics mode.
+struct TraceStatistics
+{
+    // The number of recorded entries, indexed by their type. Counted before filtering and encoding.
+    UINT64 EntryCounts[16]{};
+
+    // The number of written entry buffers.
+    UINT64 BufferFlushes = 0;
+
+    // The number of bytes written into trace files or the shared memory ring.
+    UINT64 BytesWritten = 0;
+
+    // The number of time stamp counter cycles spent in writing entry buffers.
+    UINT64 WriteCycles = 0;
+
+    // Adds the counters of the given statistics to this object.
+    void Add(const TraceStatistics& other);
+};
+
+// Counters of the trace instrumentation, in statistics mode.
+struct InstrumentationStatistics
+{
+    // The number of instrumented traces.
+    UINT64 Traces = 0;
+
+    // The number of traces which were instrumented again, after being removed from the code cache.
+    UINT64 ReinstrumentedTraces = 0;
+
+    // The number of time stamp counter cycles spent in trace instrumentation.
+    UINT64 Cycles = 0;
+};
+
+// The taint state of a thread, which is managed by the taint tracker.
+struct TaintState;
+
+// Encodes trace entries into variable-length records.
+// Each record starts with a tag byte, which holds the entry type in the lower 4 bits and the entry flag in the upper 4 bits.
+// The tag is followed by those parameters that are used by the given entry type, in order Param0, Param1, Param2, as LEB128 varints.
+// Param1 and Param2 are stored as zigzag-encoded differences to the respective parameter of the previous entry with the same type.
+class CompactTraceEncoder
+{
+private:
+    // The number of distinct entry types, including the unused 0 value.
+    static constexpr int EntryTypeCount = 16;
+
+    // The last Param1 value for each entry type.
+    UINT64 _lastParam1[EntryTypeCount]{};
+
+    // The last Param2 value for each entry type.
+    UINT64 _lastParam2[EntryTypeCount]{};
+
+private:
+    // Writes the given value as LEB128 varint and returns the address after the last written byte.
+    static UINT8* WriteVarUInt(UINT8* output, UINT64 value);
+
+    // Writes the zigzag-encoded difference of the given values as LEB128 varint and returns the address after the last written byte.
+    static UINT8* WriteDelta(UINT8* output, UINT64 value, UINT64 lastValue);
+
+public:
+    // Returns the fields which are used by the given entry type, as a combination of TraceEntryFields values.
+    static UINT8 GetUsedFields(TraceEntryTypes type);
+
+    // Returns a copy of the given entry, where all fields that are not used by its type are cleared.
+    static TraceEntry NormalizeEntry(const TraceEntry& entry);
+
+    // Resets the delta state. Must be called at the beginning of each trace file.
+    void Reset();
+
+    // Encodes the given entries and returns the number of written bytes.
+    // The output buffer must hold at least COMPACT_ENTRY_MAX_SIZE bytes per entry.
+    size_t Encode(const TraceEntry* begin, const TraceEntry* end, UINT8* output);
 };
 
 // Provides functions to write trace buffer contents into a log file.
-// The prefix handling of this class is designed for single-threaded mode!
+// Each application thread owns one trace writer; the writers of threads which are not traced discard all entries.
 class TraceWriter
 {
 private:
     // The path prefix of the output file.
     std::string _outputFilenamePrefix;
 
+    // The ID of the thread owning this trace writer.
+    THREADID _threadId;
+
+    // Determines whether the entries of the owning thread are written to trace files.
+    // Trace writers of threads which are not traced write into a private buffer, which is discarded when it is full.
+    bool _traced;
+
     // The file where the trace data is currently written to.
 	std::ofstream _outputFileStream;
 
     // The name of the currently open output file.
 	std::string _currentOutputFilename;
 
-    // The buffer entries.
-    TraceEntry _entries[ENTRY_BUFFER_SIZE]{};
+    // The buffer which is currently filled by the instrumented thread.
+    TraceEntry* _entries;
+
+    // The size of the entry buffers of this trace writer, in entries.
+    size_t _entryBufferSize;
+
+    // The number of entries which were handed over for writing in the current trace.
+    UINT64 _traceEntryCount = 0;
+
+    // The number of entries of the last closed trace.
+    UINT64 _lastTraceEntryCount = 0;
 
     // The current testcase ID.
     int _testcaseId = -1;
 
-private:
-    // Determines whether the program is currently tracing the trace prefix.
-    static bool _prefixMode;
-    
+    // Determines whether this trace writer is currently writing the trace prefix of its thread.
+    bool _prefixMode = false;
+
     // Determines whether the first return entry after testcase begin has been observed.
-    static bool _sawFirstReturn;
+    bool _sawFirstReturn = true;
+
+    // The entry buffers. In synchronous mode, this only contains a single buffer.
+    std::vector<TraceEntry*> _bufferRing;
+
+    // The end pointers of the filled buffers, as passed to the flush thread.
+    std::vector<TraceEntry*> _bufferRingEnds;
+
+    // The index of the buffer which is currently filled by the instrumented thread.
+    int _currentBufferIndex = 0;
+
+    // The index of the oldest buffer that waits for being written by the flush thread.
+    int _nextFlushBufferIndex = 0;
+
+    // The number of filled buffers that have not yet been written by the flush thread.
+    int _pendingBufferCount = 0;
+
+    // Protects the buffer ring state.
+    PIN_MUTEX _bufferRingMutex{};
+
+    // Signaled when a filled buffer is enqueued, or when the flush thread should exit.
+    PIN_SEMAPHORE _bufferReadyEvent{};
+
+    // Signaled when the flush thread has finished writing a buffer.
+    PIN_SEMAPHORE _bufferFreedEvent{};
+
+    // The ID of the flush thread.
+    PIN_THREAD_UID _flushThreadUid{};
+
+    // Determines whether the flush thread is running, i.e., whether filled buffers are written asynchronously.
+    volatile bool _flushThreadRunning = false;
+
+    // Instructs the flush thread to exit after writing all pending buffers.
+    volatile bool _stopFlushThread = false;
+
+    // The encoder for compact trace files.
+    CompactTraceEncoder _compactEncoder;
+
+    // Holds encoded entries before they are written to the output file.
+    std::vector<UINT8> _encodedEntries;
+
+    // Determines whether the current output is compressed.
+    bool _compressingOutput = false;
+
+    // The encoder for compressed trace files.
+    Lz4FrameEncoder _lz4Encoder;
+
+    // Holds output data until a full block can be compressed.
+    std::vector<UINT8> _uncompressedOutput;
+
+    // Holds the last compressed block before it is written to the output file.
+    std::vector<UINT8> _compressedOutput;
+
+    // Determines whether the current output goes to the shared memory ring instead of the output file stream.
+    bool _writingToSharedMemoryRing = false;
+
+    // Determines whether the last closed trace was written to the shared memory ring.
+    bool _wroteSharedMemoryRingSegment = false;
+
+    // The offset of the last trace in the shared memory ring.
+    UINT64 _sharedMemoryRingSegmentStart = 0;
+
+    // The length of the last trace in the shared memory ring.
+    UINT64 _sharedMemoryRingSegmentLength = 0;
+
+    // Determines whether the current output goes to the trace archive instead of the output file stream.
+    bool _writingToTraceArchive = false;
+
+    // Determines whether the last closed trace was written to the trace archive.
+    bool _wroteTraceArchiveRecord = false;
+
+    // The archive file, offset and length of the last trace in the trace archive.
+    std::string _traceArchiveRecordFileName;
+    UINT64 _traceArchiveRecordOffset = 0;
+    UINT64 _traceArchiveRecordLength = 0;
+
+    // Determines whether the current trace gets an index footer.
+    bool _writingTraceIndex = false;
+
+    // The footer of the current trace, which accumulates the entry counts and the checksum, in trace index mode.
+    TraceFileFooter _traceFooter{};
+
+    // The state after the last stored entry of the current trace, in trace index mode.
+    TraceChunkInfo _traceIndexState{};
+
+    // The chunk index of the current trace, in trace index mode.
+    std::vector<TraceChunkInfo> _traceChunks;
+
+    // Digest of the prefix trace of the owning thread, computed over the compact encoding of its entries.
+    UINT64 _prefixDigest = 0;
+
+    // The encoder used for computing the prefix digest, independently of the trace format.
+    CompactTraceEncoder _prefixDigestEncoder;
+
+    // Fingerprint of the entire current testcase trace, in fingerprint mode.
+    UINT64 _traceFingerprint = 0;
+
+    // Fingerprints of the memory accesses and branches of the current testcase, indexed by instruction address, in fingerprint mode.
+    std::unordered_map<UINT64, UINT64> _instructionFingerprints;
+
+    // Determines whether the memory accesses of the current trace are aggregated in the access histogram.
+    bool _aggregatingMemoryAccesses = false;
+
+    // The memory accesses of the current testcase, in aggregation mode.
+    AccessHistogram _accessHistogram;
+
+    // Holds the entries which are written directly in aggregation mode.
+    std::vector<TraceEntry> _aggregatedEntries;
+
+    // Heap deallocations of the current testcase, which are written after the memory accesses in aggregation mode.
+    std::vector<TraceEntry> _deferredFreeEntries;
+
+    // Determines whether the entries of the current trace are stored as reference for the subsequent traces, in differential mode.
+    bool _recordingReference = false;
+
+    // Determines whether the current trace is written as difference to the reference trace.
+    bool _writingDifferential = false;
+
+    // Determines whether the reference trace has been recorded.
+    bool _referenceRecorded = false;
+
+    // The normalized entries of the reference trace, in differential mode.
+    std::vector<TraceEntry> _referenceEntries;
+
+    // The header flags of the reference trace file.
+    UINT16 _referenceFileFlags = 0;
+
+    // The position in the reference trace which corresponds to the next entry of the current differential trace.
+    INT64 _referencePosition = 0;
+
+    // The number of matching reference entries which have not been written yet.
+    UINT64 _pendingReferenceCopyCount = 0;
+
+    // The offset by which the reference position was moved before the pending matching entries.
+    INT64 _pendingReferenceOffset = 0;
+
+    // Holds the entries of the current buffer in differential encoding.
+    std::vector<TraceEntry> _differentialEntries;
+
+    // Holds the entries which are written after collapsing repeated loop iterations.
+    std::vector<TraceEntry> _collapsedEntries;
+
+    // The last memory access of each instruction in the current trace, indexed by a hash of the instruction address, for suppressing duplicate accesses.
+    std::vector<LastMemoryAccess> _lastMemoryAccesses;
+
+    // The instructions which accessed a secret region in the current trace, in secret region filter mode.
+    std::unordered_set<UINT64> _secretInstructions;
+
+    // The number of memory accesses and branches which are still recorded after the last access to a secret region.
+    UINT64 _secretDependencyRemaining = 0;
+
+    // The counters of the current trace, in statistics mode.
+    TraceStatistics _traceStatistics;
+
+    // The counters of all closed traces of the owning thread, in statistics mode.
+    TraceStatistics _totalStatistics;
+
+    // The frames of the functions which are currently running, in stack frame summary mode. The last element is the innermost frame.
+    std::vector<ShadowStackFrame> _shadowStack;
+
+    // The minimum stack pointer of the innermost frame, in stack frame summary mode.
+    ADDRINT _frameMinimumStackPointer = ~static_cast<ADDRINT>(0);
+
+public:
+    // The stack pointer at entry of the currently running allocation function, which points to its return address.
+    // The allocation function has returned as soon as a return instruction sets the stack pointer above this value.
+    // The maximum value indicates that allocation tracking is inactive.
+    ADDRINT _allocationStackPointer = ~static_cast<ADDRINT>(0);
+
+    // Determines whether the owning thread currently executes one of the routines which limit the tracing scope, or one of their callees (1), or not (0).
+    // Always 1 if the tracing scope is not limited.
+    ADDRINT _inTraceScope = 1;
+
+    // Depth of the call stack relative to the routine which opened the tracing scope.
+    // -1 indicates that this routine has returned.
+    int _traceScopeCallDepth = -1;
+
+    // The taint state of the owning thread, if taint tracking is enabled.
+    TaintState* _taintState = nullptr;
+
+    // Determines whether the relevant operands of the currently executed instruction are tainted (1), or not (0).
+    // Set by the taint tracker before the instruction's trace entries are written. Always 1 if taint tracking is disabled.
+    ADDRINT _taintedOperands = 1;
+
+private:
+    // Determines whether the program is currently in the trace prefix phase, i.e., no testcase has been started yet.
+    static bool _prefixActive;
+
+    // The ID of the currently running testcase, or -1 if no testcase is running. Used for threads which are created during a testcase.
+    static int _currentTestcaseId;
+
+    // The initial size of the entry buffers, in entries.
+    static size_t _defaultEntryBufferSize;
+
+    // The kind of pages which back the entry buffers.
+    static HugePageModes _hugePageMode;
+
+    // Determines whether the entry buffer size of each trace writer is adapted to the volume of its previous trace.
+    static bool _adaptiveBufferSize;
 
     // The file where some additional trace prefix meta data is stored.
     static std::ofstream _prefixDataFileStream;
 
+    // Determines whether the digests of the prefix traces are written to the prefix digest file.
+    static bool _writePrefixDigests;
+
+    // The file where the digests of the prefix traces are stored.
+    static std::ofstream _prefixDigestFileStream;
+
+    // Determines whether the trace prefix is verified against a reference prefix recorded by another instance, instead of being written.
+    static bool _verifyPrefix;
+
+    // The trace prefix meta data file of the reference prefix.
+    static std::ifstream _referencePrefixDataFileStream;
+
+    // The prefix trace digests of the reference prefix, indexed by thread ID.
+    static std::map<THREADID, UINT64> _referencePrefixDigests;
+
+    // The persistent prefix cache, or nullptr if the trace prefix is always recorded.
+    static PrefixCache* _prefixCache;
+
+    // Determines whether the trace prefix was restored from the prefix cache, so it is not recorded again, but only its image loads are verified.
+    static bool _restoredPrefix;
+
+    // The format of the trace files.
+    static TraceFormats _traceFormat;
+
+    // The compression of the trace files.
+    static TraceCompressions _traceCompression;
+
+    // The number of entry buffers per trace writer in asynchronous flushing mode, or 0 if asynchronous flushing is disabled.
+    static int _asyncBufferCount;
+
+    // Determines whether the tracing scope is limited to certain routines.
+    static bool _traceScopeLimited;
+
+    // The shared memory ring which receives the testcase traces of the main thread, or nullptr if traces are written to files.
+    static SharedMemoryRing* _sharedMemoryRing;
+
+    // The archive which receives the testcase traces of the main thread, or nullptr if traces are written to individual files.
+    static TraceArchive* _traceArchive;
+
+    // Determines whether only fingerprints of the testcase traces are computed, instead of writing them.
+    static bool _fingerprintMode;
+
+    // Determines whether the memory accesses of testcase traces are aggregated into access histograms.
+    static bool _aggregationMode;
+
+    // Determines whether the control flow is recorded as BasicBlock entries instead of Branch entries.
+    static bool _basicBlockMode;
+
+    // Determines whether repeated loop iterations are collapsed into Repeat entries.
+    static bool _runLengthEncoding;
+
+    // Determines whether testcase traces are written as difference to the first testcase trace of the main thread.
+    static bool _differentialMode;
+
+    // Determines whether testcases run in forked worker processes, so the messages to the caller are prefixed with the testcase ID.
+    static bool _forkServerMode;
+
+    // The number of entries per chunk in the trace index footer, or 0 if trace files do not get an index footer.
+    static UINT64 _traceIndexInterval;
+
+    // Determines whether the code outside of testcases runs in an idle version without entry writers, so the state which depends on the entries is reset at testcase start.
+    static bool _pausedInstrumentation;
+
+    // The mask which is applied to the addresses of memory accesses, to reduce them to the address granularity.
+    static UINT64 _memoryAddressMask;
+
+    // Determines whether repeated accesses of an instruction to the same address (with the address granularity applied) are omitted.
+    static bool _suppressDuplicateAccesses;
+
+    // Determines whether memory accesses and branches of testcases are only recorded if they are related to a secret region.
+    static bool _secretRegionFilter;
+
+    // The number of memory accesses and branches after an access to a secret region, which are recorded as well.
+    static UINT64 _secretDependencyWindow;
+
+    // The secret regions, as mapping from start address to end address (exclusive). The regions do not overlap.
+    static std::map<ADDRINT, ADDRINT> _secretRegions;
+
+    // Protects the secret regions, which are read by the flush threads.
+    static PIN_LOCK _secretRegionsLock;
+
+    // The file where the basic block table is stored.
+    static std::ofstream _basicBlockTableFileStream;
+
+    // The IDs of all instrumented basic blocks, indexed by their address and size.
+    static std::map<std::pair<ADDRINT, USIZE>, UINT32> _basicBlockIds;
+
+    // Determines whether overhead and volume counters are collected and reported.
+    static bool _statisticsMode;
+
+    // The counters of the trace instrumentation since start.
+    static InstrumentationStatistics _instrumentationStatistics;
+
+    // The counters of the trace instrumentation at the time of the last report, for computing per-testcase values.
+    static InstrumentationStatistics _reportedInstrumentationStatistics;
+
+    // The number of instrumented entry writer call sites per image, indexed by the image name.
+    static std::map<std::string, UINT64> _instrumentedCallSites;
+
+    // The number of instrumented entry writer call sites per image at the time of the last report.
+    static std::map<std::string, UINT64> _reportedInstrumentedCallSites;
+
+    // The addresses of all instrumented traces, for detecting re-instrumentation.
+    static std::unordered_set<ADDRINT> _instrumentedTraceAddresses;
+
+    // Protects the instrumentation statistics.
+    static PIN_LOCK _statisticsLock;
+
+    // The trace writers which own a flush thread.
+    static std::vector<TraceWriter*> _asyncTraceWriters;
+
+    // Protects the list of trace writers with a flush thread.
+    static PIN_LOCK _asyncTraceWritersLock;
+
 private:
+    // Rounds the given entry buffer size to the allocation granularity and bounds.
+    static size_t RoundEntryBufferSize(size_t entryCount);
+
+    // Allocates an entry buffer with the given number of entries, which must be rounded by RoundEntryBufferSize().
+    static TraceEntry* AllocateEntryBuffer(size_t entryCount);
+
+    // Frees an entry buffer with the given number of entries.
+    static void FreeEntryBuffer(TraceEntry* buffer, size_t entryCount);
+
+    // Grows or shrinks the entry buffers according to the volume of the last trace. All buffers must have been written.
+    void AdaptEntryBufferSize();
+
     // Opens the output file and sets the respective internal state.
     void OpenOutputFile(std::string& filename);
 
+    // Returns the name of the trace file for the given testcase ID, or of the trace prefix file if the ID is -1.
+    // The trace files of the main thread are named "t<id>.trace", the ones of other threads "t<id>_th<tid>.trace".
+    std::string GetOutputFilename(int testcaseId);
+
+    // Writes the remaining entries and closes the current output file.
+    void CloseOutputFile(TraceEntry* nextEntry);
+
+    // Ends the trace prefix phase and closes the prefix metadata file, if this has not happened yet.
+    static void EndPrefixPhase();
+
+    // Adds the given entries to the prefix digest.
+    void UpdatePrefixDigest(TraceEntry* begin, TraceEntry* end);
+
+    // Writes the prefix digest of the owning thread, or compares it with the reference prefix.
+    void FinishPrefixDigest();
+
+    // Adds the given entries to the testcase trace fingerprints.
+    void UpdateFingerprints(TraceEntry* begin, TraceEntry* end);
+
+    // Mixes the given value into the given fingerprint.
+    static UINT64 MixFingerprint(UINT64 fingerprint, UINT64 value)
+    {
+        fingerprint = (fingerprint ^ value) * 0x9e3779b97f4a7c15ull;
+        return fingerprint ^ (fingerprint >> 29);
+    }
+
+    // Writes the given data into the output file or the shared memory ring, or appends it to the current compression block.
+    void WriteOutput(const void* data, size_t length);
+
+    // Writes the given data into the output file or the shared memory ring, without compression.
+    void WriteOutputDirect(const void* data, size_t length);
+
+    // Compresses the pending output data and writes the resulting block.
+    void FlushCompressedOutput();
+
+    // Writes the given entries into the output file, or hands them to the fingerprint or aggregation logic.
+    // In statistics mode, the entries and the time spent are counted.
+    void WriteEntries(TraceEntry* begin, TraceEntry* end);
+
+    // Filters the given entries, and writes them into the output file or hands them to the fingerprint or aggregation logic.
+    void DispatchEntries(TraceEntry* begin, TraceEntry* end);
+
+    // Records or differentially encodes the given entries in differential mode, and writes them into the output file.
+    void WriteRecords(const TraceEntry* begin, const TraceEntry* end);
+
+    // Encodes the given entries in the trace format and writes them into the output file.
+    // In trace index mode, the entries are counted, and a new chunk is started every _traceIndexInterval entries.
+    void SerializeRecords(const TraceEntry* begin, const TraceEntry* end);
+
+    // Encodes the given entries in the trace format and writes them into the output file, without updating the chunk index.
+    void EncodeRecords(const TraceEntry* begin, const TraceEntry* end);
+
+    // Writes the given encoded records into the output file, and adds them to the checksum in trace index mode.
+    void WriteRecordData(const void* data, size_t length);
+
+    // Writes the chunk index and the footer of the current trace.
+    void WriteTraceFooter();
+
+    // Replaces the entries which match the reference trace by ReferenceCopy entries, and writes the result into the output file.
+    void WriteDifferentialRecords(const TraceEntry* begin, const TraceEntry* end);
+
+    // Returns whether the given normalized entry matches the reference entry at the given position.
+    bool MatchesReference(const TraceEntry& normalizedEntry, INT64 position) const;
+
+    // Searches the reference trace around the current reference position for the entries starting at the given entry.
+    // Returns the offset to the current reference position, or 0 if no match was found.
+    INT64 FindReferenceMatch(const TraceEntry* entry, const TraceEntry* end) const;
+
+    // Appends a ReferenceCopy entry for the pending matching reference entries to the differential entries.
+    void FlushReferenceCopy();
+
+    // Writes the recorded reference trace into the reference trace file.
+    void WriteReferenceFile();
+
+    // Applies the address granularity to the given memory accesses, and removes duplicate accesses from the given entries if requested.
+    // Returns the new end of the entries.
+    TraceEntry* FilterMemoryAccesses(TraceEntry* begin, TraceEntry* end);
+
+    // Removes the memory accesses and branches which are not related to a secret region from the given entries.
+    // Returns the new end of the entries.
+    TraceEntry* FilterSecretAccesses(TraceEntry* begin, TraceEntry* end);
+
+    // Returns whether the given memory access overlaps a secret region. The caller must hold the secret region lock.
+    static bool IsSecretAccess(UINT64 address, UINT64 size);
+
+    // Collapses repeated loop iterations into Repeat entries, and writes the resulting entries into the output file.
+    void CollapseRuns(const TraceEntry* begin, const TraceEntry* end);
+
+    // Returns whether the given entry continues a run with the given period, i.e., it matches the entries one and two periods before, and its Param2 value advances by a constant stride.
+    static bool ContinuesRun(const TraceEntry* entry, size_t period);
+
+    // Formats the given statistics as tab-separated "<key>=<value>" list.
+    static std::string FormatStatistics(const TraceStatistics& statistics);
+
+    // Adds the given memory accesses to the access histogram, and writes the remaining entries which are kept in aggregation mode.
+    void AggregateEntries(TraceEntry* begin, TraceEntry* end);
+
+    // Writes the access histogram and the deferred heap deallocations of the current testcase.
+    void WriteAccessHistogram();
+
+    // Writes the given message line to stdout, for notifying the caller about the given testcase.
+    static void NotifyCaller(int testcaseId, const std::string& message);
+
+    // Hands the current buffer over to the flush thread and switches to the next free buffer.
+    // Blocks if all buffers are still waiting to be written.
+    // -> end: A pointer to the address *after* the last entry to be written.
+    void EnqueueBuffer(TraceEntry* end);
+
+    // Waits until the flush thread has written all pending buffers.
+    void WaitForFlush();
+
+    // Writes pending buffers and stops the flush thread.
+    void StopFlushThread();
+
+    // Main function of the flush thread, which writes filled buffers of the given trace writer.
+    static VOID FlushThreadMain(VOID* arg);
+
 public:
 
-    // Creates a new trace logger.
+    // Creates a new trace logger for the given thread.
     // -> filenamePrefix: The path prefix of the output file. Existing files are overwritten.
-    explicit TraceWriter(const std::string& filenamePrefix);
+    // -> threadId: The ID of the owning thread.
+    // -> traced: Determines whether the entries of the thread are written to trace files, or discarded.
+    TraceWriter(const std::string& filenamePrefix, THREADID threadId, bool traced);
 
     // Frees resources.
     ~TraceWriter();
@@ -140,27 +907,172 @@ public:
     // Returns the address AFTER the last buffer entry.
     TraceEntry* End();
 
+    // Returns whether the entries of the owning thread are written to trace files.
+    bool IsTraced() const { return _traced; }
+
+    // Returns whether a testcase is currently running.
+    bool IsInTestcase() const { return _testcaseId != -1; }
+
     // Writes the contents of the trace buffer into the output file.
+    // In asynchronous flushing mode, the buffer is handed over to the flush thread, so Begin() and End() return the next free buffer afterwards.
     // -> end: A pointer to the address *after* the last entry to be written.
     void WriteBufferToFile(TraceEntry* end);
 
+    // Writes the contents of the trace buffer into the output file, after all pending buffers have been written.
+    // Begin() and End() remain unchanged, so this can be used by routines which cannot update the buffer end register.
+    // -> end: A pointer to the address *after* the last entry to be written.
+    void WriteBufferToFileInPlace(TraceEntry* end);
+
+    // Writes the remaining entries and completes the trace which is still open, when the owning thread exits.
+    // -> nextEntry: A pointer to the address *after* the last entry to be written.
+    void ThreadEnd(TraceEntry* nextEntry);
+
     // Sets the next testcase ID and opens a suitable trace file.
+    // The entry buffer may be replaced, so Begin() and End() must be reloaded afterwards.
     void TestcaseStart(int testcaseId, TraceEntry* nextEntry);
 
-    // Closes the current trace file and notifies the caller that the testcase has completed.
-    void TestcaseEnd(TraceEntry* nextEntry);
+    // Closes the current trace file.
+    // -> notifyCaller: Determines whether the caller is notified that the testcase has completed. This is only done for the thread which ends the testcase.
+    void TestcaseEnd(TraceEntry* nextEntry, bool notifyCaller);
+
+    // Ends the trace prefix and writes all pending buffers, before the process forks a testcase worker.
+    // Begin() and End() remain unchanged; the entries after the prefix are discarded until the next testcase starts.
+    void PrepareFork(TraceEntry* nextEntry);
+
+    // Continues tracing in a forked worker process, which only contains the forking thread.
+    void ResumeAfterFork();
 
 public:
 
     // Checks whether the next entry points beyond the entry list, and flushes the entry list to the trace file in that case.
+    // Does not change the entry buffer, so the buffer end register remains valid.
     // The function returns a pointer to the next entry.
     static TraceEntry* CheckBufferAndStore(TraceWriter *traceWriter, TraceEntry* nextEntry);
 
-    // Creates a new MemoryRead entry.
-    static TraceEntry* InsertMemoryReadEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size);
+    /* Fast path */
+
+    // The following functions are designed to be inlined by Pin: They do not contain calls or branches, and do not check for a full buffer.
+    // Each call must be followed by a CheckBufferFull/FlushBuffer If-Then pair.
+
+    // Returns whether the entry buffer is full.
+    static ADDRINT CheckBufferFull(TraceEntry* nextEntry, TraceEntry* entryBufferEnd)
+    {
+        return reinterpret_cast<ADDRINT>(nextEntry) >= reinterpret_cast<ADDRINT>(entryBufferEnd);
+    }
+
+    // Writes the entry buffer into the output file, and returns a pointer to the next entry.
+    // The pointer to the buffer end is updated, as the buffer may change in asynchronous flushing mode.
+    static TraceEntry* FlushBuffer(TraceWriter* traceWriter, TraceEntry* nextEntry, ADDRINT* entryBufferEnd);
+
+    // Creates a new MemoryRead or MemoryWrite entry.
+    template<TraceEntryTypes Type>
+    static TraceEntry* WriteMemoryAccessEntry(TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size)
+    {
+        static_assert(Type == TraceEntryTypes::MemoryRead || Type == TraceEntryTypes::MemoryWrite, "Unsupported memory access entry type");
+
+        nextEntry->Type = Type;
+        nextEntry->Param0 = static_cast<UINT16>(size);
+        nextEntry->Param1 = instructionAddress;
+        nextEntry->Param2 = memoryAddress;
+        return nextEntry + 1;
+    }
+
+    // Creates a new Branch entry.
+    template<TraceEntryFlags BranchType>
+    static TraceEntry* WriteBranchEntry(TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress, BOOL taken)
+    {
+        nextEntry->Type = TraceEntryTypes::Branch;
+        nextEntry->Flag = static_cast<UINT8>(static_cast<UINT8>(BranchType) | static_cast<UINT8>(taken != 0));
+        nextEntry->Param1 = sourceAddress;
+        nextEntry->Param2 = targetAddress;
+        return nextEntry + 1;
+    }
+
+    // Creates a new StackPointerModification entry.
+    template<TraceEntryFlags StackFlag>
+    static TraceEntry* WriteStackPointerModificationEntry(TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT newStackPointer)
+    {
+        nextEntry->Type = TraceEntryTypes::StackPointerModification;
+        nextEntry->Flag = static_cast<UINT8>(StackFlag);
+        nextEntry->Param1 = instructionAddress;
+        nextEntry->Param2 = newStackPointer;
+        return nextEntry + 1;
+    }
+
+    // Lowers the minimum stack pointer of the innermost frame to the given stack pointer, in stack frame summary mode.
+    static void UpdateStackFrameMinimum(TraceWriter* traceWriter, ADDRINT stackPointer)
+    {
+        traceWriter->_frameMinimumStackPointer = std::min(traceWriter->_frameMinimumStackPointer, stackPointer);
+    }
+
+    // Creates a new BasicBlock entry.
+    static TraceEntry* WriteBasicBlockEntry(TraceEntry* nextEntry, UINT32 basicBlockId)
+    {
+        nextEntry->Type = TraceEntryTypes::BasicBlock;
+        nextEntry->Flag = 0;
+        nextEntry->Param1 = basicBlockId;
+        return nextEntry + 1;
+    }
+
+    // Returns whether the first return after testcase begin has not yet been observed.
+    static ADDRINT CheckFirstReturnPending(TraceWriter* traceWriter)
+    {
+        return !traceWriter->_sawFirstReturn;
+    }
 
-    // Creates a new MemoryWrite entry.
-    static TraceEntry* InsertMemoryWriteEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT memoryAddress, UINT32 size);
+    // Marks the first return after testcase begin as observed, when it is executed by the idle code version and thus not recorded.
+    static VOID SkipFirstReturn(TraceWriter* traceWriter)
+    {
+        traceWriter->_sawFirstReturn = true;
+    }
+
+    // Returns whether the trace writer currently records entries (1), i.e., its thread is traced and in the trace prefix or a testcase, or discards them (0).
+    static ADDRINT CheckRecording(TraceWriter* traceWriter)
+    {
+        return traceWriter->_traced && (traceWriter->_prefixMode || traceWriter->_testcaseId != -1) ? 1 : 0;
+    }
+
+    // Removes the entry which was just written, if the owning thread is outside of the tracing scope.
+    static TraceEntry* ApplyTraceScope(TraceWriter* traceWriter, TraceEntry* nextEntry)
+    {
+        return nextEntry - 1 + traceWriter->_inTraceScope;
+    }
+
+    // Removes the entry which was just written, if the owning thread is outside of the tracing scope, or if the instruction's operands are not tainted.
+    static TraceEntry* ApplyTaintFilter(TraceWriter* traceWriter, TraceEntry* nextEntry)
+    {
+        return nextEntry - 1 + (traceWriter->_inTraceScope & traceWriter->_taintedOperands);
+    }
+
+    // Returns whether the thread of the given trace writer is inside the tracing scope.
+    static ADDRINT CheckTraceScopeActive(TraceWriter* traceWriter)
+    {
+        return traceWriter->_inTraceScope;
+    }
+
+    // Returns whether the given stack pointer after a return instruction is above the return address of the allocation function, i.e., the allocation function has returned.
+    // Always false if allocation tracking is inactive.
+    static ADDRINT CheckAllocationReturn(TraceWriter* traceWriter, ADDRINT stackPointer)
+    {
+        return stackPointer > traceWriter->_allocationStackPointer;
+    }
+
+    // Removes the "ret" Branch entry which was just written, as the very first return after testcase begin leads to an invalid call stack.
+    // If the entry was already removed by ApplyTraceScope(), this only marks the first return as observed.
+    static TraceEntry* DiscardFirstReturn(TraceWriter* traceWriter, TraceEntry* nextEntry);
+
+    // Marks the first return after testcase begin as observed, and writes a BasicBlock discontinuity entry, so the return is not derived from the basic block sequence.
+    static TraceEntry* MarkFirstReturn(TraceWriter* traceWriter, TraceEntry* nextEntry);
+
+    /* Slow path */
+
+    // Pushes a new frame for the given called function onto the shadow stack, in stack frame summary mode.
+    // -> stackPointer: The stack pointer after the call, i.e., at function entry.
+    static void EnterStackFrame(TraceWriter* traceWriter, ADDRINT function, ADDRINT stackPointer);
+
+    // Removes all frames which are left by the given stack pointer after a return from the shadow stack, and creates a StackFrame entry for each of them.
+    // This may be more than one frame, e.g. after tail calls into other functions or after longjmp.
+    static TraceEntry* LeaveStackFrames(TraceWriter* traceWriter, TraceEntry* nextEntry, ADDRINT stackPointer);
 
     // Creates a new HeapAllocSizeParameter entry.
     static TraceEntry* InsertHeapAllocSizeParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, UINT64 size);
@@ -172,21 +1084,125 @@ public:
     // Creates a new HeapFreeAddressParameter entry.
     static TraceEntry* InsertHeapFreeAddressParameterEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT memoryAddress);
 
-    // Creates a new StackPointerModification entry.
-    static TraceEntry* InsertStackPointerModificationEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT instructionAddress, ADDRINT newStackPointer, UINT8 flags);
-
-    // Creates a new Branch entry.
-    static TraceEntry* InsertBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress, UINT8 taken, UINT8 type);
+    // Marks the given memory range as secret, after writing the preceding entries with the previous secret regions.
+    static TraceEntry* AddSecretRegion(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT address, UINT64 size);
 
-    // Creates a new "ret" Branch entry.
-    static TraceEntry* InsertRetBranchEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT sourceAddress, ADDRINT targetAddress);
+    // Removes the given memory range from the secret regions, after writing the preceding entries with the previous secret regions.
+    static TraceEntry* RemoveSecretRegion(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT address, UINT64 size);
 
     // Creates a new StackPointerInfo entry.
     static TraceEntry* InsertStackPointerInfoEntry(TraceWriter *traceWriter, TraceEntry* nextEntry, ADDRINT stackPointerMin, ADDRINT stackPointerMax);
 
     // Initializes the static part of the prefix mode (record image loads, even when the thread's TraceWriter object is not yet initialized).
     // -> filenamePrefix: The path prefix of the output file. Existing files are overwritten.
-    static void InitPrefixMode(const std::string& filenamePrefix);
+    // -> writeDigests: Determines whether the digests of the prefix traces are written, so other instances can verify their prefix against this one.
+    // -> referencePrefix: The path prefix of a trace prefix recorded by another instance. If not empty, the prefix is verified against it instead of being written.
+    static void InitPrefixMode(const std::string& filenamePrefix, bool writeDigests, const std::string& referencePrefix);
+
+    // Looks up the trace prefix in the given prefix cache directory. Must be called before InitPrefixMode().
+    // If the prefix is cached, it is restored instead of being recorded, else it is stored in the cache once it is complete.
+    // -> directory: The cache directory.
+    // -> filenamePrefix: The path prefix of the output file.
+    // -> settings: The settings which influence the prefix.
+    // -> keyFiles: The files whose contents influence the prefix.
+    static void InitPrefixCache(const std::string& directory, const std::string& filenamePrefix, const std::string& settings, const std::vector<std::string>& keyFiles);
+
+    // Returns whether the trace prefix is restored from the prefix cache.
+    static bool IsPrefixCached() { return _prefixCache != nullptr && _prefixCache->IsHit(); }
+
+    // Sets the size and the backing pages of all entry buffers. Must be called before the first trace writer is created.
+    // -> entryCount: The initial number of entries per buffer.
+    // -> hugePageMode: The kind of pages which back the buffers.
+    // -> adaptive: Determines whether each trace writer grows or shrinks its buffers at a testcase start, according to the volume of its previous trace.
+    static void InitEntryBuffers(size_t entryCount, HugePageModes hugePageMode, bool adaptive);
+
+    // Sets the format of all subsequently opened trace files.
+    static void InitTraceFormat(TraceFormats format);
+
+    // Sets the compression of all subsequently opened trace files.
+    // Compression happens while writing the entry buffers, so it runs on the flush thread if asynchronous flushing is enabled.
+    static void InitTraceCompression(TraceCompressions compression);
+
+    // Enables asynchronous flushing for all subsequently created trace writers.
+    // -> bufferCount: The number of entry buffers per trace writer.
+    static void InitAsyncFlushing(int bufferCount);
+
+    // Writes the testcase traces of the main thread into a shared memory ring, instead of trace files.
+    // -> fileName: The path of the shared memory file.
+    // -> capacity: The size of the ring's data area.
+    static void InitSharedMemoryRing(const std::string& fileName, UINT64 capacity);
+
+    // Appends the testcase traces of the main thread to a trace archive, instead of creating a trace file for each testcase.
+    // -> fileName: The path of the archive file.
+    // -> segmentSize: The size after which a new archive segment file is started (0 = single file).
+    static void InitTraceArchive(const std::string& fileName, UINT64 segmentSize);
+
+    // Only computes fingerprints of the testcase traces, which are reported at the end of each testcase instead of the trace file.
+    // The trace prefix is still written.
+    static void InitFingerprintMode();
+
+    // Aggregates the memory accesses of each testcase trace into a histogram of distinct accesses, which is written at the end of the testcase.
+    // The trace prefix is written in full.
+    static void InitAggregationMode();
+
+    // Records the control flow as sequence of executed basic blocks, which refer to a basic block table, instead of individual branches.
+    // -> filenamePrefix: The path prefix of the basic block table file. Existing files are overwritten.
+    static void InitBasicBlockMode(const std::string& filenamePrefix);
+
+    // Returns the ID of the given basic block, and adds it to the basic block table if it is not yet known.
+    // Each line of the table has the format "<id>\t<address>\t<size>\t<last instruction address>\t<branch type>\t<conditional>\t<branch target>".
+    // The branch type is a TraceEntryFlags branch type, or 0 if the block does not end with a traced branch; the target is 0 for indirect branches.
+    static UINT32 GetBasicBlockId(BBL bbl);
+
+    // Reduces the addresses of memory accesses to the given granularity, and optionally omits repeated accesses of an instruction to the same address.
+    // -> granularityBits: The number of low address bits which are cleared, e.g. 6 for cache lines or 12 for pages.
+    // -> suppressDuplicates: Determines whether an access is omitted, if it is identical to the last access of the same instruction in the current trace.
+    static void InitMemoryAccessFilter(int granularityBits, bool suppressDuplicates);
+
+    // Only records the memory accesses and branches of testcases which are related to the secret regions passed by the target.
+    // These are the instructions which accessed a secret region in the current trace, and the given number of memory accesses and branches after each secret access.
+    // -> dependencyWindow: The number of memory accesses and branches after an access to a secret region, which are recorded as well.
+    static void InitSecretRegionFilter(UINT64 dependencyWindow);
+
+    // Collapses repeated loop iterations, like strided memory accesses, into Repeat entries in all subsequently written trace files.
+    static void InitRunLengthEncoding();
+
+    // Collects overhead and volume counters, which are reported for each testcase and summarized for each thread when it exits.
+    static void InitStatistics();
+
+    // Uses the first testcase trace of the main thread as reference, and only stores the differences to it in all later testcase traces of the main thread.
+    // The reference trace is written into "reference.trace" in the output directory.
+    static void InitDifferentialMode();
+
+    // Runs each testcase in a worker process forked by the wrapper, after the trace prefix has been recorded.
+    // The messages to the caller are prefixed with the testcase ID, since the workers complete their testcases in arbitrary order.
+    static void InitForkServerMode();
+
+    // Appends an index footer to each trace file, which holds the entry counts per type, a checksum, and the state at the beginning of every chunk of the given number of entries.
+    static void InitTraceIndex(UINT64 chunkInterval);
+
+    // Signals that the instrumentation is paused outside of testcases, i.e., the entry writers do not run between testcases and in threads which are not traced.
+    static void InitPausedInstrumentation();
+
+    // Records the instrumentation of a trace in the instrumentation statistics.
+    // -> traceAddress: The address of the instrumented trace.
+    // -> cycles: The number of time stamp counter cycles spent in instrumenting the trace.
+    // -> imageName: The name of the image containing the trace.
+    // -> callSiteCount: The number of inserted entry writer call sites.
+    static void RecordTraceInstrumentation(ADDRINT traceAddress, UINT64 cycles, const std::string& imageName, UINT64 callSiteCount);
+
+    // Returns the current value of the time stamp counter.
+    static UINT64 ReadTimestampCounter()
+    {
+        return __rdtsc();
+    }
+
+    // Limits the tracing scope of all subsequently created trace writers to certain routines.
+    // The threads start outside of the tracing scope.
+    static void InitTraceScope();
+
+    // Writes all pending buffers and stops the flush threads. Must be called before the process exits.
+    static void StopAsyncFlushing();
 
     // Writes information about the given loaded image into the trace metadata file.
     static void WriteImageLoadData(int interesting, uint64_t startAddress, uint64_t endAddress, std::string& name);
@@ -201,6 +1217,9 @@ public:
     UINT64 _startAddress;
     UINT64 _endAddress;
 
+    // Determines whether this image contains an instrumented allocation function, so its return instructions need to be checked for allocation returns.
+    bool _containsAllocator;
+
 public:
     // Constructor.
     ImageData(bool interesting, std::string name, UINT64 startAddress, UINT64 endAddress);
@@ -210,4 +1229,7 @@ public:
 
     // Returns whether this image is considered interesting.
     [[nodiscard]] bool IsInteresting() const;
+
+    // Returns whether this image contains an instrumented allocation function.
+    [[nodiscard]] bool ContainsAllocator() const;
 };
\ No newline at end of file
@@ -0,0 +1,114 @@
+#!/bin/bash
+
+# Checks that the Pin tool completes the traces of threads which exit during a testcase.
+# The target-threads kernel creates and joins worker threads in each testcase, so the worker traces are finished at thread exit.
+#
+# Required environment variables:
+#   PIN_PATH        Pin installation directory.
+#   PINTOOL         Path of the compiled Pin tool.
+#
+# Optional environment variables:
+#   TESTCASE_COUNT  Number of testcases (default: 10).
+
+set -e
+
+thisDir=$(realpath $(dirname "$0"))
+kernel=target-threads
+testcaseCount=${TESTCASE_COUNT:-10}
+
+if [ ! -x $thisDir/$kernel ]; then
+  echo "Kernel $kernel not found, run 'make' first."
+  exit 1
+fi
+
+workDir=$(mktemp -d)
+trap "rm -rf $workDir" EXIT
+
+# Generate random testcases and the wrapper command stream
+mkdir -p $workDir/testcases
+commandsFile=$workDir/commands.txt
+echo "b $testcaseCount" > $commandsFile
+for (( i = 0; i < testcaseCount; ++i ))
+do
+  head -c 64 /dev/urandom > $workDir/testcases/$i.testcase
+  printf "%d\t%s\n" $i $workDir/testcases/$i.testcase >> $commandsFile
+done
+echo "e 0" >> $commandsFile
+
+failed=0
+
+# Reports a failed check.
+fail() {
+  echo "  FAIL: $1"
+  failed=1
+}
+
+# Checks that the given uncompressed trace data ends with an index footer: "... <size:u32> <magic:u32>"
+checkFooter() {
+  local traceFile=$1
+  local dataFile=$2
+  local fileSize=$(stat -c %s $dataFile)
+  read footerSize footerMagic < <(tail -c 8 $dataFile | od -An -tu4)
+  if [ "$footerMagic" != "$((0x4654574D))" ]; then
+    fail "$traceFile does not end with an index footer"
+  elif [ "$footerSize" -gt "$fileSize" ]; then
+    fail "$traceFile has a footer of $footerSize bytes, but only $fileSize bytes of data"
+  fi
+}
+
+# Runs the Pin tool with the given arguments, and checks every trace of the worker threads with the given function.
+runCheck() {
+  local name=$1
+  local args=$2
+  local check=$3
+  echo "Checking $name..."
+
+  local traceDir=$workDir/traces
+  rm -rf $traceDir
+  mkdir -p $traceDir
+  if ! $PIN_PATH/pin -t $PINTOOL -o $traceDir/ -i $kernel -m 1 $args -- $thisDir/$kernel < $commandsFile > /dev/null 2> $workDir/pin.log; then
+    echo "Pin tool failed, log:"
+    cat $workDir/pin.log
+    exit 1
+  fi
+
+  local workerTraces=$(find $traceDir -name "t*_th*.trace*" | sort)
+  if [ -z "$workerTraces" ]; then
+    fail "no worker thread traces were written"
+    return
+  fi
+  for traceFile in $workerTraces
+  do
+    $check $traceFile
+  done
+}
+
+checkIndexedTrace() {
+  checkFooter $1 $1
+}
+
+checkCompressedTrace() {
+  lz4 -t -q $1 || fail "$1 is not a complete LZ4 frame"
+}
+
+checkCompressedIndexedTrace() {
+  if ! lz4 -d -c -q $1 > $workDir/decompressed; then
+    fail "$1 is not a complete LZ4 frame"
+    return
+  fi
+  checkFooter $1 $workDir/decompressed
+}
+
+runCheck "index footer" "-ti 1024" checkIndexedTrace
+if command -v lz4 > /dev/null; then
+  runCheck "LZ4 frames" "-z 1" checkCompressedTrace
+  runCheck "LZ4 frames with index footer" "-z 1 -ti 1024" checkCompressedIndexedTrace
+else
+  echo "lz4 not found, skipping checks of compressed traces"
+fi
+
+if [ $failed -ne 0 ]; then
+  echo "Some checks failed."
+  exit 1
+fi
+echo "All checks passed."
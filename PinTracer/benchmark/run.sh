@@ -0,0 +1,152 @@
+#!/bin/bash
+
+# Measures the overhead of the Pin tool for each benchmark kernel and Pin tool option combination.
+# The results are written to results/results.csv.
+#
+# Required environment variables:
+#   PIN_PATH        Pin installation directory.
+#   PINTOOL         Path of the compiled Pin tool.
+#
+# Optional environment variables:
+#   TESTCASE_COUNT  Number of testcases per run (default: 100).
+#   KERNELS         Space-separated list of kernels (default: all target-* executables).
+#   CONFIGS         Semicolon-separated list of "<name>:<Pin tool arguments>" option combinations (default: see below).
+
+set -e
+
+thisDir=$(realpath $(dirname "$0"))
+resultsDir=$thisDir/results
+resultsFile=$resultsDir/results.csv
+
+testcaseCount=${TESTCASE_COUNT:-100}
+
+# Option combinations, as "<name>:<Pin tool arguments>"
+# Statistics (-st) are always enabled, since they provide the entry and byte counts
+if [ -z "$CONFIGS" ]; then
+  configs=(
+    "default:"
+    "stack-tracking:-s 1"
+    "stack-frame-summaries:-s 2"
+    "cpu-westmere:-c 3"
+    "fixed-rdrand:-r 1234"
+    "compact:-f 1"
+    "async:-a 8"
+    "compact-async:-f 1 -a 8"
+    "lz4:-z 1"
+    "compact-lz4-async:-f 1 -z 1 -a 8"
+    "large-buffers:-bs 262144"
+    "huge-pages:-hp 1"
+    "adaptive-buffers:-ba 1"
+    "run-length-encoding:-rl 1"
+    "differential:-dr 1"
+    "basic-block-control-flow:-b 1"
+    "cache-line-deduplicated:-ag 6 -ad 1"
+    "aggregate:-g 1"
+    "fingerprint:-fp 1"
+    "taint-input:-tt 2"
+    "compact-indexed:-f 1 -ti 65536"
+    "paused-instrumentation:-pi 1"
+  )
+else
+  IFS=';' read -ra configs <<< "$CONFIGS"
+fi
+
+if [ -z "$KERNELS" ]; then
+  KERNELS=$(cd $thisDir && find . -maxdepth 1 -name "target-*" -type f -executable -printf "%f\n" | sort)
+fi
+if [ -z "$KERNELS" ]; then
+  echo "No benchmark kernels found, run 'make' first."
+  exit 1
+fi
+
+workDir=$(mktemp -d)
+trap "rm -rf $workDir" EXIT
+
+# Returns the current time in milliseconds.
+timestampMs() {
+  echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Generate random testcases and the wrapper command stream, which runs all testcases in a single batch
+mkdir -p $workDir/testcases
+commandsFile=$workDir/commands.txt
+echo "b $testcaseCount" > $commandsFile
+for (( i = 0; i < testcaseCount; ++i ))
+do
+  head -c 256 /dev/urandom > $workDir/testcases/$i.testcase
+  printf "%d\t%s\n" $i $workDir/testcases/$i.testcase >> $commandsFile
+done
+echo "e 0" >> $commandsFile
+
+mkdir -p $resultsDir
+echo "kernel,config,testcases,native_ms,traced_ms,slowdown,startup_ms,entries,entries_per_second,bytes_per_testcase" > $resultsFile
+
+for kernel in $KERNELS
+do
+  # Native run
+  startTime=$(timestampMs)
+  $thisDir/$kernel < $commandsFile > /dev/null
+  nativeMs=$(( $(timestampMs) - startTime ))
+
+  for config in "${configs[@]}"
+  do
+    configName=${config%%:*}
+    configArgs=${config#*:}
+    echo "Running kernel ${kernel} with configuration ${configName}..."
+
+    traceDir=$workDir/traces
+    mkdir -p $traceDir
+    rm -f $workDir/statistics.txt $workDir/output
+    mkfifo $workDir/output
+
+    # Traced run
+    # The first line on the Pin tool's stdout marks the completion of the first testcase, including the trace prefix
+    startTime=$(timestampMs)
+    $PIN_PATH/pin -t $PINTOOL -o $traceDir/ -i $kernel -st 1 $configArgs -- $thisDir/$kernel < $commandsFile > $workDir/output 2> $workDir/pin.log &
+    pinPid=$!
+    firstOutputTime=""
+    while IFS= read -r line
+    do
+      [ -z "$firstOutputTime" ] && firstOutputTime=$(timestampMs)
+      if [ "${line:0:2}" == $'s\t' ]; then
+        echo "$line" >> $workDir/statistics.txt
+      fi
+    done < $workDir/output
+    if ! wait $pinPid; then
+      echo "Pin tool failed, log:"
+      cat $workDir/pin.log
+      exit 1
+    fi
+    tracedMs=$(( $(timestampMs) - startTime ))
+    startupMs=$(( ${firstOutputTime:-$startTime} - startTime ))
+
+    # Sum the per-testcase statistics: "s\t<trace>\tentries=<type>:<count>,...\t...\tbytes=<count>\t..."
+    read entries bytes < <(awk -F'\t' '
+      {
+        for(i = 3; i <= NF; ++i)
+        {
+          split($i, keyValue, "=");
+          if(keyValue[1] == "entries")
+          {
+            n = split(keyValue[2], typeCounts, ",");
+            for(j = 1; j <= n; ++j)
+            {
+              split(typeCounts[j], typeCount, ":");
+              entries += typeCount[2];
+            }
+          }
+          else if(keyValue[1] == "bytes")
+            bytes += keyValue[2];
+        }
+      }
+      END { printf "%d %d\n", entries, bytes }' $workDir/statistics.txt 2> /dev/null || echo "0 0")
+
+    awk -v kernel=$kernel -v config=$configName -v testcases=$testcaseCount -v nativeMs=$nativeMs -v tracedMs=$tracedMs -v startupMs=$startupMs -v entries=$entries -v bytes=$bytes 'BEGIN {
+      printf "%s,%s,%d,%d,%d,%.1f,%d,%d,%.0f,%.0f\n", kernel, config, testcases, nativeMs, tracedMs, tracedMs / (nativeMs > 0 ? nativeMs : 1), startupMs, entries, entries / ((tracedMs > 0 ? tracedMs : 1) / 1000.0), bytes / testcases
+    }' >> $resultsFile
+
+    rm -rf $traceDir $workDir/output
+  done
+done
+
+echo "Results written to $resultsFile"
@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Table-based AES-128 encryption, representing lookup-heavy cryptographic code.
+
+// The number of blocks encrypted per testcase.
+#define BLOCK_COUNT 256
+
+uint8_t sbox[256];
+uint32_t te0[256];
+
+// Receives the result, so the computation is not optimized away.
+volatile uint32_t resultSink;
+
+static uint32_t rotr(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static uint8_t xtime(uint8_t value)
+{
+    return (uint8_t)((value << 1) ^ ((value >> 7) * 0x1b));
+}
+
+static void ExpandKey(const uint8_t* key, uint32_t* roundKeys)
+{
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+    for(int i = 0; i < 4; ++i)
+        roundKeys[i] = ((uint32_t)key[4 * i] << 24) | ((uint32_t)key[4 * i + 1] << 16) | ((uint32_t)key[4 * i + 2] << 8) | key[4 * i + 3];
+
+    for(int i = 4; i < 44; ++i)
+    {
+        uint32_t temp = roundKeys[i - 1];
+        if(i % 4 == 0)
+        {
+            temp = ((uint32_t)sbox[(temp >> 16) & 0xff] << 24) | ((uint32_t)sbox[(temp >> 8) & 0xff] << 16) | ((uint32_t)sbox[temp & 0xff] << 8) | sbox[temp >> 24];
+            temp ^= (uint32_t)rcon[i / 4 - 1] << 24;
+        }
+        roundKeys[i] = roundKeys[i - 4] ^ temp;
+    }
+}
+
+static void EncryptBlock(const uint32_t* roundKeys, uint32_t* state)
+{
+    uint32_t s0 = state[0] ^ roundKeys[0];
+    uint32_t s1 = state[1] ^ roundKeys[1];
+    uint32_t s2 = state[2] ^ roundKeys[2];
+    uint32_t s3 = state[3] ^ roundKeys[3];
+
+    for(int round = 1; round < 10; ++round)
+    {
+        const uint32_t* rk = &roundKeys[4 * round];
+        uint32_t t0 = te0[s0 >> 24] ^ rotr(te0[(s1 >> 16) & 0xff], 8) ^ rotr(te0[(s2 >> 8) & 0xff], 16) ^ rotr(te0[s3 & 0xff], 24) ^ rk[0];
+        uint32_t t1 = te0[s1 >> 24] ^ rotr(te0[(s2 >> 16) & 0xff], 8) ^ rotr(te0[(s3 >> 8) & 0xff], 16) ^ rotr(te0[s0 & 0xff], 24) ^ rk[1];
+        uint32_t t2 = te0[s2 >> 24] ^ rotr(te0[(s3 >> 16) & 0xff], 8) ^ rotr(te0[(s0 >> 8) & 0xff], 16) ^ rotr(te0[s1 & 0xff], 24) ^ rk[2];
+        uint32_t t3 = te0[s3 >> 24] ^ rotr(te0[(s0 >> 16) & 0xff], 8) ^ rotr(te0[(s1 >> 8) & 0xff], 16) ^ rotr(te0[s2 & 0xff], 24) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    const uint32_t* rk = &roundKeys[40];
+    state[0] = (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0];
+    state[1] = (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1];
+    state[2] = (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2];
+    state[3] = (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) | ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3];
+}
+
+extern void RunTarget(FILE* input)
+{
+    // Key and initial block
+    uint8_t data[32];
+    if(fread(data, 1, 32, input) != 32)
+        return;
+
+    uint32_t roundKeys[44];
+    ExpandKey(data, roundKeys);
+
+    uint32_t state[4];
+    for(int i = 0; i < 4; ++i)
+        state[i] = ((uint32_t)data[16 + 4 * i] << 24) | ((uint32_t)data[16 + 4 * i + 1] << 16) | ((uint32_t)data[16 + 4 * i + 2] << 8) | data[16 + 4 * i + 3];
+
+    // Encrypt each block with the previous ciphertext as plaintext
+    for(int i = 0; i < BLOCK_COUNT; ++i)
+        EncryptBlock(roundKeys, state);
+
+    resultSink = state[0] ^ state[1] ^ state[2] ^ state[3];
+}
+
+extern void InitTarget(FILE* input)
+{
+    // Compute S-box by iterating over the multiplicative group of GF(2^8)
+    uint8_t p = 1;
+    uint8_t q = 1;
+    do
+    {
+        p = (uint8_t)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+
+        q ^= (uint8_t)(q << 1);
+        q ^= (uint8_t)(q << 2);
+        q ^= (uint8_t)(q << 4);
+        if(q & 0x80)
+            q ^= 0x09;
+
+        uint8_t affine = (uint8_t)(q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6)) ^ (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4)));
+        sbox[p] = affine ^ 0x63;
+    } while(p != 1);
+    sbox[0] = 0x63;
+
+    // Compute T-table: Each entry holds the MixColumns coefficients (2, 1, 1, 3) applied to the S-box output
+    for(int i = 0; i < 256; ++i)
+    {
+        uint8_t s = sbox[i];
+        uint8_t s2 = xtime(s);
+        te0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint8_t)(s2 ^ s);
+    }
+}
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Modular exponentiation with Montgomery multiplication, representing arithmetic-heavy public key code.
+
+// The number of 32-bit limbs of the modulus (512 bits).
+#define LIMB_COUNT 16
+
+// The number of exponent bytes (128 bits).
+#define EXPONENT_SIZE 16
+
+// Receives the result, so the computation is not optimized away.
+volatile uint32_t resultSink;
+
+// Computes -modulus^-1 mod 2^32 for the given odd lowest limb of the modulus.
+static uint32_t ComputeModulusInverse(uint32_t modulus)
+{
+    uint32_t inverse = 1;
+    for(int i = 0; i < 5; ++i)
+        inverse *= 2 - modulus * inverse;
+    return (uint32_t)0 - inverse;
+}
+
+// Computes result = a * b * 2^(-32 * LIMB_COUNT) mod modulus.
+static void MontgomeryMultiply(uint32_t* result, const uint32_t* a, const uint32_t* b, const uint32_t* modulus, uint32_t modulusInverse)
+{
+    uint32_t t[LIMB_COUNT + 2];
+    memset(t, 0, sizeof(t));
+
+    for(int i = 0; i < LIMB_COUNT; ++i)
+    {
+        // t += a * b[i]
+        uint64_t carry = 0;
+        for(int j = 0; j < LIMB_COUNT; ++j)
+        {
+            uint64_t sum = (uint64_t)t[j] + (uint64_t)a[j] * b[i] + carry;
+            t[j] = (uint32_t)sum;
+            carry = sum >> 32;
+        }
+        uint64_t sum = (uint64_t)t[LIMB_COUNT] + carry;
+        t[LIMB_COUNT] = (uint32_t)sum;
+        t[LIMB_COUNT + 1] = (uint32_t)(sum >> 32);
+
+        // t = (t + m * modulus) / 2^32
+        uint32_t m = t[0] * modulusInverse;
+        sum = (uint64_t)t[0] + (uint64_t)m * modulus[0];
+        carry = sum >> 32;
+        for(int j = 1; j < LIMB_COUNT; ++j)
+        {
+            sum = (uint64_t)t[j] + (uint64_t)m * modulus[j] + carry;
+            t[j - 1] = (uint32_t)sum;
+            carry = sum >> 32;
+        }
+        sum = (uint64_t)t[LIMB_COUNT] + carry;
+        t[LIMB_COUNT - 1] = (uint32_t)sum;
+        t[LIMB_COUNT] = t[LIMB_COUNT + 1] + (uint32_t)(sum >> 32);
+    }
+
+    // Final subtraction
+    uint32_t difference[LIMB_COUNT];
+    uint64_t borrow = 0;
+    for(int j = 0; j < LIMB_COUNT; ++j)
+    {
+        uint64_t value = (uint64_t)t[j] - modulus[j] - borrow;
+        difference[j] = (uint32_t)value;
+        borrow = (value >> 32) & 1;
+    }
+    if(t[LIMB_COUNT] != 0 || borrow == 0)
+        memcpy(result, difference, sizeof(difference));
+    else
+        memcpy(result, t, sizeof(difference));
+}
+
+static void LoadLimbs(uint32_t* limbs, const uint8_t* data)
+{
+    for(int i = 0; i < LIMB_COUNT; ++i)
+        limbs[i] = (uint32_t)data[4 * i] | ((uint32_t)data[4 * i + 1] << 8) | ((uint32_t)data[4 * i + 2] << 16) | ((uint32_t)data[4 * i + 3] << 24);
+}
+
+extern void RunTarget(FILE* input)
+{
+    // Modulus, base and exponent
+    uint8_t data[8 * LIMB_COUNT + EXPONENT_SIZE];
+    if(fread(data, 1, sizeof(data), input) != sizeof(data))
+        return;
+
+    uint32_t modulus[LIMB_COUNT];
+    uint32_t base[LIMB_COUNT];
+    LoadLimbs(modulus, data);
+    LoadLimbs(base, data + 4 * LIMB_COUNT);
+    const uint8_t* exponent = data + 8 * LIMB_COUNT;
+
+    // The modulus must be odd and have its top limb set; the base must be smaller than the modulus
+    modulus[0] |= 1;
+    modulus[LIMB_COUNT - 1] |= 0x80000000;
+    base[LIMB_COUNT - 1] &= 0x7fffffff;
+    uint32_t modulusInverse = ComputeModulusInverse(modulus[0]);
+
+    // Left-to-right square-and-multiply, in Montgomery representation
+    uint32_t result[LIMB_COUNT];
+    memcpy(result, base, sizeof(result));
+    for(int i = EXPONENT_SIZE * 8 - 2; i >= 0; --i)
+    {
+        MontgomeryMultiply(result, result, result, modulus, modulusInverse);
+        if((exponent[i / 8] >> (i % 8)) & 1)
+            MontgomeryMultiply(result, result, base, modulus, modulusInverse);
+    }
+
+    resultSink = result[0];
+}
+
+extern void InitTarget(FILE* input)
+{
+}
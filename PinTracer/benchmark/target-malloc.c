@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frequent heap allocations and deallocations, representing allocation-heavy code like big number libraries with temporary values.
+
+// The number of allocation slots.
+#define SLOT_COUNT 64
+
+// The number of passes over the testcase input.
+#define PASS_COUNT 8
+
+// Receives the result, so the computation is not optimized away.
+volatile uint8_t resultSink;
+
+extern void RunTarget(FILE* input)
+{
+    uint8_t data[256];
+    size_t length = fread(data, 1, sizeof(data), input);
+    if(length < 2)
+        return;
+
+    uint8_t* slots[SLOT_COUNT] = { 0 };
+    size_t sizes[SLOT_COUNT] = { 0 };
+    uint8_t checksum = 0;
+
+    // Each pair of input bytes selects a slot and an operation
+    for(int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        for(size_t i = 0; i + 1 < length; i += 2)
+        {
+            int slot = (data[i] + pass) % SLOT_COUNT;
+            size_t size = 16 + (size_t)data[i + 1] * 8;
+
+            if(slots[slot] == NULL)
+            {
+                slots[slot] = (data[i + 1] & 1) ? calloc(1, size) : malloc(size);
+                sizes[slot] = size;
+                memset(slots[slot], data[i], size);
+            }
+            else if(data[i + 1] & 2)
+            {
+                slots[slot] = realloc(slots[slot], size);
+                if(size > sizes[slot])
+                    memset(slots[slot] + sizes[slot], data[i], size - sizes[slot]);
+                sizes[slot] = size;
+            }
+            else
+            {
+                checksum ^= slots[slot][sizes[slot] - 1];
+                free(slots[slot]);
+                slots[slot] = NULL;
+            }
+        }
+    }
+
+    for(int slot = 0; slot < SLOT_COUNT; ++slot)
+        free(slots[slot]);
+
+    resultSink = checksum;
+}
+
+extern void InitTarget(FILE* input)
+{
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Bulk memory copies, representing memcpy-heavy code like buffer management in protocol implementations.
+
+// The size of the source and destination buffers.
+#define BUFFER_SIZE 65536
+
+// The number of copy operations per testcase.
+#define COPY_COUNT 64
+
+uint8_t sourceBuffer[BUFFER_SIZE];
+uint8_t destinationBuffer[BUFFER_SIZE];
+
+// Receives the result, so the computation is not optimized away.
+volatile uint8_t resultSink;
+
+// Copies the given number of bytes with "rep movsb".
+static void CopyRepMovs(uint8_t* destination, const uint8_t* source, size_t length)
+{
+    asm volatile("rep movsb" : "+D"(destination), "+S"(source), "+c"(length) : : "memory");
+}
+
+// Copies the given number of bytes with an explicit word loop.
+static void CopyWords(uint8_t* destination, const uint8_t* source, size_t length)
+{
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, source + i, 8);
+        memcpy(destination + i, &word, 8);
+    }
+    for(; i < length; ++i)
+        destination[i] = source[i];
+}
+
+extern void RunTarget(FILE* input)
+{
+    // Offset and length of each copy operation
+    uint8_t data[4 * COPY_COUNT];
+    if(fread(data, 1, sizeof(data), input) != sizeof(data))
+        return;
+
+    for(int i = 0; i < COPY_COUNT; ++i)
+    {
+        size_t sourceOffset = (size_t)data[4 * i] * 128;
+        size_t destinationOffset = (size_t)data[4 * i + 1] * 128;
+        size_t length = ((size_t)data[4 * i + 2] << 8 | data[4 * i + 3]) % (BUFFER_SIZE / 2);
+
+        switch(i % 3)
+        {
+            case 0:
+                memcpy(destinationBuffer + destinationOffset, sourceBuffer + sourceOffset, length);
+                break;
+            case 1:
+                CopyRepMovs(destinationBuffer + destinationOffset, sourceBuffer + sourceOffset, length);
+                break;
+            default:
+                CopyWords(destinationBuffer + destinationOffset, sourceBuffer + sourceOffset, length);
+                break;
+        }
+    }
+
+    resultSink = destinationBuffer[data[0]];
+}
+
+extern void InitTarget(FILE* input)
+{
+    for(int i = 0; i < BUFFER_SIZE; ++i)
+        sourceBuffer[i] = (uint8_t)(i * 31 + 7);
+}
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// A tokenizer with many data-dependent branches, representing parsers of encoded keys and protocol messages.
+
+// The number of passes over the testcase input.
+#define PASS_COUNT 16
+
+// Receives the result, so the computation is not optimized away.
+volatile uint64_t resultSink;
+
+// The tokenizer states.
+enum ParserState
+{
+    STATE_DEFAULT,
+    STATE_NUMBER,
+    STATE_IDENTIFIER,
+    STATE_STRING,
+    STATE_ESCAPE
+};
+
+// Tokenizes the given input and returns a digest of the tokens.
+static uint64_t Tokenize(const uint8_t* input, size_t length)
+{
+    enum ParserState state = STATE_DEFAULT;
+    uint64_t value = 0;
+    uint64_t digest = 0;
+    int depth = 0;
+
+    for(size_t i = 0; i < length; ++i)
+    {
+        // Map input bytes to a small alphabet, so all token types occur
+        uint8_t c = (uint8_t)(" 0123456789abcdefxyz_\"\\(),;="[input[i] % 29]);
+
+        switch(state)
+        {
+            case STATE_NUMBER:
+                if(c >= '0' && c <= '9')
+                {
+                    value = value * 10 + (c - '0');
+                    continue;
+                }
+                digest = digest * 31 + value;
+                state = STATE_DEFAULT;
+                break;
+
+            case STATE_IDENTIFIER:
+                if((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_')
+                {
+                    value = value * 131 + c;
+                    continue;
+                }
+                digest ^= value;
+                state = STATE_DEFAULT;
+                break;
+
+            case STATE_STRING:
+                if(c == '\\')
+                    state = STATE_ESCAPE;
+                else if(c == '"')
+                {
+                    digest += value;
+                    state = STATE_DEFAULT;
+                }
+                else
+                    value += c;
+                continue;
+
+            case STATE_ESCAPE:
+                value += (uint64_t)c << 8;
+                state = STATE_STRING;
+                continue;
+
+            default:
+                break;
+        }
+
+        // Start of a new token
+        value = 0;
+        if(c >= '0' && c <= '9')
+        {
+            value = c - '0';
+            state = STATE_NUMBER;
+        }
+        else if((c >= 'a' && c <= 'z') || c == '_')
+        {
+            value = c;
+            state = STATE_IDENTIFIER;
+        }
+        else if(c == '"')
+            state = STATE_STRING;
+        else if(c == '(')
+            ++depth;
+        else if(c == ')')
+        {
+            if(depth > 0)
+                --depth;
+            else
+                digest = ~digest;
+        }
+        else if(c == ',' || c == ';' || c == '=')
+            digest = digest * 7 + (uint64_t)c + (uint64_t)depth;
+    }
+
+    return digest + value + (uint64_t)depth;
+}
+
+extern void RunTarget(FILE* input)
+{
+    uint8_t data[256];
+    size_t length = fread(data, 1, sizeof(data), input);
+    if(length == 0)
+        return;
+
+    uint64_t digest = 0;
+    for(int i = 0; i < PASS_COUNT; ++i)
+    {
+        // Shift the input in each pass, so the tokens change
+        size_t offset = (size_t)(i % 8) < length ? (size_t)(i % 8) : 0;
+        digest += Tokenize(data + offset, length - offset);
+    }
+
+    resultSink = digest;
+}
+
+extern void InitTarget(FILE* input)
+{
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Table lookups on short-lived worker threads, representing thread pools which are created and joined within a single operation.
+// Each worker exits while the testcase is still running, so its trace is completed at thread exit.
+
+// The number of worker threads per testcase.
+#define WORKER_COUNT 4
+
+// The number of table lookups per worker.
+#define LOOKUP_COUNT 4096
+
+// The lookup table.
+uint8_t table[256];
+
+// The testcase data, shared by all workers.
+uint8_t data[64];
+
+// The results of the workers, so the computation is not optimized away.
+volatile uint8_t resultSink[WORKER_COUNT];
+
+// Performs data-dependent table lookups.
+static void* WorkerMain(void* arg)
+{
+    int workerIndex = (int)(intptr_t)arg;
+    uint8_t state = (uint8_t)workerIndex;
+    for(int i = 0; i < LOOKUP_COUNT; ++i)
+        state = table[(uint8_t)(state ^ data[i % sizeof(data)])];
+
+    resultSink[workerIndex] = state;
+    return NULL;
+}
+
+extern void RunTarget(FILE* input)
+{
+    if(fread(data, 1, sizeof(data), input) != sizeof(data))
+        return;
+
+    pthread_t workers[WORKER_COUNT];
+    for(int i = 0; i < WORKER_COUNT; ++i)
+        pthread_create(&workers[i], NULL, WorkerMain, (void*)(intptr_t)i);
+    for(int i = 0; i < WORKER_COUNT; ++i)
+        pthread_join(workers[i], NULL);
+}
+
+extern void InitTarget(FILE* input)
+{
+    for(int i = 0; i < 256; ++i)
+        table[i] = (uint8_t)(i * 167 + 13);
+}
@@ -3,6 +3,11 @@
 #endif
 
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <stdio.h>
 #include <stdint.h>
@@ -10,6 +15,10 @@
 #include <errno.h>
 
 
+// The maximum number of parallel worker processes in fork-server mode.
+#define MAX_WORKER_COUNT 256
+
+
 // Performs target initialization steps.
 // This function is called once in the very beginning for the first testcase file, to make sure that the target is entirely loaded.
 // The call is included in the trace prefix.
@@ -22,14 +31,26 @@ extern void RunTarget(FILE* input);
 
 // Pin notification functions.
 // These functions (and their names) must not be optimized away by the compiler, so Pin can find and instrument them.
+// The target may call the secret region functions for its key buffers (declare them as extern), so the Pin tool's secret region filter only records accesses related to these buffers.
 // The return values reduce the probability that the compiler uses these function in other places as no-ops (Visual C++ did do this in some experiments).
 #pragma optimize("", off)
 int PinNotifyTestcaseStart(int t) { return t + 42; }
 int PinNotifyTestcaseEnd() { return 42; }
 int PinNotifyStackPointer(uint64_t spMin, uint64_t spMax) { return (int)(spMin + spMax + 42); }
 int PinNotifyAllocation(uint64_t address, uint64_t size) { return (int)(address + 23 * size); }
+int PinNotifySecretRegion(uint64_t address, uint64_t size) { return (int)(address + 29 * size); }
+int PinNotifyClearSecretRegion(uint64_t address, uint64_t size) { return (int)(address + 31 * size); }
+int PinNotifyTestcaseInput(uint64_t address, uint64_t size) { return (int)(address + 37 * size); }
 #pragma optimize("", on)
 
+// The maximum number of parallel worker processes, or 0 if fork-server mode is disabled (set by the "f" command).
+int workerLimit = 0;
+
+// The process and testcase IDs of the running worker processes.
+pid_t workerProcessIds[MAX_WORKER_COUNT];
+int workerTestcaseIds[MAX_WORKER_COUNT];
+int workerCount = 0;
+
 // Reads the stack pointer base value and transmits it to Pin.
 void ReadAndSendStackPointer()
 {
@@ -54,10 +75,224 @@ void ReadAndSendStackPointer()
     PinNotifyStackPointer(stackMin, stackMax);
 }
 
+// Reads a line from stdin into the given buffer and removes the trailing line break.
+// Returns 0 if no line could be read.
+int ReadLine(char* buffer, int bufferSize)
+{
+    if(!fgets(buffer, bufferSize, stdin))
+        return 0;
+
+    int length = strlen(buffer);
+    if(length > 0 && buffer[length - 1] == '\n')
+        buffer[length - 1] = '\0';
+    return 1;
+}
+
+// Reports the given testcase as failed on stdout, since its trace is never announced by the Pin tool.
+// In fork-server mode, the report is prefixed with the testcase ID like the Pin tool's messages ("<ID>\tx\t<wait status>"), else it has the form "x\t<ID>".
+void ReportFailedTestcase(int testcaseId, int status)
+{
+    if(workerLimit > 0)
+        printf("%d\tx\t%d\n", testcaseId, status);
+    else
+        printf("x\t%d\n", testcaseId);
+    fflush(stdout);
+}
+
+// Waits until at most the given number of worker processes are running.
+// The testcase of a failed worker is reported on stdout.
+void WaitForWorkers(int maxWorkerCount)
+{
+    while(workerCount > maxWorkerCount)
+    {
+        int status;
+        pid_t pid = wait(&status);
+        if(pid < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            char errBuffer[128];
+            strerror_r(errno, errBuffer, sizeof(errBuffer));
+            fprintf(stderr, "Error waiting for worker processes: [%d] %s\n", errno, errBuffer);
+            workerCount = 0;
+            return;
+        }
+
+        for(int i = 0; i < workerCount; ++i)
+        {
+            if(workerProcessIds[i] != pid)
+                continue;
+
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "Error: Worker process %d of testcase #%d failed with status %d\n", (int)pid, workerTestcaseIds[i], status);
+                ReportFailedTestcase(workerTestcaseIds[i], status);
+            }
+
+            --workerCount;
+            workerProcessIds[i] = workerProcessIds[workerCount];
+            workerTestcaseIds[i] = workerTestcaseIds[workerCount];
+            break;
+        }
+    }
+}
+
+// Runs the target function for the given testcase input, and initializes the target before the first testcase.
+// In fork-server mode, the testcase is run in a new worker process, which starts from the initialized state of this process.
+void RunTestcase(int testcaseId, FILE* inputFile, int* targetInitialized)
+{
+    // If the target was not yet initialized, call the init function for the first test case
+    if(!*targetInitialized)
+    {
+        InitTarget(inputFile);
+        fseek(inputFile, 0, SEEK_SET);
+        *targetInitialized = 1;
+    }
+
+    if(workerLimit > 0)
+    {
+        WaitForWorkers(workerLimit - 1);
+
+        // The Pin tool ends the trace prefix before the first fork, and follows the worker process
+        // This process does not read from the input file anymore, so closing it does not affect the worker's file offset
+        fflush(NULL);
+        pid_t pid = fork();
+        if(pid < 0)
+        {
+            char errBuffer[128];
+            strerror_r(errno, errBuffer, sizeof(errBuffer));
+            fprintf(stderr, "Error forking worker process for testcase #%d: [%d] %s\n", testcaseId, errno, errBuffer);
+            ReportFailedTestcase(testcaseId, -1);
+            return;
+        }
+        if(pid > 0)
+        {
+            workerProcessIds[workerCount] = pid;
+            workerTestcaseIds[workerCount] = testcaseId;
+            ++workerCount;
+            return;
+        }
+    }
+
+    PinNotifyTestcaseStart(testcaseId);
+    RunTarget(inputFile);
+    PinNotifyTestcaseEnd();
+
+    // The worker process exits immediately, without running the cleanup of the server's state (e.g., flushing the buffered command stream)
+    if(workerLimit > 0)
+    {
+        fflush(NULL);
+        _exit(0);
+    }
+}
+
+// Loads the given testcase file and runs the target function for it.
+void RunTestcaseFile(int testcaseId, const char* inputFileName, int* targetInitialized)
+{
+    FILE* inputFile = fopen(inputFileName, "rb");
+    if(!inputFile)
+    {
+        char errBuffer[128];
+        strerror_r(errno, errBuffer, sizeof(errBuffer));
+        fprintf(stderr, "Error opening input file '%s': [%d] %s\n", inputFileName, errno, errBuffer);
+        ReportFailedTestcase(testcaseId, -1);
+        return;
+    }
+
+    RunTestcase(testcaseId, inputFile, targetInitialized);
+
+    fclose(inputFile);
+}
+
+// Maps the given testcase buffer file, and runs the target function for the given number of testcases stored in it.
+// The testcase descriptions ("<ID>\t<offset>\t<length>") are read from stdin.
+void RunTestcaseBuffer(int testcaseCount, const char* bufferFileName, int* targetInitialized)
+{
+    char inputBuffer[512];
+    char errBuffer[128];
+
+    // Map buffer file
+    // The mapping is private and writable, so fmemopen() can be used without copying the file contents
+    uint8_t* buffer = NULL;
+    size_t bufferSize = 0;
+    int bufferFile = open(bufferFileName, O_RDONLY);
+    struct stat bufferFileStat;
+    if(bufferFile < 0 || fstat(bufferFile, &bufferFileStat) != 0)
+    {
+        strerror_r(errno, errBuffer, sizeof(errBuffer));
+        fprintf(stderr, "Error opening testcase buffer file '%s': [%d] %s\n", bufferFileName, errno, errBuffer);
+    }
+    else if(bufferFileStat.st_size > 0)
+    {
+        bufferSize = (size_t)bufferFileStat.st_size;
+        buffer = mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, bufferFile, 0);
+        if(buffer == MAP_FAILED)
+        {
+            strerror_r(errno, errBuffer, sizeof(errBuffer));
+            fprintf(stderr, "Error mapping testcase buffer file '%s': [%d] %s\n", bufferFileName, errno, errBuffer);
+            buffer = NULL;
+        }
+    }
+    if(bufferFile >= 0)
+        close(bufferFile);
+
+    // Run testcases
+    // The descriptions are always consumed, even if the buffer could not be mapped, so the command stream stays consistent
+    // Each testcase which cannot be run is reported, so the caller can match the remaining traces to their testcases
+    for(int i = 0; i < testcaseCount; ++i)
+    {
+        int testcaseId;
+        unsigned long long offset;
+        unsigned long long length;
+        if(!ReadLine(inputBuffer, sizeof(inputBuffer)))
+        {
+            fprintf(stderr, "Error reading testcase description %d of %d\n", i + 1, testcaseCount);
+            break;
+        }
+        if(sscanf(inputBuffer, "%d\t%llu\t%llu", &testcaseId, &offset, &length) != 3)
+        {
+            fprintf(stderr, "Error parsing testcase description %d of %d\n", i + 1, testcaseCount);
+            ReportFailedTestcase(-1, -1);
+            continue;
+        }
+        if(buffer == NULL || offset + length > bufferSize)
+        {
+            fprintf(stderr, "Error: Testcase #%d is outside of the testcase buffer\n", testcaseId);
+            ReportFailedTestcase(testcaseId, -1);
+            continue;
+        }
+
+        FILE* inputFile = fmemopen(buffer + offset, length, "rb");
+        if(!inputFile)
+        {
+            strerror_r(errno, errBuffer, sizeof(errBuffer));
+            fprintf(stderr, "Error opening testcase #%d from buffer: [%d] %s\n", testcaseId, errno, errBuffer);
+            ReportFailedTestcase(testcaseId, -1);
+            continue;
+        }
+
+        // The testcase is not read through system calls, so the Pin tool's taint tracker is told about its location
+        PinNotifyTestcaseInput((uint64_t)(buffer + offset), length);
+
+        RunTestcase(testcaseId, inputFile, targetInitialized);
+
+        fclose(inputFile);
+    }
+
+    if(buffer != NULL)
+        munmap(buffer, bufferSize);
+}
+
 // Main trace target function. The following actions are performed:
 //     The current action is read from stdin.
 //     A line with "t" followed by a numeric ID, and another line with a file path determining a new testcase, that is subsequently loaded and fed into the target function, while calling PinNotifyNextFile() beforehand.
-//     A line with "e 0" terminates the program.
+//     A line with "b" followed by a testcase count N, and N lines "<ID>\t<file path>", which are handled like N "t" commands.
+//     A line with "m" followed by a testcase count N, a line with the path of a testcase buffer file, and N lines "<ID>\t<offset>\t<length>" describing testcases in that buffer. The testcases are fed into the target function through fmemopen().
+//     A line with "f" followed by a worker count N enables fork-server mode: After the target initialization, each testcase runs in a forked worker process, with up to N workers in parallel.
+//         Since the workers finish in arbitrary order, the Pin tool prefixes the trace announcements with the testcase ID.
+//     Testcases which cannot be loaded are reported on stdout ("x\t<ID>"), since the Pin tool does not announce a trace for them.
+//     A line with "e 0" terminates the program, after all worker processes have exited.
 void TraceFunc()
 {
     // First transmit stack pointer information
@@ -67,15 +302,16 @@ void TraceFunc()
 
     // Run until exit is requested
     char inputBuffer[512];
-    char errBuffer[128];
 	int targetInitialized = 0;
     while(1)
     {
-        // Read command and testcase ID (0 for exit command)
+        // Read command and testcase ID or count (0 for exit command)
         char command;
         int testcaseId;
-        fgets(inputBuffer, sizeof(inputBuffer), stdin);
-        sscanf(inputBuffer, "%c %d", &command, &testcaseId);
+        if(!ReadLine(inputBuffer, sizeof(inputBuffer)))
+            break;
+        if(sscanf(inputBuffer, "%c %d", &command, &testcaseId) != 2)
+            continue;
 
         // Exit or process given testcase
         if(command == 'e')
@@ -83,35 +319,54 @@ void TraceFunc()
         if(command == 't')
         {
             // Read testcase file name
-            fgets(inputBuffer, sizeof(inputBuffer), stdin);
-            int inputFileNameLength = strlen(inputBuffer);
-            if(inputFileNameLength > 0 && inputBuffer[inputFileNameLength - 1] == '\n')
-                inputBuffer[inputFileNameLength - 1] = '\0';
+            ReadLine(inputBuffer, sizeof(inputBuffer));
 
             // Load testcase file and run target function
-            FILE* inputFile = fopen(inputBuffer, "rb");
-            if(!inputFile)
+            RunTestcaseFile(testcaseId, inputBuffer, &targetInitialized);
+        }
+        else if(command == 'b')
+        {
+            // Run batch of testcase files
+            // All descriptions are consumed, so they are not interpreted as commands
+            int testcaseCount = testcaseId;
+            for(int i = 0; i < testcaseCount; ++i)
             {
-                strerror_r(errno, errBuffer, sizeof(errBuffer));
-                fprintf(stderr, "Error opening input file '%s': [%d] %s\n", inputBuffer, errno, errBuffer);
-                continue;
+                int batchTestcaseId;
+                int fileNameOffset;
+                if(!ReadLine(inputBuffer, sizeof(inputBuffer)))
+                {
+                    fprintf(stderr, "Error reading testcase %d of %d\n", i + 1, testcaseCount);
+                    break;
+                }
+                if(sscanf(inputBuffer, "%d\t%n", &batchTestcaseId, &fileNameOffset) != 1)
+                {
+                    fprintf(stderr, "Error parsing testcase %d of %d\n", i + 1, testcaseCount);
+                    ReportFailedTestcase(-1, -1);
+                    continue;
+                }
+
+                RunTestcaseFile(batchTestcaseId, inputBuffer + fileNameOffset, &targetInitialized);
             }
-			
-			// If the target was not yet initialized, call the init function for the first test case
-			if(!targetInitialized)
-			{
-				InitTarget(inputFile);
-				fseek(inputFile, 0, SEEK_SET);
-				targetInitialized = 1;
-			}
-            
-            PinNotifyTestcaseStart(testcaseId);
-            RunTarget(inputFile);
-            PinNotifyTestcaseEnd();
-            
-            fclose(inputFile);
+        }
+        else if(command == 'm')
+        {
+            // Run batch of testcases from shared buffer
+            ReadLine(inputBuffer, sizeof(inputBuffer));
+            RunTestcaseBuffer(testcaseId, inputBuffer, &targetInitialized);
+        }
+        else if(command == 'f')
+        {
+            // Enable fork-server mode
+            workerLimit = testcaseId;
+            if(workerLimit < 0)
+                workerLimit = 0;
+            if(workerLimit > MAX_WORKER_COUNT)
+                workerLimit = MAX_WORKER_COUNT;
         }
     }
+
+    // Wait for the remaining testcases
+    WaitForWorkers(0);
 }
 
 // Wrapper entry point.